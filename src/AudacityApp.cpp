@@ -1902,8 +1902,8 @@ int AudacityApp::OnExit()
 
    UnloadEffects();
 
+   WaveClip::Deinit();
    DeinitFFT();
-   BlockFile::Deinit();
 
    DeinitAudioIO();
 
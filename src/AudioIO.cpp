@@ -301,6 +301,7 @@ writing audio.
 #include "Prefs.h"
 #include "Project.h"
 #include "WaveTrack.h"
+#include "WorkerPool.h"
 
 #include "toolbars/ControlToolBar.h"
 #include "widgets/Meter.h"
@@ -444,6 +445,96 @@ class AudioThread : public wxThread {
 
 #endif
 
+//////////////////////////////////////////////////////////////////////
+//
+//     class AudioThreadSemaphore
+//
+//////////////////////////////////////////////////////////////////////
+
+// The PortAudio callback wakes the audio thread through this semaphore.
+// Post() must be safe to call from the callback, so it may not take a
+// mutex the way wxSemaphore does; each platform's native semaphore is
+// signalled without locking.
+
+#if defined(__WXMAC__)
+#include <mach/mach.h>
+#elif !defined(__WXMSW__)
+#include <errno.h>
+#include <semaphore.h>
+#include <time.h>
+#endif
+
+class AudioThreadSemaphore {
+ public:
+   AudioThreadSemaphore()
+   {
+#if defined(__WXMSW__)
+      mSem = CreateSemaphore(NULL, 0, LONG_MAX, NULL);
+#elif defined(__WXMAC__)
+      semaphore_create(mach_task_self(), &mSem, SYNC_POLICY_FIFO, 0);
+#else
+      sem_init(&mSem, 0, 0);
+#endif
+   }
+
+   ~AudioThreadSemaphore()
+   {
+#if defined(__WXMSW__)
+      CloseHandle(mSem);
+#elif defined(__WXMAC__)
+      semaphore_destroy(mach_task_self(), mSem);
+#else
+      sem_destroy(&mSem);
+#endif
+   }
+
+   void Post()
+   {
+#if defined(__WXMSW__)
+      ReleaseSemaphore(mSem, 1, NULL);
+#elif defined(__WXMAC__)
+      semaphore_signal(mSem);
+#else
+      sem_post(&mSem);
+#endif
+   }
+
+   // Returns false if the timeout expired without a Post()
+   bool Wait(int ms)
+   {
+#if defined(__WXMSW__)
+      return WaitForSingleObject(mSem, ms) == WAIT_OBJECT_0;
+#elif defined(__WXMAC__)
+      mach_timespec_t spec;
+      spec.tv_sec = ms / 1000;
+      spec.tv_nsec = (ms % 1000) * 1000 * 1000;
+      return semaphore_timedwait(mSem, spec) == KERN_SUCCESS;
+#else
+      struct timespec spec;
+      clock_gettime(CLOCK_REALTIME, &spec);
+      spec.tv_sec += ms / 1000;
+      spec.tv_nsec += (ms % 1000) * 1000 * 1000;
+      if (spec.tv_nsec >= 1000 * 1000 * 1000) {
+         spec.tv_sec++;
+         spec.tv_nsec -= 1000 * 1000 * 1000;
+      }
+      int result;
+      while ((result = sem_timedwait(&mSem, &spec)) != 0 && errno == EINTR)
+         ;
+      return result == 0;
+#endif
+   }
+
+ private:
+#if defined(__WXMSW__)
+   HANDLE mSem;
+#elif defined(__WXMAC__)
+   semaphore_t mSem;
+#else
+   sem_t mSem;
+#endif
+};
+
 #ifdef EXPERIMENTAL_MIDI_OUT
 class MidiThread : public AudioThread {
  public:
@@ -601,6 +692,20 @@ AudioIO::AudioIO()
 #endif
 
    // Start thread
+   // Playback tracks are rendered in parallel by this many threads,
+   // plus the audio thread itself
+   int mixerThreads = gPrefs->Read(wxT("/AudioIO/MixerThreads"),
+                                   (long)WorkerPool::GetDefaultNumThreads());
+   mPlaybackMixerPool = new WorkerPool(mixerThreads);
+   mPlaybackProcessed = NULL;
+
+   mAudioThreadSemaphore = new AudioThreadSemaphore();
+   mPlaybackLowWaterFrames = 0;
+   mCaptureLowFreeFrames = 0;
+   mRefillRequested = false;
+   mRefillRequestTime = 0.0;
+   ResetRefillStats();
+
    mThread = new AudioThread();
    mThread->Create();
 
@@ -641,12 +746,15 @@ AudioIO::~AudioIO()
    /* Delete is a "graceful" way to stop the thread.
       (Kill is the not-graceful way.) */
    wxTheApp->Yield();
+   mAudioThreadSemaphore->Post();
    mThread->Delete();
 
    if(mSilentBuf)
       DeleteSamples(mSilentBuf);
 
    delete mThread;
+   delete mAudioThreadSemaphore;
+   delete mPlaybackMixerPool;
 }
 
 void AudioIO::SetMixer(int inputSource)
@@ -1212,6 +1320,7 @@ int AudioIO::StartStream(WaveTrackArray playbackTracks,
    mCutPreviewGapLen = cutPreviewGapLen;
    mPlaybackBuffers = NULL;
    mPlaybackMixers = NULL;
+   mPlaybackProcessed = NULL;
    mCaptureBuffers = NULL;
    mResample = NULL;
 
@@ -1230,8 +1339,15 @@ int AudioIO::StartStream(WaveTrackArray playbackTracks,
    // killing performance.
    //
 
-   mPlaybackRingBufferSecs = 10.0;
-   mMaxPlaybackSecsToCopy = 4.0;
+   // The audio thread tops up the playback buffers whenever they have
+   // drained to the low-water mark, so the difference between the two
+   // is the most it renders at a time.
+   double lowWaterSecs;
+   gPrefs->Read(wxT("/AudioIO/PlaybackBufferSecs"), &mPlaybackRingBufferSecs, 10.0);
+   gPrefs->Read(wxT("/AudioIO/PlaybackLowWaterSecs"), &lowWaterSecs, 6.0);
+   mPlaybackRingBufferSecs = std::max(mPlaybackRingBufferSecs, 0.1);
+   lowWaterSecs = std::max(0.0, std::min(lowWaterSecs, 0.9 * mPlaybackRingBufferSecs));
+   mMaxPlaybackSecsToCopy = mPlaybackRingBufferSecs - lowWaterSecs;
 
    mCaptureRingBufferSecs = 4.5 + 0.5 * std::min(size_t(16), mCaptureTracks.GetCount());
    mMinCaptureSecsToCopy = 0.2 + 0.2 * std::min(size_t(16), mCaptureTracks.GetCount());
@@ -1321,6 +1437,7 @@ int AudioIO::StartStream(WaveTrackArray playbackTracks,
 
             mPlaybackBuffers = new RingBuffer* [mPlaybackTracks.GetCount()];
             mPlaybackMixers  = new Mixer*      [mPlaybackTracks.GetCount()];
+            mPlaybackProcessed = new int      [mPlaybackTracks.GetCount()];
 
             // Set everything to zero in case we have to delete these due to a memory exception.
             memset(mPlaybackBuffers, 0, sizeof(RingBuffer*)*mPlaybackTracks.GetCount());
@@ -1337,6 +1454,11 @@ int AudioIO::StartStream(WaveTrackArray playbackTracks,
                                                mRate, floatSample, false);
                mPlaybackMixers[i]->ApplyTrackGains(false);
             }
+
+            // Wake the audio thread as soon as a whole refill fits,
+            // allowing for the few samples FillBuffers() holds back
+            mPlaybackLowWaterFrames =
+               (int)(playbackBufferSize - playbackMixBufferSize - 16);
          }
 
          if( mNumCaptureChannels > 0 )
@@ -1368,6 +1490,10 @@ int AudioIO::StartStream(WaveTrackArray playbackTracks,
                                                     captureBufferSize );
                mResample[i] = new Resample(true, mFactor, mFactor); // constant rate resampling
             }
+
+            // Wake the audio thread once it has a batch worth writing
+            mCaptureLowFreeFrames = (int)(captureBufferSize - 4 -
+                                  (sampleCount)(mRate * mMinCaptureSecsToCopy + 0.5));
          }
       }
       catch(std::bad_alloc&)
@@ -1383,6 +1509,9 @@ int AudioIO::StartStream(WaveTrackArray playbackTracks,
        }
    } while(!bDone);
 
+   mRefillRequested = false;
+   ResetRefillStats();
+
 #if defined(EXPERIMENTAL_REALTIME_EFFECTS)
    if (mNumPlaybackChannels > 0)
    {
@@ -1432,6 +1561,7 @@ int AudioIO::StartStream(WaveTrackArray playbackTracks,
    // audio thread call FillBuffers here makes the code more predictable, since
    // FillBuffers will ALWAYS get called from the Audio thread.
    mAudioThreadShouldCallFillBuffersOnce = true;
+   mAudioThreadSemaphore->Post();
 
    while( mAudioThreadShouldCallFillBuffersOnce == true )
       wxMilliSleep( 50 );
@@ -1477,6 +1607,7 @@ int AudioIO::StartStream(WaveTrackArray playbackTracks,
    }
 
    mAudioThreadFillBuffersLoopRunning = true;
+   mAudioThreadSemaphore->Post();
 #ifdef EXPERIMENTAL_MIDI_OUT
    // If audio is not running, mNumFrames will not be incremented and
    // MIDI will hang waiting for it unless we do it here.
@@ -1523,6 +1654,9 @@ void AudioIO::StartStreamCleanup(bool bOnlyBuffers)
       mPlaybackMixers = NULL;
    }
 
+   delete [] mPlaybackProcessed;
+   mPlaybackProcessed = NULL;
+
    if(mCaptureBuffers)
    {
       for( unsigned int i = 0; i < mCaptureTracks.GetCount(); i++ )
@@ -1839,6 +1973,7 @@ void AudioIO::StopStream()
       // call FillBuffers one last time (it normally would not do so since
       // Pa_GetStreamActive() would now return false
       mAudioThreadShouldCallFillBuffersOnce = true;
+      mAudioThreadSemaphore->Post();
 
       while( mAudioThreadShouldCallFillBuffersOnce == true )
       {
@@ -1862,6 +1997,8 @@ void AudioIO::StopStream()
 
          delete[] mPlaybackBuffers;
          delete[] mPlaybackMixers;
+         delete[] mPlaybackProcessed;
+         mPlaybackProcessed = NULL;
       }
 
       //
@@ -2351,10 +2488,14 @@ AudioThread::ExitCode AudioThread::Entry()
       else if( gAudioIO->mAudioThreadFillBuffersLoopRunning )
       {
          gAudioIO->FillBuffers();
+         gAudioIO->RefillDone();
       }
       gAudioIO->mAudioThreadFillBuffersLoopActive = false;
 
-      Sleep(10);
+      // Sleep until the callback reports that the buffers have crossed
+      // their watermarks, or somebody sets one of the flags above.  The
+      // timeout is only a safety net, and lets us notice TestDestroy().
+      gAudioIO->mAudioThreadSemaphore->Wait(100);
    }
 
    return 0;
@@ -2811,6 +2952,79 @@ wxString AudioIO::GetDeviceInfo()
    return o.GetString();
 }
 
+void AudioIO::RefillDone()
+{
+   if (!mRefillRequested)
+      return;
+
+   if (mPortStreamV19) {
+      double latency = Pa_GetStreamTime(mPortStreamV19) - mRefillRequestTime;
+      if (latency >= 0.0) {
+         mRefillCount++;
+         mTotalRefillLatency += latency;
+         if (latency > mMaxRefillLatency)
+            mMaxRefillLatency = latency;
+      }
+   }
+
+   // Let the callback ask again
+   mRefillRequested = false;
+}
+
+void AudioIO::ResetRefillStats()
+{
+   mPlaybackUnderruns = 0;
+   mRefillCount = 0;
+   mTotalRefillLatency = 0.0;
+   mMaxRefillLatency = 0.0;
+}
+
+double AudioIO::GetAverageRefillLatency() const
+{
+   if (mRefillCount == 0)
+      return 0.0;
+   return mTotalRefillLatency / mRefillCount;
+}
+
+// Renders one fill cycle of every playback track; see FillBuffers()
+class PlaybackRenderJob : public WorkerPoolJob {
+ public:
+   PlaybackRenderJob(AudioIO *audioIO, int len)
+      : mAudioIO(audioIO), mLen(len) {}
+
+   virtual void RunItem(int track)
+   {
+      mAudioIO->mPlaybackProcessed[track] =
+         mAudioIO->RenderPlaybackTrack(track, mLen);
+   }
+
+ private:
+   AudioIO *mAudioIO;
+   int mLen;
+};
+
+// Mixes up to len samples of one playback track into the free space of
+// its ring buffer, without committing them.  Returns how many it mixed.
+int AudioIO::RenderPlaybackTrack(int track, int len)
+{
+   samplePtr region1, region2;
+   int len1, len2;
+   mPlaybackBuffers[track]->ReserveForPut(&region1, &len1, &region2, &len2);
+
+   if (len1 > len)
+      len1 = len;
+   if (len2 > len - len1)
+      len2 = len - len1;
+
+   int processed = 0;
+   if (len1 > 0)
+      processed = mPlaybackMixers[track]->Process(len1, &region1);
+   if (processed == len1 && len2 > 0)
+      processed += mPlaybackMixers[track]->Process(len2, &region2);
+
+   return processed;
+}
+
 // This method is the data gateway between the audio thread (which
 // communicates with the disk) and the PortAudio callback thread
 // (which communicates with the audio device).
@@ -2871,21 +3085,25 @@ void AudioIO::FillBuffers()
 
             secsAvail -= deltat;
 
+            // The mixers here aren't actually mixing: they're just doing
+            // resampling, format conversion, and possibly time track
+            // warping.  The tracks are independent, so they are rendered
+            // in parallel, straight into their ring buffers; then, once
+            // all are done, the new samples are made visible to the
+            // callback in track order.
+            //don't do anything if we have no length.  In particular, Process() will fail an wxAssert
+            //that causes a crash since this is not the GUI thread and wxASSERT is a GUI call.
+            if(deltat > 0.0)
+            {
+               PlaybackRenderJob job(this, lrint(deltat * mRate));
+               mPlaybackMixerPool->Run(&job, mPlaybackTracks.GetCount());
+               for( i = 0; i < mPlaybackTracks.GetCount(); i++ )
+                  mPlaybackBuffers[i]->CommitPut(mPlaybackProcessed[i]);
+            }
+
             for( i = 0; i < mPlaybackTracks.GetCount(); i++ )
             {
-               // The mixer here isn't actually mixing: it's just doing
-               // resampling, format conversion, and possibly time track
-               // warping
-               int processed = 0;
-               samplePtr warpedSamples;
-               //don't do anything if we have no length.  In particular, Process() will fail an wxAssert
-               //that causes a crash since this is not the GUI thread and wxASSERT is a GUI call.
-               if(deltat > 0.0)
-               {
-                  processed = mPlaybackMixers[i]->Process(lrint(deltat * mRate));
-                  warpedSamples = mPlaybackMixers[i]->GetBuffer();
-                  mPlaybackBuffers[i]->Put(warpedSamples, floatSample, processed);
-               }
+               int processed = (deltat > 0.0) ? mPlaybackProcessed[i] : 0;
                //if looping and processed is less than the full chunk/block/buffer that gets pulled from
                //other longer tracks, then we still need to advance the ring buffers or
                //we'll trip up on ourselves when we start them back up again.
@@ -3603,6 +3821,7 @@ int audacityAudioCallback(const void *inputBuffer, void *outputBuffer,
 
             // Reload the ring buffers
             gAudioIO->mAudioThreadShouldCallFillBuffersOnce = true;
+            gAudioIO->mAudioThreadSemaphore->Post();
             while( gAudioIO->mAudioThreadShouldCallFillBuffersOnce == true )
             {
                wxMilliSleep( 50 );
@@ -3610,6 +3829,7 @@ int audacityAudioCallback(const void *inputBuffer, void *outputBuffer,
 
             // Reenable the audio thread
             gAudioIO->mAudioThreadFillBuffersLoopRunning = true;
+            gAudioIO->mAudioThreadSemaphore->Post();
 
             return paContinue;
          }
@@ -3638,6 +3858,7 @@ int audacityAudioCallback(const void *inputBuffer, void *outputBuffer,
 #endif
 
          bool selected = false;
+         bool underrun = false;
          int group = 0;
          int chanCnt = 0;
          float rate = 0.0;
@@ -3718,6 +3939,14 @@ int audacityAudioCallback(const void *inputBuffer, void *outputBuffer,
             }
 #endif
 
+            // Running short before the audio thread has mixed everything
+            // means it didn't keep up
+            if (!cut && (unsigned long)len < framesPerBuffer &&
+                gAudioIO->mWarpedTime < gAudioIO->mWarpedLength)
+            {
+               underrun = true;
+            }
+
 #if defined(EXPERIMENTAL_REALTIME_EFFECTS)
             if( !cut && selected )
             {
@@ -3783,6 +4012,9 @@ int audacityAudioCallback(const void *inputBuffer, void *outputBuffer,
             chanCnt = 0;
          }
 
+         if (underrun)
+            gAudioIO->mPlaybackUnderruns++;
+
 #if defined(EXPERIMENTAL_REALTIME_EFFECTS)
          em.RealtimeProcessEnd();
 #endif
@@ -3879,6 +4111,30 @@ int audacityAudioCallback(const void *inputBuffer, void *outputBuffer,
          }
       }
 
+      // Wake the audio thread once the playback buffers have drained to
+      // the low-water mark, or a batch of captured samples is waiting.
+      // The flag keeps us from posting again until it has been serviced.
+      if (gAudioIO->mAudioThreadFillBuffersLoopRunning &&
+          !gAudioIO->mRefillRequested)
+      {
+         bool wake = false;
+         if (numPlaybackTracks > 0 &&
+             gAudioIO->mPlaybackBuffers[0]->AvailForGet() <=
+                gAudioIO->mPlaybackLowWaterFrames)
+            wake = true;
+         if (numCaptureChannels > 0 &&
+             gAudioIO->mCaptureBuffers[0]->AvailForPut() <=
+                gAudioIO->mCaptureLowFreeFrames)
+            wake = true;
+
+         if (wake) {
+            gAudioIO->mRefillRequestTime =
+               Pa_GetStreamTime(gAudioIO->mPortStreamV19);
+            gAudioIO->mRefillRequested = true;
+            gAudioIO->mAudioThreadSemaphore->Post();
+         }
+      }
+
       // Update the current time position
       if (gAudioIO->mTimeTrack) {
          // MB: this is why SolveWarpedLength is needed :)
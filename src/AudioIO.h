@@ -37,6 +37,8 @@
 
 class AudioIO;
 class RingBuffer;
+class AudioThreadSemaphore;
+class WorkerPool;
 class Mixer;
 class Resample;
 class TimeTrack;
@@ -140,6 +142,19 @@ class AUDACITY_DLL_API AudioIO {
 
    wxLongLong GetLastPlaybackTime() const { return mLastPlaybackTimeMillis; }
 
+   /** \brief How many times, since the stream started, the device wanted
+    * playback samples the audio thread hadn't mixed yet */
+   int GetPlaybackUnderruns() const { return mPlaybackUnderruns; }
+
+   /** \brief Time in seconds from the audio callback asking for a refill
+    * to the audio thread completing it, since the stream started
+    *
+    * The callback asks when the playback buffers drain to the low-water
+    * mark set by the "/AudioIO/PlaybackLowWaterSecs" preference, or when
+    * a batch of captured samples is waiting. */
+   double GetMaxRefillLatency() const { return mMaxRefillLatency; }
+   double GetAverageRefillLatency() const;
+
 #ifdef EXPERIMENTAL_MIDI_OUT
    /** \brief Compute the current PortMidi timestamp time.
     *
@@ -494,6 +509,9 @@ private:
    WaveTrackArray      mPlaybackTracks;
 
    Mixer             **mPlaybackMixers;
+   WorkerPool         *mPlaybackMixerPool;
+   int                *mPlaybackProcessed; // per track, in a fill cycle
+   int RenderPlaybackTrack(int track, int len);
    volatile int        mStreamToken;
    static int          mNextStreamToken;
    double              mFactor;
@@ -521,6 +539,22 @@ private:
    volatile bool       mAudioThreadFillBuffersLoopRunning;
    volatile bool       mAudioThreadFillBuffersLoopActive;
 
+   // The callback wakes the audio thread through this when the buffers
+   // cross their watermarks, instead of the thread polling them
+   AudioThreadSemaphore *mAudioThreadSemaphore;
+   int                 mPlaybackLowWaterFrames;
+   int                 mCaptureLowFreeFrames;
+   volatile bool       mRefillRequested;
+   volatile double     mRefillRequestTime;
+
+   void RefillDone();
+   void ResetRefillStats();
+
+   volatile int        mPlaybackUnderruns;
+   int                 mRefillCount;
+   double              mTotalRefillLatency;
+   double              mMaxRefillLatency;
+
    wxLongLong          mLastPlaybackTimeMillis;
 
 #ifdef EXPERIMENTAL_MIDI_OUT
@@ -563,6 +597,7 @@ private:
    AudioIOListener*    mListener;
 
    friend class AudioThread;
+   friend class PlaybackRenderJob;
 #ifdef EXPERIMENTAL_MIDI_OUT
    friend class MidiThread;
 #endif
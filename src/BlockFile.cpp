@@ -84,8 +84,6 @@ SummaryInfo::SummaryInfo(sampleCount samples)
    totalSummaryBytes = offset256 + (frames256 * bytesPerFrame);
 }
 
-char *BlockFile::fullSummary = 0;
-
 /// Initializes the base BlockFile data.  The block is initially
 /// unlocked and its reference count is 1.
 ///
@@ -179,11 +177,6 @@ bool BlockFile::Deref()
       return false;
 }
 
-void BlockFile::Deinit()
-{
-   if(fullSummary)delete[] fullSummary;
-}
-
 /// Get a buffer containing a summary block describing this sample
 /// data.  This must be called by derived classes when they
 /// are constructed, to allow them to construct their summary data,
@@ -192,8 +185,8 @@ void BlockFile::Deinit()
 /// This method also has the side effect of setting the mMin, mMax,
 /// and mRMS members of this class.
 ///
-/// You must not delete the returned buffer; it is static to this
-/// method.
+/// The returned buffer is allocated for this call, so that blocks may be
+/// written on several threads at once; the caller must delete[] it.
 ///
 /// @param buffer A buffer containing the sample data to be analyzed
 /// @param len    The length of the sample data
@@ -201,8 +194,7 @@ void BlockFile::Deinit()
 void *BlockFile::CalcSummary(samplePtr buffer, sampleCount len,
                              sampleFormat format)
 {
-   if(fullSummary)delete[] fullSummary;
-   fullSummary = new char[mSummaryInfo.totalSummaryBytes];
+   char *fullSummary = new char[mSummaryInfo.totalSummaryBytes];
 
    memcpy(fullSummary, headerTag, headerTagLen);
 
@@ -586,6 +578,7 @@ void AliasBlockFile::WriteSummary()
    summaryFile.Write(summaryData, mSummaryInfo.totalSummaryBytes);
 
    DeleteSamples(sampleData);
+   delete [] (char *) summaryData;
 }
 
 AliasBlockFile::~AliasBlockFile()
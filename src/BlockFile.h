@@ -47,8 +47,6 @@ class BlockFile {
    BlockFile(wxFileName fileName, sampleCount samples);
    virtual ~BlockFile();
 
-   static void Deinit();
-
    // Reading
 
    /// Retrieves audio data from this BlockFile
@@ -97,6 +95,10 @@ class BlockFile {
    /// Returns TRUE if this block references another disk file
    virtual bool IsAlias() { return false; }
 
+   /// Returns TRUE if this block's data is kept in a segment of its
+   /// DirManager's BlockSegmentStore rather than a file of its own
+   virtual bool IsPacked() { return false; }
+
    /// Returns TRUE if this block's complete summary has been computed and is ready (for OD)
    virtual bool IsSummaryAvailable(){return true;}
 
@@ -159,8 +161,6 @@ class BlockFile {
    int mLockCount;
    int mRefCount;
 
-   static char *fullSummary;
-
  protected:
    wxFileName mFileName;
    sampleCount mLen;
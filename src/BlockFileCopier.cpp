@@ -0,0 +1,265 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  BlockFileCopier.cpp
+
+*******************************************************************//**
+
+\class BlockFileCopier
+\brief Copies block files into another directory, sharing their data
+with the originals wherever the file system allows.
+
+*//*******************************************************************/
+
+#include "Audacity.h"
+#include "BlockFileCopier.h"
+
+#include <wx/filefn.h>
+
+#if defined(__UNIX__) || defined(__WXMAC__)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#endif
+
+#if defined(__APPLE__)
+#include <AvailabilityMacros.h>
+#if MAC_OS_X_VERSION_MAX_ALLOWED >= 101200
+#include <sys/clonefile.h>
+#define HAVE_CLONEFILE
+#endif
+#endif
+
+#include "BlockFile.h"
+#include "Internat.h"
+
+BlockFileCopier::BlockFileCopier()
+:  mFirst(0)
+{
+}
+
+void BlockFileCopier::Add(BlockFile *f, const wxFileName &newFileName,
+                          bool link)
+{
+   BlockFileCopy copy;
+
+   copy.mFile = f;
+   copy.mNewFileName = newFileName;
+   copy.mFrom = wxString(f->GetFileName().GetFullPath().c_str());
+   copy.mTo = wxString(newFileName.GetFullPath().c_str());
+   copy.mLink = link;
+   copy.mMethod = eCopyFailed;
+   copy.mBytesShared = 0;
+
+   mCopies.push_back(copy);
+}
+
+void BlockFileCopier::Run(WorkerPool *pool, int first, int count)
+{
+   mFirst = first;
+   pool->Run(this, count);
+}
+
+void BlockFileCopier::RunItem(int item)
+{
+   BlockFileCopy &copy = mCopies[mFirst + item];
+
+   copy.mMethod = CopyFileData(copy.mFrom, copy.mTo, copy.mLink,
+                               &copy.mBytesShared);
+}
+
+bool BlockFileCopier::GetSuccess() const
+{
+   for (size_t i = 0; i < mCopies.size(); i++)
+      if (mCopies[i].mMethod == eCopyFailed)
+         return false;
+
+   return true;
+}
+
+void BlockFileCopier::SetFileNames()
+{
+   for (size_t i = 0; i < mCopies.size(); i++)
+      if (mCopies[i].mMethod != eCopyFailed)
+         mCopies[i].mFile->SetFileName(mCopies[i].mNewFileName);
+}
+
+void BlockFileCopier::RemoveCopies()
+{
+   for (size_t i = 0; i < mCopies.size(); i++)
+      if (mCopies[i].mMethod != eCopyFailed) {
+         // A hard link goes without touching the file it links to
+         wxRemoveFile(mCopies[i].mTo);
+         mCopies[i].mMethod = eCopyFailed;
+      }
+}
+
+wxLongLong BlockFileCopier::GetBytesShared() const
+{
+   wxLongLong bytes = 0;
+
+   for (size_t i = 0; i < mCopies.size(); i++)
+      bytes += mCopies[i].mBytesShared;
+
+   return bytes;
+}
+
+#if defined(__UNIX__) || defined(__WXMAC__)
+
+// Copies what is left of in to out with copy_file_range(), which lets the
+// kernel (or a network file system's server) move the data without it
+// passing through this process.  Returns false if that can't be done at
+// all, with nothing written, so that the caller can copy it itself.
+static bool CopyRange(int in, int out, off_t size, bool *ok)
+{
+#if defined(__linux__) && defined(SYS_copy_file_range)
+   off_t done = 0;
+
+   while (done < size) {
+      long len = syscall(SYS_copy_file_range, in, NULL, out, NULL,
+                         (size_t)(size - done), 0);
+      if (len < 0 && done == 0 &&
+          (errno == ENOSYS || errno == EXDEV || errno == EINVAL ||
+           errno == EOPNOTSUPP))
+         return false;
+      if (len <= 0) {
+         *ok = false;
+         return true;
+      }
+      done += len;
+   }
+
+   *ok = true;
+   return true;
+#else
+   return false;
+#endif
+}
+
+static bool CopyBuffered(int in, int out)
+{
+   char buffer[65536];
+
+   for (;;) {
+      ssize_t len = read(in, buffer, sizeof(buffer));
+      if (len == 0)
+         return true;
+      if (len < 0) {
+         if (errno == EINTR)
+            continue;
+         return false;
+      }
+
+      char *p = buffer;
+      while (len > 0) {
+         ssize_t written = write(out, p, len);
+         if (written < 0) {
+            if (errno == EINTR)
+               continue;
+            return false;
+         }
+         p += written;
+         len -= written;
+      }
+   }
+}
+
+BlockFileCopier::Method BlockFileCopier::CopyFileData(const wxString &from,
+                                                      const wxString &to,
+                                                      bool link,
+                                                      wxLongLong_t *bytesShared)
+{
+   int in = open(OSFILENAME(from), O_RDONLY);
+   if (in < 0)
+      return eCopyFailed;
+
+   struct stat info;
+   if (fstat(in, &info) != 0) {
+      close(in);
+      return eCopyFailed;
+   }
+
+#if defined(HAVE_CLONEFILE)
+   unlink(OSFILENAME(to));
+   if (clonefile(OSFILENAME(from), OSFILENAME(to), 0) == 0) {
+      close(in);
+      if (bytesShared)
+         *bytesShared += info.st_size;
+      return eCopyReflink;
+   }
+#endif
+
+   int out = open(OSFILENAME(to), O_WRONLY | O_CREAT | O_TRUNC,
+                  info.st_mode & 0777);
+   if (out < 0) {
+      close(in);
+      return eCopyFailed;
+   }
+
+#if defined(__linux__) && defined(FICLONE)
+   if (ioctl(out, FICLONE, in) == 0) {
+      close(in);
+      close(out);
+      if (bytesShared)
+         *bytesShared += info.st_size;
+      return eCopyReflink;
+   }
+#endif
+
+   if (link) {
+      close(out);
+      unlink(OSFILENAME(to));
+      if (::link(OSFILENAME(from), OSFILENAME(to)) == 0) {
+         close(in);
+         if (bytesShared)
+            *bytesShared += info.st_size;
+         return eCopyHardLink;
+      }
+
+      out = open(OSFILENAME(to), O_WRONLY | O_CREAT | O_TRUNC,
+                 info.st_mode & 0777);
+      if (out < 0) {
+         close(in);
+         return eCopyFailed;
+      }
+   }
+
+   Method method = eCopyRange;
+   bool ok;
+   if (!CopyRange(in, out, info.st_size, &ok)) {
+      method = eCopyBuffered;
+      ok = CopyBuffered(in, out);
+   }
+
+   close(in);
+   if (close(out) != 0)
+      ok = false;
+
+   if (!ok) {
+      unlink(OSFILENAME(to));
+      return eCopyFailed;
+   }
+
+   return method;
+}
+
+#else
+
+BlockFileCopier::Method BlockFileCopier::CopyFileData(const wxString &from,
+                                                      const wxString &to,
+                                                      bool WXUNUSED(link),
+                                                      wxLongLong_t * WXUNUSED(bytesShared))
+{
+   return wxCopyFile(from, to) ? eCopyBuffered : eCopyFailed;
+}
+
+#endif
@@ -0,0 +1,92 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  BlockFileCopier.h
+
+**********************************************************************/
+
+#ifndef __AUDACITY_BLOCK_FILE_COPIER__
+#define __AUDACITY_BLOCK_FILE_COPIER__
+
+#include <vector>
+
+#include <wx/filename.h>
+#include <wx/longlong.h>
+#include <wx/string.h>
+
+#include "WorkerPool.h"
+
+class BlockFile;
+
+/// \brief Copies block files into another directory, sharing their data
+/// with the originals wherever the file system allows.
+///
+/// Each file is cloned if the file system can (a reflink, whose data is
+/// shared until either file is written), else hard linked if the caller
+/// allows it, else copied by the kernel with copy_file_range(), else
+/// copied a buffer at a time.  DirManager::SetProject() queues the files
+/// of a Save As with Add() and makes the copies on a WorkerPool with Run().
+/// If the Save As fails, RemoveCopies() deletes those that were made.
+class BlockFileCopier : public WorkerPoolJob
+{
+public:
+   /// How a copy was made, cheapest first
+   enum Method {
+      eCopyFailed,
+      eCopyReflink,
+      eCopyHardLink,
+      eCopyRange,
+      eCopyBuffered
+   };
+
+   BlockFileCopier();
+
+   /// Queues a copy of the file of f to newFileName.  link says whether
+   /// the copy may be a hard link, which is only safe if neither file will
+   /// ever be written again.
+   void Add(BlockFile *f, const wxFileName &newFileName, bool link);
+
+   int GetCount() const { return (int)mCopies.size(); }
+
+   /// Makes the queued copies first .. first + count - 1, on pool
+   void Run(WorkerPool *pool, int first, int count);
+
+   /// Whether all the copies made so far worked
+   bool GetSuccess() const;
+
+   /// Gives the block files whose copies worked their new names
+   void SetFileNames();
+
+   /// Deletes the copies made so far, leaving their originals alone
+   void RemoveCopies();
+
+   /// Bytes of the copies made so far that are shared with the originals
+   /// rather than written again
+   wxLongLong GetBytesShared() const;
+
+   /// Copies the file 'from' to 'to', which is replaced if it exists.
+   /// Adds the bytes the copy shares with 'from' to *bytesShared, if given.
+   static Method CopyFileData(const wxString &from, const wxString &to,
+                              bool link, wxLongLong_t *bytesShared = NULL);
+
+   virtual void RunItem(int item);
+
+private:
+   class BlockFileCopy
+   {
+   public:
+      BlockFile *mFile;
+      wxFileName mNewFileName;
+      wxString mFrom;      // not shared with any other string, since
+      wxString mTo;        // they are used on the pool's threads
+      bool mLink;
+      Method mMethod;
+      wxLongLong_t mBytesShared;
+   };
+
+   std::vector<BlockFileCopy> mCopies;
+   int mFirst;             // the first copy of the Run()
+};
+
+#endif
@@ -0,0 +1,356 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  BlockFileHandlePool.cpp
+
+*******************************************************************//**
+
+\class BlockFileHandlePool
+\brief Keeps recently read .au block files open, with their headers
+already parsed, so that sample reads become a single positioned read.
+
+Playing or redrawing a long project reads thousands of block files per
+second.  Opening each one, handing it to libsndfile to parse the header,
+seeking and closing it again costs far more than the read itself.  The
+pool keeps up to GetMaxHandles() descriptors open and evicts the least
+recently used handle that no reader currently holds.
+
+With a mapping budget, each pooled file is also mapped read-only, so
+reads of samples and summaries are memory copies from the page cache
+rather than system calls.  Only the mappings are limited by the budget;
+a handle whose mapping was dropped falls back to positioned reads until
+it is mapped again by a later Acquire().
+
+*//****************************************************************//**
+
+\class BlockFileHandle
+\brief One open block file in a BlockFileHandlePool.
+
+*//*******************************************************************/
+
+#include "Audacity.h"
+
+#ifdef __WXMSW__
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include <wx/log.h>
+
+#include "BlockFileHandlePool.h"
+#include "blockfile/SimpleBlockFile.h"
+
+BlockFileHandlePool::BlockFileHandlePool(int maxHandles, wxFileOffset mapBudget)
+:  mMaxHandles(maxHandles > 0 ? maxHandles : 1),
+   mMapBudget(mapBudget > 0 ? mapBudget : 0),
+   mMappedBytes(0),
+   mHits(0),
+   mMisses(0),
+   mEvictions(0),
+   mUnmaps(0)
+{
+}
+
+BlockFileHandlePool::~BlockFileHandlePool()
+{
+   wxMutexLocker locker(mMutex);
+
+   BlockFileHandleList::iterator iter = mLRU.begin();
+   while (iter != mLRU.end()) {
+      wxASSERT((*iter)->users == 0);
+      Destroy(*iter);
+      iter++;
+   }
+   mLRU.clear();
+   mHandles.clear();
+}
+
+BlockFileHandle *BlockFileHandlePool::Acquire(const wxString &path)
+{
+   {
+      wxMutexLocker locker(mMutex);
+
+      BlockFileHandleHash::iterator found = mHandles.find(path);
+      if (found != mHandles.end()) {
+         BlockFileHandle *handle = found->second;
+         handle->users++;
+         mLRU.splice(mLRU.begin(), mLRU, handle->lru);
+         mHits++;
+         // Only map while no other thread is reading through the handle
+         if (!handle->map && handle->users == 1)
+            Map(handle);
+         return handle;
+      }
+      mMisses++;
+   }
+
+   // Open and parse outside the lock, so a slow disk doesn't stall
+   // readers of blocks that are already in the pool
+   BlockFileHandle *handle = Open(path);
+   if (!handle)
+      return NULL;
+
+   wxMutexLocker locker(mMutex);
+
+   // Another thread may have opened the same file in the meantime
+   BlockFileHandleHash::iterator found = mHandles.find(path);
+   if (found != mHandles.end()) {
+      Destroy(handle);
+      handle = found->second;
+      handle->users++;
+      mLRU.splice(mLRU.begin(), mLRU, handle->lru);
+      return handle;
+   }
+
+   handle->users = 1;
+   mLRU.push_front(handle);
+   handle->lru = mLRU.begin();
+   mHandles[path] = handle;
+
+   Trim();
+   Map(handle);
+
+   return handle;
+}
+
+void BlockFileHandlePool::Release(BlockFileHandle *handle)
+{
+   wxMutexLocker locker(mMutex);
+
+   wxASSERT(handle->users > 0);
+   handle->users--;
+
+   if (handle->users == 0) {
+      if (handle->stale)
+         Destroy(handle);
+      else
+         Trim();
+   }
+}
+
+size_t BlockFileHandlePool::ReadAt(BlockFileHandle *handle, wxFileOffset pos,
+                                   void *buffer, size_t len)
+{
+   if (handle->map) {
+      if (pos >= (wxFileOffset)handle->mapLength)
+         return 0;
+      if (len > handle->mapLength - pos)
+         len = handle->mapLength - pos;
+      memcpy(buffer, handle->map + pos, len);
+      return len;
+   }
+
+#ifdef __WXMSW__
+   wxMutexLocker locker(handle->readMutex);
+   if (handle->file.Seek(pos) == wxInvalidOffset)
+      return 0;
+   ssize_t result = handle->file.Read(buffer, len);
+   return (result == wxInvalidOffset) ? 0 : (size_t)result;
+#else
+   char *dest = (char *)buffer;
+   size_t total = 0;
+   while (total < len) {
+      ssize_t result = pread(handle->file.fd(), dest + total,
+                             len - total, (off_t)(pos + total));
+      if (result <= 0)
+         break;
+      total += result;
+   }
+   return total;
+#endif
+}
+
+void BlockFileHandlePool::Invalidate(const wxString &path)
+{
+   wxMutexLocker locker(mMutex);
+
+   BlockFileHandleHash::iterator found = mHandles.find(path);
+   if (found == mHandles.end())
+      return;
+
+   BlockFileHandle *handle = found->second;
+   Unlink(handle);
+
+   if (handle->users == 0)
+      Destroy(handle);
+   else
+      handle->stale = true;
+}
+
+void BlockFileHandlePool::Clear()
+{
+   wxMutexLocker locker(mMutex);
+
+   BlockFileHandleList::iterator iter = mLRU.begin();
+   while (iter != mLRU.end()) {
+      BlockFileHandle *handle = *iter++;
+      if (handle->users == 0) {
+         Unlink(handle);
+         Destroy(handle);
+      }
+   }
+}
+
+void BlockFileHandlePool::SetMaxHandles(int maxHandles)
+{
+   wxMutexLocker locker(mMutex);
+
+   mMaxHandles = (maxHandles > 0 ? maxHandles : 1);
+   Trim();
+}
+
+void BlockFileHandlePool::SetMapBudget(wxFileOffset bytes)
+{
+   wxMutexLocker locker(mMutex);
+
+   mMapBudget = (bytes > 0 ? bytes : 0);
+
+   // Drop idle mappings, coldest first, until we are within the new budget
+   BlockFileHandleList::iterator iter = mLRU.end();
+   while (iter != mLRU.begin() && mMappedBytes > mMapBudget) {
+      --iter;
+      if ((*iter)->users == 0 && (*iter)->map) {
+         Unmap(*iter);
+         mUnmaps++;
+      }
+   }
+}
+
+void BlockFileHandlePool::ResetStats()
+{
+   wxMutexLocker locker(mMutex);
+
+   mHits = mMisses = mEvictions = mUnmaps = 0;
+}
+
+BlockFileHandle *BlockFileHandlePool::Open(const wxString &path)
+{
+   // Missing files are reported by the libsndfile path in
+   // SimpleBlockFile::ReadData(), which knows about mSilentLog
+   wxLogNull silence;
+
+   BlockFileHandle *handle = new BlockFileHandle;
+   if (!handle->file.Open(path)) {
+      Destroy(handle);
+      return NULL;
+   }
+
+   auHeader header;
+   if (handle->file.Read(&header, sizeof(header)) != (ssize_t)sizeof(header)) {
+      Destroy(handle);
+      return NULL;
+   }
+
+   wxUint32 dataOffset;
+   if (!SimpleBlockFile::ParseHeader(header, &handle->format, &dataOffset,
+                                     &handle->swapped)) {
+      // Leave anything unusual to libsndfile
+      Destroy(handle);
+      return NULL;
+   }
+
+   handle->path = path;
+   handle->dataOffset = dataOffset;
+
+   return handle;
+}
+
+// Must be called with mMutex held
+void BlockFileHandlePool::Unlink(BlockFileHandle *handle)
+{
+   mHandles.erase(handle->path);
+   mLRU.erase(handle->lru);
+}
+
+// Must be called with mMutex held
+void BlockFileHandlePool::Trim()
+{
+   if ((int)mHandles.size() <= mMaxHandles)
+      return;
+
+   // Walk from the least recently used end, skipping handles in use
+   BlockFileHandleList::iterator iter = mLRU.end();
+   while (iter != mLRU.begin() && (int)mHandles.size() > mMaxHandles) {
+      --iter;
+      BlockFileHandle *handle = *iter;
+      if (handle->users > 0)
+         continue;
+
+      BlockFileHandleList::iterator victim = iter++;
+      mHandles.erase(handle->path);
+      mLRU.erase(victim);
+      Destroy(handle);
+      mEvictions++;
+   }
+}
+
+// Must be called with mMutex held, by the only thread holding the handle
+void BlockFileHandlePool::Map(BlockFileHandle *handle)
+{
+   if (mMapBudget == 0 || handle->map)
+      return;
+
+   wxFileOffset length = handle->file.Length();
+   if (length <= 0 || length > mMapBudget)
+      return;
+
+   // Make room by dropping the mappings of the coldest idle handles
+   BlockFileHandleList::iterator iter = mLRU.end();
+   while (iter != mLRU.begin() && mMappedBytes + length > mMapBudget) {
+      --iter;
+      if ((*iter)->users == 0 && (*iter)->map) {
+         Unmap(*iter);
+         mUnmaps++;
+      }
+   }
+   if (mMappedBytes + length > mMapBudget)
+      return;
+
+#ifdef __WXMSW__
+   HANDLE file = (HANDLE)_get_osfhandle(handle->file.fd());
+   HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+   if (!mapping)
+      return;
+   void *addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, (SIZE_T)length);
+   // The view keeps the mapping object alive
+   CloseHandle(mapping);
+   if (!addr)
+      return;
+#else
+   void *addr = mmap(NULL, (size_t)length, PROT_READ, MAP_SHARED,
+                     handle->file.fd(), 0);
+   if (addr == MAP_FAILED)
+      return;
+#endif
+
+   handle->map = (const char *)addr;
+   handle->mapLength = (size_t)length;
+   mMappedBytes += length;
+}
+
+// Must be called with mMutex held, and only for handles nobody holds
+void BlockFileHandlePool::Unmap(BlockFileHandle *handle)
+{
+   if (!handle->map)
+      return;
+
+#ifdef __WXMSW__
+   UnmapViewOfFile((LPCVOID)handle->map);
+#else
+   munmap((void *)handle->map, handle->mapLength);
+#endif
+
+   mMappedBytes -= handle->mapLength;
+   handle->map = NULL;
+   handle->mapLength = 0;
+}
+
+void BlockFileHandlePool::Destroy(BlockFileHandle *handle)
+{
+   Unmap(handle);
+   delete handle;
+}
@@ -0,0 +1,134 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  BlockFileHandlePool.h
+
+**********************************************************************/
+
+#ifndef __AUDACITY_BLOCKFILE_HANDLE_POOL__
+#define __AUDACITY_BLOCKFILE_HANDLE_POOL__
+
+#include <list>
+
+#include <wx/file.h>
+#include <wx/hashmap.h>
+#include <wx/string.h>
+#include <wx/thread.h>
+
+#include "SampleFormat.h"
+
+class BlockFileHandle;
+
+typedef std::list<BlockFileHandle *> BlockFileHandleList;
+
+WX_DECLARE_STRING_HASH_MAP(BlockFileHandle *, BlockFileHandleHash);
+
+/// An open .au block file whose header has already been parsed.
+class BlockFileHandle {
+ public:
+   /// The full path the handle was opened with (the pool key)
+   wxString     path;
+   /// Sample format of the data section on disk
+   sampleFormat format;
+   /// Byte offset of the first sample
+   wxFileOffset dataOffset;
+   /// True if the file was written with the opposite byte order
+   bool         swapped;
+   /// The whole file mapped read-only into memory, or NULL.  Valid for
+   /// as long as the handle is held.
+   const char  *map;
+   size_t       mapLength;
+
+ private:
+   friend class BlockFileHandlePool;
+
+   BlockFileHandle() : format(floatSample), dataOffset(0), swapped(false),
+      map(NULL), mapLength(0), users(0), stale(false) {}
+
+   wxFile file;
+   int    users;   // readers currently holding the handle
+   bool   stale;   // invalidated while in use; delete on last Release()
+   BlockFileHandleList::iterator lru;
+
+#ifdef __WXMSW__
+   // There is no pread() on Windows, so Seek() and Read() must be paired
+   wxMutex readMutex;
+#endif
+};
+
+/// \brief A bounded, thread-safe LRU pool of open block file handles.
+///
+/// SimpleBlockFile::ReadData() asks the pool for a handle instead of
+/// opening the file and parsing it with libsndfile on every call.  The
+/// pool is owned by DirManager; see DirManager::GetReadHandlePool().
+///
+/// Block files are immutable once written, which makes them safe to map
+/// into memory.  When a mapping budget is set, Acquire() also maps the
+/// file so that ReadAt() becomes a plain memory read from the page
+/// cache.  Mappings of the least recently used handles are dropped to
+/// stay within the budget.
+///
+/// Any code that rewrites, renames or removes a block file must call
+/// Invalidate() first, so that no stale descriptor survives (and, on
+/// Windows, so that the open handle doesn't make the operation fail).
+class BlockFileHandlePool {
+ public:
+   BlockFileHandlePool(int maxHandles, wxFileOffset mapBudget = 0);
+   ~BlockFileHandlePool();
+
+   /// Returns an open handle for the .au file at path, or NULL if it
+   /// can't be opened or isn't a block file this pool understands.
+   /// Every successful Acquire() must be paired with a Release().
+   BlockFileHandle *Acquire(const wxString &path);
+   void Release(BlockFileHandle *handle);
+
+   /// Reads up to len bytes at byte offset pos.  Thread-safe; returns
+   /// the number of bytes read.
+   size_t ReadAt(BlockFileHandle *handle, wxFileOffset pos,
+                 void *buffer, size_t len);
+
+   /// Closes the handle for path, if there is one
+   void Invalidate(const wxString &path);
+   /// Closes every handle that isn't in use
+   void Clear();
+
+   void SetMaxHandles(int maxHandles);
+   int GetMaxHandles() const { return mMaxHandles; }
+
+   /// Limits the address space used by mappings; 0 disables mapping
+   void SetMapBudget(wxFileOffset bytes);
+   wxFileOffset GetMapBudget() const { return mMapBudget; }
+   wxFileOffset GetMappedBytes() const { return mMappedBytes; }
+
+   // Statistics, so we can verify that reads don't pay for opens
+   long GetHits() const { return mHits; }
+   long GetMisses() const { return mMisses; }
+   long GetEvictions() const { return mEvictions; }
+   long GetUnmaps() const { return mUnmaps; }
+   void ResetStats();
+
+ private:
+   BlockFileHandle *Open(const wxString &path);
+   void Unlink(BlockFileHandle *handle);
+   void Trim();
+   void Map(BlockFileHandle *handle);
+   void Unmap(BlockFileHandle *handle);
+   void Destroy(BlockFileHandle *handle);
+
+   wxMutex mMutex;
+
+   BlockFileHandleHash mHandles;
+   BlockFileHandleList mLRU;  // most recently used at the front
+   int mMaxHandles;
+
+   wxFileOffset mMapBudget;
+   wxFileOffset mMappedBytes;
+
+   long mHits;
+   long mMisses;
+   long mEvictions;
+   long mUnmaps;
+};
+
+#endif
@@ -0,0 +1,191 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  BlockFileInventory.cpp
+
+*******************************************************************//**
+
+\class BlockFileInventory
+\brief The files under a project data directory, listed once so that
+the blocks of the project can be checked against the list.
+
+*//****************************************************************//**
+
+\class FileExistenceChecker
+\brief Checks on a WorkerPool which of a set of files exist.
+
+*//*******************************************************************/
+
+#include "Audacity.h"
+#include "BlockFileInventory.h"
+
+#include <wx/dir.h>
+#include <wx/filefn.h>
+
+#include "widgets/ProgressDialog.h"
+
+BlockFileInventory::BlockFileInventory(WorkerPool *pool)
+:  mPool(pool),
+   mFirst(0)
+{
+}
+
+int BlockFileInventory::Scan(const wxString &dir, ProgressDialog *progress)
+{
+   mDir = dir;
+   mNames.Clear();
+   mSubdirs.Clear();
+   mIndex.clear();
+   mDirs.clear();
+
+   wxDir top(dir);
+   if (!top.IsOpened())
+      return 0;
+
+   // The files of dir itself are listed here, as are its subdirectories
+   // and theirs.  Each of those (e00/d00 and the like, which hold the
+   // block files) is then listed as an item on the pool.
+   wxString name;
+   bool cont = top.GetFirst(&name, wxEmptyString, wxDIR_FILES);
+   while (cont) {
+      Add(wxEmptyString, name);
+      cont = top.GetNext(&name);
+   }
+
+   cont = top.GetFirst(&name, wxEmptyString, wxDIR_DIRS);
+   while (cont) {
+      wxString path = dir + wxFILE_SEP_PATH + name;
+
+      InventoryDir item;
+      item.mPath = wxString(path.c_str());
+      item.mSubdir = wxString(name.c_str());
+      item.mRecurse = false;
+      mDirs.push_back(item);
+
+      wxDir sub(path);
+      wxString subname;
+      bool subcont = sub.IsOpened() &&
+         sub.GetFirst(&subname, wxEmptyString, wxDIR_DIRS);
+      while (subcont) {
+         item.mPath = wxString((path + wxFILE_SEP_PATH + subname).c_str());
+         item.mSubdir = wxString((name + wxFILE_SEP_PATH + subname).c_str());
+         item.mRecurse = true;
+         mDirs.push_back(item);
+
+         subcont = sub.GetNext(&subname);
+      }
+
+      cont = top.GetNext(&name);
+   }
+
+   int total = (int)mDirs.size();
+   for (int i = 0; i < total; i += 64) {
+      mFirst = i;
+      mPool->Run(this, wxMin(64, total - i));
+
+      if (progress)
+         progress->Update(wxMin(i + 64, total), total);
+   }
+
+   for (size_t i = 0; i < mDirs.size(); i++) {
+      InventoryDir &item = mDirs[i];
+      for (size_t j = 0; j < item.mNames.GetCount(); j++)
+         Add(item.mSubdirs[j], item.mNames[j]);
+   }
+   mDirs.clear();
+
+   return GetCount();
+}
+
+wxString BlockFileInventory::GetFullPath(int i) const
+{
+   if (mSubdirs[i].IsEmpty())
+      return mDir + wxFILE_SEP_PATH + mNames[i];
+
+   return mDir + wxFILE_SEP_PATH + mSubdirs[i] + wxFILE_SEP_PATH + mNames[i];
+}
+
+bool BlockFileInventory::Contains(const wxString &subdir,
+                                  const wxString &fullName) const
+{
+   BlockFileInventoryHash::const_iterator iter = mIndex.find(fullName);
+   if (iter == mIndex.end())
+      return false;
+
+   // If the name is in more than one directory, only the last one found
+   // is indexed, so the caller must stat the file to be sure it's missing
+   return mSubdirs[iter->second] == subdir;
+}
+
+void BlockFileInventory::RunItem(int item)
+{
+   InventoryDir &dir = mDirs[mFirst + item];
+
+   List(dir.mPath, dir.mSubdir, dir.mRecurse, dir.mNames, dir.mSubdirs);
+}
+
+void BlockFileInventory::Add(const wxString &subdir, const wxString &name)
+{
+   mIndex[name] = (int)mNames.GetCount();
+   mNames.Add(name);
+   mSubdirs.Add(subdir);
+}
+
+void BlockFileInventory::List(const wxString &path, const wxString &subdir,
+                              bool recurse, wxArrayString &names,
+                              wxArrayString &subdirs)
+{
+   wxDir dir(path);
+   if (!dir.IsOpened())
+      return;
+
+   wxString name;
+   bool cont = dir.GetFirst(&name, wxEmptyString, wxDIR_FILES);
+   while (cont) {
+      names.Add(name);
+      subdirs.Add(subdir);
+      cont = dir.GetNext(&name);
+   }
+
+   if (!recurse)
+      return;
+
+   cont = dir.GetFirst(&name, wxEmptyString, wxDIR_DIRS);
+   while (cont) {
+      List(path + wxFILE_SEP_PATH + name, subdir + wxFILE_SEP_PATH + name,
+           true, names, subdirs);
+      cont = dir.GetNext(&name);
+   }
+}
+
+FileExistenceChecker::FileExistenceChecker(WorkerPool *pool)
+:  mPool(pool)
+{
+}
+
+void FileExistenceChecker::Add(const wxString &path)
+{
+   if (mIndex.find(path) != mIndex.end())
+      return;
+
+   mIndex[path] = (int)mPaths.GetCount();
+   mPaths.Add(wxString(path.c_str()));
+}
+
+void FileExistenceChecker::Run()
+{
+   mExists.assign(mPaths.GetCount(), 0);
+   mPool->Run(this, (int)mPaths.GetCount());
+}
+
+bool FileExistenceChecker::Exists(const wxString &path) const
+{
+   BlockFileInventoryHash::const_iterator iter = mIndex.find(path);
+   return iter != mIndex.end() && mExists[iter->second];
+}
+
+void FileExistenceChecker::RunItem(int item)
+{
+   mExists[item] = wxFileExists(mPaths[item]);
+}
@@ -0,0 +1,106 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  BlockFileInventory.h
+
+**********************************************************************/
+
+#ifndef __AUDACITY_BLOCK_FILE_INVENTORY__
+#define __AUDACITY_BLOCK_FILE_INVENTORY__
+
+#include <vector>
+
+#include <wx/arrstr.h>
+#include <wx/hashmap.h>
+#include <wx/string.h>
+
+#include "WorkerPool.h"
+
+class ProgressDialog;
+
+WX_DECLARE_HASH_MAP(wxString, int, wxStringHash, wxStringEqual, BlockFileInventoryHash);
+
+/// \brief The files under a project data directory, listed once so that
+/// the blocks of the project can be checked against the list.
+///
+/// ProjectFSCK() used to stat the file of every block, once per kind of
+/// check, and list the directory tree besides.  Now it lists the tree with
+/// Scan(), whose subdirectories are read on a WorkerPool, and looks the
+/// blocks up in the result.
+class BlockFileInventory : public WorkerPoolJob
+{
+public:
+   BlockFileInventory(WorkerPool *pool);
+
+   /// Lists all the files under dir, replacing any earlier list.  Returns
+   /// the number of files found.
+   int Scan(const wxString &dir, ProgressDialog *progress = NULL);
+
+   int GetCount() const { return (int)mNames.GetCount(); }
+
+   /// Name and extension of file i
+   const wxString &GetName(int i) const { return mNames[i]; }
+   /// Its directory, relative to the scanned one ("" for that one itself)
+   const wxString &GetSubdir(int i) const { return mSubdirs[i]; }
+   wxString GetFullPath(int i) const;
+
+   /// Whether a file fullName was found in the directory subdir, relative
+   /// to the scanned one
+   bool Contains(const wxString &subdir, const wxString &fullName) const;
+
+   virtual void RunItem(int item);
+
+private:
+   class InventoryDir
+   {
+   public:
+      wxString mPath;      // not shared with any other string, since
+      wxString mSubdir;    // they are used on the pool's threads
+      bool mRecurse;
+
+      // Found by RunItem()
+      wxArrayString mNames;
+      wxArrayString mSubdirs;
+   };
+
+   void Add(const wxString &subdir, const wxString &name);
+   static void List(const wxString &path, const wxString &subdir,
+                    bool recurse, wxArrayString &names,
+                    wxArrayString &subdirs);
+
+   WorkerPool *mPool;
+   std::vector<InventoryDir> mDirs;
+   int mFirst;                      // the first item of the Run()
+
+   wxString mDir;
+   wxArrayString mNames;
+   wxArrayString mSubdirs;
+   BlockFileInventoryHash mIndex;   // file name to its index in mNames
+};
+
+/// \brief Checks on a WorkerPool which of a set of files exist, such as
+/// the audio files aliased by the blocks of a project.
+class FileExistenceChecker : public WorkerPoolJob
+{
+public:
+   FileExistenceChecker(WorkerPool *pool);
+
+   /// Queues a check of path; adding a path twice checks it once
+   void Add(const wxString &path);
+
+   /// Checks all the queued paths
+   void Run();
+
+   bool Exists(const wxString &path) const;
+
+   virtual void RunItem(int item);
+
+private:
+   WorkerPool *mPool;
+   wxArrayString mPaths;            // deep copies, for the pool's threads
+   std::vector<char> mExists;
+   BlockFileInventoryHash mIndex;   // path to its index in mPaths
+};
+
+#endif
@@ -0,0 +1,739 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  BlockSegmentStore.cpp
+
+*******************************************************************//**
+
+\class BlockSegmentStore
+\brief Keeps the .au images of packed SimpleBlockFiles in a few large,
+append-only segment files instead of a file per block.
+
+A project of a few hours has hundreds of thousands of block files, spread
+over the e??/d?? directories.  Every save to a new place, project check
+and backup walks all of them, and the file system spends more on the
+inodes and directory entries than on the audio.  With the preference
+"/Directories/PackBlockFiles" set, DirManager makes its SimpleBlockFiles
+packed instead, and their images are appended to the segments of its
+store.
+
+Appends reserve their place under the store's mutex and write outside
+it, so that several threads can write blocks at once, as importing and
+recording do.  Reads are positioned reads through descriptors that stay
+open, as with BlockFileHandlePool.
+
+*//****************************************************************//**
+
+\class BlockSegmentEntry
+\brief The location of one packed block in a BlockSegmentStore.
+
+*//*******************************************************************/
+
+#include "Audacity.h"
+
+#ifndef __WXMSW__
+#include <errno.h>
+#include <unistd.h>
+#endif
+
+#include <wx/dir.h>
+#include <wx/filefn.h>
+#include <wx/filename.h>
+#include <wx/log.h>
+
+#include "BlockSegmentStore.h"
+#include "BlockFileCopier.h"
+
+// Each image in a segment follows one of these, so that a segment can
+// be walked and checked without the project file
+struct BlockSegmentRecord {
+   char     magic[4];   // "AUBK"
+   wxUint32 bytes;      // length of the image that follows
+};
+
+/// An open segment file.  Like a BlockFileHandle, it is only closed once
+/// no reader holds it.
+class BlockSegmentFile {
+ public:
+   BlockSegmentFile() : users(0), stale(false) {}
+
+   wxFile file;
+   int    users;   // readers and writers currently holding the file
+   bool   stale;   // closed while in use; delete on last release
+
+#ifdef __WXMSW__
+   // There is no pread() on Windows, so Seek() and Read() must be paired
+   wxMutex ioMutex;
+#endif
+};
+
+/// One segment file of a BlockSegmentStore
+class BlockSegment {
+ public:
+   BlockSegment(int n) : number(n), file(NULL), length(-1), liveBytes(0),
+      compacted(false) {}
+
+   int number;
+   BlockSegmentFile *file;    // NULL until first needed
+   wxFileOffset length;       // written or reserved; -1 until known
+   wxFileOffset liveBytes;    // of the records of the entries below
+   std::map<wxFileOffset, BlockSegmentEntry *> entries;
+   bool compacted;            // emptied by Compact(); remove once saved
+};
+
+typedef std::map<int, BlockSegment *> BlockSegmentMap;
+typedef std::map<wxFileOffset, BlockSegmentEntry *> BlockSegmentEntryMap;
+
+static size_t ReadFileAt(BlockSegmentFile *file, wxFileOffset pos,
+                         void *buffer, size_t len)
+{
+#ifdef __WXMSW__
+   wxMutexLocker locker(file->ioMutex);
+   if (file->file.Seek(pos) == wxInvalidOffset)
+      return 0;
+   ssize_t result = file->file.Read(buffer, len);
+   return (result == wxInvalidOffset) ? 0 : (size_t)result;
+#else
+   char *dest = (char *)buffer;
+   size_t total = 0;
+   while (total < len) {
+      ssize_t result = pread(file->file.fd(), dest + total,
+                             len - total, (off_t)(pos + total));
+      if (result < 0 && errno == EINTR)
+         continue;
+      if (result <= 0)
+         break;
+      total += result;
+   }
+   return total;
+#endif
+}
+
+static bool WriteFileAt(BlockSegmentFile *file, wxFileOffset pos,
+                        const void *buffer, size_t len)
+{
+#ifdef __WXMSW__
+   wxMutexLocker locker(file->ioMutex);
+   if (file->file.Seek(pos) == wxInvalidOffset)
+      return false;
+   return file->file.Write(buffer, len) == len;
+#else
+   const char *src = (const char *)buffer;
+   size_t total = 0;
+   while (total < len) {
+      ssize_t result = pwrite(file->file.fd(), src + total,
+                              len - total, (off_t)(pos + total));
+      if (result < 0 && errno == EINTR)
+         continue;
+      if (result <= 0)
+         return false;
+      total += result;
+   }
+   return true;
+#endif
+}
+
+BlockSegmentStore::BlockSegmentStore(const wxString &dir,
+                                     wxFileOffset segmentSize)
+:  mRef(1),
+   mDir(dir.c_str()),
+   mSegmentSize(segmentSize),
+   mAppending(NULL),
+   mNextSegment(0),
+   mRemoveOnClose(false)
+{
+}
+
+BlockSegmentStore::~BlockSegmentStore()
+{
+   BlockSegmentMap::iterator iter;
+   for (iter = mSegments.begin(); iter != mSegments.end(); iter++) {
+      BlockSegment *segment = iter->second;
+
+      CloseFile(segment);
+      if (mRemoveOnClose)
+         wxRemoveFile(GetSegmentPath(segment->number));
+
+      // Every block holds a reference, so all the entries are gone
+      wxASSERT(segment->entries.empty());
+      delete segment;
+   }
+}
+
+void BlockSegmentStore::Ref()
+{
+   wxMutexLocker locker(mMutex);
+   mRef++;
+}
+
+void BlockSegmentStore::Deref()
+{
+   bool last;
+   {
+      wxMutexLocker locker(mMutex);
+      last = (--mRef == 0);
+   }
+   if (last)
+      delete this;
+}
+
+void BlockSegmentStore::SetDirectory(const wxString &dir)
+{
+   wxMutexLocker locker(mMutex);
+
+   mDir = dir.c_str();
+   mNextSegment = 0;
+}
+
+wxString BlockSegmentStore::GetDirectory()
+{
+   wxMutexLocker locker(mMutex);
+   return wxString(mDir.c_str());
+}
+
+bool BlockSegmentStore::MoveTo(const wxString &dir, bool copy)
+{
+   wxMutexLocker locker(mMutex);
+
+   if (dir == mDir)
+      return true;
+
+   std::vector<BlockSegment *> done;
+   bool success = true;
+
+   BlockSegmentMap::iterator iter;
+   for (iter = mSegments.begin(); success && iter != mSegments.end(); iter++) {
+      BlockSegment *segment = iter->second;
+
+      // Unused segments are left behind, for whoever owns them
+      if (segment != mAppending && segment->entries.empty())
+         continue;
+
+      wxString from = GetSegmentPath(segment->number);
+      wxString to = dir + wxFILE_SEP_PATH + GetSegmentFileName(segment->number);
+
+      // A missing segment is for ProjectFSCK() to report
+      if (!wxFileExists(from))
+         continue;
+
+      if (copy)
+         // No new record is ever written into a segment once it has been
+         // copied (see below), so the copy may be a hard link
+         success = BlockFileCopier::CopyFileData(from, to, true) !=
+                   BlockFileCopier::eCopyFailed;
+      else {
+#ifdef __WXMSW__
+         // Windows won't rename an open file
+         CloseFile(segment);
+#endif
+         success = wxRenameFile(from, to);
+      }
+
+      if (success)
+         done.push_back(segment);
+   }
+
+   if (!success) {
+      for (size_t i = 0; i < done.size(); i++) {
+         wxString from = GetSegmentPath(done[i]->number);
+         wxString to = dir + wxFILE_SEP_PATH +
+                       GetSegmentFileName(done[i]->number);
+         if (copy)
+            wxRemoveFile(to);
+         else
+            wxRenameFile(to, from);
+      }
+      return false;
+   }
+
+   iter = mSegments.begin();
+   while (iter != mSegments.end()) {
+      BlockSegment *segment = iter->second;
+      iter++;
+
+      if (segment != mAppending && segment->entries.empty()) {
+         CloseFile(segment);
+         mSegments.erase(segment->number);
+         delete segment;
+      }
+      else if (copy)
+         // The open files are the other project's now
+         CloseFile(segment);
+   }
+
+   if (copy)
+      mAppending = NULL;
+
+   mDir = dir.c_str();
+   mNextSegment = 0;
+
+   return true;
+}
+
+BlockSegmentEntry *BlockSegmentStore::Append(const void *image, size_t bytes)
+{
+   int number;
+   wxFileOffset offset;
+
+   if (!AppendRecord(image, bytes, &number, &offset))
+      return NULL;
+
+   BlockSegmentEntry *entry = new BlockSegmentEntry;
+   entry->segment = number;
+   entry->offset = offset;
+   entry->bytes = (wxUint32)bytes;
+
+   wxMutexLocker locker(mMutex);
+
+   BlockSegment *segment = GetSegment(number);
+   segment->entries[offset] = entry;
+   segment->liveBytes += sizeof(BlockSegmentRecord) + bytes;
+
+   return entry;
+}
+
+BlockSegmentEntry *BlockSegmentStore::Load(int number, wxFileOffset offset,
+                                           wxUint32 bytes)
+{
+   wxMutexLocker locker(mMutex);
+
+   BlockSegment *segment = GetSegment(number);
+
+   BlockSegmentEntryMap::iterator found = segment->entries.find(offset);
+   if (found != segment->entries.end()) {
+      if (found->second->bytes == bytes) {
+         found->second->users++;
+         return found->second;
+      }
+      // Two different lengths at one place, so the project file is
+      // damaged.  The first one loaded is kept; this block has no image,
+      // and ProjectFSCK() reports it missing.
+      return NULL;
+   }
+
+   BlockSegmentEntry *entry = new BlockSegmentEntry;
+   entry->segment = number;
+   entry->offset = offset;
+   entry->bytes = bytes;
+
+   segment->entries[offset] = entry;
+   segment->liveBytes += sizeof(BlockSegmentRecord) + bytes;
+
+   return entry;
+}
+
+void BlockSegmentStore::Share(BlockSegmentEntry *entry)
+{
+   wxMutexLocker locker(mMutex);
+   entry->users++;
+}
+
+void BlockSegmentStore::Release(BlockSegmentEntry *entry)
+{
+   wxMutexLocker locker(mMutex);
+
+   if (--entry->users > 0)
+      return;
+
+   BlockSegment *segment = GetSegment(entry->segment);
+   BlockSegmentEntryMap::iterator found = segment->entries.find(entry->offset);
+   if (found != segment->entries.end() && found->second == entry) {
+      segment->entries.erase(found);
+      segment->liveBytes -= sizeof(BlockSegmentRecord) + entry->bytes;
+   }
+
+   delete entry;
+}
+
+void BlockSegmentStore::GetLocation(BlockSegmentEntry *entry, int *segment,
+                                    wxFileOffset *offset, wxUint32 *bytes)
+{
+   wxMutexLocker locker(mMutex);
+
+   *segment = entry->segment;
+   *offset = entry->offset;
+   *bytes = entry->bytes;
+}
+
+size_t BlockSegmentStore::ReadAt(BlockSegmentEntry *entry, wxFileOffset pos,
+                                 void *buffer, size_t len)
+{
+   BlockSegmentFile *file;
+   wxFileOffset offset;
+   {
+      wxMutexLocker locker(mMutex);
+
+      if (pos >= (wxFileOffset)entry->bytes)
+         return 0;
+      if (len > entry->bytes - pos)
+         len = (size_t)(entry->bytes - pos);
+
+      file = AcquireFile(GetSegment(entry->segment));
+      offset = entry->offset + pos;
+   }
+
+   if (!file)
+      return 0;
+
+   size_t read = ReadFileAt(file, offset, buffer, len);
+
+   wxMutexLocker locker(mMutex);
+   ReleaseFile(file);
+
+   return read;
+}
+
+bool BlockSegmentStore::ReadHeader(BlockSegmentEntry *entry, void *header,
+                                   size_t len)
+{
+   wxASSERT(len == sizeof(entry->header));
+
+   {
+      wxMutexLocker locker(mMutex);
+      if (entry->headerRead) {
+         memcpy(header, entry->header, len);
+         return true;
+      }
+   }
+
+   if (ReadAt(entry, 0, header, len) != len)
+      return false;
+
+   wxMutexLocker locker(mMutex);
+   memcpy(entry->header, header, len);
+   entry->headerRead = true;
+
+   return true;
+}
+
+bool BlockSegmentStore::IsOnDisk(BlockSegmentEntry *entry)
+{
+   wxMutexLocker locker(mMutex);
+
+   BlockSegment *segment = GetSegment(entry->segment);
+   BlockSegmentFile *file = AcquireFile(segment);
+   if (!file)
+      return false;
+   ReleaseFile(file);
+
+   return entry->offset + entry->bytes <= segment->length;
+}
+
+wxLongLong BlockSegmentStore::GetSpaceUsage(BlockSegmentEntry *entry)
+{
+   wxMutexLocker locker(mMutex);
+   return (wxLongLong_t)(sizeof(BlockSegmentRecord) + entry->bytes);
+}
+
+bool BlockSegmentStore::IsSegmentInUse(int number)
+{
+   wxMutexLocker locker(mMutex);
+
+   BlockSegmentMap::iterator found = mSegments.find(number);
+   if (found == mSegments.end())
+      return false;
+
+   return found->second == mAppending || !found->second->entries.empty();
+}
+
+wxLongLong BlockSegmentStore::Compact(double maxDeadFraction)
+{
+   std::vector<BlockSegmentEntry *> moving;
+   wxLongLong reclaimed = 0;
+
+   {
+      wxMutexLocker locker(mMutex);
+
+      BlockSegmentMap::iterator iter;
+      for (iter = mSegments.begin(); iter != mSegments.end(); iter++) {
+         BlockSegment *segment = iter->second;
+         if (segment == mAppending || segment->compacted)
+            continue;
+
+         // Opening the file tells us its length
+         BlockSegmentFile *file = AcquireFile(segment);
+         if (!file)
+            continue;
+         ReleaseFile(file);
+
+         wxFileOffset dead = segment->length - segment->liveBytes;
+         if (dead <= segment->length * maxDeadFraction)
+            continue;
+
+         segment->compacted = true;
+         reclaimed += dead;
+
+         // Hold the entries, so that blocks freed meanwhile don't take
+         // them away from under us
+         BlockSegmentEntryMap::iterator it;
+         for (it = segment->entries.begin(); it != segment->entries.end(); it++) {
+            it->second->users++;
+            moving.push_back(it->second);
+         }
+      }
+   }
+
+   char *image = NULL;
+   wxUint32 imageLen = 0;
+
+   for (size_t i = 0; i < moving.size(); i++) {
+      BlockSegmentEntry *entry = moving[i];
+
+      int oldNumber;
+      wxFileOffset oldOffset;
+      wxUint32 bytes;
+      GetLocation(entry, &oldNumber, &oldOffset, &bytes);
+
+      if (bytes > imageLen) {
+         delete[] image;
+         image = new char[bytes];
+         imageLen = bytes;
+      }
+
+      int number;
+      wxFileOffset offset;
+      bool ok = ReadAt(entry, 0, image, bytes) == bytes &&
+                AppendRecord(image, bytes, &number, &offset);
+
+      {
+         wxMutexLocker locker(mMutex);
+
+         BlockSegment *oldSegment = GetSegment(oldNumber);
+         if (ok) {
+            oldSegment->entries.erase(oldOffset);
+            oldSegment->liveBytes -= sizeof(BlockSegmentRecord) + bytes;
+
+            BlockSegment *segment = GetSegment(number);
+            segment->entries[offset] = entry;
+            segment->liveBytes += sizeof(BlockSegmentRecord) + bytes;
+
+            entry->segment = number;
+            entry->offset = offset;
+         }
+         else
+            // Keep the segment, with what couldn't be moved
+            oldSegment->compacted = false;
+      }
+
+      Release(entry);
+   }
+
+   delete[] image;
+
+   return reclaimed;
+}
+
+void BlockSegmentStore::RemoveCompacted()
+{
+   wxMutexLocker locker(mMutex);
+
+   BlockSegmentMap::iterator iter = mSegments.begin();
+   while (iter != mSegments.end()) {
+      BlockSegment *segment = iter->second;
+      iter++;
+
+      if (!segment->compacted)
+         continue;
+
+      if (segment->entries.empty())
+         Remove(segment);
+      else
+         segment->compacted = false;
+   }
+}
+
+// static
+wxString BlockSegmentStore::GetSegmentFileName(int segment)
+{
+   return wxString::Format(wxT("seg%05d.aus"), segment);
+}
+
+// static
+bool BlockSegmentStore::ParseSegmentFileName(const wxString &name,
+                                             int *segment)
+{
+   long number;
+
+   if (!name.StartsWith(wxT("seg")) || !name.EndsWith(wxT(".aus")) ||
+       !name.Mid(3, name.Length() - 7).ToLong(&number) || number <= 0)
+      return false;
+
+   *segment = (int)number;
+   return true;
+}
+
+// Must be called with mMutex held
+wxString BlockSegmentStore::GetSegmentPath(int segment)
+{
+   return mDir + wxFILE_SEP_PATH + GetSegmentFileName(segment);
+}
+
+// Must be called with mMutex held
+BlockSegment *BlockSegmentStore::GetSegment(int number)
+{
+   BlockSegmentMap::iterator found = mSegments.find(number);
+   if (found != mSegments.end())
+      return found->second;
+
+   BlockSegment *segment = new BlockSegment(number);
+   mSegments[number] = segment;
+   return segment;
+}
+
+// Must be called with mMutex held.  Every successful AcquireFile() must
+// be paired with a ReleaseFile().
+BlockSegmentFile *BlockSegmentStore::AcquireFile(BlockSegment *segment)
+{
+   if (!segment->file) {
+      wxString path = GetSegmentPath(segment->number);
+
+      // Missing segments are reported by ProjectFSCK(), not here
+      if (!wxFileExists(path))
+         return NULL;
+
+      // The segment being appended to may have been closed to be moved
+      // (see MoveTo()), and must be written again once reopened
+      BlockSegmentFile *file = new BlockSegmentFile;
+      if (!file->file.Open(path, segment == mAppending ?
+                                 wxFile::read_write : wxFile::read)) {
+         delete file;
+         return NULL;
+      }
+
+      segment->file = file;
+      if (segment->length < 0)
+         segment->length = file->file.Length();
+   }
+
+   segment->file->users++;
+   return segment->file;
+}
+
+// Must be called with mMutex held
+void BlockSegmentStore::ReleaseFile(BlockSegmentFile *file)
+{
+   wxASSERT(file->users > 0);
+
+   if (--file->users == 0 && file->stale)
+      delete file;
+}
+
+// Must be called with mMutex held
+void BlockSegmentStore::CloseFile(BlockSegment *segment)
+{
+   if (!segment->file)
+      return;
+
+   if (segment->file->users == 0)
+      delete segment->file;
+   else
+      segment->file->stale = true;
+
+   segment->file = NULL;
+}
+
+// Must be called with mMutex held
+bool BlockSegmentStore::StartSegment()
+{
+   if (!wxDirExists(mDir) &&
+       !wxFileName::Mkdir(mDir, 0777, wxPATH_MKDIR_FULL))
+      return false;
+
+   if (mNextSegment == 0) {
+      // Number the new segment after those already in the directory,
+      // which may belong to other projects sharing it
+      mNextSegment = 1;
+
+      wxDir dir(mDir);
+      wxString name;
+      int number;
+      bool cont = dir.IsOpened() &&
+                  dir.GetFirst(&name, wxT("seg*.aus"), wxDIR_FILES);
+      while (cont) {
+         if (ParseSegmentFileName(name, &number) && number >= mNextSegment)
+            mNextSegment = number + 1;
+         cont = dir.GetNext(&name);
+      }
+   }
+
+   for (;;) {
+      int number = mNextSegment++;
+
+      wxString path = GetSegmentPath(number);
+      if (mSegments.find(number) != mSegments.end() || wxFileExists(path))
+         continue;
+
+      // Create() won't open a file to read, so reopen it
+      BlockSegmentFile *file = new BlockSegmentFile;
+      if (!file->file.Create(path) || !file->file.Close() ||
+          !file->file.Open(path, wxFile::read_write)) {
+         delete file;
+         return false;
+      }
+
+      BlockSegment *segment = new BlockSegment(number);
+      segment->file = file;
+      segment->length = 0;
+      mSegments[number] = segment;
+      mAppending = segment;
+
+      return true;
+   }
+}
+
+bool BlockSegmentStore::AppendRecord(const void *image, size_t bytes,
+                                     int *segment, wxFileOffset *offset)
+{
+   BlockSegmentRecord record;
+   memcpy(record.magic, "AUBK", 4);
+   record.bytes = (wxUint32)bytes;
+
+   size_t total = sizeof(record) + bytes;
+
+   BlockSegmentFile *file;
+   wxFileOffset pos;
+   {
+      wxMutexLocker locker(mMutex);
+
+      if (!mAppending ||
+          (mAppending->length > 0 &&
+           mAppending->length + (wxFileOffset)total > mSegmentSize))
+         if (!StartSegment())
+            return false;
+
+      file = AcquireFile(mAppending);
+      if (!file)
+         return false;
+
+      // Reserve the place, so that other threads append after it
+      // while this one writes
+      pos = mAppending->length;
+      mAppending->length += total;
+      *segment = mAppending->number;
+   }
+
+   bool ok = WriteFileAt(file, pos, &record, sizeof(record)) &&
+             WriteFileAt(file, pos + sizeof(record), image, bytes);
+
+   {
+      wxMutexLocker locker(mMutex);
+      ReleaseFile(file);
+   }
+
+   *offset = pos + sizeof(record);
+   return ok;
+}
+
+// Must be called with mMutex held
+void BlockSegmentStore::Remove(BlockSegment *segment)
+{
+   CloseFile(segment);
+   wxRemoveFile(GetSegmentPath(segment->number));
+
+   if (mAppending == segment)
+      mAppending = NULL;
+
+   mSegments.erase(segment->number);
+   delete segment;
+}
@@ -0,0 +1,158 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  BlockSegmentStore.h
+
+**********************************************************************/
+
+#ifndef __AUDACITY_BLOCK_SEGMENT_STORE__
+#define __AUDACITY_BLOCK_SEGMENT_STORE__
+
+#include <map>
+#include <vector>
+
+#include <wx/file.h>
+#include <wx/longlong.h>
+#include <wx/string.h>
+#include <wx/thread.h>
+
+class BlockSegment;
+class BlockSegmentFile;
+
+/// Where the .au image of one packed block is kept in a
+/// BlockSegmentStore.  Blocks copied from one another share an entry.
+/// The location changes when the store is compacted, so read it with
+/// BlockSegmentStore::GetLocation().
+class BlockSegmentEntry {
+ private:
+   friend class BlockSegmentStore;
+
+   BlockSegmentEntry() : segment(0), offset(0), bytes(0), users(1),
+      headerRead(false) {}
+
+   int          segment;
+   wxFileOffset offset;    // of the image, just past its record header
+   wxUint32     bytes;     // length of the image
+   int          users;     // blocks sharing the image
+
+   // The start of the image, kept once read, so that the .au header
+   // isn't read again for every read of the block
+   bool         headerRead;
+   char         header[24];
+};
+
+/// \brief Keeps the .au images of packed SimpleBlockFiles in a few large,
+/// append-only segment files instead of a file per block.
+///
+/// Each DirManager has a store, whose segments ("seg00001.aus" and so on)
+/// are in the project data directory.  A segment is a run of records,
+/// each a small header followed by the image of one block, byte for byte
+/// the .au file SimpleBlockFile would otherwise write.  The project file
+/// records each block's segment, offset and length, so opening a project
+/// touches no block data at all, and saving it to a new place moves or
+/// copies a handful of segments instead of every block.
+///
+/// Nothing is removed from a segment when its blocks are freed.  The
+/// store counts the bytes of each segment still in use, and Compact()
+/// copies the blocks still alive out of segments that are mostly dead,
+/// so that RemoveCompacted() can delete those segments once the project
+/// file no longer refers to them.
+///
+/// The store is reference counted, since blocks may outlive the
+/// DirManager that made them (e.g. on the clipboard).
+class BlockSegmentStore {
+ public:
+   /// segmentSize is the size at which a new segment is started
+   BlockSegmentStore(const wxString &dir, wxFileOffset segmentSize);
+
+   void Ref();
+   void Deref();
+
+   /// Points the store at another directory without moving anything,
+   /// e.g. before loading a project
+   void SetDirectory(const wxString &dir);
+   wxString GetDirectory();
+
+   /// Moves (or copies, if the segments must stay where they are for
+   /// another project) the segments in use to dir.  Nothing is changed
+   /// if this fails.
+   bool MoveTo(const wxString &dir, bool copy);
+
+   /// Appends the image of a block, returning its entry, or NULL if it
+   /// couldn't be written.  May be called on any thread.
+   BlockSegmentEntry *Append(const void *image, size_t bytes);
+
+   /// Returns the entry of an image already written, as read from a
+   /// project file.  Blocks loaded with the same location share it.
+   /// Returns NULL if another length was already loaded at that offset.
+   BlockSegmentEntry *Load(int segment, wxFileOffset offset, wxUint32 bytes);
+
+   /// Adds a user to the entry, for a copy of its block
+   void Share(BlockSegmentEntry *entry);
+   /// Removes a user; the bytes of the image are dead after the last
+   void Release(BlockSegmentEntry *entry);
+
+   void GetLocation(BlockSegmentEntry *entry, int *segment,
+                    wxFileOffset *offset, wxUint32 *bytes);
+
+   /// Reads up to len bytes at pos in the image.  Thread-safe; returns
+   /// the number of bytes read.
+   size_t ReadAt(BlockSegmentEntry *entry, wxFileOffset pos,
+                 void *buffer, size_t len);
+
+   /// Reads the .au header at the start of the image
+   bool ReadHeader(BlockSegmentEntry *entry, void *header, size_t len);
+
+   /// Whether the whole image is on disk
+   bool IsOnDisk(BlockSegmentEntry *entry);
+
+   /// Bytes the image takes in its segment
+   wxLongLong GetSpaceUsage(BlockSegmentEntry *entry);
+
+   /// Whether the segment file is still used by some block or is being
+   /// appended to.  Others are unused and may be removed.
+   bool IsSegmentInUse(int segment);
+
+   /// Copies the live images out of segments that are more than
+   /// maxDeadFraction dead into new segments.  The old segments are kept
+   /// until RemoveCompacted(), since a saved project may still refer to
+   /// them.  Returns the bytes to be reclaimed.
+   wxLongLong Compact(double maxDeadFraction);
+   /// Removes the segments emptied by Compact()
+   void RemoveCompacted();
+
+   /// Remove the files of all the segments when the store goes away.
+   /// For temporary projects, whose data is discarded with them.
+   void SetRemoveOnClose(bool remove) { mRemoveOnClose = remove; }
+
+   static wxString GetSegmentFileName(int segment);
+   static bool ParseSegmentFileName(const wxString &name, int *segment);
+
+ private:
+   ~BlockSegmentStore();
+
+   wxString GetSegmentPath(int segment);
+   BlockSegment *GetSegment(int segment);
+   BlockSegmentFile *AcquireFile(BlockSegment *segment);
+   void ReleaseFile(BlockSegmentFile *file);
+   void CloseFile(BlockSegment *segment);
+   bool StartSegment();
+   bool AppendRecord(const void *image, size_t bytes,
+                     int *segment, wxFileOffset *offset);
+   void Remove(BlockSegment *segment);
+
+   wxMutex mMutex;
+   int mRef;
+
+   wxString mDir;
+   wxFileOffset mSegmentSize;
+
+   std::map<int, BlockSegment *> mSegments;
+   BlockSegment *mAppending;   // the segment new images go to, or NULL
+   int mNextSegment;           // 0 until the directory has been looked at
+
+   bool mRemoveOnClose;
+};
+
+#endif
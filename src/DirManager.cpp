@@ -73,6 +73,7 @@
 #include <wx/hash.h>
 #include <wx/msgdlg.h>
 #include <wx/progdlg.h>
+#include <wx/stopwatch.h>
 #include <wx/timer.h>
 #include <wx/intl.h>
 #include <wx/file.h>
@@ -87,6 +88,10 @@
 
 #include "AudacityApp.h"
 #include "BlockFile.h"
+#include "BlockFileCopier.h"
+#include "BlockFileHandlePool.h"
+#include "BlockFileInventory.h"
+#include "BlockSegmentStore.h"
 #include "blockfile/LegacyBlockFile.h"
 #include "blockfile/LegacyAliasBlockFile.h"
 #include "blockfile/SimpleBlockFile.h"
@@ -98,6 +103,7 @@
 #include "Internat.h"
 #include "Project.h"
 #include "Prefs.h"
+#include "WorkerPool.h"
 #include "widgets/Warning.h"
 #include "widgets/MultiDialog.h"
 
@@ -196,30 +202,6 @@ static int RecursivelyEnumerate(wxString dirPath,
 }
 
 
-static int RecursivelyEnumerateWithProgress(wxString dirPath,
-                                             wxArrayString& filePathArray, // output: all files in dirPath tree
-                                             wxString dirspec,
-                                             bool bFiles, bool bDirs,
-                                             int progress_count,
-                                             const wxChar* message)
-{
-   ProgressDialog *progress = NULL;
-
-   if (message)
-      progress = new ProgressDialog(_("Progress"), message);
-
-   int count = RecursivelyEnumerate(
-                  dirPath, filePathArray, dirspec,
-                  bFiles, bDirs,
-                  progress_count, 0,
-                  progress);
-
-   if (progress)
-      delete progress;
-
-   return count;
-}
-
 static int RecursivelyCountSubdirs(wxString dirPath)
 {
    bool bContinue;
@@ -317,6 +299,7 @@ static void RecursivelyRemove(wxArrayString& filePathArray, int count,
 wxString DirManager::globaltemp;
 int DirManager::numDirManagers = 0;
 bool DirManager::dontDeleteTempFiles = false;
+BlockFileHandlePool *DirManager::sReadHandlePool = NULL;
 
 
 DirManager::DirManager()
@@ -342,6 +325,14 @@ DirManager::DirManager()
                wxString::Format(wxT("project%d"), rand());
    } while (wxDirExists(mytemp));
 
+   if (numDirManagers == 0) {
+      int maxHandles = gPrefs->Read(wxT("/Directories/OpenBlockFileHandles"), 128l);
+      // Address space for memory-mapped block files, in MB; 0 disables mapping
+      long mapBudget = gPrefs->Read(wxT("/Directories/BlockFileMapBudget"),
+                                    (sizeof(void *) >= 8) ? 1024l : 64l);
+      sReadHandlePool = new BlockFileHandlePool(maxHandles,
+                                                (wxFileOffset)mapBudget << 20);
+   }
    numDirManagers++;
 
    projPath = wxT("");
@@ -350,6 +341,14 @@ DirManager::DirManager()
    mLoadingTarget = NULL;
    mMaxSamples = -1;
 
+   // Packed blocks go to a few large segment files rather than a file
+   // each.  Projects with packed blocks are read either way.
+   mPackBlockFiles = gPrefs->Read(wxT("/Directories/PackBlockFiles"), 0L) != 0;
+   long segmentSize = gPrefs->Read(wxT("/Directories/BlockSegmentSize"), 256l);
+   mSegmentStore = new BlockSegmentStore(mytemp,
+                                         (wxFileOffset)wxMax(segmentSize, 1l) << 20);
+   mNextPackedBlock = 0;
+
    // toplevel pool hash is fully populated to begin
    {
       int i;
@@ -370,8 +369,22 @@ DirManager::~DirManager()
 {
    wxASSERT(mRef == 0); // MM: Otherwise, we shouldn't delete it
 
+   // The segments of a project that was never saved go with it, as its
+   // .au files do.  Blocks still on the clipboard keep them until then.
+   mSegmentStore->SetRemoveOnClose(projFull == wxT("") && !dontDeleteTempFiles);
+   mSegmentStore->Deref();
+
    numDirManagers--;
    if (numDirManagers == 0) {
+      // Close all pooled handles first; Windows won't delete open files.
+      wxLogDebug(wxT("DirManager: block file handle pool had %ld hits, %ld misses, %ld evictions, %ld unmaps."),
+                 sReadHandlePool->GetHits(),
+                 sReadHandlePool->GetMisses(),
+                 sReadHandlePool->GetEvictions(),
+                 sReadHandlePool->GetUnmaps());
+      delete sReadHandlePool;
+      sReadHandlePool = NULL;
+
       CleanTempDir();
       //::wxRmdir(temp);
    }
@@ -449,25 +462,71 @@ bool DirManager::SetProject(wxString& newProjPath, wxString& newProjName, const
    int total = mBlockFileHash.size();
    int count=0;
 
+   // The copies are queued and made afterwards, several at once
+   BlockFileCopier copier;
+
+   // Packed blocks move with the segments of the store, which are copied
+   // instead if any of them must stay for the old project
+   bool copySegments = false;
+
    BlockHash::iterator iter = mBlockFileHash.begin();
    bool success = true;
    while ((iter != mBlockFileHash.end()) && success)
    {
       BlockFile *b = iter->second;
 
-      if (b->IsLocked())
-         success = CopyToNewProjectDirectory(b);
+      if (b->IsPacked()) {
+         // Blocks pasted from other projects were copied into this
+         // store by CopyBlockFile()
+         if (b->IsLocked())
+            copySegments = true;
+         count++;
+      }
+      else if (b->IsLocked())
+         success = MoveOrCopyToNewProjectDirectory(b, true, &copier);
       else{
          success = MoveToNewProjectDirectory(b);
+         count++;
       }
 
       progress->Update(count, total);
 
       iter++;
-      count++;
+   }
+
+   if (success && copier.GetCount() > 0) {
+      WorkerPool pool(gPrefs->Read(wxT("/Directories/CopyThreads"),
+                                   (long)WorkerPool::GetDefaultNumThreads()));
+
+      for (int i = 0; success && i < copier.GetCount(); i += 64) {
+         int batch = wxMin(64, copier.GetCount() - i);
+         copier.Run(&pool, i, batch);
+         success = copier.GetSuccess();
+
+         count += batch;
+         progress->Update(count, total);
+      }
+   }
+
+   // Last, since the store undoes its own move if it fails
+   if (success)
+      success = mSegmentStore->MoveTo(projFull, copySegments);
+
+   if (success && copier.GetCount() > 0) {
+      // Only now are the blocks pointed at their copies, so that nothing
+      // reads them from the new names before they are there
+      copier.SetFileNames();
+
+      wxLogMessage(wxT("Copied %d block files, sharing %s with the originals"),
+                   copier.GetCount(),
+                   Internat::FormatSize(copier.GetBytesShared()).c_str());
    }
 
    if (!success) {
+      // The blocks still have their old names, so the copies and links
+      // made in the new directory are of no use to anything
+      copier.RemoveCopies();
+
       // If the move failed, we try to move/copy as many files
       // back as possible so that no damage was done.  (No sense
       // in checking for errors this time around - there's nothing
@@ -563,6 +622,9 @@ wxString DirManager::GetDataFilesDir() const
 void DirManager::SetLocalTempDir(wxString path)
 {
    mytemp = path;
+
+   if (projFull == wxT(""))
+      mSegmentStore->SetDirectory(mytemp);
 }
 
 wxFileName DirManager::MakeBlockFilePath(wxString value){
@@ -594,6 +656,19 @@ wxFileName DirManager::MakeBlockFilePath(wxString value){
    return dir;
 }
 
+// The directory MakeBlockFilePath() gives, relative to the data
+// directory, without making it
+wxString DirManager::GetBlockFileSubdir(const wxString &value)
+{
+   if(value.GetChar(0)==wxT('d'))
+      return value.Mid(0,value.Find(wxT('b')));
+
+   if(value.GetChar(0)==wxT('e'))
+      return value.Mid(0,3) + wxFILE_SEP_PATH + wxT("d") + value.Mid(3,2);
+
+   return wxEmptyString;
+}
+
 bool DirManager::AssignFile(wxFileName &fileName,
                             wxString value,
                             bool diskcheck)
@@ -869,18 +944,44 @@ wxFileName DirManager::MakeBlockFileName()
    return ret;
 }
 
+// Packed blocks have no files, so they are only named, in sequence
+wxFileName DirManager::MakePackedBlockName()
+{
+   wxString name;
+   do
+      name.Printf(wxT("p%08lx"), mNextPackedBlock++);
+   while (mBlockFileHash.find(name) != mBlockFileHash.end());
+
+   return wxFileName(wxEmptyString, name, wxEmptyString);
+}
+
+wxFileName DirManager::ReserveBlockFileName(bool packed)
+{
+   wxMutexLocker lock(mBlockFileMutex);
+
+   wxFileName fileName = packed ? MakePackedBlockName() : MakeBlockFileName();
+   mBlockFileHash[fileName.GetName()] = NULL;
+
+   return fileName;
+}
+
 BlockFile *DirManager::NewSimpleBlockFile(
                                  samplePtr sampleData, sampleCount sampleLen,
                                  sampleFormat format,
                                  bool allowDeferredWrite)
 {
-   wxFileName fileName = MakeBlockFileName();
+   // The file is written and summarized unlocked, so that sequences being
+   // appended to on different threads write their blocks at the same time
+   wxFileName fileName = ReserveBlockFileName(mPackBlockFiles);
 
    BlockFile *newBlockFile =
        new SimpleBlockFile(fileName, sampleData, sampleLen, format,
-                           allowDeferredWrite);
+                           allowDeferredWrite, false,
+                           mPackBlockFiles ? mSegmentStore : NULL);
 
+   wxMutexLocker lock(mBlockFileMutex);
    mBlockFileHash[fileName.GetName()]=newBlockFile;
+   mNewBlockFiles.insert(fileName.GetName());
 
    return newBlockFile;
 }
@@ -889,13 +990,15 @@ BlockFile *DirManager::NewAliasBlockFile(
                                  wxString aliasedFile, sampleCount aliasStart,
                                  sampleCount aliasLen, int aliasChannel)
 {
-   wxFileName fileName = MakeBlockFileName();
+   wxFileName fileName = ReserveBlockFileName();
 
    BlockFile *newBlockFile =
        new PCMAliasBlockFile(fileName,
                              aliasedFile, aliasStart, aliasLen, aliasChannel);
 
+   wxMutexLocker lock(mBlockFileMutex);
    mBlockFileHash[fileName.GetName()]=newBlockFile;
+   mNewBlockFiles.insert(fileName.GetName());
    aliasList.Add(aliasedFile);
 
    return newBlockFile;
@@ -905,13 +1008,15 @@ BlockFile *DirManager::NewODAliasBlockFile(
                                  wxString aliasedFile, sampleCount aliasStart,
                                  sampleCount aliasLen, int aliasChannel)
 {
-   wxFileName fileName = MakeBlockFileName();
+   wxFileName fileName = ReserveBlockFileName();
 
    BlockFile *newBlockFile =
        new ODPCMAliasBlockFile(fileName,
                              aliasedFile, aliasStart, aliasLen, aliasChannel);
 
+   wxMutexLocker lock(mBlockFileMutex);
    mBlockFileHash[fileName.GetName()]=newBlockFile;
+   mNewBlockFiles.insert(fileName.GetName());
    aliasList.Add(aliasedFile);
 
    return newBlockFile;
@@ -921,13 +1026,15 @@ BlockFile *DirManager::NewODDecodeBlockFile(
                                  wxString aliasedFile, sampleCount aliasStart,
                                  sampleCount aliasLen, int aliasChannel, int decodeType)
 {
-   wxFileName fileName = MakeBlockFileName();
+   wxFileName fileName = ReserveBlockFileName();
 
    BlockFile *newBlockFile =
        new ODDecodeBlockFile(fileName,
                              aliasedFile, aliasStart, aliasLen, aliasChannel, decodeType);
 
+   wxMutexLocker lock(mBlockFileMutex);
    mBlockFileHash[fileName.GetName()]=newBlockFile;
+   mNewBlockFiles.insert(fileName.GetName());
    aliasList.Add(aliasedFile); //OD TODO: check to see if we need to remove this when done decoding.
                                //I don't immediately see a place where aliased files remove when a file is closed.
 
@@ -945,12 +1052,44 @@ bool DirManager::ContainsBlockFile(wxString filepath)
    return mBlockFileHash[filepath] != NULL;
 }
 
+bool DirManager::ContainsBlockSegment(const wxFileName &segmentFile)
+{
+   int segment;
+   if (!BlockSegmentStore::ParseSegmentFileName(segmentFile.GetFullName(), &segment))
+      return false;
+
+   // The same directory may have been another project's store before
+   if (!wxFileName::DirName(segmentFile.GetPath()).SameAs(
+            wxFileName::DirName(mSegmentStore->GetDirectory())))
+      return false;
+
+   return mSegmentStore->IsSegmentInUse(segment);
+}
+
+void DirManager::CompactBlockSegments()
+{
+   wxLongLong bytes = mSegmentStore->Compact(0.5);
+   if (bytes > 0)
+      wxLogMessage(wxT("Compacting block segments to reclaim %s"),
+                   Internat::FormatSize(bytes).c_str());
+}
+
+void DirManager::RemoveCompactedBlockSegments()
+{
+   mSegmentStore->RemoveCompacted();
+}
+
 // Adds one to the reference count of the block file,
 // UNLESS it is "locked", then it makes a new copy of
 // the BlockFile.
 BlockFile *DirManager::CopyBlockFile(BlockFile *b)
 {
-   if (!b->IsLocked()) {
+   // A packed block of another project has its image in that project's
+   // store, which this project's file can't refer to, so it's copied
+   bool foreignPacked = b->IsPacked() &&
+      ((SimpleBlockFile *)b)->GetSegmentStore() != mSegmentStore;
+
+   if (!b->IsLocked() && !foreignPacked) {
       b->Ref();
       //mchinen:July 13 2009 - not sure about this, but it needs to be added to the hash to be able to save if not locked.
       //note that this shouldn't hurt mBlockFileHash's that already contain the filename, since it should just overwrite.
@@ -968,6 +1107,26 @@ BlockFile *DirManager::CopyBlockFile(BlockFile *b)
       // Block files with uninitialized filename (i.e. SilentBlockFile)
       // just need an in-memory copy.
       b2 = b->Copy(wxFileName());
+   else if (b->IsPacked())
+   {
+      wxFileName newFile = ReserveBlockFileName(true);
+      newFile.SetExt(b->GetFileName().GetExt());
+
+      if (foreignPacked)
+         b2 = ((SimpleBlockFile *)b)->CopyToSegmentStore(newFile,
+                                                         mSegmentStore);
+      else
+         // The copy shares the image in the segment, under a new name
+         b2 = b->Copy(newFile);
+
+      wxMutexLocker lock(mBlockFileMutex);
+      if (b2 == NULL) {
+         mBlockFileHash.erase(newFile.GetName());
+         return NULL;
+      }
+      mBlockFileHash[newFile.GetName()]=b2;
+      mNewBlockFiles.insert(newFile.GetName());
+   }
    else
    {
       wxFileName newFile = MakeBlockFileName();
@@ -980,8 +1139,8 @@ BlockFile *DirManager::CopyBlockFile(BlockFile *b)
       //a summary file, so we should check before we copy.
       if(b->IsSummaryAvailable())
       {
-         if( !wxCopyFile(b->GetFileName().GetFullPath(),
-                  newFile.GetFullPath()) )
+         if( BlockFileCopier::CopyFileData(b->GetFileName().GetFullPath(),
+                  newFile.GetFullPath(), false) == BlockFileCopier::eCopyFailed )
             return NULL;
       }
 
@@ -991,6 +1150,7 @@ BlockFile *DirManager::CopyBlockFile(BlockFile *b)
          return NULL;
 
       mBlockFileHash[newFile.GetName()]=b2;
+      mNewBlockFiles.insert(newFile.GetName());
       aliasList.Add(newFile.GetFullPath());
    }
 
@@ -1012,6 +1172,8 @@ bool DirManager::HandleXMLTag(const wxChar *tag, const wxChar **attrs)
    }
    else if ( !wxStricmp(tag, wxT("simpleblockfile")) )
       pBlockFile = SimpleBlockFile::BuildFromXML(*this, attrs);
+   else if ( !wxStricmp(tag, wxT("packedblockfile")) )
+      pBlockFile = SimpleBlockFile::BuildPackedFromXML(*this, attrs);
    else if( !wxStricmp(tag, wxT("pcmaliasblockfile")) )
       pBlockFile = PCMAliasBlockFile::BuildFromXML(*this, attrs);
    else if( !wxStricmp(tag, wxT("odpcmaliasblockfile")) )
@@ -1092,14 +1254,23 @@ bool DirManager::HandleXMLTag(const wxChar *tag, const wxChar **attrs)
 
    // This is a new object
    mBlockFileHash[name]=*mLoadingTarget;
-   // MakeBlockFileName wasn't used so we must add the directory
-   // balancing information
-   BalanceInfoAdd(name);
+   mNewBlockFiles.insert(name);
+   if ((*mLoadingTarget)->IsPacked()) {
+      // New packed blocks are named after the loaded ones
+      unsigned long number;
+      if (name.Mid(1).ToULong(&number, 16) && number >= mNextPackedBlock)
+         mNextPackedBlock = number + 1;
+   }
+   else
+      // MakeBlockFileName wasn't used so we must add the directory
+      // balancing information
+      BalanceInfoAdd(name);
 
    return true;
 }
 
-bool DirManager::MoveOrCopyToNewProjectDirectory(BlockFile *f, bool copy)
+bool DirManager::MoveOrCopyToNewProjectDirectory(BlockFile *f, bool copy,
+                                                 BlockFileCopier *copier)
 {
    // Check that this BlockFile corresponds to a file on disk
    //ANSWER-ME: Is this checking only for SilentBlockFiles, in which case
@@ -1108,18 +1279,35 @@ bool DirManager::MoveOrCopyToNewProjectDirectory(BlockFile *f, bool copy)
       return true;
    }
 
+   // Packed blocks move with the segments of the store; see SetProject()
+   if (f->IsPacked())
+      return true;
+
    wxFileName newFileName;
    wxFileName oldFileName=f->GetFileName();
    if (!this->AssignFile(newFileName, f->GetFileName().GetFullName(), false))
       return false;
 
    if (newFileName != f->GetFileName()) {
+      if (!copy && sReadHandlePool)
+         sReadHandlePool->Invalidate(oldFileName.GetFullPath());
+
       //check to see that summary exists before we copy.
       bool summaryExisted = f->IsSummaryAvailable();
       if (summaryExisted) {
+         // The files of a block are never written again once its summary
+         // is there, so a copy may share them with a hard link
+         if (copy && copier) {
+            copier->Add(f, newFileName, true);
+            return true;
+         }
+
          if(!copy && !wxRenameFile(f->GetFileName().GetFullPath(), newFileName.GetFullPath()))
             return false;
-         if(copy && !wxCopyFile(f->GetFileName().GetFullPath(), newFileName.GetFullPath()))
+         if(copy &&
+            BlockFileCopier::CopyFileData(f->GetFileName().GetFullPath(),
+                                          newFileName.GetFullPath(),
+                                          false) == BlockFileCopier::eCopyFailed)
                return false;
       }
       f->SetFileName(newFileName);
@@ -1136,8 +1324,9 @@ bool DirManager::MoveOrCopyToNewProjectDirectory(BlockFile *f, bool copy)
          //if it doesn't, we can assume it was written to the new name, which is fine.
          if (oldFileName.FileExists())
          {
-            bool ok = wxCopyFile(oldFileName.GetFullPath(),
-                            newFileName.GetFullPath());
+            bool ok = BlockFileCopier::CopyFileData(oldFileName.GetFullPath(),
+                            newFileName.GetFullPath(), false) !=
+                      BlockFileCopier::eCopyFailed;
             if(ok && !copy)
                wxRemoveFile(f->GetFileName().GetFullPath());
             else if (!ok)
@@ -1185,12 +1374,29 @@ void DirManager::Deref(BlockFile * f)
       // and this block is no longer needed.  Remove it from the hash
       // table.
 
+      wxMutexLocker lock(mBlockFileMutex);
       mBlockFileHash.erase(theFileName);
+      mNewBlockFiles.erase(theFileName);
       BalanceInfoDel(theFileName);
 
    }
 }
 
+wxLongLong DirManager::TakeNewBlockFilesSpaceUsage()
+{
+   wxLongLong bytes = 0;
+
+   std::set<wxString>::const_iterator it;
+   for (it = mNewBlockFiles.begin(); it != mNewBlockFiles.end(); it++) {
+      BlockHash::iterator found = mBlockFileHash.find(*it);
+      if (found != mBlockFileHash.end() && found->second)
+         bytes += found->second->GetSpaceUsage();
+   }
+   mNewBlockFiles.clear();
+
+   return bytes;
+}
+
 bool DirManager::EnsureSafeFilename(wxFileName fName)
 {
    // Quick check: If it's not even in our alias list,
@@ -1339,18 +1545,26 @@ bool DirManager::EnsureSafeFilename(wxFileName fName)
 
 void DirManager::Ref()
 {
+   wxMutexLocker lock(mRefMutex);
+
    wxASSERT(mRef > 0); // MM: If mRef is smaller, it should have been deleted already
    ++mRef;
 }
 
 void DirManager::Deref()
 {
-   wxASSERT(mRef > 0); // MM: If mRef is smaller, it should have been deleted already
+   bool last;
+   {
+      wxMutexLocker lock(mRefMutex);
 
-   --mRef;
+      wxASSERT(mRef > 0); // MM: If mRef is smaller, it should have been deleted already
+
+      --mRef;
+      last = (mRef == 0);
+   }
 
    // MM: Automatically delete if refcount reaches zero
-   if (mRef == 0)
+   if (last)
       delete this;
 }
 
@@ -1396,15 +1610,20 @@ int DirManager::ProjectFSCK(const bool bForceError, const bool bAutoRecoverMode)
          nResult = FSCKstatus_CHANGED | FSCKstatus_SAVE_AUP;
    }
 
-   wxArrayString filePathArray; // *all* files in the project directory/subdirectories
+   // The project directory is listed once, on several threads, and the
+   // checks below look the blocks up in the listing rather than each
+   // stat'ing the files of every block.
+   WorkerPool pool(gPrefs->Read(wxT("/Directories/CheckThreads"),
+                                (long)WorkerPool::GetDefaultNumThreads()));
+   BlockFileInventory inventory(&pool); // *all* files in the project directory/subdirectories
    wxString dirPath = (projFull != wxT("") ? projFull : mytemp);
-   RecursivelyEnumerateWithProgress(
-      dirPath,
-      filePathArray,          // output: all files in project directory tree
-      wxEmptyString,
-      true, false,
-      mBlockFileHash.size(),  // rough guess of how many BlockFiles will be found/processed, for progress
-      _("Inspecting project file data"));
+   wxStopWatch timer;
+
+   ProgressDialog *progress =
+      new ProgressDialog(_("Progress"), _("Inspecting project file data"));
+   inventory.Scan(dirPath, progress);
+   delete progress;
+   long scanTime = timer.Time();
 
    //
    // MISSING ALIASED AUDIO FILES
@@ -1412,7 +1631,9 @@ int DirManager::ProjectFSCK(const bool bForceError, const bool bAutoRecoverMode)
    wxGetApp().SetMissingAliasedFileWarningShouldShow(false);
    BlockHash missingAliasedFileAUFHash;   // (.auf) AliasBlockFiles whose aliased files are missing
    BlockHash missingAliasedFilePathHash;  // full paths of missing aliased files
-   this->FindMissingAliasedFiles(missingAliasedFileAUFHash, missingAliasedFilePathHash);
+   timer.Start();
+   this->FindMissingAliasedFiles(pool, missingAliasedFileAUFHash, missingAliasedFilePathHash);
+   long aliasedTime = timer.Time();
 
    if ((nResult != FSCKstatus_CLOSE_REQ) && !missingAliasedFileAUFHash.empty())
    {
@@ -1483,7 +1704,9 @@ _("Project check of \"%s\" folder \
    // Alias summary regeneration must happen after checking missing aliased files.
    //
    BlockHash missingAUFHash;              // missing (.auf) AliasBlockFiles
-   this->FindMissingAUFs(missingAUFHash);
+   timer.Start();
+   this->FindMissingAUFs(inventory, missingAUFHash);
+   long aufTime = timer.Time();
    if ((nResult != FSCKstatus_CLOSE_REQ) && !missingAUFHash.empty())
    {
       // In auto-recover mode, we just recreate the alias files, and do not ask user.
@@ -1534,7 +1757,9 @@ _("Project check of \"%s\" folder \
    // MISSING (.AU) SimpleBlockFiles
    //
    BlockHash missingAUHash;               // missing data (.au) blockfiles
-   this->FindMissingAUs(missingAUHash);
+   timer.Start();
+   this->FindMissingAUs(inventory, missingAUHash);
+   long auTime = timer.Time();
    if ((nResult != FSCKstatus_CLOSE_REQ) && !missingAUHash.empty())
    {
       // In auto-recover mode, we just always create silent blocks.
@@ -1592,7 +1817,9 @@ _("Project check of \"%s\" folder \
    // ORPHAN BLOCKFILES (.au and .auf files that are not in the project.)
    //
    wxArrayString orphanFilePathArray;     // orphan .au and .auf files
-   this->FindOrphanBlockFiles(filePathArray, orphanFilePathArray);
+   timer.Start();
+   this->FindOrphanBlockFiles(inventory, orphanFilePathArray);
+   long orphanTime = timer.Time();
 
    if ((nResult != FSCKstatus_CLOSE_REQ) && !orphanFilePathArray.IsEmpty())
    {
@@ -1650,6 +1877,10 @@ other projects. \
       delete pProgress;
    }
 
+   wxLogMessage(wxT("Project check of %d files on %d threads took %ld ms to list them, then %ld ms for aliased files, %ld ms for .auf files, %ld ms for .au files and %ld ms for orphans"),
+                inventory.GetCount(), pool.GetNumThreads() + 1, scanTime,
+                aliasedTime, aufTime, auTime, orphanTime);
+
    // Summarize and flush the log.
    if (bForceError ||
          !missingAliasedFileAUFHash.empty() ||
@@ -1673,11 +1904,32 @@ other projects. \
 }
 
 void DirManager::FindMissingAliasedFiles(
+      WorkerPool &pool,                         // input: threads for the checks
       BlockHash& missingAliasedFileAUFHash,     // output: (.auf) AliasBlockFiles whose aliased files are missing
       BlockHash& missingAliasedFilePathHash)    // output: full paths of missing aliased files
 {
+   // Many blocks alias each file, so each file is checked just once, and
+   // the checks are shared out over the pool
+   FileExistenceChecker checker(&pool);
+
    BlockHash::iterator iter = mBlockFileHash.begin();
    while (iter != mBlockFileHash.end())
+   {
+      BlockFile *b = iter->second;
+      if (b->IsAlias())
+      {
+         wxString aliasedFileFullPath =
+            ((AliasBlockFile*)b)->GetAliasedFileName().GetFullPath();
+         if (aliasedFileFullPath != wxEmptyString)
+            checker.Add(aliasedFileFullPath);
+      }
+      iter++;
+   }
+
+   checker.Run();
+
+   iter = mBlockFileHash.begin();
+   while (iter != mBlockFileHash.end())
    {
       wxString key = iter->first;   // file name and extension
       BlockFile *b = iter->second;
@@ -1687,7 +1939,7 @@ void DirManager::FindMissingAliasedFiles(
          wxString aliasedFileFullPath = aliasedFileName.GetFullPath();
          // wxEmptyString can happen if user already chose to "replace... with silence".
          if ((aliasedFileFullPath != wxEmptyString) &&
-               !aliasedFileName.FileExists())
+               !checker.Exists(aliasedFileFullPath))
          {
             missingAliasedFileAUFHash[key] = b;
             if (missingAliasedFilePathHash.find(aliasedFileFullPath) ==
@@ -1709,6 +1961,7 @@ void DirManager::FindMissingAliasedFiles(
 }
 
 void DirManager::FindMissingAUFs(
+      const BlockFileInventory& inventory,      // input: all files in project directory
       BlockHash& missingAUFHash)                // output: missing (.auf) AliasBlockFiles
 {
    BlockHash::iterator iter = mBlockFileHash.begin();
@@ -1716,10 +1969,12 @@ void DirManager::FindMissingAUFs(
    {
       wxString key = iter->first;
       BlockFile *b = iter->second;
-      if (b->IsAlias() && b->IsSummaryAvailable())
+      if (b->IsAlias() && b->IsSummaryAvailable() &&
+            /* don't look in hash; that might find files the user moved
+               that the Blockfile abstraction can't find itself */
+            !inventory.Contains(GetBlockFileSubdir(key), key + wxT(".auf")))
       {
-         /* don't look in hash; that might find files the user moved
-            that the Blockfile abstraction can't find itself */
+         // Not where it belongs in the listing; stat it to be sure
          wxFileName fileName = MakeBlockFilePath(key);
          fileName.SetName(key);
          fileName.SetExt(wxT("auf"));
@@ -1735,6 +1990,7 @@ void DirManager::FindMissingAUFs(
 }
 
 void DirManager::FindMissingAUs(
+      const BlockFileInventory& inventory,      // input: all files in project directory
       BlockHash& missingAUHash)                 // missing data (.au) blockfiles
 {
    BlockHash::iterator iter = mBlockFileHash.begin();
@@ -1742,8 +1998,18 @@ void DirManager::FindMissingAUs(
    {
       wxString key = iter->first;
       BlockFile *b = iter->second;
-      if (!b->IsAlias())
+      if (b->IsPacked())
       {
+         if (!((SimpleBlockFile *)b)->IsPackedImageOnDisk())
+         {
+            missingAUHash[key] = b;
+            wxLogWarning(_("Missing packed data block: '%s'"), key.c_str());
+         }
+      }
+      else if (!b->IsAlias() &&
+            !inventory.Contains(GetBlockFileSubdir(key), key + wxT(".au")))
+      {
+         // Not where it belongs in the listing; stat it to be sure
          wxFileName fileName = MakeBlockFilePath(key);
          fileName.SetName(key);
          fileName.SetExt(wxT("au"));
@@ -1758,37 +2024,44 @@ void DirManager::FindMissingAUs(
    }
 }
 
-// Find .au and .auf files that are not in the project.
+// Find .au and .auf files, and block segments, that are not in the project.
 void DirManager::FindOrphanBlockFiles(
-      const wxArrayString& filePathArray,       // input: all files in project directory
+      const BlockFileInventory& inventory,      // input: all files in project directory
       wxArrayString& orphanFilePathArray)       // output: orphan files
 {
    DirManager *clipboardDM = NULL;
+   TrackList *clipTracks = AudacityProject::GetClipboardTracks();
 
-   for (size_t i = 0; i < filePathArray.GetCount(); i++)
+   if (clipTracks) {
+      TrackListIterator clipIter(clipTracks);
+      Track *track = clipIter.First();
+      if (track)
+         clipboardDM = track->GetDirManager();
+   }
+
+   for (int i = 0; i < inventory.GetCount(); i++)
    {
-      wxFileName fullname = filePathArray[i];
-      wxString basename = fullname.GetName();
-      if ((mBlockFileHash.find(basename) == mBlockFileHash.end()) && // is orphan
+      wxString basename;
+      wxString ext;
+      wxFileName::SplitPath(inventory.GetName(i), NULL, &basename, &ext);
+      if (ext.IsSameAs(wxT("aus")))
+      {
+         // A segment is an orphan once no block is kept in it, here or
+         // on the clipboard
+         wxFileName fullname = inventory.GetFullPath(i);
+         if (!ContainsBlockSegment(fullname) &&
+               !(clipboardDM && clipboardDM->ContainsBlockSegment(fullname)))
+            orphanFilePathArray.Add(fullname.GetFullPath());
+      }
+      else if ((mBlockFileHash.find(basename) == mBlockFileHash.end()) && // is orphan
             // Consider only Audacity data files.
             // Specifically, ignore <branding> JPG and <import> OGG ("Save Compressed Copy").
-            (fullname.GetExt().IsSameAs(wxT("au")) ||
-               fullname.GetExt().IsSameAs(wxT("auf"))))
+            (ext.IsSameAs(wxT("au")) ||
+               ext.IsSameAs(wxT("auf"))))
       {
-         if (!clipboardDM) {
-            TrackList *clipTracks = AudacityProject::GetClipboardTracks();
-
-            if (clipTracks) {
-               TrackListIterator clipIter(clipTracks);
-               Track *track = clipIter.First();
-               if (track)
-                  clipboardDM = track->GetDirManager();
-            }
-         }
-
          // Ignore it if it exists in the clipboard (from a previously closed project)
          if (!(clipboardDM && clipboardDM->ContainsBlockFile(basename)))
-            orphanFilePathArray.Add(fullname.GetFullPath());
+            orphanFilePathArray.Add(inventory.GetFullPath(i));
       }
    }
    for (size_t i = 0; i < orphanFilePathArray.GetCount(); i++)
@@ -1798,19 +2071,19 @@ void DirManager::FindOrphanBlockFiles(
 
 void DirManager::RemoveOrphanBlockfiles()
 {
-   wxArrayString filePathArray; // *all* files in the project directory/subdirectories
+   WorkerPool pool(gPrefs->Read(wxT("/Directories/CheckThreads"),
+                                (long)WorkerPool::GetDefaultNumThreads()));
+   BlockFileInventory inventory(&pool); // *all* files in the project directory/subdirectories
    wxString dirPath = (projFull != wxT("") ? projFull : mytemp);
-   RecursivelyEnumerateWithProgress(
-      dirPath,
-      filePathArray,          // output: all files in project directory tree
-      wxEmptyString,
-      true, false,
-      mBlockFileHash.size(),  // rough guess of how many BlockFiles will be found/processed, for progress
-      _("Inspecting project file data"));
+
+   ProgressDialog *progress =
+      new ProgressDialog(_("Progress"), _("Inspecting project file data"));
+   inventory.Scan(dirPath, progress);
+   delete progress;
 
    wxArrayString orphanFilePathArray;
    this->FindOrphanBlockFiles(
-            filePathArray,          // input: all files in project directory tree
+            inventory,              // input: all files in project directory tree
             orphanFilePathArray);   // output: orphan files
 
    // Remove all orphan blockfiles.
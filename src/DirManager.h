@@ -15,12 +15,20 @@
 #include <wx/string.h>
 #include <wx/filename.h>
 #include <wx/hashmap.h>
+#include <wx/thread.h>
+
+#include <set>
 
 #include "WaveTrack.h"
 
 class wxHashTable;
 class BlockFile;
+class BlockFileCopier;
+class BlockFileHandlePool;
+class BlockFileInventory;
+class BlockSegmentStore;
 class SequenceTest;
+class WorkerPool;
 
 #define FSCKstatus_CLOSE_REQ 0x1
 #define FSCKstatus_CHANGED   0x2
@@ -74,6 +82,8 @@ class DirManager: public XMLTagHandler {
    bool ContainsBlockFile(BlockFile *b);
    /// Check for existing using filename using complete filename
    bool ContainsBlockFile(wxString filepath);
+   /// Returns true if a packed block is kept in the given segment file
+   bool ContainsBlockSegment(const wxFileName &segmentFile);
 
    // Adds one to the reference count of the block file,
    // UNLESS it is "locked", then it makes a new copy of
@@ -96,6 +106,11 @@ class DirManager: public XMLTagHandler {
    void Ref(BlockFile * f);
    void Deref(BlockFile * f);
 
+   /// The space on disk of the block files made since the last call and
+   /// not freed since.  The UndoManager charges it to the state it is
+   /// pushing, so it never has to walk the blocks of the whole history.
+   wxLongLong TakeNewBlockFilesSpaceUsage();
+
    // For debugging only
    int GetRefCount(BlockFile * f);
 
@@ -121,15 +136,18 @@ class DirManager: public XMLTagHandler {
    int ProjectFSCK(const bool bForceError, const bool bAutoRecoverMode);
 
    void FindMissingAliasedFiles(
+         WorkerPool& pool,                         // input: threads for the checks
          BlockHash& missingAliasedFileAUFHash,     // output: (.auf) AliasBlockFiles whose aliased files are missing
          BlockHash& missingAliasedFilePathHash);   // output: full paths of missing aliased files
    void FindMissingAUFs(
+         const BlockFileInventory& inventory,      // input: all files in project directory
          BlockHash& missingAUFHash);               // output: missing (.auf) AliasBlockFiles
    void FindMissingAUs(
+         const BlockFileInventory& inventory,      // input: all files in project directory
          BlockHash& missingAUHash);                // missing data (.au) blockfiles
    // Find .au and .auf files that are not in the project.
    void FindOrphanBlockFiles(
-         const wxArrayString& filePathArray,       // input: all files in project directory
+         const BlockFileInventory& inventory,      // input: all files in project directory
          wxArrayString& orphanFilePathArray);      // output: orphan files
 
 
@@ -153,24 +171,56 @@ class DirManager: public XMLTagHandler {
    // Write all write-cached block files to disc, if any
    void WriteCacheToDisk();
 
+   // Where packed block files are kept
+   BlockSegmentStore *GetBlockSegmentStore() { return mSegmentStore; }
+
+   // Copy the packed blocks out of segments that are more than half
+   // unused, before saving.  The old segments are only removed by
+   // RemoveCompactedBlockSegments(), once the project file is saved,
+   // since until then the saved project still refers to them.
+   void CompactBlockSegments();
+   void RemoveCompactedBlockSegments();
+
    // Fill cache of blockfiles, if caching is enabled (otherwise do nothing)
    void FillBlockfilesCache();
 
+   // Open block file handles shared by all projects' SimpleBlockFile reads.
+   // NULL while no DirManager exists (e.g. in the unit tests).
+   static BlockFileHandlePool *GetReadHandlePool() { return sReadHandlePool; }
+
  private:
 
    wxFileName MakeBlockFileName();
    wxFileName MakeBlockFilePath(wxString value);
+   static wxString GetBlockFileSubdir(const wxString &value);
 
-   bool MoveOrCopyToNewProjectDirectory(BlockFile *f, bool copy);
+   wxFileName MakePackedBlockName();
+
+   // Makes a name under mBlockFileMutex and holds its place in the hash,
+   // so that the block file can be made outside the lock
+   wxFileName ReserveBlockFileName(bool packed = false);
+
+   // With a copier, a copy is queued on it instead of made
+   bool MoveOrCopyToNewProjectDirectory(BlockFile *f, bool copy,
+                                        BlockFileCopier *copier = NULL);
 
    int mRef; // MM: Current refcount
+   wxMutex mRefMutex; // tracks are made on import threads too
 
    BlockHash mBlockFileHash; // repository for blockfiles
+   std::set<wxString> mNewBlockFiles; // names of blocks made since
+                                      // TakeNewBlockFilesSpaceUsage()
    DirHash   dirTopPool;    // available toplevel dirs
    DirHash   dirTopFull;    // full toplevel dirs
    DirHash   dirMidPool;    // available two-level dirs
    DirHash   dirMidFull;    // full two-level dirs
 
+   // Guards the above and aliasList in the New...BlockFile() calls and
+   // Deref(BlockFile *), the only calls appending to a sequence makes,
+   // so that different sequences can be appended to on several threads
+   // at once
+   wxMutex   mBlockFileMutex;
+
    void BalanceInfoDel(wxString);
    void BalanceInfoAdd(wxString);
    void BalanceFileAdd(int);
@@ -190,10 +240,15 @@ class DirManager: public XMLTagHandler {
 
    sampleCount mMaxSamples; // max samples per block
 
+   BlockSegmentStore *mSegmentStore;
+   bool mPackBlockFiles;            // make new SimpleBlockFiles packed
+   unsigned long mNextPackedBlock;  // number of the next packed name
+
    static wxString globaltemp;
    wxString mytemp;
    static int numDirManagers;
    static bool dontDeleteTempFiles;
+   static BlockFileHandlePool *sReadHandlePool;
 
    friend class SequenceTest;
 };
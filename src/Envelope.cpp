@@ -1175,6 +1175,103 @@ void Envelope::GetValues(double *buffer, int bufferLen,
    }
 }
 
+// Number of the samples t + k * tstep, k >= 0, that come before (or, if
+// inclusive, at) time t + span; at least one and at most maxLen.
+static int CountSamplesUntil(double span, double tstep, bool inclusive,
+                             int maxLen)
+{
+   if (tstep <= 0.0)
+      return maxLen;
+
+   double n = inclusive ? floor(span / tstep) + 1 : ceil(span / tstep);
+   if (n >= maxLen)
+      return maxLen;
+   if (n < 1)
+      return 1;
+   return (int)n;
+}
+
+// Exponential segments multiply by a float step, so keep them short
+// enough that rounding in the step can't build up
+#define MAX_EXPONENTIAL_SEGMENT 256
+
+EnvelopeCursor::EnvelopeCursor(const Envelope *envelope,
+                               double t0, double tstep)
+{
+   mEnvelope = envelope;
+   mT0 = t0 - envelope->mOffset;
+   mTStep = tstep;
+   mPos = 0;
+   mIndex = 0;
+}
+
+EnvelopeSegment EnvelopeCursor::Next(int maxLen)
+{
+   const EnvArray &env = mEnvelope->mEnv;
+   int len = env.Count();
+   double t = mT0 + mPos * mTStep;
+
+   EnvelopeSegment seg;
+   seg.shape = EnvelopeSegment::Constant;
+   seg.len = maxLen;
+   seg.step = 0.0f;
+
+   if (len <= 0) {
+      seg.value = mEnvelope->mDefaultValue;
+   }
+   else if (t <= env[0]->GetT()) {
+      // Before the envelope, up to and including its first point
+      seg.value = env[0]->GetVal();
+      seg.len = CountSamplesUntil(env[0]->GetT() - t, mTStep, true, maxLen);
+   }
+   else if (t >= env[len - 1]->GetT()) {
+      seg.value = env[len - 1]->GetVal();
+   }
+   else {
+      // Find the points either side of t.  Going forwards we just step
+      // along; only a jump backwards needs a search.
+      if (mIndex >= len - 1 || t < env[mIndex]->GetT()) {
+         int hi;
+         mEnvelope->BinarySearchForTime(mIndex, hi, t);
+      }
+      while (t >= env[mIndex + 1]->GetT())
+         mIndex++;
+
+      double tprev = env[mIndex]->GetT();
+      double tnext = env[mIndex + 1]->GetT();
+      double vprev = mEnvelope->GetInterpolationStartValueAtPoint(mIndex);
+      double vnext = mEnvelope->GetInterpolationStartValueAtPoint(mIndex + 1);
+
+      // Interpolate, either linear or log depending on mDB, as
+      // Envelope::GetValues() does
+      double dt = tnext - tprev;
+      double to = t - tprev;
+      double v = (vprev * (dt - to) + vnext * to) / dt;
+      double vstep = (vnext - vprev) * mTStep / dt;
+
+      seg.len = CountSamplesUntil(tnext - t, mTStep, false, maxLen);
+      if (mEnvelope->mDB) {
+         seg.value = pow(10.0, v);
+         if (vstep != 0.0) {
+            seg.shape = EnvelopeSegment::Exponential;
+            seg.step = pow(10.0, vstep);
+            if (seg.len > MAX_EXPONENTIAL_SEGMENT)
+               seg.len = MAX_EXPONENTIAL_SEGMENT;
+         }
+      }
+      else {
+         seg.value = v;
+         if (vstep != 0.0) {
+            seg.shape = EnvelopeSegment::Linear;
+            seg.step = vstep;
+         }
+      }
+   }
+
+   mPos += seg.len;
+   return seg;
+}
+
 int Envelope::NumberOfPointsAfter(double t)
 {
    if( t >= mEnv[mEnv.Count()-1]->GetT() )
@@ -28,6 +28,7 @@ class wxTextFile;
 
 class DirManager;
 class Envelope;
+class EnvelopeCursor;
 
 #define ENV_DB_RANGE 60
 
@@ -194,6 +195,8 @@ class Envelope : public XMLTagHandler {
                   int bufferLen) const;
 
 private:
+   friend class EnvelopeCursor;
+
    double fromDB(double x) const;
    double toDB(double x);
    EnvPoint *  AddPointAtEnd( double t, double val );
@@ -251,6 +254,44 @@ private:
 
 };
 
+/// A run of envelope values at evenly spaced times that follow one rule,
+/// as handed out by EnvelopeCursor.
+struct EnvelopeSegment {
+   enum Shape {
+      Constant,     ///< every value is value
+      Linear,       ///< the i'th value is value + step * i
+      Exponential   ///< the i'th value is value * step^i
+   };
+
+   Shape shape;
+   int   len;
+   float value;
+   float step;
+};
+
+/// Walks forwards through an Envelope at evenly spaced times, handing out
+/// the values as segments rather than one by one.  It remembers which
+/// pair of points it is between, so moving on to the next pair costs
+/// nothing; only a jump backwards needs a search.  Gives approximately
+/// the values Envelope::GetValues() does for the same times: segments
+/// are stepped in float, so they differ in the last few bits, and by up
+/// to a few parts in 100000 along a long exponential (dB) segment.
+class EnvelopeCursor {
+ public:
+   EnvelopeCursor(const Envelope *envelope, double t0, double tstep);
+
+   /// The segment covering the next samples, at most maxLen of them.
+   /// The cursor moves past the samples it covers.
+   EnvelopeSegment Next(int maxLen);
+
+ private:
+   const Envelope *mEnvelope;
+   double mT0;
+   double mTStep;
+   int mPos;
+   int mIndex;
+};
+
 inline double EnvPoint::ClampValue(double val)
 {
    return mEnvelope->ClampValue(val);
@@ -37,6 +37,7 @@
 #include "DirManager.h"
 #include "Envelope.h"
 #include "Internat.h"
+#include "MixKernels.h"
 #include "Prefs.h"
 #include "Project.h"
 #include "Resample.h"
@@ -271,6 +272,7 @@ Mixer::Mixer(int numInputTracks, WaveTrack **inputTracks,
 
    mBuffer = new samplePtr[mNumBuffers];
    mTemp = new samplePtr[mNumBuffers];
+   mMixDest = mTemp;
    for (int c = 0; c < mNumBuffers; c++) {
       mBuffer[c] = NewSamples(mInterleavedBufferSize, mFormat);
       mTemp[c] = NewSamples(mInterleavedBufferSize, floatSample);
@@ -298,11 +300,6 @@ Mixer::Mixer(int numInputTracks, WaveTrack **inputTracks,
       mQueueStart[i] = 0;
       mQueueLen[i] = 0;
    }
-
-   int envLen = mInterleavedBufferSize;
-   if (mQueueMaxLen > envLen)
-      envLen = mQueueMaxLen;
-   mEnvValues = new double[envLen];
 }
 
 Mixer::~Mixer()
@@ -316,7 +313,6 @@ Mixer::~Mixer()
    delete[] mBuffer;
    delete[] mTemp;
    delete[] mInputTrack;
-   delete[] mEnvValues;
    delete[] mFloatBuffer;
    delete[] mGains;
    delete[] mSamplePos;
@@ -336,10 +332,12 @@ void Mixer::ApplyTrackGains(bool apply)
    mApplyTrackGains = apply;
 }
 
-void Mixer::Clear()
+void Mixer::Clear(samplePtr *dests, sampleCount len)
 {
+   if (mInterleaved)
+      len *= mNumChannels;
    for (int c = 0; c < mNumBuffers; c++) {
-      memset(mTemp[c], 0, mInterleavedBufferSize * SAMPLE_SIZE(floatSample));
+      memset(dests[c], 0, len * SAMPLE_SIZE(floatSample));
    }
 }
 
@@ -347,28 +345,25 @@ void MixBuffers(int numChannels, int *channelFlags, float *gains,
                 samplePtr src, samplePtr *dests,
                 int len, bool interleaved)
 {
+   float *temp = (float *)src;
+
+   // A track mixed into both channels of a stereo output is the common
+   // case during playback; do both channels in a single pass
+   if (interleaved && numChannels == 2 && channelFlags[0] && channelFlags[1]) {
+      MixMulAddStereo((float *)dests[0], temp, gains[0], gains[1], len);
+      return;
+   }
+
    for (int c = 0; c < numChannels; c++) {
       if (!channelFlags[c])
          continue;
 
-      samplePtr destPtr;
-      int skip;
-
-      if (interleaved) {
-         destPtr = dests[0] + c*SAMPLE_SIZE(floatSample);
-         skip = numChannels;
-      } else {
-         destPtr = dests[c];
-         skip = 1;
-      }
-
-      float gain = gains[c];
-      float *dest = (float *)destPtr;
-      float *temp = (float *)src;
-      for (int j = 0; j < len; j++) {
-         *dest += temp[j] * gain;   // the actual mixing process
-         dest += skip;
-      }
+      // the actual mixing process
+      if (interleaved)
+         MixMulAddInterleaved((float *)dests[0] + c, numChannels,
+                              temp, gains[c], len);
+      else
+         MixMulAdd((float *)dests[c], temp, gains[c], len);
    }
 }
 
@@ -425,14 +420,10 @@ sampleCount Mixer::MixVariableRates(int *channelFlags, WaveTrack *track,
                        *pos,
                        getLen);
 
-            track->GetEnvelopeValues(mEnvValues,
-                                     getLen,
-                                     (*pos) / trackRate,
-                                     tstep);
-
-            for (int i = 0; i < getLen; i++) {
-               queue[(*queueLen) + i] *= mEnvValues[i];
-            }
+            track->ApplyEnvelope(queue + (*queueLen),
+                                 getLen,
+                                 (*pos) / trackRate,
+                                 tstep);
 
             *queueLen += getLen;
             *pos += getLen;
@@ -492,7 +483,7 @@ sampleCount Mixer::MixVariableRates(int *channelFlags, WaveTrack *track,
               channelFlags,
               mGains,
               (samplePtr)mFloatBuffer,
-              mTemp,
+              mMixDest,
               out,
               mInterleaved);
 
@@ -519,9 +510,7 @@ sampleCount Mixer::MixSameRate(int *channelFlags, WaveTrack *track,
       slen = mMaxOut;
 
    track->Get((samplePtr)mFloatBuffer, floatSample, *pos, slen);
-   track->GetEnvelopeValues(mEnvValues, slen, t, 1.0 / mRate);
-   for(int i=0; i<slen; i++)
-      mFloatBuffer[i] *= mEnvValues[i]; // Track gain control will go here?
+   track->ApplyEnvelope(mFloatBuffer, slen, t, 1.0 / mRate); // Track gain control will go here?
 
    for(c=0; c<mNumChannels; c++)
       if (mApplyTrackGains)
@@ -530,7 +519,7 @@ sampleCount Mixer::MixSameRate(int *channelFlags, WaveTrack *track,
          mGains[c] = 1.0;
 
    MixBuffers(mNumChannels, channelFlags, mGains,
-              (samplePtr)mFloatBuffer, mTemp, slen, mInterleaved);
+              (samplePtr)mFloatBuffer, mMixDest, slen, mInterleaved);
 
    *pos += slen;
 
@@ -538,6 +527,11 @@ sampleCount Mixer::MixSameRate(int *channelFlags, WaveTrack *track,
 }
 
 sampleCount Mixer::Process(sampleCount maxToProcess)
+{
+   return Process(maxToProcess, mBuffer);
+}
+
+sampleCount Mixer::Process(sampleCount maxToProcess, samplePtr *dests)
 {
    // MB: this is wrong! mT represented warped time, and mTime is too inaccurate to use
    // it here. It's also unnecessary I think.
@@ -551,7 +545,9 @@ sampleCount Mixer::Process(sampleCount maxToProcess)
 
    mMaxOut = maxToProcess;
 
-   Clear();
+   // Float output needs no conversion, so accumulate straight into it
+   mMixDest = (mFormat == floatSample) ? dests : mTemp;
+   Clear(mMixDest, maxToProcess);
    for(i=0; i<mNumInputTracks; i++) {
       WaveTrack *track = mInputTrack[i];
       for(j=0; j<mNumChannels; j++)
@@ -596,26 +592,31 @@ sampleCount Mixer::Process(sampleCount maxToProcess)
          mTime = std::min(t, mT1);
 
    }
-   if(mInterleaved) {
-      for(int c=0; c<mNumChannels; c++) {
-         CopySamples(mTemp[0] + (c * SAMPLE_SIZE(floatSample)),
-                     floatSample,
-                     mBuffer[0] + (c * SAMPLE_SIZE(mFormat)),
-                     mFormat,
-                     maxOut,
-                     mHighQuality,
-                     mNumChannels,
-                     mNumChannels);
-      }
-   }
-   else {
-      for(int c=0; c<mNumBuffers; c++) {
-            CopySamples(mTemp[c],
+   // Convert to the output format, unless we mixed straight into it
+   if (mMixDest == mTemp) {
+      if(mInterleaved) {
+         for(int c=0; c<mNumChannels; c++) {
+            CopySamples(mTemp[0] + (c * SAMPLE_SIZE(floatSample)),
                         floatSample,
-                        mBuffer[c],
+                        dests[0] + (c * SAMPLE_SIZE(mFormat)),
                         mFormat,
                         maxOut,
-                        mHighQuality);
+                        mDither,
+                        mHighQuality,
+                        mNumChannels,
+                        mNumChannels);
+         }
+      }
+      else {
+         for(int c=0; c<mNumBuffers; c++) {
+               CopySamples(mTemp[c],
+                           floatSample,
+                           dests[c],
+                           mFormat,
+                           maxOut,
+                           mDither,
+                           mHighQuality);
+         }
       }
    }
    // MB: this doesn't take warping into account, replaced with code based on mSamplePos
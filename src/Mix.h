@@ -15,6 +15,7 @@
 #include <wx/string.h>
 
 #include "SampleFormat.h"
+#include "Dither.h"
 #include "WaveTrack.h"
 #include "TimeTrack.h"
 #include "Resample.h"
@@ -96,6 +97,13 @@ class AUDACITY_DLL_API Mixer {
    /// more samples that must be processed.
    sampleCount Process(sampleCount maxSamples);
 
+   /// Like Process(), but puts the samples into the caller's buffers
+   /// rather than into GetBuffer(): one buffer per channel, or a single
+   /// one if the mixer is interleaved, each holding at least maxSamples
+   /// samples of the output format.  For float output nothing is copied;
+   /// the tracks are mixed straight into dests.
+   sampleCount Process(sampleCount maxSamples, samplePtr *dests);
+
    /// Restart processing at beginning of buffer next time
    /// Process() is called.
    void Restart();
@@ -116,7 +124,7 @@ class AUDACITY_DLL_API Mixer {
 
  private:
 
-   void Clear();
+   void Clear(samplePtr *dests, sampleCount len);
    sampleCount MixSameRate(int *channelFlags, WaveTrack *src,
                            sampleCount *pos);
 
@@ -133,7 +141,6 @@ class AUDACITY_DLL_API Mixer {
    sampleCount     *mSamplePos;
    bool             mApplyTrackGains;
    float           *mGains;
-   double          *mEnvValues;
    double           mT0; // Start time
    double           mT1; // Stop time (none if mT0==mT1)
    double           mTime;  // Current time (renamed from mT to mTime for consistency with AudioIO - mT represented warped time there)
@@ -155,9 +162,12 @@ class AUDACITY_DLL_API Mixer {
    bool             mInterleaved;
    samplePtr       *mBuffer;
    samplePtr       *mTemp;
+   samplePtr       *mMixDest;   // where the current Process() accumulates
    float           *mFloatBuffer;
    double           mRate;
    bool             mHighQuality;
+   Dither           mDither;     // of this mixer alone, as mixers may run
+                                 // on several threads at once
 };
 
 #endif
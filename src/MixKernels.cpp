@@ -0,0 +1,404 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  MixKernels.cpp
+
+*******************************************************************//**
+
+\file MixKernels.cpp
+\brief Scalar, SSE2 and AVX versions of the mixing inner loops.
+
+Every playback buffer and every export goes through these loops once
+per input track, so with many tracks they dominate the cost of mixing.
+
+The vector versions are compiled with per-function target attributes
+rather than with global compiler flags, so that one binary runs on any
+x86 processor; which one is used is decided at run time by querying the
+processor, the same way EffectEqualization48x::GetMathCaps() does.
+
+Each vector kernel does exactly the same arithmetic, in the same
+precision, as its scalar counterpart, so the results are identical
+whichever path is taken.
+
+*//*******************************************************************/
+
+#include "Audacity.h"
+
+#include "MixKernels.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+   #if defined(_MSC_VER)
+      #define MIX_HAVE_SSE2
+      #define MIX_TARGET_SSE2
+      // _xgetbv() first appeared in Visual Studio 2010 SP1
+      #if _MSC_FULL_VER >= 160040219
+         #define MIX_HAVE_AVX
+         #define MIX_TARGET_AVX
+      #endif
+   #elif defined(__clang__) || \
+         (defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)))
+      #define MIX_HAVE_SSE2
+      #define MIX_TARGET_SSE2 __attribute__((target("sse2")))
+      #define MIX_HAVE_AVX
+      #define MIX_TARGET_AVX __attribute__((target("avx")))
+   #elif defined(__SSE2__)
+      // Older compilers only understand the intrinsics they were
+      // told to generate for the whole file
+      #define MIX_HAVE_SSE2
+      #define MIX_TARGET_SSE2
+   #endif
+#endif
+
+#ifdef MIX_HAVE_SSE2
+   #include <emmintrin.h>
+   #ifdef _MSC_VER
+      #include <intrin.h>
+   #else
+      #include <cpuid.h>
+   #endif
+#endif
+
+#ifdef MIX_HAVE_AVX
+   #include <immintrin.h>
+#endif
+
+//
+// Plain C++ versions; these also finish the tails of the vector loops
+//
+
+static void MulAddScalar(float *dest, const float *src, float gain, int len)
+{
+   for (int i = 0; i < len; i++)
+      dest[i] += src[i] * gain;
+}
+
+static void MulAddInterleavedScalar(float *dest, int stride,
+                                    const float *src, float gain, int len)
+{
+   for (int i = 0; i < len; i++) {
+      *dest += src[i] * gain;
+      dest += stride;
+   }
+}
+
+static void MulAddStereoScalar(float *dest, const float *src,
+                               float gainLeft, float gainRight, int len)
+{
+   for (int i = 0; i < len; i++) {
+      dest[2*i] += src[i] * gainLeft;
+      dest[2*i+1] += src[i] * gainRight;
+   }
+}
+
+// Starts at index i, so that the vector versions can finish with it
+// and still compute each gain the same way
+static void ApplyRampScalar(float *buffer, float value, float step,
+                            int i, int len)
+{
+   for (; i < len; i++)
+      buffer[i] *= value + step * (float)i;
+}
+
+#ifdef MIX_HAVE_SSE2
+
+//
+// SSE2: four samples at a time
+//
+
+static MIX_TARGET_SSE2 void MulAddSSE2(float *dest, const float *src,
+                                       float gain, int len)
+{
+   const __m128 g = _mm_set1_ps(gain);
+   int i = 0;
+
+   for (; i + 8 <= len; i += 8) {
+      __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), g);
+      __m128 b = _mm_mul_ps(_mm_loadu_ps(src + i + 4), g);
+      _mm_storeu_ps(dest + i, _mm_add_ps(_mm_loadu_ps(dest + i), a));
+      _mm_storeu_ps(dest + i + 4, _mm_add_ps(_mm_loadu_ps(dest + i + 4), b));
+   }
+   for (; i + 4 <= len; i += 4) {
+      __m128 a = _mm_mul_ps(_mm_loadu_ps(src + i), g);
+      _mm_storeu_ps(dest + i, _mm_add_ps(_mm_loadu_ps(dest + i), a));
+   }
+
+   MulAddScalar(dest + i, src + i, gain, len - i);
+}
+
+static MIX_TARGET_SSE2 void MulAddInterleavedSSE2(float *dest, int stride,
+                                                  const float *src,
+                                                  float gain, int len)
+{
+   int i = 0;
+
+   if (stride == 2) {
+      // Two frames per vector.  The lanes of the other channel are
+      // loaded and stored back unchanged, so the loop stops one frame
+      // early to avoid touching memory past the last frame.
+      const __m128 g = _mm_set1_ps(gain);
+      const __m128 mask = _mm_castsi128_ps(_mm_setr_epi32(-1, 0, -1, 0));
+      for (; i + 2 < len; i += 2) {
+         __m128 s = _mm_castpd_ps(_mm_load_sd((const double *)(src + i)));
+         __m128 p = _mm_mul_ps(_mm_unpacklo_ps(s, s), g);
+         __m128 d = _mm_loadu_ps(dest + 2*i);
+         __m128 sum = _mm_add_ps(d, p);
+         _mm_storeu_ps(dest + 2*i, _mm_or_ps(_mm_and_ps(mask, sum),
+                                             _mm_andnot_ps(mask, d)));
+      }
+   }
+
+   MulAddInterleavedScalar(dest + i*stride, stride, src + i, gain, len - i);
+}
+
+static MIX_TARGET_SSE2 void MulAddStereoSSE2(float *dest, const float *src,
+                                             float gainLeft, float gainRight,
+                                             int len)
+{
+   const __m128 g = _mm_setr_ps(gainLeft, gainRight, gainLeft, gainRight);
+   int i = 0;
+
+   for (; i + 4 <= len; i += 4) {
+      __m128 s = _mm_loadu_ps(src + i);
+      __m128 lo = _mm_mul_ps(_mm_unpacklo_ps(s, s), g);   // s0 s0 s1 s1
+      __m128 hi = _mm_mul_ps(_mm_unpackhi_ps(s, s), g);   // s2 s2 s3 s3
+      float *d = dest + 2*i;
+      _mm_storeu_ps(d, _mm_add_ps(_mm_loadu_ps(d), lo));
+      _mm_storeu_ps(d + 4, _mm_add_ps(_mm_loadu_ps(d + 4), hi));
+   }
+
+   MulAddStereoScalar(dest + 2*i, src + i, gainLeft, gainRight, len - i);
+}
+
+static MIX_TARGET_SSE2 void ApplyRampSSE2(float *buffer, float value,
+                                          float step, int len)
+{
+   const __m128 v = _mm_set1_ps(value);
+   const __m128 s = _mm_set1_ps(step);
+   const __m128 offsets = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+   int i = 0;
+
+   // (float)i + k is exact, so each gain is the same as the scalar one
+   for (; i + 4 <= len; i += 4) {
+      __m128 index = _mm_add_ps(_mm_set1_ps((float)i), offsets);
+      __m128 g = _mm_add_ps(v, _mm_mul_ps(s, index));
+      _mm_storeu_ps(buffer + i, _mm_mul_ps(_mm_loadu_ps(buffer + i), g));
+   }
+
+   ApplyRampScalar(buffer, value, step, i, len);
+}
+
+#endif // MIX_HAVE_SSE2
+
+#ifdef MIX_HAVE_AVX
+
+//
+// AVX: eight samples at a time.  Only the floating point instructions
+// of AVX are needed, so these run on any processor with AVX, not just
+// those with AVX2.
+//
+
+static MIX_TARGET_AVX void MulAddAVX(float *dest, const float *src,
+                                     float gain, int len)
+{
+   const __m256 g = _mm256_set1_ps(gain);
+   int i = 0;
+
+   for (; i + 16 <= len; i += 16) {
+      __m256 a = _mm256_mul_ps(_mm256_loadu_ps(src + i), g);
+      __m256 b = _mm256_mul_ps(_mm256_loadu_ps(src + i + 8), g);
+      _mm256_storeu_ps(dest + i, _mm256_add_ps(_mm256_loadu_ps(dest + i), a));
+      _mm256_storeu_ps(dest + i + 8,
+                       _mm256_add_ps(_mm256_loadu_ps(dest + i + 8), b));
+   }
+   for (; i + 8 <= len; i += 8) {
+      __m256 a = _mm256_mul_ps(_mm256_loadu_ps(src + i), g);
+      _mm256_storeu_ps(dest + i, _mm256_add_ps(_mm256_loadu_ps(dest + i), a));
+   }
+
+   MulAddScalar(dest + i, src + i, gain, len - i);
+}
+
+static MIX_TARGET_AVX void MulAddStereoAVX(float *dest, const float *src,
+                                           float gainLeft, float gainRight,
+                                           int len)
+{
+   const __m256 g = _mm256_setr_ps(gainLeft, gainRight, gainLeft, gainRight,
+                                   gainLeft, gainRight, gainLeft, gainRight);
+   int i = 0;
+
+   for (; i + 4 <= len; i += 4) {
+      __m128 s = _mm_loadu_ps(src + i);
+      __m256 dup = _mm256_insertf128_ps(
+         _mm256_castps128_ps256(_mm_unpacklo_ps(s, s)),
+         _mm_unpackhi_ps(s, s), 1);   // s0 s0 s1 s1 s2 s2 s3 s3
+      float *d = dest + 2*i;
+      _mm256_storeu_ps(d, _mm256_add_ps(_mm256_loadu_ps(d),
+                                        _mm256_mul_ps(dup, g)));
+   }
+
+   MulAddStereoScalar(dest + 2*i, src + i, gainLeft, gainRight, len - i);
+}
+
+static MIX_TARGET_AVX void ApplyRampAVX(float *buffer, float value,
+                                        float step, int len)
+{
+   const __m256 v = _mm256_set1_ps(value);
+   const __m256 s = _mm256_set1_ps(step);
+   const __m256 offsets =
+      _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+   int i = 0;
+
+   for (; i + 8 <= len; i += 8) {
+      __m256 index = _mm256_add_ps(_mm256_set1_ps((float)i), offsets);
+      __m256 g = _mm256_add_ps(v, _mm256_mul_ps(s, index));
+      _mm256_storeu_ps(buffer + i,
+                       _mm256_mul_ps(_mm256_loadu_ps(buffer + i), g));
+   }
+
+   ApplyRampScalar(buffer, value, step, i, len);
+}
+
+#endif // MIX_HAVE_AVX
+
+//
+// Run time selection
+//
+
+static MixKernelPath DetectMixKernelPath()
+{
+#ifdef MIX_HAVE_SSE2
+   int info[4];
+#ifdef _MSC_VER
+   __cpuid(info, 0);
+   if (info[0] < 1)
+      return MixKernelScalar;
+   __cpuid(info, 1);
+#else
+   unsigned int a, b, c, d;
+   if (!__get_cpuid(1, &a, &b, &c, &d))
+      return MixKernelScalar;
+   info[0] = a; info[1] = b; info[2] = c; info[3] = d;
+#endif
+
+   if (!(info[3] & (1 << 26)))
+      return MixKernelScalar;
+
+#ifdef MIX_HAVE_AVX
+   // AVX needs both the processor and the OS, which has to save the
+   // upper halves of the registers on a context switch
+   bool osxsave = (info[2] & (1 << 27)) != 0;
+   bool avx = (info[2] & (1 << 28)) != 0;
+   if (osxsave && avx) {
+#ifdef _MSC_VER
+      unsigned long long xcr0 = _xgetbv(0);
+#else
+      unsigned int eax, edx;
+      // xgetbv, spelled out for assemblers that don't know it
+      __asm__ __volatile__(".byte 0x0f, 0x01, 0xd0"
+                           : "=a" (eax), "=d" (edx) : "c" (0));
+      unsigned long long xcr0 = eax | ((unsigned long long)edx << 32);
+#endif
+      if ((xcr0 & 6) == 6)
+         return MixKernelAVX;
+   }
+#endif
+
+   return MixKernelSSE2;
+#else
+   return MixKernelScalar;
+#endif
+}
+
+static const MixKernelPath sBestPath = DetectMixKernelPath();
+static MixKernelPath sPath = sBestPath;
+
+MixKernelPath GetMixKernelPath()
+{
+   return sPath;
+}
+
+MixKernelPath GetBestMixKernelPath()
+{
+   return sBestPath;
+}
+
+void SetMixKernelPath(MixKernelPath path)
+{
+   sPath = (path > sBestPath) ? sBestPath : path;
+}
+
+void MixMulAdd(float *dest, const float *src, float gain, int len)
+{
+   switch (sPath) {
+#ifdef MIX_HAVE_AVX
+   case MixKernelAVX:
+      MulAddAVX(dest, src, gain, len);
+      return;
+#endif
+#ifdef MIX_HAVE_SSE2
+   case MixKernelSSE2:
+      MulAddSSE2(dest, src, gain, len);
+      return;
+#endif
+   default:
+      MulAddScalar(dest, src, gain, len);
+   }
+}
+
+void MixMulAddInterleaved(float *dest, int stride,
+                          const float *src, float gain, int len)
+{
+   if (stride == 1) {
+      MixMulAdd(dest, src, gain, len);
+      return;
+   }
+
+   switch (sPath) {
+#ifdef MIX_HAVE_SSE2
+   case MixKernelAVX:
+   case MixKernelSSE2:
+      MulAddInterleavedSSE2(dest, stride, src, gain, len);
+      return;
+#endif
+   default:
+      MulAddInterleavedScalar(dest, stride, src, gain, len);
+   }
+}
+
+void MixMulAddStereo(float *dest, const float *src,
+                     float gainLeft, float gainRight, int len)
+{
+   switch (sPath) {
+#ifdef MIX_HAVE_AVX
+   case MixKernelAVX:
+      MulAddStereoAVX(dest, src, gainLeft, gainRight, len);
+      return;
+#endif
+#ifdef MIX_HAVE_SSE2
+   case MixKernelSSE2:
+      MulAddStereoSSE2(dest, src, gainLeft, gainRight, len);
+      return;
+#endif
+   default:
+      MulAddStereoScalar(dest, src, gainLeft, gainRight, len);
+   }
+}
+
+void MixApplyRamp(float *buffer, float value, float step, int len)
+{
+   switch (sPath) {
+#ifdef MIX_HAVE_AVX
+   case MixKernelAVX:
+      ApplyRampAVX(buffer, value, step, len);
+      return;
+#endif
+#ifdef MIX_HAVE_SSE2
+   case MixKernelSSE2:
+      ApplyRampSSE2(buffer, value, step, len);
+      return;
+#endif
+   default:
+      ApplyRampScalar(buffer, value, step, 0, len);
+   }
+}
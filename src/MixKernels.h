@@ -0,0 +1,48 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  MixKernels.h
+
+  The arithmetic at the heart of mixing: scaling a buffer of float
+  samples by a gain or an envelope segment and accumulating it into an output
+  buffer.  Each kernel has a plain C++ version and, on x86, SSE2 and AVX
+  versions.  The fastest version the processor supports is chosen the
+  first time a kernel is used.
+
+**********************************************************************/
+
+#ifndef __AUDACITY_MIX_KERNELS__
+#define __AUDACITY_MIX_KERNELS__
+
+enum MixKernelPath {
+   MixKernelScalar,
+   MixKernelSSE2,
+   MixKernelAVX
+};
+
+/// The instruction set the kernels are currently using
+MixKernelPath GetMixKernelPath();
+
+/// The best instruction set this processor and build support
+MixKernelPath GetBestMixKernelPath();
+
+/// Forces a particular set of kernels, e.g. to compare them in a
+/// benchmark.  Requests beyond GetBestMixKernelPath() are clamped to it.
+void SetMixKernelPath(MixKernelPath path);
+
+/// dest[i] += src[i] * gain
+void MixMulAdd(float *dest, const float *src, float gain, int len);
+
+/// dest[i*stride] += src[i] * gain
+void MixMulAddInterleaved(float *dest, int stride,
+                          const float *src, float gain, int len);
+
+/// dest[2*i] += src[i] * gainLeft; dest[2*i+1] += src[i] * gainRight
+void MixMulAddStereo(float *dest, const float *src,
+                     float gainLeft, float gainRight, int len);
+
+/// buffer[i] *= value + step * i; a constant gain when step is 0
+void MixApplyRamp(float *buffer, float value, float step, int len);
+
+#endif
@@ -408,10 +408,7 @@ public:
       ODManager::Pause();
 
       sortednames.Sort(CompareNoCaseFileName);
-      for (unsigned int i = 0; i < sortednames.GetCount(); i++) {
-
-         mProject->Import(sortednames[i]);
-      }
+      mProject->ImportFiles(sortednames);
       mProject->HandleResize(); // Adjust scrollers for new track sizes.
 
       ODManager::Resume();
@@ -3320,6 +3317,11 @@ bool AudacityProject::Save(bool overwrite /* = true */ ,
       }
    }
 
+   // Packed blocks are moved out of mostly unused segments, so that the
+   // project file written below no longer refers to those
+   if (!bWantSaveCompressed)
+      mDirManager->CompactBlockSegments();
+
    // Write the AUP file.
    XMLFileWriter saveFile;
 
@@ -3367,6 +3369,9 @@ bool AudacityProject::Save(bool overwrite /* = true */ ,
       // Now that we have saved the file, we can delete the auto-saved version
       DeleteCurrentAutoSaveFile();
 
+      // ... and the block segments emptied above
+      mDirManager->RemoveCompactedBlockSegments();
+
       if (mIsRecovered)
       {
          // This was a recovered file, that is, we have just overwritten the
@@ -3605,6 +3610,48 @@ bool AudacityProject::Import(wxString fileName, WaveTrackArray* pTrackArray /*=
                                             mTags,
                                             errorMessage);
 
+   return AddImportedFile(fileName, newTracks, numTracks, errorMessage,
+                          pTrackArray);
+}
+
+void AudacityProject::ImportFiles(const wxArrayString &fileNames)
+{
+   wxArrayString batch;
+
+   for (size_t i = 0; i <= fileNames.GetCount(); i++) {
+      // LOF ("list of files") files add the files they list to the project
+      // as they are read, so the files before them must be in first
+      bool isLOF = (i < fileNames.GetCount() &&
+                    fileNames[i].AfterLast('.').IsSameAs(wxT("lof"), false));
+
+      if (i < fileNames.GetCount() && !isLOF) {
+         batch.Add(fileNames[i]);
+         continue;
+      }
+
+      std::vector<Track **> newTracks;
+      std::vector<int> numTracks;
+      wxArrayString errorMessages;
+
+      Importer::Get().ImportBatch(batch, mTrackFactory, mTags,
+                                  newTracks, numTracks, errorMessages);
+
+      for (size_t j = 0; j < batch.GetCount(); j++) {
+         AddImportedFile(batch[j], newTracks[j], numTracks[j],
+                         errorMessages[j], NULL);
+      }
+      batch.Clear();
+
+      if (isLOF)
+         Import(fileNames[i]);
+   }
+}
+
+bool AudacityProject::AddImportedFile(wxString fileName,
+                                      Track **newTracks, int numTracks,
+                                      const wxString &errorMessage,
+                                      WaveTrackArray *pTrackArray)
+{
    if (!errorMessage.IsEmpty()) {
 // Version that goes to internet...
 //      ShowErrorDialog(this, _("Error Importing"),
@@ -205,8 +205,16 @@ class AUDACITY_DLL_API AudacityProject:  public wxFrame,
    // If pNewTrackList is passed in non-NULL, it gets filled with the pointers to new tracks.
    bool Import(wxString fileName, WaveTrackArray *pTrackArray = NULL);
 
+   // Imports several files at once (see Importer::ImportBatch) and adds
+   // their tracks in the order given
+   void ImportFiles(const wxArrayString &fileNames);
+
    void AddImportedTracks(wxString fileName,
                           Track **newTracks, int numTracks);
+   bool AddImportedFile(wxString fileName,
+                        Track **newTracks, int numTracks,
+                        const wxString &errorMessage,
+                        WaveTrackArray *pTrackArray);
    void LockAllBlocks();
    void UnlockAllBlocks();
    bool Save(bool overwrite = true, bool fromSaveAs = false, bool bWantSaveCompressed = false);
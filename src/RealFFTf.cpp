@@ -39,6 +39,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <wx/thread.h>
 #include "Experimental.h"
 
 #include "RealFFTf.h"
@@ -126,11 +127,14 @@ void EndFFT(HFFT h)
 #define MAX_HFFT 10
 static HFFT hFFTArray[MAX_HFFT] = { NULL };
 static int nFFTLockCount[MAX_HFFT] = { 0 };
+// The spectrogram computes columns on several threads at once
+static wxMutex hFFTArrayMutex;
 
 /* Get a handle to the FFT tables of the desired length */
 /* This version keeps common tables rather than allocating a new table every time */
 HFFT GetFFT(int fftlen)
 {
+   wxMutexLocker locker(hFFTArrayMutex);
    int h,n = fftlen/2;
    for(h=0; (h<MAX_HFFT) && (hFFTArray[h] != NULL) && (n != hFFTArray[h]->Points); h++);
    if(h<MAX_HFFT) {
@@ -149,6 +153,7 @@ HFFT GetFFT(int fftlen)
 /* Release a previously requested handle to the FFT tables */
 void ReleaseFFT(HFFT hFFT)
 {
+   wxMutexLocker locker(hFFTArrayMutex);
    int h;
    for(h=0; (h<MAX_HFFT) && (hFFTArray[h] != hFFT); h++);
    if(h<MAX_HFFT) {
@@ -161,6 +166,7 @@ void ReleaseFFT(HFFT hFFT)
 /* Deallocate any unused FFT tables */
 void CleanupFFT()
 {
+   wxMutexLocker locker(hFFTArrayMutex);
    int h;
    for(h=0; (h<MAX_HFFT); h++) {
       if((nFFTLockCount[h] <= 0) && (hFFTArray[h] != NULL)) {
@@ -16,6 +16,13 @@
   need to read, or both need to write, they need to lock this
   class from outside using their own mutex.
 
+  No locks are taken.  The writer publishes new samples by storing
+  mEnd with release semantics after copying them in, and the reader
+  frees space by storing mStart with release semantics after copying
+  them out; each side loads the other's index with acquire semantics.
+  So the reader never sees an index before the samples it covers, and
+  the writer never overwrites samples the reader is still copying.
+
   AvailForPut and AvailForGet may underestimate but will never
   overestimate.
 
@@ -24,6 +31,56 @@
 
 #include "RingBuffer.h"
 
+#include <wx/debug.h>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+//
+// Atomic access to the indices.  x86 and x86-64 never reorder loads with
+// older loads or stores with older stores, so on MSVC it suffices to stop
+// the compiler from doing so.
+//
+
+static inline int LoadAcquire(const volatile int *index)
+{
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+   return __atomic_load_n(index, __ATOMIC_ACQUIRE);
+#elif defined(__GNUC__)
+   int value = *index;
+   __sync_synchronize();
+   return value;
+#elif defined(_MSC_VER)
+   int value = *index;
+   _ReadWriteBarrier();
+   return value;
+#else
+   #error "Need an acquire load for this compiler"
+#endif
+}
+
+static inline void StoreRelease(volatile int *index, int value)
+{
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7))
+   __atomic_store_n(index, value, __ATOMIC_RELEASE);
+#elif defined(__GNUC__)
+   __sync_synchronize();
+   *index = value;
+#elif defined(_MSC_VER)
+   _ReadWriteBarrier();
+   *index = value;
+#else
+   #error "Need a release store for this compiler"
+#endif
+}
+
+// Only for an index the calling thread itself writes
+static inline int LoadOwn(const volatile int *index)
+{
+   return *index;
+}
+
 RingBuffer::RingBuffer(sampleFormat format, int size)
 {
    mFormat = format;
@@ -38,9 +95,9 @@ RingBuffer::~RingBuffer()
    DeleteSamples(mBuffer);
 }
 
-int RingBuffer::Len()
+int RingBuffer::Filled(int start, int end)
 {
-   return (mEnd + mBufferSize - mStart) % mBufferSize;
+   return (end + mBufferSize - start) % mBufferSize;
 }
 
 //
@@ -49,7 +106,7 @@ int RingBuffer::Len()
 
 int RingBuffer::AvailForPut()
 {
-   return (mBufferSize-4) - Len();
+   return (mBufferSize-4) - Filled(LoadAcquire(&mStart), LoadOwn(&mEnd));
 }
 
 int RingBuffer::Put(samplePtr buffer, sampleFormat format,
@@ -58,15 +115,14 @@ int RingBuffer::Put(samplePtr buffer, sampleFormat format,
    samplePtr src;
    int block;
    int copied;
-   int pos;
-   int len = Len();
+   int pos = LoadOwn(&mEnd);
+   int len = Filled(LoadAcquire(&mStart), pos);
 
    if (samplesToCopy > (mBufferSize-4) - len)
       samplesToCopy = (mBufferSize-4) - len;
 
    src = buffer;
    copied = 0;
-   pos = mEnd;
 
    while(samplesToCopy) {
       block = samplesToCopy;
@@ -83,18 +139,41 @@ int RingBuffer::Put(samplePtr buffer, sampleFormat format,
       copied += block;
    }
 
-   mEnd = pos;
+   StoreRelease(&mEnd, pos);
 
    return copied;
 }
 
+int RingBuffer::ReserveForPut(samplePtr *region1, int *samples1,
+                              samplePtr *region2, int *samples2)
+{
+   int pos = LoadOwn(&mEnd);
+   int avail = (mBufferSize-4) - Filled(LoadAcquire(&mStart), pos);
+
+   *region1 = mBuffer + pos * SAMPLE_SIZE(mFormat);
+   *samples1 = (avail > mBufferSize - pos) ? mBufferSize - pos : avail;
+   *region2 = mBuffer;
+   *samples2 = avail - *samples1;
+
+   return avail;
+}
+
+void RingBuffer::CommitPut(int samples)
+{
+   int pos = LoadOwn(&mEnd);
+
+   wxASSERT(samples >= 0 && samples <= mBufferSize - 4);
+
+   StoreRelease(&mEnd, (pos + samples) % mBufferSize);
+}
+
 //
 // For the reader only:
 //
 
 int RingBuffer::AvailForGet()
 {
-   return Len();
+   return Filled(LoadOwn(&mStart), LoadAcquire(&mEnd));
 }
 
 int RingBuffer::Get(samplePtr buffer, sampleFormat format,
@@ -103,7 +182,8 @@ int RingBuffer::Get(samplePtr buffer, sampleFormat format,
    samplePtr dest;
    int block;
    int copied;
-   int len = Len();
+   int pos = LoadOwn(&mStart);
+   int len = Filled(pos, LoadAcquire(&mEnd));
 
    if (samplesToCopy > len)
       samplesToCopy = len;
@@ -113,30 +193,33 @@ int RingBuffer::Get(samplePtr buffer, sampleFormat format,
 
    while(samplesToCopy) {
       block = samplesToCopy;
-      if (block > mBufferSize - mStart)
-         block = mBufferSize - mStart;
+      if (block > mBufferSize - pos)
+         block = mBufferSize - pos;
 
-      CopySamples(mBuffer + mStart * SAMPLE_SIZE(mFormat), mFormat,
+      CopySamples(mBuffer + pos * SAMPLE_SIZE(mFormat), mFormat,
                   dest, format,
                   block);
 
       dest += block * SAMPLE_SIZE(format);
-      mStart = (mStart + block) % mBufferSize;
+      pos = (pos + block) % mBufferSize;
       samplesToCopy -= block;
       copied += block;
    }
 
+   StoreRelease(&mStart, pos);
+
    return copied;
 }
 
 int RingBuffer::Discard(int samplesToDiscard)
 {
-   int len = Len();
+   int pos = LoadOwn(&mStart);
+   int len = Filled(pos, LoadAcquire(&mEnd));
 
    if (samplesToDiscard > len)
       samplesToDiscard = len;
 
-   mStart = (mStart + samplesToDiscard) % mBufferSize;
+   StoreRelease(&mStart, (pos + samplesToDiscard) % mBufferSize);
 
    return samplesToDiscard;
 }
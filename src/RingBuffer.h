@@ -13,6 +13,10 @@
 
 #include "SampleFormat.h"
 
+// Enough to keep the two indices on separate cache lines on any
+// processor we run on
+#define RING_BUFFER_CACHE_LINE 128
+
 class RingBuffer {
  public:
    RingBuffer(sampleFormat format, int size);
@@ -25,6 +29,16 @@ class RingBuffer {
    int AvailForPut();
    int Put(samplePtr buffer, sampleFormat format, int samples);
 
+   /// Returns all of the free space, in the buffer's own format, as two
+   /// regions, the second starting at the beginning of the buffer (and
+   /// empty unless the free space wraps around).  Returns the total
+   /// number of samples.
+   int ReserveForPut(samplePtr *region1, int *samples1,
+                     samplePtr *region2, int *samples2);
+   /// Makes the first 'samples' samples of the reserved space visible
+   /// to the reader.
+   void CommitPut(int samples);
+
    //
    // For the reader only:
    //
@@ -34,13 +48,21 @@ class RingBuffer {
    int Discard(int samples);
 
  private:
-   int Len();
+   int Filled(int start, int end);
 
+   // Set up by the constructor and never changed
    sampleFormat  mFormat;
-   int           mStart;
-   int           mEnd;
    int           mBufferSize;
    samplePtr     mBuffer;
+
+   // Each index is written by only one thread, and lives on its own
+   // cache line so the two threads don't keep stealing it from each
+   // other.  Access them only with the helpers in RingBuffer.cpp.
+   char          mPad0[RING_BUFFER_CACHE_LINE];
+   volatile int  mStart;   // written by the reader
+   char          mPad1[RING_BUFFER_CACHE_LINE - sizeof(int)];
+   volatile int  mEnd;     // written by the writer
+   char          mPad2[RING_BUFFER_CACHE_LINE - sizeof(int)];
 };
 
 #endif /*  __AUDACITY_RING_BUFFER__ */
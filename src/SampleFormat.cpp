@@ -92,6 +92,81 @@ void ClearSamples(samplePtr src, sampleFormat format,
    memset(src + start*size, 0, len*size);
 }
 
+// Little-endian packing works a group of 4 samples at a time through
+// three 32-bit words, which compilers turn into a handful of shifts and
+// ors per sample instead of three byte stores.
+static inline wxUint32 LoadWord(const unsigned char *p)
+{
+   wxUint32 w;
+   memcpy(&w, p, 4);
+   return w;
+}
+
+static inline void StoreWord(unsigned char *p, wxUint32 w)
+{
+   memcpy(p, &w, 4);
+}
+
+void PackInt24(const int *src, unsigned char *dst, int len, bool msbFirst)
+{
+   int i = 0;
+
+#if wxBYTE_ORDER == wxLITTLE_ENDIAN
+   if (!msbFirst) {
+      for (; i + 4 <= len; i += 4, src += 4, dst += 12) {
+         wxUint32 s0 = (wxUint32)src[0], s1 = (wxUint32)src[1];
+         wxUint32 s2 = (wxUint32)src[2], s3 = (wxUint32)src[3];
+         StoreWord(dst,     (s0 & 0xffffff) | (s1 << 24));
+         StoreWord(dst + 4, ((s1 >> 8) & 0xffff) | (s2 << 16));
+         StoreWord(dst + 8, ((s2 >> 16) & 0xff) | (s3 << 8));
+      }
+   }
+#endif
+
+   for (; i < len; i++, src++, dst += 3) {
+      wxUint32 s = (wxUint32)*src;
+      if (msbFirst) {
+         dst[0] = (unsigned char)(s >> 16);
+         dst[1] = (unsigned char)(s >> 8);
+         dst[2] = (unsigned char)s;
+      }
+      else {
+         dst[0] = (unsigned char)s;
+         dst[1] = (unsigned char)(s >> 8);
+         dst[2] = (unsigned char)(s >> 16);
+      }
+   }
+}
+
+void UnpackInt24(const unsigned char *src, int *dst, int len, bool msbFirst)
+{
+   int i = 0;
+
+   // Each sample is put in the top 24 bits and shifted back down, which
+   // sign-extends it
+
+#if wxBYTE_ORDER == wxLITTLE_ENDIAN
+   if (!msbFirst) {
+      for (; i + 4 <= len; i += 4, src += 12, dst += 4) {
+         wxUint32 w0 = LoadWord(src);
+         wxUint32 w1 = LoadWord(src + 4);
+         wxUint32 w2 = LoadWord(src + 8);
+         dst[0] = ((int)(w0 << 8)) >> 8;
+         dst[1] = ((int)((w0 >> 16) | (w1 << 16))) >> 8;
+         dst[2] = ((int)((w1 >> 8) | (w2 << 24))) >> 8;
+         dst[3] = ((int)w2) >> 8;
+      }
+   }
+#endif
+
+   for (; i < len; i++, src += 3, dst++) {
+      wxUint32 packed = msbFirst ?
+         ((wxUint32)src[0] << 24) | ((wxUint32)src[1] << 16) | ((wxUint32)src[2] << 8) :
+         ((wxUint32)src[2] << 24) | ((wxUint32)src[1] << 16) | ((wxUint32)src[0] << 8);
+      *dst = ((int)packed) >> 8;
+   }
+}
+
 void CopySamples(samplePtr src, sampleFormat srcFormat,
                  samplePtr dst, sampleFormat dstFormat,
                  unsigned int len,
@@ -104,6 +179,19 @@ void CopySamples(samplePtr src, sampleFormat srcFormat,
       src, srcFormat, dst, dstFormat, len, srcStride, dstStride);
 }
 
+void CopySamples(samplePtr src, sampleFormat srcFormat,
+                 samplePtr dst, sampleFormat dstFormat,
+                 unsigned int len,
+                 Dither &dither,
+                 bool highQuality, /* = true */
+                 unsigned int srcStride /* = 1 */,
+                 unsigned int dstStride /* = 1 */)
+{
+   dither.Apply(
+      highQuality ? gHighQualityDither : gLowQualityDither,
+      src, srcFormat, dst, dstFormat, len, srcStride, dstStride);
+}
+
 void CopySamplesNoDither(samplePtr src, sampleFormat srcFormat,
                  samplePtr dst, sampleFormat dstFormat,
                  unsigned int len,
@@ -61,6 +61,17 @@ void      CopySamples(samplePtr src, sampleFormat srcFormat,
                       unsigned int srcStride=1,
                       unsigned int dstStride=1);
 
+// As above, but keeping the state of the dither in 'dither' instead of
+// the one shared by all callers, so that conversions on several threads
+// at once don't disturb each other
+class Dither;
+void      CopySamples(samplePtr src, sampleFormat srcFormat,
+                      samplePtr dst, sampleFormat dstFormat,
+                      unsigned int len, Dither &dither,
+                      bool highQuality=true,
+                      unsigned int srcStride=1,
+                      unsigned int dstStride=1);
+
 void      CopySamplesNoDither(samplePtr src, sampleFormat srcFormat,
                       samplePtr dst, sampleFormat dstFormat,
                       unsigned int len,
@@ -70,6 +81,17 @@ void      CopySamplesNoDither(samplePtr src, sampleFormat srcFormat,
 void      ClearSamples(samplePtr buffer, sampleFormat format,
                        int start, int len);
 
+//
+// Packing 24-bit samples for disk, 3 bytes each, most significant byte
+// first if msbFirst
+//
+
+void      PackInt24(const int *src, unsigned char *dst, int len,
+                    bool msbFirst);
+
+void      UnpackInt24(const unsigned char *src, int *dst, int len,
+                      bool msbFirst);
+
 //
 // This must be called on startup and everytime new ditherers
 // are set in preferences.
@@ -62,6 +62,9 @@ Sequence::Sequence(DirManager * projDirManager, sampleFormat format)
    mMinSamples = sMaxDiskBlockSize / SAMPLE_SIZE(mSampleFormat) / 2;
    mMaxSamples = mMinSamples * 2;
    mErrorOpening = false;
+
+   mTailFile = NULL;
+   mTailBuffer = NULL;
 }
 
 Sequence::Sequence(const Sequence &orig, DirManager *projDirManager)
@@ -78,6 +81,9 @@ Sequence::Sequence(const Sequence &orig, DirManager *projDirManager)
    mMinSamples = orig.mMinSamples;
    mErrorOpening = false;
 
+   mTailFile = NULL;
+   mTailBuffer = NULL;
+
    mBlock = new BlockArray();
 
    bool bResult = Paste(0, &orig);
@@ -87,6 +93,8 @@ Sequence::Sequence(const Sequence &orig, DirManager *projDirManager)
 
 Sequence::~Sequence()
 {
+   ClearTail();
+
    for (unsigned int i = 0; i < mBlock->GetCount(); i++) {
       if (mBlock->Item(i)->f)
          mDirManager->Deref(mBlock->Item(i)->f);
@@ -147,6 +155,8 @@ bool Sequence::SetSampleFormat(sampleFormat format)
 
 bool Sequence::ConvertToSampleFormat(sampleFormat format, bool* pbChanged)
 {
+   ClearTail();
+
    wxASSERT(pbChanged);
    *pbChanged = false;
 
@@ -453,6 +463,8 @@ bool Sequence::Copy(sampleCount s0, sampleCount s1, Sequence **dest)
 
 bool Sequence::Paste(sampleCount s, const Sequence *src)
 {
+   ClearTail();
+
    if ((s < 0) || (s > mNumSamples))
    {
       wxLogError(
@@ -500,10 +512,12 @@ bool Sequence::Paste(sampleCount s, const Sequence *src)
       // onto the end because the current last block is longer than the
       // minimum size
 
+      mBlock->Alloc(numBlocks + srcNumBlocks);
       for (unsigned int i = 0; i < srcNumBlocks; i++)
          AppendBlock(srcBlock->Item(i));
 
-      return ConsistencyCheck(wxT("Paste branch one"));
+      return ConsistencyCheck(wxT("Paste branch one"),
+                              numBlocks, mBlock->GetCount());
    }
 
    if ((b >= 0 ) && (b < (int)numBlocks)
@@ -546,21 +560,16 @@ bool Sequence::Paste(sampleCount s, const Sequence *src)
 
       DeleteSamples(buffer);
 
-      return ConsistencyCheck(wxT("Paste branch two"));
+      return ConsistencyCheck(wxT("Paste branch two"), b, b + 1);
    }
 
    // Case two: if we are inserting four or fewer blocks,
    // it's simplest to just lump all the data together
    // into one big block along with the split block,
-   // then resplit it all
+   // then resplit it all.  The new blocks are collected in newBlock
+   // and spliced into mBlock in place of the split block.
    BlockArray *newBlock = new BlockArray();
-   newBlock->Alloc(numBlocks + srcNumBlocks + 2);
-   int newNumBlocks = 0;
-
-   for (int i = 0; i < b; i++) {
-      newBlock->Add(mBlock->Item(i));
-      newNumBlocks++;
-   }
+   newBlock->Alloc(srcNumBlocks + 4);
 
    SeqBlock *splitBlock = mBlock->Item(b);
    sampleCount splitLen = mBlock->Item(b)->f->GetLength();
@@ -584,7 +593,6 @@ bool Sequence::Paste(sampleCount s, const Sequence *src)
       for (i = 0; i < split->GetCount(); i++) {
          split->Item(i)->start += splitBlock->start;
          newBlock->Add(split->Item(i));
-         newNumBlocks++;
       }
       delete split;
       DeleteSamples(sumBuffer);
@@ -609,7 +617,6 @@ bool Sequence::Paste(sampleCount s, const Sequence *src)
       for (i = 0; i < split->GetCount(); i++) {
          split->Item(i)->start += splitBlock->start;
          newBlock->Add(split->Item(i));
-         newNumBlocks++;
       }
       delete split;
       DeleteSamples(leftBuffer);
@@ -628,7 +635,6 @@ bool Sequence::Paste(sampleCount s, const Sequence *src)
          }
 
          newBlock->Add(insertBlock);
-         newNumBlocks++;
       }
 
       sampleCount srcLastTwoLen =
@@ -650,7 +656,6 @@ bool Sequence::Paste(sampleCount s, const Sequence *src)
       for (i = 0; i < split->Count(); i++) {
          split->Item(i)->start += pos;
          newBlock->Add(split->Item(i));
-         newNumBlocks++;
       }
       delete split;
       DeleteSamples(rightBuffer);
@@ -659,20 +664,13 @@ bool Sequence::Paste(sampleCount s, const Sequence *src)
    mDirManager->Deref(splitBlock->f);
    delete splitBlock;
 
-   // Copy remaining blocks to new block array and
-   // swap the new block array in for the old
-   for (i = b + 1; i < numBlocks; i++) {
-      mBlock->Item(i)->start += addedLen;
-      newBlock->Add(mBlock->Item(i));
-      newNumBlocks++;
-   }
-
-   delete mBlock;
-   mBlock = newBlock;
+   unsigned int numNewBlocks = newBlock->GetCount();
+   SpliceBlocks(b, 1, *newBlock, addedLen);
+   delete newBlock;
 
    mNumSamples += addedLen;
 
-   return ConsistencyCheck(wxT("Paste branch three"));
+   return ConsistencyCheck(wxT("Paste branch three"), b, b + numNewBlocks);
 }
 
 bool Sequence::SetSilence(sampleCount s0, sampleCount len)
@@ -724,6 +722,8 @@ bool Sequence::AppendAlias(wxString fullPath,
                            sampleCount start,
                            sampleCount len, int channel,bool useOD)
 {
+   ClearTail();
+
    // Quick check to make sure that it doesn't overflow
    if (((double)mNumSamples) + ((double)len) > wxLL(9223372036854775807))
       return false;
@@ -743,6 +743,8 @@ bool Sequence::AppendAlias(wxString fullPath,
 bool Sequence::AppendCoded(wxString fName, sampleCount start,
                             sampleCount len, int channel, int decodeType)
 {
+   ClearTail();
+
    // Quick check to make sure that it doesn't overflow
    if (((double)mNumSamples) + ((double)len) > wxLL(9223372036854775807))
       return false;
@@ -759,6 +761,8 @@ bool Sequence::AppendCoded(wxString fName, sampleCount start,
 
 bool Sequence::AppendBlock(SeqBlock * b)
 {
+   ClearTail();
+
    // Quick check to make sure that it doesn't overflow
    if (((double)mNumSamples) + ((double)b->f->GetLength()) > wxLL(9223372036854775807))
       return false;
@@ -1183,6 +1187,8 @@ bool Sequence::Get(samplePtr buffer, sampleFormat format,
 bool Sequence::Set(samplePtr buffer, sampleFormat format,
                    sampleCount start, sampleCount len)
 {
+   ClearTail();
+
    if (start < 0 || start > mNumSamples ||
        start+len > mNumSamples)
       return false;
@@ -1477,7 +1483,11 @@ bool Sequence::Append(samplePtr buffer, sampleFormat format,
       SeqBlock *newLastBlock = new SeqBlock();
 
       samplePtr buffer2 = NewSamples((lastBlock->f->GetLength() + addLen), mSampleFormat);
-      Read(buffer2, mSampleFormat, lastBlock, 0, lastBlock->f->GetLength());
+      if (lastBlock->f == mTailFile)
+         memcpy(buffer2, mTailBuffer,
+                lastBlock->f->GetLength() * SAMPLE_SIZE(mSampleFormat));
+      else
+         Read(buffer2, mSampleFormat, lastBlock, 0, lastBlock->f->GetLength());
 
       CopySamples(buffer,
                   format,
@@ -1494,6 +1504,7 @@ bool Sequence::Append(samplePtr buffer, sampleFormat format,
       if (blockFileLog)
          ((SimpleBlockFile*)newLastBlock->f)->SaveXML(*blockFileLog);
 
+      SetTail(newLastBlock->f, buffer2);
       DeleteSamples(buffer2);
 
       mDirManager->Deref(lastBlock->f);
@@ -1539,6 +1550,9 @@ bool Sequence::Append(samplePtr buffer, sampleFormat format,
       if (blockFileLog)
          ((SimpleBlockFile*)w->f)->SaveXML(*blockFileLog);
 
+      if (l == len)
+         SetTail(w->f, (format == mSampleFormat) ? buffer : temp);
+
       mBlock->Add(w);
 
       buffer += l * SAMPLE_SIZE(format);
@@ -1585,7 +1599,7 @@ BlockArray *Sequence::Blockify(samplePtr buffer, sampleCount len)
 
 bool Sequence::Delete(sampleCount start, sampleCount len)
 {
-
+   ClearTail();
 
    if (len == 0)
       return true;
@@ -1598,7 +1612,6 @@ bool Sequence::Delete(sampleCount start, sampleCount len)
    LockDeleteUpdateMutex();
 
    unsigned int numBlocks = mBlock->GetCount();
-   unsigned int newNumBlocks = 0;
 
    unsigned int b0 = FindBlock(start);
    unsigned int b1 = FindBlock(start + len - 1);
@@ -1637,20 +1650,17 @@ bool Sequence::Delete(sampleCount start, sampleCount len)
       mNumSamples -= len;
       UnlockDeleteUpdateMutex();
 
-      return ConsistencyCheck(wxT("Delete - branch one"));
+      return ConsistencyCheck(wxT("Delete - branch one"), b0, b0 + 1);
    }
 
-   // Create a new array of blocks
+   // Collect the blocks that replace b0 through b1 (and possibly their
+   // neighbours, if short leftovers get merged into them) in a new array,
+   // then splice it into mBlock.
    BlockArray *newBlock = new BlockArray();
-   newBlock->Alloc(numBlocks - (b1 - b0) + 2);
+   newBlock->Alloc(6);
+   unsigned int first = b0;
 
-   // Copy the blocks before the deletion point over to
-   // the new array
    unsigned int i;
-   for (i = 0; i < b0; i++) {
-      newBlock->Add(mBlock->Item(i));
-      newNumBlocks++;
-   }
 
    // First grab the samples in block b0 before the deletion point
    // into preBuffer.  If this is enough samples for its own block,
@@ -1672,7 +1682,6 @@ bool Sequence::Delete(sampleCount start, sampleCount len)
          DeleteSamples(preBuffer);
 
          newBlock->Add(insBlock);
-         newNumBlocks++;
 
          if (b0 != b1) {
             mDirManager->Deref(preBlock->f);
@@ -1690,14 +1699,12 @@ bool Sequence::Delete(sampleCount start, sampleCount len)
               preBlock, 0, preBufferLen);
 
          BlockArray *split = Blockify(sumBuffer, sum);
-         split->Item(0)->start += prepreBlock->start;
-         newBlock->Item(b0 - 1) = split->Item(0);
-         for (i = 1; i < split->GetCount(); i++) {
+         for (i = 0; i < split->GetCount(); i++) {
             split->Item(i)->start += prepreBlock->start;
             newBlock->Add(split->Item(i));
-            newNumBlocks++;
          }
          delete split;
+         first = b0 - 1;
 
          DeleteSamples(sumBuffer);
 
@@ -1747,7 +1754,6 @@ bool Sequence::Delete(sampleCount start, sampleCount len)
          DeleteSamples(postBuffer);
 
          newBlock->Add(insBlock);
-         newNumBlocks++;
 
          mDirManager->Deref(postBlock->f);
          delete postBlock;
@@ -1766,7 +1772,6 @@ bool Sequence::Delete(sampleCount start, sampleCount len)
          for (i = 0; i < split->GetCount(); i++) {
             split->Item(i)->start += start;
             newBlock->Add(split->Item(i));
-            newNumBlocks++;
          }
          delete split;
          b1++;
@@ -1785,32 +1790,75 @@ bool Sequence::Delete(sampleCount start, sampleCount len)
       delete mBlock->Item(b1);
    }
 
-   // Copy the remaining blocks over from the old array
-   for (i = b1 + 1; i < numBlocks; i++) {
-      mBlock->Item(i)->start -= len;
-      newBlock->Add(mBlock->Item(i));
-      newNumBlocks++;
-   }
-
-   // Substitute our new array for the old one
-   delete mBlock;
-   mBlock = newBlock;
+   // Put the new blocks in place of the old ones and move the
+   // blocks after them back
+   unsigned int numNewBlocks = newBlock->GetCount();
+   SpliceBlocks(first, b1 - first + 1, *newBlock, -len);
+   delete newBlock;
 
    // Update total number of samples and do a consistency check.
    mNumSamples -= len;
 
    UnlockDeleteUpdateMutex();
-   return ConsistencyCheck(wxT("Delete - branch two"));
+   return ConsistencyCheck(wxT("Delete - branch two"),
+                           first, first + numNewBlocks);
+}
+
+void Sequence::SpliceBlocks(unsigned int first, unsigned int numReplaced,
+                            const BlockArray &replacement, sampleCount delta)
+{
+   unsigned int numNew = replacement.GetCount();
+
+   // Open or close the gap with a single move of the tail, rather than
+   // copying every block pointer into a new array
+   if (numNew > numReplaced)
+      mBlock->Insert(NULL, first + numReplaced, numNew - numReplaced);
+   else if (numNew < numReplaced)
+      mBlock->RemoveAt(first + numNew, numReplaced - numNew);
+
+   unsigned int i;
+   for (i = 0; i < numNew; i++)
+      mBlock->Item(first + i) = replacement.Item(i);
+
+   if (delta != 0) {
+      unsigned int numBlocks = mBlock->GetCount();
+      for (i = first + numNew; i < numBlocks; i++)
+         mBlock->Item(i)->start += delta;
+   }
 }
 
 bool Sequence::ConsistencyCheck(const wxChar *whereStr)
+{
+   return ConsistencyCheck(whereStr, 0, mBlock->GetCount());
+}
+
+bool Sequence::ConsistencyCheck(const wxChar *whereStr,
+                                unsigned int from, unsigned int to)
 {
    unsigned int i;
    sampleCount pos = 0;
    unsigned int numBlocks = mBlock->GetCount();
    bool bError = false;
 
-   for (i = 0; i < numBlocks; i++) {
+#ifdef VERY_SLOW_CHECKING
+   from = 0;
+   to = numBlocks;
+#endif
+   if (to > numBlocks)
+      to = numBlocks;
+   if (from > to)
+      from = to;
+
+   // Start from where the block before the range ends
+   if (from > 0) {
+      SeqBlock* pPrevBlock = mBlock->Item(from - 1);
+      if (pPrevBlock->f)
+         pos = pPrevBlock->start + pPrevBlock->f->GetLength();
+      else
+         bError = true;
+   }
+
+   for (i = from; i < to; i++) {
       SeqBlock* pSeqBlock = mBlock->Item(i);
       if (pos != pSeqBlock->start)
          bError = true;
@@ -1820,6 +1868,19 @@ bool Sequence::ConsistencyCheck(const wxChar *whereStr)
       else
          bError = true;
    }
+
+   // The blocks after the range must follow on from it, and the last
+   // of them must end the track
+   if (to < numBlocks) {
+      if (pos != mBlock->Item(to)->start)
+         bError = true;
+
+      SeqBlock* pLastBlock = mBlock->Item(numBlocks - 1);
+      if (pLastBlock->f)
+         pos = pLastBlock->start + pLastBlock->f->GetLength();
+      else
+         bError = true;
+   }
    if (pos != mNumSamples)
       bError = true;
 
@@ -1878,8 +1939,36 @@ int Sequence::GetMaxDiskBlockSize()
    return sMaxDiskBlockSize;
 }
 
+void Sequence::SetTail(BlockFile *f, samplePtr buffer)
+{
+   ClearTail();
+
+   // Blocks that are long enough are never grown again
+   sampleCount len = f->GetLength();
+   if (len >= mMinSamples)
+      return;
+
+   mTailBuffer = NewSamples(len, mSampleFormat);
+   memcpy(mTailBuffer, buffer, len * SAMPLE_SIZE(mSampleFormat));
+
+   // No reference is held: every other change to the blocks clears the
+   // tail first, so while it is set, f is still the last block
+   mTailFile = f;
+}
+
+void Sequence::ClearTail()
+{
+   mTailFile = NULL;
+   if (mTailBuffer) {
+      DeleteSamples(mTailBuffer);
+      mTailBuffer = NULL;
+   }
+}
+
 void Sequence::AppendBlockFile(BlockFile* blockFile)
 {
+   ClearTail();
+
    SeqBlock *w = new SeqBlock();
    w->start = mNumSamples;
    w->f = blockFile;
@@ -194,6 +194,12 @@ class Sequence: public XMLTagHandler {
 
    bool          mErrorOpening;
 
+   // While the last block is shorter than mMinSamples, Append keeps a copy
+   // of its samples so that the next Append can grow it without reading it
+   // back from disk.  Any other change to the blocks clears it.
+   BlockFile    *mTailFile;
+   samplePtr     mTailBuffer;
+
    ///To block the Delete() method against the ODCalcSummaryTask::Update() method
    ODLock   mDeleteUpdateMutex;
 
@@ -209,6 +215,9 @@ class Sequence: public XMLTagHandler {
 
    bool AppendBlock(SeqBlock *b);
 
+   void SetTail(BlockFile *f, samplePtr buffer);
+   void ClearTail();
+
    bool Read(samplePtr buffer, sampleFormat format,
              SeqBlock * b,
              sampleCount start, sampleCount len) const;
@@ -225,6 +234,12 @@ class Sequence: public XMLTagHandler {
 
    BlockArray *Blockify(samplePtr buffer, sampleCount len);
 
+   // Replaces numReplaced blocks of mBlock, starting at index first, with the
+   // blocks in replacement, and moves every block after them by delta samples.
+   // The replaced blocks are not deleted.
+   void SpliceBlocks(unsigned int first, unsigned int numReplaced,
+                     const BlockArray &replacement, sampleCount delta);
+
  public:
 
    //
@@ -235,6 +250,12 @@ class Sequence: public XMLTagHandler {
    // because of inconsistent block starts & lengths
    bool ConsistencyCheck(const wxChar *whereStr);
 
+   // The same check limited to the blocks in [from, to), their seams with
+   // the neighbouring blocks and the end of the track.  Edits move all later
+   // blocks by one amount, so this is enough after an edit of that range.
+   bool ConsistencyCheck(const wxChar *whereStr,
+                         unsigned int from, unsigned int to);
+
    // This function prints information to stdout about the blocks in the
    // tracks and indicates if there are inconsistencies.
    void DebugPrintf(wxString *dest);
@@ -450,6 +450,7 @@ class AUDACITY_DLL_API TrackFactory
    DirManager *mDirManager;
    friend class AudacityProject;
    friend class BenchmarkDialog;
+   friend class PerformanceBenchmark;
 
  public:
    // These methods are defined in WaveTrack.cpp, NoteTrack.cpp,
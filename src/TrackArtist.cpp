@@ -230,6 +230,7 @@ TrackArtist::TrackArtist()
 
    mdBrange = ENV_DB_RANGE;
    mShowClipping = false;
+   mSpectrumPending = false;
    UpdatePrefs();
 
    SetColours();
@@ -1937,8 +1938,11 @@ void TrackArtist::DrawClipSpectrum(WaveTrack *track,
    float *freq = new float[mid.width * half];
    sampleCount *where = new sampleCount[mid.width+1];
 
+   bool isPending = false;
    bool updated = clip->GetSpectrogram(freq, where, mid.width,
-                              t0, pps, autocorrelation);
+                              t0, pps, autocorrelation, isPending);
+   if (isPending)
+      mSpectrumPending = true;
    int ifreq = lrint(rate/2);
 
    int maxFreq;
@@ -74,6 +74,11 @@ class AUDACITY_DLL_API TrackArtist {
    int GetSpectrumLogMaxFreq(int deffreq);
    int GetSpectrumWindowSize();
 
+   /// True when a spectrogram was drawn with some columns still to be
+   /// computed, until ClearSpectrumPending()
+   bool IsSpectrumPending() const { return mSpectrumPending; }
+   void ClearSpectrumPending() { mSpectrumPending = false; }
+
 #ifdef EXPERIMENTAL_FFT_SKIP_POINTS
    int GetSpectrumFftSkipPoints();
 #endif
@@ -201,6 +206,8 @@ class AUDACITY_DLL_API TrackArtist {
    bool mFindNotesQuantize;   // "/Spectrum/FindNotesQuantize")
 #endif //EXPERIMENTAL_FIND_NOTES
 
+   bool mSpectrumPending;
+
    int mInsetLeft;
    int mInsetTop;
    int mInsetRight;
@@ -1092,6 +1092,13 @@ void TrackPanel::OnTimer()
          }
       }
    }
+
+   // Keep painting until the spectrograms on screen are complete
+   if (mTrackArtist->IsSpectrumPending()) {
+      mTrackArtist->ClearSpectrumPending();
+      Refresh( false );
+   }
+
    if(mTimeCount > 1000)
       mTimeCount = 0;
 }
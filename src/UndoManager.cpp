@@ -22,16 +22,11 @@ UndoManager
 
 #include "Audacity.h"
 
-#include "BlockFile.h"
+#include "DirManager.h"
 #include "Internat.h"
-#include "Sequence.h"
 #include "Track.h"
-#include "WaveTrack.h"          // temp
 #include "NoteTrack.h"  // for Sonify* function declarations
 
-#include <map>
-#include <set>
-
 #include "UndoManager.h"
 
 UndoManager::UndoManager()
@@ -47,65 +42,19 @@ UndoManager::~UndoManager()
    ClearStates();
 }
 
-// get the sum of the sizes of all blocks this track list
-// references.  However, if a block is referred to multiple
-// times it is only counted once.  Return value is in bytes.
-wxLongLong UndoManager::CalculateSpaceUsage(int index)
+// Get the space taken by the block files made since a state was last
+// pushed or modified, which are those the new state introduced.  This
+// charges each block to the first state that referenced it, as the old
+// walk over the whole history did, but the DirManager keeps the tally
+// as blocks are made and freed.  Return value is in bytes.
+wxLongLong UndoManager::CalculateSpaceUsage(TrackList *l)
 {
-   TrackListOfKindIterator iter(Track::Wave);
-   WaveTrack *wt;
-   WaveClipList::compatibility_iterator it;
-   BlockArray *blocks;
-   unsigned int i;
-
-   // get a map of all blocks referenced in this TrackList
-   std::map<BlockFile*, wxLongLong> cur;
-
-   wt = (WaveTrack *) iter.First(stack[index]->tracks);
-   while (wt) {
-      for (it = wt->GetClipIterator(); it; it = it->GetNext()) {
-         blocks = it->GetData()->GetSequenceBlockArray();
-         for (i = 0; i < blocks->GetCount(); i++)
-         {
-            BlockFile* pBlockFile = blocks->Item(i)->f;
-            if (pBlockFile->GetFileName().FileExists())
-               cur[pBlockFile] = pBlockFile->GetSpaceUsage();
-         }
-      }
-      wt = (WaveTrack *) iter.Next();
-   }
-
-   if (index > 0) {
-      // get a set of all blocks referenced in all prev TrackList
-      std::set<BlockFile*> prev;
-      while (--index) {
-         wt = (WaveTrack *) iter.First(stack[index]->tracks);
-         while (wt) {
-            for (it = wt->GetClipIterator(); it; it = it->GetNext()) {
-               blocks = it->GetData()->GetSequenceBlockArray();
-               for (i = 0; i < blocks->GetCount(); i++) {
-                  prev.insert(blocks->Item(i)->f);
-               }
-            }
-            wt = (WaveTrack *) iter.Next();
-         }
-      }
-
-      // remove all blocks in prevBlockFiles from curBlockFiles
-      std::set<BlockFile*>::const_iterator prevIter;
-      for (prevIter = prev.begin(); prevIter != prev.end(); prevIter++) {
-         cur.erase(*prevIter);
-      }
-   }
-
-   // sum the sizes of the blocks remaining in curBlockFiles;
-   wxLongLong bytes = 0;
-   std::map<BlockFile*, wxLongLong>::const_iterator curIter;
-   for (curIter = cur.begin(); curIter != cur.end(); curIter++) {
-      bytes += curIter->second;
-   }
+   TrackListIterator iter(l);
+   Track *t = iter.First();
+   if (!t || !t->GetDirManager())
+      return 0;
 
-   return bytes;
+   return t->GetDirManager()->TakeNewBlockFilesSpaceUsage();
 }
 
 void UndoManager::GetLongDescription(unsigned int n, wxString *desc,
@@ -208,6 +157,7 @@ void UndoManager::ModifyState(TrackList * l,
    // Replace
    stack[current]->tracks = tracksCopy;
    stack[current]->selectedRegion = selectedRegion;
+   stack[current]->spaceUsage += CalculateSpaceUsage(tracksCopy);
    SonifyEndModifyState();
 }
 
@@ -252,12 +202,16 @@ void UndoManager::PushState(TrackList * l,
    push->selectedRegion = selectedRegion;
    push->description = longDescription;
    push->shortDescription = shortDescription;
-   push->spaceUsage = 0; // Calculate actual value after it's on the stack.
+   push->spaceUsage = 0;
+
+   // Always take the new blocks' space, so that it isn't charged to the
+   // next state instead
+   wxLongLong spaceUsage = CalculateSpaceUsage(tracksCopy);
+   if( (flags&PUSH_CALC_SPACE)!=0)
+      push->spaceUsage = spaceUsage;
 
    stack.Add(push);
    current++;
-   if( (flags&PUSH_CALC_SPACE)!=0)
-      push->spaceUsage = this->CalculateSpaceUsage(current);
 
    if (saved >= current) {
       saved = -1;
@@ -113,7 +113,7 @@ class AUDACITY_DLL_API UndoManager {
    void ResetODChangesFlag();
 
  private:
-   wxLongLong CalculateSpaceUsage(int index);
+   wxLongLong CalculateSpaceUsage(TrackList *l);
 
    int current;
    int saved;
@@ -26,8 +26,12 @@ drawing).  Cache's the Spectrogram frequency samples.
 *//*******************************************************************/
 
 #include <math.h>
+#include <algorithm>
+#include <map>
+#include <set>
 #include <vector>
 #include <wx/log.h>
+#include <wx/stopwatch.h>
 
 #include "Spectrum.h"
 #include "Prefs.h"
@@ -35,6 +39,7 @@ drawing).  Cache's the Spectrogram frequency samples.
 #include "Envelope.h"
 #include "Resample.h"
 #include "Project.h"
+#include "WorkerPool.h"
 
 #include <wx/listimpl.cpp>
 WX_DEFINE_LIST(WaveClipList);
@@ -234,12 +239,18 @@ public:
       ac = autocorrelation;
       freq = new float[len*half];
       where = new sampleCount[len+1];
+      pending = new bool[len];
+      for (sampleCount x = 0; x < len; x++)
+         pending[x] = false;
+      numPending = 0;
+      level = 0;
    }
 
    ~SpecCache()
    {
       delete[] freq;
       delete[] where;
+      delete[] pending;
    }
 
    int          minFreqOld;
@@ -259,8 +270,162 @@ public:
    double       pps;
    sampleCount *where;
    float       *freq;
+   bool        *pending;     // columns not filled in yet
+   sampleCount  numPending;
+   int          level;       // of the tiles the columns come from
 };
 
+// Identifies a run of SpecTile::Columns spectrogram columns, spaced
+// 2^level samples apart, computed with one set of FFT settings
+struct SpecTileKey {
+   int windowSize;
+   int windowType;
+   bool ac;
+   int fftSkipPoints;
+   int level;
+   sampleCount index;
+
+   bool operator<(const SpecTileKey &other) const
+   {
+      if (level != other.level) return level < other.level;
+      if (index != other.index) return index < other.index;
+      if (windowSize != other.windowSize) return windowSize < other.windowSize;
+      if (windowType != other.windowType) return windowType < other.windowType;
+      if (ac != other.ac) return ac < other.ac;
+      return fftSkipPoints < other.fftSkipPoints;
+   }
+};
+
+class SpecTile {
+public:
+   enum { Columns = 64 };
+
+   SpecTile(int half)
+   {
+      freq = new float[Columns*half];
+      for (int c = 0; c < Columns; c++)
+         computed[c] = false;
+      lastUse = 0;
+      bytes = Columns*half*sizeof(float);
+   }
+
+   ~SpecTile()
+   {
+      delete[] freq;
+   }
+
+   float        *freq;
+   bool          computed[Columns];
+   unsigned long lastUse;
+   long          bytes;
+};
+
+/// Spectrogram columns of one clip at several spacings, kept across
+/// zooms, scrolls and settings changes until the clip's samples change.
+/// The tiles of all clips share one memory budget and are freed least
+/// recently used first, whichever clip they belong to.
+/// Used only by the GUI thread.
+class SpecTileCache {
+public:
+   SpecTileCache()
+   {
+      dirty = -1;
+      sCaches.insert(this);
+   }
+
+   ~SpecTileCache()
+   {
+      Clear();
+      sCaches.erase(this);
+   }
+
+   void Clear()
+   {
+      std::map<SpecTileKey, SpecTile*>::iterator it;
+      for (it = tiles.begin(); it != tiles.end(); ++it) {
+         sTotalBytes -= it->second->bytes;
+         delete it->second;
+      }
+      tiles.clear();
+   }
+
+   // Returns the tile, creating it if need be, and marks it used
+   SpecTile *Get(const SpecTileKey &key, int half)
+   {
+      SpecTile *&tile = tiles[key];
+      if (!tile) {
+         tile = new SpecTile(half);
+         sTotalBytes += tile->bytes;
+      }
+      tile->lastUse = sUseCount;
+      return tile;
+   }
+
+   // Starts a new use of the tiles, returning its stamp
+   static unsigned long NextUse()
+   {
+      return ++sUseCount;
+   }
+
+   // Frees the least recently used tiles of all clips, but none used
+   // since 'since', until they fit in maxBytes
+   static void Trim(wxLongLong_t maxBytes, unsigned long since)
+   {
+      if (sTotalBytes <= maxBytes)
+         return;
+
+      std::vector<TileAge> byAge;
+      std::set<SpecTileCache*>::iterator c;
+      for (c = sCaches.begin(); c != sCaches.end(); ++c) {
+         std::map<SpecTileKey, SpecTile*>::iterator it;
+         for (it = (*c)->tiles.begin(); it != (*c)->tiles.end(); ++it)
+            if (it->second->lastUse < since) {
+               TileAge age;
+               age.lastUse = it->second->lastUse;
+               age.cache = *c;
+               age.key = it->first;
+               byAge.push_back(age);
+            }
+      }
+      std::sort(byAge.begin(), byAge.end(), CompareAge);
+
+      for (size_t i = 0; i < byAge.size() && sTotalBytes > maxBytes; i++) {
+         std::map<SpecTileKey, SpecTile*> &tiles = byAge[i].cache->tiles;
+         std::map<SpecTileKey, SpecTile*>::iterator it =
+            tiles.find(byAge[i].key);
+         sTotalBytes -= it->second->bytes;
+         delete it->second;
+         tiles.erase(it);
+      }
+   }
+
+   int           dirty;
+   std::map<SpecTileKey, SpecTile*> tiles;
+
+private:
+   struct TileAge {
+      unsigned long lastUse;
+      SpecTileCache *cache;
+      SpecTileKey key;
+   };
+
+   static bool CompareAge(const TileAge &a, const TileAge &b)
+   {
+      return a.lastUse < b.lastUse;
+   }
+
+   // Memory held by the tiles of every clip
+   static wxLongLong_t sTotalBytes;
+   // The caches of every clip, for Trim()
+   static std::set<SpecTileCache*> sCaches;
+   // Counts uses of the tiles of any clip, to order them by age
+   static unsigned long sUseCount;
+};
+
+wxLongLong_t SpecTileCache::sTotalBytes = 0;
+std::set<SpecTileCache*> SpecTileCache::sCaches;
+unsigned long SpecTileCache::sUseCount = 0;
+
 #ifdef EXPERIMENTAL_USE_REALFFTF
 #include "FFT.h"
 static void ComputeSpectrumUsingRealFFTf(float *buffer, HFFT hFFT, float *window, int len, float *out)
@@ -290,6 +455,199 @@ static void ComputeSpectrumUsingRealFFTf(float *buffer, HFFT hFFT, float *window
 }
 #endif // EXPERIMENTAL_USE_REALFFTF
 
+// Spectrogram columns are computed by this pool, which is started the
+// first time it is needed and stopped by WaveClip::Deinit()
+static WorkerPool *sSpectrogramPool = NULL;
+
+static WorkerPool *GetSpectrogramPool()
+{
+   if (!sSpectrogramPool) {
+      int threads = gPrefs->Read(wxT("/Spectrum/Threads"),
+                                 (long)WorkerPool::GetDefaultNumThreads());
+      sSpectrogramPool = new WorkerPool(threads);
+   }
+   return sSpectrogramPool;
+}
+
+// Computes a list of spectrogram columns into SpecTiles.  Each item
+// is a run of ColumnsPerItem columns with its own sample buffer; the
+// sequence, FFT tables and window are only read, so the items can run
+// at the same time.
+class SpectrogramJob : public WorkerPoolJob {
+ public:
+   enum { ColumnsPerItem = 8 };
+
+   struct Column {
+      sampleCount center;   // sample in the middle of the window
+      float *freq;          // where its 'half' values go
+   };
+
+   SpectrogramJob() : columns(NULL), numColumns(0) {}
+
+   virtual void RunItem(int item)
+   {
+      int first = item * ColumnsPerItem;
+      int last = std::min(first + ColumnsPerItem, numColumns);
+
+#ifdef EXPERIMENTAL_FFT_SKIP_POINTS
+      float *buffer = new float[windowSize*(fftSkipPoints+1)];
+#else //!EXPERIMENTAL_FFT_SKIP_POINTS
+      float *buffer = new float[windowSize];
+#endif //EXPERIMENTAL_FFT_SKIP_POINTS
+
+      for (int c = first; c < last; c++)
+         ComputeColumn(columns[c].center, columns[c].freq, buffer);
+
+      delete[] buffer;
+   }
+
+   void ComputeColumn(sampleCount start, float *out, float *buffer);
+
+   const Sequence *sequence;
+   const Column *columns;
+   int numColumns;
+   int rate;
+   int windowType;
+   int windowSize;
+   int half;
+   bool autocorrelation;
+#ifdef EXPERIMENTAL_FFT_SKIP_POINTS
+   int fftSkipPoints;
+#endif //EXPERIMENTAL_FFT_SKIP_POINTS
+#ifdef EXPERIMENTAL_USE_REALFFTF
+   HFFT hFFT;
+   const float *window;
+#endif
+};
+
+void SpectrogramJob::ComputeColumn(sampleCount start, float *out,
+                                   float *buffer)
+{
+   sampleCount len = windowSize;
+   sampleCount i;
+#ifdef EXPERIMENTAL_FFT_SKIP_POINTS
+   int fftSkipPoints1 = fftSkipPoints+1;
+#endif //EXPERIMENTAL_FFT_SKIP_POINTS
+
+   if (start <= 0 || start >= sequence->GetNumSamples()) {
+
+      for (i = 0; i < (sampleCount)half; i++)
+         out[i] = 0;
+
+   }
+   else
+   {
+      float *adj = buffer;
+      start -= windowSize >> 1;
+
+      if (start < 0) {
+         for (i = start; i < 0; i++)
+            *adj++ = 0;
+         len += start;
+         start = 0;
+      }
+#ifdef EXPERIMENTAL_FFT_SKIP_POINTS
+      if (start + len*fftSkipPoints1 > sequence->GetNumSamples()) {
+         int newlen = (sequence->GetNumSamples() - start)/fftSkipPoints1;
+         for (i = newlen*fftSkipPoints1; i < (sampleCount)len*fftSkipPoints1; i++)
+#else //!EXPERIMENTAL_FFT_SKIP_POINTS
+      if (start + len > sequence->GetNumSamples()) {
+         int newlen = sequence->GetNumSamples() - start;
+         for (i = newlen; i < (sampleCount)len; i++)
+#endif //EXPERIMENTAL_FFT_SKIP_POINTS
+            adj[i] = 0;
+         len = newlen;
+      }
+
+      if (len > 0)
+#ifdef EXPERIMENTAL_FFT_SKIP_POINTS
+         sequence->Get((samplePtr)adj, floatSample, start, len*fftSkipPoints1);
+      if (fftSkipPoints) {
+         // TODO: (maybe) alternatively change Get to include skipping of points
+         int j=0;
+         for (int i=0; i < len; i++) {
+            adj[i]=adj[j];
+            j+=fftSkipPoints1;
+         }
+      }
+#else //!EXPERIMENTAL_FFT_SKIP_POINTS
+         sequence->Get((samplePtr)adj, floatSample, start, len);
+#endif //EXPERIMENTAL_FFT_SKIP_POINTS
+
+#ifdef EXPERIMENTAL_USE_REALFFTF
+      if(autocorrelation) {
+         ComputeSpectrum(buffer, windowSize, windowSize,
+                         rate, out,
+                         autocorrelation, windowType);
+      } else {
+         ComputeSpectrumUsingRealFFTf(buffer, hFFT, window, windowSize, out);
+      }
+#else  // EXPERIMENTAL_USE_REALFFTF
+     ComputeSpectrum(buffer, windowSize, windowSize,
+                     rate, out,
+                     autocorrelation, windowType);
+#endif // EXPERIMENTAL_USE_REALFFTF
+   }
+}
+
+// Copies into the pending columns of cache those that the tiles have,
+// and if columns isn't NULL, lists each tile column that is missing
+// once, with its 'computed' flag
+static void FillSpectrogramFromTiles(SpecCache *cache, SpecTileCache *tiles,
+                                     sampleCount numSamples,
+                                     SpecTileKey &key,
+                                     const float *gainfactor,
+                                     std::vector<SpectrogramJob::Column> *columns,
+                                     std::vector<bool *> *computed)
+{
+   int half = key.windowSize / 2;
+   int level = key.level;
+
+   for (sampleCount x = 0; x < cache->len; x++) {
+      if (!cache->pending[x])
+         continue;
+
+      float *dest = &cache->freq[half * x];
+      sampleCount where = cache->where[x];
+
+      if (where <= 0 || where >= numSamples) {
+         for (int i = 0; i < half; i++)
+            dest[i] = 0;
+      }
+      else {
+         // The nearest tile column
+         sampleCount k = (where + (((sampleCount)1 << level) >> 1)) >> level;
+         key.index = k / SpecTile::Columns;
+         int c = (int)(k % SpecTile::Columns);
+         SpecTile *tile = tiles->Get(key, half);
+         float *src = &tile->freq[half * c];
+
+         if (!tile->computed[c]) {
+            // Neighbouring pixels often share a column
+            if (columns && (columns->empty() || columns->back().freq != src)) {
+               SpectrogramJob::Column column;
+               column.center = k << level;
+               column.freq = src;
+               columns->push_back(column);
+               computed->push_back(&tile->computed[c]);
+            }
+            continue;
+         }
+
+         for (int i = 0; i < half; i++)
+            dest[i] = src[i];
+         if (gainfactor) {
+            // Apply a frequency-dependant gain factor
+            for (int i = 0; i < half; i++)
+               dest[i] += gainfactor[i];
+         }
+      }
+
+      cache->pending[x] = false;
+      cache->numPending--;
+   }
+}
+
 WaveClip::WaveClip(DirManager *projDirManager, sampleFormat format, int rate)
 {
    mOffset = 0;
@@ -304,6 +662,7 @@ WaveClip::WaveClip(DirManager *projDirManager, sampleFormat format, int rate)
    mWindow = NULL;
 #endif
    mSpecCache = new SpecCache(1, 1, false);
+   mSpecTiles = new SpecTileCache();
    mSpecPxCache = new SpecPxCache(1);
    mAppendBuffer = NULL;
    mAppendBufferLen = 0;
@@ -332,6 +691,7 @@ WaveClip::WaveClip(WaveClip& orig, DirManager *projDirManager)
    mWindow = NULL;
 #endif
    mSpecCache = new SpecCache(1, 1, false);
+   mSpecTiles = new SpecTileCache();
    mSpecPxCache = new SpecPxCache(1);
 
    for (WaveClipList::compatibility_iterator it=orig.mCutLines.GetFirst(); it; it=it->GetNext())
@@ -352,6 +712,7 @@ WaveClip::~WaveClip()
 
    delete mWaveCache;
    delete mSpecCache;
+   delete mSpecTiles;
    delete mSpecPxCache;
 #ifdef EXPERIMENTAL_USE_REALFFTF
    if(hFFT != NULL)
@@ -367,6 +728,12 @@ WaveClip::~WaveClip()
    mCutLines.Clear();
 }
 
+void WaveClip::Deinit()
+{
+   delete sSpectrogramPool;
+   sSpectrogramPool = NULL;
+}
+
 void WaveClip::SetOffset(double offset)
 {
     mOffset = offset;
@@ -723,7 +1090,7 @@ bool WaveClip::GetWaveDisplay(float *min, float *max, float *rms,int* bl,
 bool WaveClip::GetSpectrogram(float *freq, sampleCount *where,
                                int numPixels,
                                double t0, double pixelsPerSecond,
-                               bool autocorrelation)
+                               bool autocorrelation, bool &isPending)
 {
    int minFreq = gPrefs->Read(wxT("/Spectrum/MinFreq"), 0L);
    int maxFreq = gPrefs->Read(wxT("/Spectrum/MaxFreq"), 8000L);
@@ -734,7 +1101,6 @@ bool WaveClip::GetSpectrogram(float *freq, sampleCount *where,
    int windowSize = gPrefs->Read(wxT("/Spectrum/FFTSize"), 256);
 #ifdef EXPERIMENTAL_FFT_SKIP_POINTS
    int fftSkipPoints = gPrefs->Read(wxT("/Spectrum/FFTSkipPoints"), 0L);
-   int fftSkipPoints1 = fftSkipPoints+1;
 #endif //EXPERIMENTAL_FFT_SKIP_POINTS
    int half = windowSize/2;
    gPrefs->Read(wxT("/Spectrum/WindowType"), &windowType, 3);
@@ -767,7 +1133,8 @@ bool WaveClip::GetSpectrogram(float *freq, sampleCount *where,
    }
 #endif // EXPERIMENTAL_USE_REALFFTF
 
-   if (mSpecCache &&
+   bool cacheMatches =
+       mSpecCache &&
        mSpecCache->minFreqOld == minFreq &&
        mSpecCache->maxFreqOld == maxFreq &&
        mSpecCache->rangeOld == range &&
@@ -782,176 +1149,158 @@ bool WaveClip::GetSpectrogram(float *freq, sampleCount *where,
        mSpecCache->start == t0 &&
        mSpecCache->ac == autocorrelation &&
        mSpecCache->len >= numPixels &&
-       mSpecCache->pps == pixelsPerSecond) {
+       mSpecCache->pps == pixelsPerSecond;
+
+   if (cacheMatches && mSpecCache->numPending == 0) {
       memcpy(freq, mSpecCache->freq, numPixels*half*sizeof(float));
       memcpy(where, mSpecCache->where, (numPixels+1)*sizeof(sampleCount));
+      isPending = false;
       return false;  //hit cache completely
    }
 
-   SpecCache *oldCache = mSpecCache;
-
-   mSpecCache = new SpecCache(numPixels, half, autocorrelation);
-   mSpecCache->pps = pixelsPerSecond;
-   mSpecCache->start = t0;
-
    sampleCount x;
 
-   bool *recalc = new bool[mSpecCache->len + 1];
-
-   for (x = 0; x < mSpecCache->len + 1; x++) {
-      recalc[x] = true;
-      // purposely offset the display 1/2 bin to the left (as compared
-      // to waveform display to properly center response of the FFT
-      mSpecCache->where[x] =
-         (sampleCount)floor((t0*mRate) + (x*mRate/pixelsPerSecond) + 1.);
+   // Tiles are only good for the samples they were computed from
+   if (mSpecTiles->dirty != mDirty) {
+      mSpecTiles->Clear();
+      mSpecTiles->dirty = mDirty;
    }
 
-   // Optimization: if the old cache is good and overlaps
-   // with the current one, re-use as much of the cache as
-   // possible
-   if (oldCache->dirty == mDirty &&
-       oldCache->minFreqOld == minFreq &&
-       oldCache->maxFreqOld == maxFreq &&
-       oldCache->rangeOld == range &&
-       oldCache->gainOld == gain &&
-       oldCache->windowTypeOld == windowType &&
-       oldCache->windowSizeOld == windowSize &&
-       oldCache->frequencyGainOld == frequencygain &&
-#ifdef EXPERIMENTAL_FFT_SKIP_POINTS
-       oldCache->fftSkipPointsOld == fftSkipPoints &&
-#endif //EXPERIMENTAL_FFT_SKIP_POINTS
-       oldCache->pps == pixelsPerSecond &&
-       oldCache->ac == autocorrelation &&
-       oldCache->where[0] < mSpecCache->where[mSpecCache->len] &&
-       oldCache->where[oldCache->len] > mSpecCache->where[0]) {
+   if (!cacheMatches) {
+      delete mSpecCache;
 
-      for (x = 0; x < mSpecCache->len; x++)
-         if (mSpecCache->where[x] >= oldCache->where[0] &&
-             mSpecCache->where[x] <= oldCache->where[oldCache->len]) {
+      mSpecCache = new SpecCache(numPixels, half, autocorrelation);
+      mSpecCache->pps = pixelsPerSecond;
+      mSpecCache->start = t0;
 
-            int ox = (int) ((double (oldCache->len) *
-                      (mSpecCache->where[x] - oldCache->where[0]))
-                       / (oldCache->where[oldCache->len] -
-                                             oldCache->where[0]) + 0.5);
-            if (ox >= 0 && ox < oldCache->len &&
-                mSpecCache->where[x] == oldCache->where[ox]) {
-
-               for (sampleCount i = 0; i < (sampleCount)half; i++)
-                  mSpecCache->freq[half * x + i] =
-                     oldCache->freq[half * ox + i];
+      for (x = 0; x < mSpecCache->len + 1; x++) {
+         // purposely offset the display 1/2 bin to the left (as compared
+         // to waveform display to properly center response of the FFT
+         mSpecCache->where[x] =
+            (sampleCount)floor((t0*mRate) + (x*mRate/pixelsPerSecond) + 1.);
+      }
 
-               recalc[x] = false;
-            }
-         }
-   }
+      // Take the columns from the tiles spaced by the largest power of
+      // two samples not more than a pixel, so that a column is never
+      // more than half a pixel from where it is drawn, and tiles are
+      // shared by all zooms between one power of two and the next
+      double samplesPerPixel = mRate / pixelsPerSecond;
+      int level = 0;
+      while (level < 30 && ldexp(1.0, level + 1) <= samplesPerPixel)
+         level++;
+      mSpecCache->level = level;
+
+      // Columns still to be computed are drawn as silence meanwhile
+      for (x = 0; x < mSpecCache->len; x++) {
+         mSpecCache->pending[x] = true;
+         for (sampleCount i = 0; i < (sampleCount)half; i++)
+            mSpecCache->freq[half * x + i] = -160.0;
+      }
+      mSpecCache->numPending = mSpecCache->len;
 
 #ifdef EXPERIMENTAL_FFT_SKIP_POINTS
-   float *buffer = new float[windowSize*fftSkipPoints1];
-   mSpecCache->fftSkipPointsOld = fftSkipPoints;
-#else //!EXPERIMENTAL_FFT_SKIP_POINTS
-   float *buffer = new float[windowSize];
+      mSpecCache->fftSkipPointsOld = fftSkipPoints;
 #endif //EXPERIMENTAL_FFT_SKIP_POINTS
-   mSpecCache->minFreqOld = minFreq;
-   mSpecCache->maxFreqOld = maxFreq;
-   mSpecCache->gainOld = gain;
-   mSpecCache->rangeOld = range;
-   mSpecCache->windowTypeOld = windowType;
-   mSpecCache->windowSizeOld = windowSize;
-   mSpecCache->frequencyGainOld = frequencygain;
-
-   float *gainfactor = NULL;
-   if(frequencygain > 0) {
-      // Compute a frequency-dependant gain factor
-      // scaled such that 1000 Hz gets a gain of 0dB
-      double factor = 0.001*(double)mRate/(double)windowSize;
-      gainfactor = new float[half];
-      for(x = 0; x < half; x++) {
-         gainfactor[x] = frequencygain*log10(factor * x);
-      }
+      mSpecCache->minFreqOld = minFreq;
+      mSpecCache->maxFreqOld = maxFreq;
+      mSpecCache->gainOld = gain;
+      mSpecCache->rangeOld = range;
+      mSpecCache->windowTypeOld = windowType;
+      mSpecCache->windowSizeOld = windowSize;
+      mSpecCache->frequencyGainOld = frequencygain;
+      mSpecCache->dirty = mDirty;
    }
 
-   for (x = 0; x < mSpecCache->len; x++)
-      if (recalc[x]) {
-
-         sampleCount start = mSpecCache->where[x];
-         sampleCount len = windowSize;
-         sampleCount i;
-
-         if (start <= 0 || start >= mSequence->GetNumSamples()) {
-
-            for (i = 0; i < (sampleCount)half; i++)
-               mSpecCache->freq[half * x + i] = 0;
-
+   if (mSpecCache->numPending > 0) {
+      float *gainfactor = NULL;
+      if(frequencygain > 0) {
+         // Compute a frequency-dependant gain factor
+         // scaled such that 1000 Hz gets a gain of 0dB
+         double factor = 0.001*(double)mRate/(double)windowSize;
+         gainfactor = new float[half];
+         for(x = 0; x < half; x++) {
+            gainfactor[x] = frequencygain*log10(factor * x);
          }
-         else
-         {
-            float *adj = buffer;
-            start -= windowSize >> 1;
-
-            if (start < 0) {
-               for (i = start; i < 0; i++)
-                  *adj++ = 0;
-               len += start;
-               start = 0;
-            }
+      }
+
+      SpecTileKey key;
+      key.windowSize = windowSize;
+      key.windowType = windowType;
+      key.ac = autocorrelation;
 #ifdef EXPERIMENTAL_FFT_SKIP_POINTS
-            if (start + len*fftSkipPoints1 > mSequence->GetNumSamples()) {
-               int newlen = (mSequence->GetNumSamples() - start)/fftSkipPoints1;
-               for (i = newlen*fftSkipPoints1; i < (sampleCount)len*fftSkipPoints1; i++)
+      key.fftSkipPoints = fftSkipPoints;
 #else //!EXPERIMENTAL_FFT_SKIP_POINTS
-            if (start + len > mSequence->GetNumSamples()) {
-               int newlen = mSequence->GetNumSamples() - start;
-               for (i = newlen; i < (sampleCount)len; i++)
+      key.fftSkipPoints = 0;
 #endif //EXPERIMENTAL_FFT_SKIP_POINTS
-                  adj[i] = 0;
-               len = newlen;
-            }
-
-            if (len > 0)
+      key.level = mSpecCache->level;
+
+      unsigned long since = SpecTileCache::NextUse();
+
+      // Fill in the columns the tiles already have, and list the tile
+      // columns still to be computed
+      std::vector<SpectrogramJob::Column> columns;
+      std::vector<bool *> computed;
+      FillSpectrogramFromTiles(mSpecCache, mSpecTiles,
+                               mSequence->GetNumSamples(), key,
+                               gainfactor, &columns, &computed);
+
+      SpectrogramJob job;
+      job.sequence = mSequence;
+      job.rate = mRate;
+      job.windowType = windowType;
+      job.windowSize = windowSize;
+      job.half = half;
+      job.autocorrelation = autocorrelation;
 #ifdef EXPERIMENTAL_FFT_SKIP_POINTS
-               mSequence->Get((samplePtr)adj, floatSample, start, len*fftSkipPoints1);
-            if (fftSkipPoints) {
-               // TODO: (maybe) alternatively change Get to include skipping of points
-               int j=0;
-               for (int i=0; i < len; i++) {
-                  adj[i]=adj[j];
-                  j+=fftSkipPoints1;
-               }
-            }
-#else //!EXPERIMENTAL_FFT_SKIP_POINTS
-               mSequence->Get((samplePtr)adj, floatSample, start, len);
+      job.fftSkipPoints = fftSkipPoints;
 #endif //EXPERIMENTAL_FFT_SKIP_POINTS
-
 #ifdef EXPERIMENTAL_USE_REALFFTF
-            if(autocorrelation) {
-               ComputeSpectrum(buffer, windowSize, windowSize,
-                               mRate, &mSpecCache->freq[half * x],
-                               autocorrelation, windowType);
-            } else {
-               ComputeSpectrumUsingRealFFTf(buffer, hFFT, mWindow, mWindowSize, &mSpecCache->freq[half * x]);
-            }
-#else  // EXPERIMENTAL_USE_REALFFTF
-           ComputeSpectrum(buffer, windowSize, windowSize,
-                           mRate, &mSpecCache->freq[half * x],
-                           autocorrelation, windowType);
-#endif // EXPERIMENTAL_USE_REALFFTF
-           if(gainfactor) {
-              // Apply a frequency-dependant gain factor
-              for(i=0; i<half; i++)
-                 mSpecCache->freq[half * x + i] += gainfactor[i];
-           }
-         }
+      job.hFFT = hFFT;
+      job.window = mWindow;
+#endif
+
+      // Compute the columns in rounds that keep every thread busy, and
+      // stop once this paint has had its share of time; the track panel
+      // paints again for the rest, so a long track doesn't freeze it
+      WorkerPool *pool = GetSpectrogramPool();
+      int roundLen =
+         (pool->GetNumThreads() + 1) * 4 * SpectrogramJob::ColumnsPerItem;
+      long maxMillis = gPrefs->Read(wxT("/Spectrum/MaxComputeMillis"), 50L);
+      wxStopWatch timer;
+
+      size_t done = 0;
+      while (done < columns.size()) {
+         int n = (int)std::min(columns.size() - done, (size_t)roundLen);
+
+         job.columns = &columns[done];
+         job.numColumns = n;
+         pool->Run(&job, (n + SpectrogramJob::ColumnsPerItem - 1) /
+                         SpectrogramJob::ColumnsPerItem);
+
+         for (int c = 0; c < n; c++)
+            *computed[done + c] = true;
+         done += n;
+
+         if (maxMillis > 0 && timer.Time() >= maxMillis)
+            break;
       }
 
-   if(gainfactor)
-      delete[] gainfactor;
-   delete[]buffer;
-   delete[]recalc;
-   delete oldCache;
+      if (done > 0)
+         FillSpectrogramFromTiles(mSpecCache, mSpecTiles,
+                                  mSequence->GetNumSamples(), key,
+                                  gainfactor, NULL, NULL);
+
+      if(gainfactor)
+         delete[] gainfactor;
+
+      wxLongLong_t maxBytes =
+         (wxLongLong_t)gPrefs->Read(wxT("/Spectrum/TileCacheMB"), 64L) << 20;
+      SpecTileCache::Trim(maxBytes, since);
+   }
 
-   mSpecCache->dirty = mDirty;
    memcpy(freq, mSpecCache->freq, numPixels*half*sizeof(float));
    memcpy(where, mSpecCache->where, (numPixels+1)*sizeof(sampleCount));
+   isPending = (mSpecCache->numPending > 0);
    return true;
 }
 
@@ -1072,6 +1421,7 @@ bool WaveClip::Append(samplePtr buffer, sampleFormat format,
                   mAppendBuffer + mAppendBufferLen * SAMPLE_SIZE(seqFormat),
                   seqFormat,
                   toCopy,
+                  mAppendDither,
                   true, // high quality
                   stride);
 
@@ -1612,6 +1962,7 @@ bool WaveClip::Resample(int rate, ProgressDialog *progress)
       if (mSpecCache)
          delete mSpecCache;
       mSpecCache = new SpecCache(1, 1, false);
+      mSpecTiles->Clear();
    }
 
    return !error;
@@ -13,6 +13,7 @@
 #define __AUDACITY_WAVECLIP__
 
 #include "Audacity.h"
+#include "Dither.h"
 #include "SampleFormat.h"
 #include "Sequence.h"
 #include "widgets/ProgressDialog.h"
@@ -32,6 +33,7 @@
 class Envelope;
 class WaveCache;
 class SpecCache;
+class SpecTileCache;
 
 class SpecPxCache {
 public:
@@ -87,6 +89,9 @@ public:
 
    virtual ~WaveClip();
 
+   /// Stops the threads that compute spectrograms; call at exit
+   static void Deinit();
+
    void ConvertToSampleFormat(sampleFormat format);
 
    void TimeToSamplesClip(double t0, sampleCount *s0) const;
@@ -140,10 +145,13 @@ public:
     * calculations and Contrast */
    bool GetWaveDisplay(float *min, float *max, float *rms,int* bl, sampleCount *where,
                        int numPixels, double t0, double pixelsPerSecond, bool &isLoadingOD);
+   /** Spends a bounded time computing the columns, so a long clip may
+    * come back with some of them still silent; isPending is then set,
+    * and the caller should paint again later to get the rest. */
    bool GetSpectrogram(float *buffer, sampleCount *where,
                        int numPixels,
                        double t0, double pixelsPerSecond,
-                       bool autocorrelation);
+                       bool autocorrelation, bool &isPending);
    bool GetMinMax(float *min, float *max, double t0, double t1);
    bool GetRMS(float *rms, double t0, double t1);
 
@@ -248,6 +256,7 @@ protected:
    WaveCache    *mWaveCache;
    ODLock       mWaveCacheMutex;
    SpecCache    *mSpecCache;
+   SpecTileCache *mSpecTiles;
 #ifdef EXPERIMENTAL_USE_REALFFTF
    // Variables used for computing the spectrum
    HFFT          hFFT;
@@ -257,6 +266,7 @@ protected:
 #endif
    samplePtr     mAppendBuffer;
    sampleCount   mAppendBufferLen;
+   Dither        mAppendDither;   // clips are appended to on several threads
 
    // Cut Lines are nothing more than ordinary wave clips, with the
    // offset relative to the start of the clip.
@@ -30,6 +30,7 @@ Track classes.
 #include <wx/defs.h>
 #include <wx/intl.h>
 #include <wx/debug.h>
+#include <wx/thread.h>
 
 #include <float.h>
 #include <math.h>
@@ -42,6 +43,7 @@ Track classes.
 
 #include "Envelope.h"
 #include "Sequence.h"
+#include "MixKernels.h"
 #include "Spectrum.h"
 
 #include "Project.h"
@@ -83,7 +85,11 @@ WaveTrack::WaveTrack(DirManager *projDirManager, sampleFormat format, double rat
       rate = GetActiveProject()->GetRate();
    }
 
-   gPrefs->Read(wxT("/GUI/DefaultViewMode"), &mDisplay, 0);
+   // Importer::ImportBatch() makes tracks on worker threads, which must
+   // not read gPrefs, and sets their view itself
+   mDisplay = WaveformDisplay;
+   if (wxThread::IsMain())
+      gPrefs->Read(wxT("/GUI/DefaultViewMode"), &mDisplay, 0);
 
    mLegacyProjectFileOffset = 0;
 
@@ -1909,6 +1915,78 @@ void WaveTrack::GetEnvelopeValues(double *buffer, int bufferLen,
    }
 }
 
+void WaveTrack::ApplyEnvelope(float *buffer, int bufferLen,
+                              double t0, double tstep)
+{
+   // Samples outside every clip are left as they are, which is the same as
+   // scaling them by the 1.0 that GetEnvelopeValues() gives them.  Within
+   // a clip the envelope is walked with a cursor and applied a segment at
+   // a time, without filling a buffer of values first.
+   double startTime = t0;
+   double endTime = t0+tstep*bufferLen;
+   for (WaveClipList::compatibility_iterator it=GetClipIterator(); it; it=it->GetNext())
+   {
+      WaveClip *clip = it->GetData();
+
+      // IF clip intersects startTime..endTime THEN...
+      double dClipStartTime = clip->GetStartTime();
+      double dClipEndTime = clip->GetEndTime();
+      if ((dClipStartTime < endTime) && (dClipEndTime > startTime))
+      {
+         float* rbuf = buffer;
+         int rlen = bufferLen;
+         double rt0 = t0;
+
+         if (rt0 < dClipStartTime)
+         {
+            sampleCount nDiff = (sampleCount)floor((dClipStartTime - rt0) * mRate + 0.5);
+            rbuf += nDiff;
+            rlen -= nDiff;
+            rt0 = dClipStartTime;
+         }
+
+         if (rt0 + rlen*tstep > dClipEndTime)
+         {
+            int nClipLen = clip->GetEndSample() - clip->GetStartSample();
+
+            // See GetEnvelopeValues() for these two checks
+            if (nClipLen <= 0)
+               return;
+            if (nClipLen < rlen)
+               rlen = nClipLen;
+         }
+
+         EnvelopeCursor cursor(clip->GetEnvelope(), rt0, tstep);
+         while (rlen > 0)
+         {
+            EnvelopeSegment seg = cursor.Next(rlen);
+            switch (seg.shape)
+            {
+            case EnvelopeSegment::Constant:
+               if (seg.value != 1.0f)
+                  MixApplyRamp(rbuf, seg.value, 0.0f, seg.len);
+               break;
+            case EnvelopeSegment::Linear:
+               MixApplyRamp(rbuf, seg.value, seg.step, seg.len);
+               break;
+            case EnvelopeSegment::Exponential:
+               {
+                  float v = seg.value;
+                  for (int i = 0; i < seg.len; i++)
+                  {
+                     rbuf[i] *= v;
+                     v *= seg.step;
+                  }
+               }
+               break;
+            }
+            rbuf += seg.len;
+            rlen -= seg.len;
+         }
+      }
+   }
+}
+
 WaveClip* WaveTrack::GetClipAtX(int xcoord)
 {
    for (WaveClipList::compatibility_iterator it=GetClipIterator(); it; it=it->GetNext())
@@ -236,6 +236,10 @@ class AUDACITY_DLL_API WaveTrack: public Track {
                    sampleCount start, sampleCount len);
    void GetEnvelopeValues(double *buffer, int bufferLen,
                          double t0, double tstep);
+   /// Multiplies buffer by the envelope values GetEnvelopeValues() would
+   /// give for the same times
+   void ApplyEnvelope(float *buffer, int bufferLen,
+                      double t0, double tstep);
    bool GetMinMax(float *min, float *max,
                   double t0, double t1);
    bool GetRMS(float *rms, double t0, double t1);
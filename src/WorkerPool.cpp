@@ -0,0 +1,176 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  WorkerPool.cpp
+
+*******************************************************************//**
+
+\class WorkerPool
+\brief A fixed set of threads that share out the items of a job.
+
+Items are handed out under the pool's mutex, one at a time, so the
+pool suits items that take much longer than a lock and unlock: mixing
+a track, rendering a column range, checking a directory.
+
+*//****************************************************************//**
+
+\class WorkerPoolJob
+\brief A batch of independent items of work for a WorkerPool.
+
+*//*******************************************************************/
+
+#include "Audacity.h"
+
+#include "WorkerPool.h"
+
+class WorkerPoolThread : public wxThread {
+ public:
+   WorkerPoolThread(WorkerPool *pool)
+      : wxThread(wxTHREAD_JOINABLE), mPool(pool) {}
+
+   virtual ExitCode Entry()
+   {
+      mPool->ThreadLoop();
+      return 0;
+   }
+
+ private:
+   WorkerPool *mPool;
+};
+
+WorkerPool::WorkerPool(int numThreads)
+:  mStart(mMutex),
+   mDone(mMutex),
+   mJob(NULL),
+   mNumItems(0),
+   mNextItem(0),
+   mItemsDone(0),
+   mGeneration(0),
+   mExit(false)
+{
+   for (int i = 0; i < numThreads; i++) {
+      WorkerPoolThread *thread = new WorkerPoolThread(this);
+      if (thread->Create() != wxTHREAD_NO_ERROR) {
+         delete thread;
+         break;
+      }
+      thread->Run();
+      mThreads.push_back(thread);
+   }
+}
+
+WorkerPool::~WorkerPool()
+{
+   {
+      wxMutexLocker locker(mMutex);
+      mExit = true;
+      mStart.Broadcast();
+   }
+
+   for (size_t i = 0; i < mThreads.size(); i++) {
+      mThreads[i]->Wait();
+      delete mThreads[i];
+   }
+}
+
+int WorkerPool::GetDefaultNumThreads()
+{
+   int cpus = wxThread::GetCPUCount();
+   return (cpus > 1) ? cpus - 1 : 0;
+}
+
+void WorkerPool::Run(WorkerPoolJob *job, int numItems)
+{
+   if (numItems <= 0)
+      return;
+
+   // Not worth waking anybody
+   if (mThreads.empty() || numItems == 1) {
+      for (int i = 0; i < numItems; i++)
+         job->RunItem(i);
+      return;
+   }
+
+   wxMutexLocker runLocker(mRunMutex);
+   wxMutexLocker locker(mMutex);
+
+   mJob = job;
+   mNumItems = numItems;
+   mNextItem = 0;
+   mItemsDone = 0;
+   mGeneration++;
+   mStart.Broadcast();
+
+   RunItems();
+
+   while (mItemsDone < mNumItems)
+      mDone.Wait();
+
+   mJob = NULL;
+}
+
+void WorkerPool::Post(WorkerPoolJob *job, int numItems)
+{
+   mRunMutex.Lock();
+
+   if (mThreads.empty()) {
+      for (int i = 0; i < numItems; i++)
+         job->RunItem(i);
+      return;
+   }
+
+   wxMutexLocker locker(mMutex);
+
+   mJob = job;
+   mNumItems = numItems;
+   mNextItem = 0;
+   mItemsDone = 0;
+   mGeneration++;
+   mStart.Broadcast();
+}
+
+void WorkerPool::Wait()
+{
+   {
+      wxMutexLocker locker(mMutex);
+
+      while (mItemsDone < mNumItems)
+         mDone.Wait();
+
+      mJob = NULL;
+   }
+
+   mRunMutex.Unlock();
+}
+
+void WorkerPool::ThreadLoop()
+{
+   wxMutexLocker locker(mMutex);
+
+   unsigned int seen = mGeneration;
+   for (;;) {
+      while (!mExit && mGeneration == seen)
+         mStart.Wait();
+      if (mExit)
+         return;
+
+      seen = mGeneration;
+      RunItems();
+   }
+}
+
+// Must be called with mMutex held; releases it around each item
+void WorkerPool::RunItems()
+{
+   while (mNextItem < mNumItems) {
+      int item = mNextItem++;
+
+      mMutex.Unlock();
+      mJob->RunItem(item);
+      mMutex.Lock();
+
+      if (++mItemsDone == mNumItems)
+         mDone.Broadcast();
+   }
+}
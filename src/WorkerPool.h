@@ -0,0 +1,84 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  WorkerPool.h
+
+**********************************************************************/
+
+#ifndef __AUDACITY_WORKER_POOL__
+#define __AUDACITY_WORKER_POOL__
+
+#include <vector>
+
+#include <wx/thread.h>
+
+class WorkerPoolThread;
+
+/// A batch of independent items of work for a WorkerPool.
+class WorkerPoolJob {
+ public:
+   virtual ~WorkerPoolJob() {}
+
+   /// Does item number 'item' of the batch.  Called exactly once per
+   /// item, from any of the pool's threads, possibly concurrently with
+   /// other items.
+   virtual void RunItem(int item) = 0;
+};
+
+/// \brief A fixed set of threads that share out the items of a job.
+///
+/// Run() hands the items out one at a time to the pool's threads and to
+/// the calling thread, and returns only when all of them are finished.
+/// The threads are started once and sleep between jobs, so the pool is
+/// cheap enough to use for work that repeats many times a second.
+class WorkerPool {
+ public:
+   /// Starts numThreads threads in addition to the caller of Run().
+   /// With 0 threads, Run() does all the items itself.
+   WorkerPool(int numThreads);
+   ~WorkerPool();
+
+   int GetNumThreads() const { return (int)mThreads.size(); }
+
+   /// Runs items 0 .. numItems-1 of job and waits for them to finish.
+   /// Several threads may share a pool; their calls take turns.
+   void Run(WorkerPoolJob *job, int numItems);
+
+   /// Like Run(), but leaves every item to the pool's threads and returns
+   /// at once, so the caller can get on with something else.  Wait() must
+   /// be called before the pool is used again.  With no threads, the items
+   /// are all done before Post() returns.
+   void Post(WorkerPoolJob *job, int numItems);
+
+   /// Waits for the items of the job given to Post() to finish
+   void Wait();
+
+   /// A thread count for a pool that should keep every processor busy
+   /// while the caller of Run() works too
+   static int GetDefaultNumThreads();
+
+ private:
+   friend class WorkerPoolThread;
+
+   void ThreadLoop();
+   void RunItems();
+
+   wxMutex mRunMutex;    // held through each Run() that wakes the threads,
+                         // and from Post() to Wait()
+   wxMutex mMutex;
+   wxCondition mStart;   // a job was posted, or the pool is shutting down
+   wxCondition mDone;    // the last item of the job finished
+
+   std::vector<WorkerPoolThread *> mThreads;
+
+   // Guarded by mMutex
+   WorkerPoolJob *mJob;
+   int mNumItems;
+   int mNextItem;
+   int mItemsDone;
+   unsigned int mGeneration;
+   bool mExit;
+};
+
+#endif
@@ -31,7 +31,7 @@ The summary is eventually computed and written to a file in a background thread.
 #include "../FileFormats.h"
 #include "../Internat.h"
 
-#include "../ondemand/ODManager.h"
+#include "../ondemand/ODSndFileLock.h"
 #include "../AudioIO.h"
 
 //#include <errno.h>
@@ -443,8 +443,9 @@ void ODPCMAliasBlockFile::WriteSummary()
 
 
 
-/// A thread-safe version of CalcSummary.  BlockFile::CalcSummary
-/// uses a static summary array across the class, which we can't use.
+/// A version of CalcSummary that skips the float copy of float samples.
+/// Like BlockFile::CalcSummary it allocates the buffer per call, so it
+/// is thread-safe.
 /// Get a buffer containing a summary block describing this sample
 /// data.  This must be called by derived classes when they
 /// are constructed, to allow them to construct their summary data,
@@ -453,9 +454,7 @@ void ODPCMAliasBlockFile::WriteSummary()
 /// This method also has the side effect of setting the mMin, mMax,
 /// and mRMS members of this class.
 ///
-/// Unlike BlockFile's implementation You SHOULD delete the returned buffer.
-/// this is protected so it shouldn't be hard to deal with - just override
-/// all BlockFile methods that use this method.
+/// You SHOULD delete the returned buffer.
 ///
 /// @param buffer A buffer containing the sample data to be analyzed
 /// @param len    The length of the sample data
@@ -610,10 +609,6 @@ int ODPCMAliasBlockFile::ReadData(samplePtr data, sampleFormat format,
    memset(&info, 0, sizeof(info));
 
    wxString aliasPath = mAliasedFileName.GetFullPath();
-   //there are thread-unsafe crashes here - not sure why.  sf_open may be called on the same file
-   //from different threads, but this seems okay, unless it is implemented strangely..
-   static ODLock sfMutex;
-
    wxFile f;   // will be closed when it goes out of scope
    SNDFILE *sf = NULL;
 
@@ -621,9 +616,9 @@ int ODPCMAliasBlockFile::ReadData(samplePtr data, sampleFormat format,
       // Even though there is an sf_open() that takes a filename, use the one that
       // takes a file descriptor since wxWidgets can open a file with a Unicode name and
       // libsndfile can't (under Windows).
-      ODManager::LockLibSndFileMutex();
+      ODSndFileLock::LockShared();
       sf = sf_open_fd(f.fd(), SFM_READ, &info, FALSE);
-      ODManager::UnlockLibSndFileMutex();
+      ODSndFileLock::UnlockShared();
    }
 
    if (!sf){
@@ -641,9 +636,11 @@ int ODPCMAliasBlockFile::ReadData(samplePtr data, sampleFormat format,
 
    mSilentAliasLog=FALSE;
 
-   ODManager::LockLibSndFileMutex();
+   // The handle is ours alone; the stripe only keeps us from reading
+   // the file while another thread writes it.
+   ODSndFileStripeLocker stripeLocker(aliasPath);
+
    sf_seek(sf, mAliasStart + start, SEEK_SET);
-   ODManager::UnlockLibSndFileMutex();
 
    samplePtr buffer = NewSamples(len * info.channels, floatSample);
 
@@ -655,9 +652,7 @@ int ODPCMAliasBlockFile::ReadData(samplePtr data, sampleFormat format,
       // and the calling method wants 16-bit data, go ahead and
       // read 16-bit data directly.  This is a pretty common
       // case, as most audio files are 16-bit.
-      ODManager::LockLibSndFileMutex();
       framesRead = sf_readf_short(sf, (short *)buffer, len);
-      ODManager::UnlockLibSndFileMutex();
 
       for (int i = 0; i < framesRead; i++)
          ((short *)data)[i] =
@@ -667,9 +662,7 @@ int ODPCMAliasBlockFile::ReadData(samplePtr data, sampleFormat format,
       // Otherwise, let libsndfile handle the conversion and
       // scaling, and pass us normalized data as floats.  We can
       // then convert to whatever format we want.
-      ODManager::LockLibSndFileMutex();
       framesRead = sf_readf_float(sf, (float *)buffer, len);
-      ODManager::UnlockLibSndFileMutex();
       float *bufferPtr = &((float *)buffer)[mAliasChannel];
       CopySamples((samplePtr)bufferPtr, floatSample,
                   (samplePtr)data, format,
@@ -678,9 +671,7 @@ int ODPCMAliasBlockFile::ReadData(samplePtr data, sampleFormat format,
 
    DeleteSamples(buffer);
 
-   ODManager::LockLibSndFileMutex();
    sf_close(sf);
-   ODManager::UnlockLibSndFileMutex();
 
    UnlockRead();
    return framesRead;
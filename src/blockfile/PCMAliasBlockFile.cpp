@@ -19,7 +19,7 @@
 #include "../FileFormats.h"
 #include "../Internat.h"
 
-#include "../ondemand/ODManager.h"
+#include "../ondemand/ODSndFileLock.h"
 #include "../AudioIO.h"
 
 extern AudioIO *gAudioIO;
@@ -93,9 +93,9 @@ int PCMAliasBlockFile::ReadData(samplePtr data, sampleFormat format,
          // Even though there is an sf_open() that takes a filename, use the one that
          // takes a file descriptor since wxWidgets can open a file with a Unicode name and
          // libsndfile can't (under Windows).
-         ODManager::LockLibSndFileMutex();
+         ODSndFileLock::LockShared();
          sf = sf_open_fd(f.fd(), SFM_READ, &info, FALSE);
-         ODManager::UnlockLibSndFileMutex();
+         ODSndFileLock::UnlockShared();
       }
    }
 
@@ -113,9 +113,11 @@ int PCMAliasBlockFile::ReadData(samplePtr data, sampleFormat format,
    if(silence) delete silence;
    mSilentAliasLog=FALSE;
 
-   ODManager::LockLibSndFileMutex();
+   // The handle is ours alone; the stripe only keeps us from reading
+   // the file while another thread writes it.
+   ODSndFileStripeLocker stripeLocker(mAliasedFileName.GetFullPath());
+
    sf_seek(sf, mAliasStart + start, SEEK_SET);
-   ODManager::UnlockLibSndFileMutex();
    samplePtr buffer = NewSamples(len * info.channels, floatSample);
 
    int framesRead = 0;
@@ -126,9 +128,7 @@ int PCMAliasBlockFile::ReadData(samplePtr data, sampleFormat format,
       // and the calling method wants 16-bit data, go ahead and
       // read 16-bit data directly.  This is a pretty common
       // case, as most audio files are 16-bit.
-      ODManager::LockLibSndFileMutex();
       framesRead = sf_readf_short(sf, (short *)buffer, len);
-      ODManager::UnlockLibSndFileMutex();
       for (int i = 0; i < framesRead; i++)
          ((short *)data)[i] =
             ((short *)buffer)[(info.channels * i) + mAliasChannel];
@@ -137,9 +137,7 @@ int PCMAliasBlockFile::ReadData(samplePtr data, sampleFormat format,
       // Otherwise, let libsndfile handle the conversion and
       // scaling, and pass us normalized data as floats.  We can
       // then convert to whatever format we want.
-      ODManager::LockLibSndFileMutex();
       framesRead = sf_readf_float(sf, (float *)buffer, len);
-      ODManager::UnlockLibSndFileMutex();
       float *bufferPtr = &((float *)buffer)[mAliasChannel];
       CopySamples((samplePtr)bufferPtr, floatSample,
                   (samplePtr)data, format,
@@ -147,9 +145,7 @@ int PCMAliasBlockFile::ReadData(samplePtr data, sampleFormat format,
    }
 
    DeleteSamples(buffer);
-   ODManager::LockLibSndFileMutex();
    sf_close(sf);
-   ODManager::UnlockLibSndFileMutex();
    return framesRead;
 }
 
@@ -19,7 +19,14 @@
 libsndfile
 
 A block file that writes the audio data to an .au file and reads
-it back using libsndfile.
+it back using libsndfile.  Once DirManager exists, reads go through its
+BlockFileHandlePool instead, which keeps files open (and, within a
+budget, memory-mapped) and only falls back to libsndfile for files it
+can't use.
+
+A packed block file has no file of its own.  The same .au image is
+appended to a segment of the DirManager's BlockSegmentStore, and read
+back from there.
 
 There are two ways to construct a simple block file.  One is to
 supply data and have the constructor write the file.  The other
@@ -66,6 +73,8 @@ to get its definition, rather than rolling our own.
 #include "../Prefs.h"
 
 #include "SimpleBlockFile.h"
+#include "../BlockFileHandlePool.h"
+#include "../BlockSegmentStore.h"
 #include "../FileFormats.h"
 
 #include "sndfile.h"
@@ -94,14 +103,23 @@ static wxUint32 SwapUintEndianess(wxUint32 in)
 /// @param sampleLen    The number of samples to be written to this block.
 /// @param format       The format of the given samples.
 /// @param allowDeferredWrite    Allow deferred write-caching
+/// @param store        If given, the block is packed into one of the
+///                     store's segments, and baseFileName is only its name.
 SimpleBlockFile::SimpleBlockFile(wxFileName baseFileName,
                                  samplePtr sampleData, sampleCount sampleLen,
                                  sampleFormat format,
                                  bool allowDeferredWrite /* = false */,
-                                 bool bypassCache /* = false */):
+                                 bool bypassCache /* = false */,
+                                 BlockSegmentStore *store /* = NULL */):
    BlockFile(wxFileName(baseFileName.GetFullPath() + wxT(".au")), sampleLen)
 {
    mCache.active = false;
+   mSpaceUsage = -1;
+
+   mStore = store;
+   mEntry = NULL;
+   if (mStore)
+      mStore->Ref();
 
    bool useCache = GetCache() && (!bypassCache);
 
@@ -119,11 +137,8 @@ SimpleBlockFile::SimpleBlockFile(wxFileName baseFileName,
       mCache.sampleData = new char[sampleLen * SAMPLE_SIZE(format)];
       memcpy(mCache.sampleData,
              sampleData, sampleLen * SAMPLE_SIZE(format));
-      void* summaryData = BlockFile::CalcSummary(sampleData, sampleLen,
-                                                format);
-      mCache.summaryData = new char[mSummaryInfo.totalSummaryBytes];
-      memcpy(mCache.summaryData, summaryData,
-             (size_t)mSummaryInfo.totalSummaryBytes);
+      mCache.summaryData = BlockFile::CalcSummary(sampleData, sampleLen,
+                                                  format);
     }
 }
 
@@ -140,15 +155,55 @@ SimpleBlockFile::SimpleBlockFile(wxFileName existingFile, sampleCount len,
    mRMS = rms;
 
    mCache.active = false;
+   mSpaceUsage = -1;
+
+   mStore = NULL;
+   mEntry = NULL;
+}
+
+/// Construct a packed SimpleBlockFile memory structure for an image
+/// already in a segment of the store.
+///
+/// @param entry The place of the image, whose use by the caller this
+///              block takes over, or NULL if the image is missing.
+SimpleBlockFile::SimpleBlockFile(BlockSegmentStore *store,
+                                 BlockSegmentEntry *entry,
+                                 wxFileName name, sampleCount len,
+                                 float min, float max, float rms):
+   BlockFile(name, len)
+{
+   mMin = min;
+   mMax = max;
+   mRMS = rms;
+
+   mCache.active = false;
+   mSpaceUsage = -1;
+
+   mStore = store;
+   mEntry = entry;
+   mStore->Ref();
 }
 
 SimpleBlockFile::~SimpleBlockFile()
 {
+   // ~BlockFile() may remove the file, so don't leave it open
+   InvalidateReadHandle();
+
    if (mCache.active)
    {
       delete[] mCache.sampleData;
       delete[] (char *)mCache.summaryData;
    }
+
+   if (mStore)
+   {
+      if (mEntry)
+         mStore->Release(mEntry);
+      mStore->Deref();
+
+      // The name isn't a file, so don't let ~BlockFile() remove it
+      mFileName.Clear();
+   }
 }
 
 bool SimpleBlockFile::WriteSimpleBlockFile(
@@ -157,11 +212,7 @@ bool SimpleBlockFile::WriteSimpleBlockFile(
     sampleFormat format,
     void* summaryData)
 {
-   wxFFile file(mFileName.GetFullPath(), wxT("wb"));
-   if( !file.IsOpened() ){
-      // Can't do anything else.
-      return false;
-   }
+   InvalidateReadHandle();
 
    auHeader header;
 
@@ -199,9 +250,35 @@ bool SimpleBlockFile::WriteSimpleBlockFile(
    // BlockFiles are always mono
    header.channels = 1;
 
-   // Write the file
+   // Write the file.  A summary computed here is ours to free; none is
+   // shared between blocks, which may be written on several threads.
+   void *ownSummary = NULL;
    if (!summaryData)
-      summaryData = /*BlockFile::*/CalcSummary(sampleData, sampleLen, format); //mchinen:allowing virtual override of calc summary for ODDecodeBlockFile.
+      summaryData = ownSummary = /*BlockFile::*/CalcSummary(sampleData, sampleLen, format); //mchinen:allowing virtual override of calc summary for ODDecodeBlockFile.
+
+   bool ok;
+   if (mStore)
+      ok = WritePackedImage(header, summaryData, sampleData, sampleLen,
+                            format);
+   else
+      ok = WriteAuFile(header, summaryData, sampleData, sampleLen, format);
+
+   delete [] (char *) ownSummary;
+   return ok;
+}
+
+/// Write the block to its own .au file, the summary after the header.
+bool SimpleBlockFile::WriteAuFile(const auHeader &header,
+                                  void *summaryData,
+                                  samplePtr sampleData,
+                                  sampleCount sampleLen,
+                                  sampleFormat format)
+{
+   wxFFile file(mFileName.GetFullPath(), wxT("wb"));
+   if( !file.IsOpened() ){
+      // Can't do anything else.
+      return false;
+   }
 
    size_t nBytesToWrite = sizeof(header);
    size_t nBytesWritten = file.Write(&header, nBytesToWrite);
@@ -223,23 +300,17 @@ bool SimpleBlockFile::WriteSimpleBlockFile(
    {
       // we can't write the buffer directly to disk, because 24-bit samples
       // on disk need to be packed, not padded to 32 bits like they are in
-      // memory
-      int *int24sampleData = (int*)sampleData;
-
-      for( int i = 0; i < sampleLen; i++ )
+      // memory; pack them all first and write them in one go
+      nBytesToWrite = sampleLen * 3;
+      unsigned char *packed = new unsigned char[nBytesToWrite];
+      PackInt24((int *)sampleData, packed, sampleLen,
+                wxBYTE_ORDER == wxBIG_ENDIAN);
+      nBytesWritten = file.Write(packed, nBytesToWrite);
+      delete[] packed;
+      if (nBytesWritten != nBytesToWrite)
       {
-         nBytesToWrite = 3;
-         nBytesWritten =
-            #if wxBYTE_ORDER == wxBIG_ENDIAN
-               file.Write((char*)&int24sampleData[i] + 1, nBytesToWrite);
-            #else
-               file.Write((char*)&int24sampleData[i], nBytesToWrite);
-            #endif
-         if (nBytesWritten != nBytesToWrite)
-         {
-            wxLogDebug(wxT("Wrote %lld bytes, expected %lld."), (long long) nBytesWritten, (long long) nBytesToWrite);
-            return false;
-         }
+         wxLogDebug(wxT("Wrote %lld bytes, expected %lld."), (long long) nBytesWritten, (long long) nBytesToWrite);
+         return false;
       }
    }
    else
@@ -255,52 +326,107 @@ bool SimpleBlockFile::WriteSimpleBlockFile(
       }
    }
 
+   mSpaceUsage = (wxLongLong_t)(sizeof(header) +
+                                mSummaryInfo.totalSummaryBytes +
+                                nBytesToWrite);
+
     return true;
 }
 
+/// Append the image an .au file would hold to the block's segment store.
+bool SimpleBlockFile::WritePackedImage(const auHeader &header,
+                                       void *summaryData,
+                                       samplePtr sampleData,
+                                       sampleCount sampleLen,
+                                       sampleFormat format)
+{
+   size_t summaryBytes = (size_t)mSummaryInfo.totalSummaryBytes;
+   size_t sampleBytes = (size_t)sampleLen * SAMPLE_SIZE_DISK(format);
+   size_t bytes = sizeof(header) + summaryBytes + sampleBytes;
+
+   char *image = new char[bytes];
+   memcpy(image, &header, sizeof(header));
+   memcpy(image + sizeof(header), summaryData, summaryBytes);
+
+   unsigned char *samples =
+      (unsigned char *)image + sizeof(header) + summaryBytes;
+   if (format == int24Sample)
+      PackInt24((int *)sampleData, samples, sampleLen,
+                wxBYTE_ORDER == wxBIG_ENDIAN);
+   else
+      memcpy(samples, sampleData, sampleBytes);
+
+   BlockSegmentEntry *entry = mStore->Append(image, bytes);
+   delete[] image;
+
+   if (!entry)
+      return false;
+
+   if (mEntry)
+      mStore->Release(mEntry);
+   mEntry = entry;
+   mSpaceUsage = mStore->GetSpaceUsage(mEntry);
+
+   return true;
+}
+
 void SimpleBlockFile::FillCache()
 {
    if (mCache.active)
       return; // cache is already filled
 
-   // Check sample format
-   wxFFile file(mFileName.GetFullPath(), wxT("rb"));
-   if (!file.IsOpened())
+   if (mStore)
    {
-      // Don't read into cache if file not available
-      return;
+      SimpleBlockFileImage image;
+      if (!AcquireImage(image))
+      {
+         // Don't read into cache if the image is not available
+         return;
+      }
+      mCache.format = image.format;
+      ReleaseImage(image);
    }
+   else
+   {
+      // Check sample format
+      wxFFile file(mFileName.GetFullPath(), wxT("rb"));
+      if (!file.IsOpened())
+      {
+         // Don't read into cache if file not available
+         return;
+      }
 
-   auHeader header;
+      auHeader header;
 
-   if (file.Read(&header, sizeof(header)) != sizeof(header))
-   {
-      // Corrupt file
-      return;
-   }
+      if (file.Read(&header, sizeof(header)) != sizeof(header))
+      {
+         // Corrupt file
+         return;
+      }
 
-   wxUint32 encoding;
+      wxUint32 encoding;
 
-   if (header.magic == 0x2e736e64)
-      encoding = header.encoding; // correct endianness
-   else
-      encoding = SwapUintEndianess(header.encoding);
+      if (header.magic == 0x2e736e64)
+         encoding = header.encoding; // correct endianness
+      else
+         encoding = SwapUintEndianess(header.encoding);
 
-   switch (encoding)
-   {
-   case AU_SAMPLE_FORMAT_16:
-      mCache.format = int16Sample;
-      break;
-   case AU_SAMPLE_FORMAT_24:
-      mCache.format = int24Sample;
-      break;
-   default:
-      // floatSample is a safe default (we will never loose data)
-      mCache.format = floatSample;
-      break;
-   }
+      switch (encoding)
+      {
+      case AU_SAMPLE_FORMAT_16:
+         mCache.format = int16Sample;
+         break;
+      case AU_SAMPLE_FORMAT_24:
+         mCache.format = int24Sample;
+         break;
+      default:
+         // floatSample is a safe default (we will never loose data)
+         mCache.format = floatSample;
+         break;
+      }
 
-   file.Close();
+      file.Close();
+   }
 
    // Read samples into cache
    mCache.sampleData = new char[mLen * SAMPLE_SIZE(mCache.format)];
@@ -338,6 +464,26 @@ bool SimpleBlockFile::ReadSummary(void *data)
    {
       //wxLogDebug("SimpleBlockFile::ReadSummary(): Reading summary from disk.");
 
+      SimpleBlockFileImage image;
+      if (AcquireImage(image)) {
+         // The offset is just past the au header
+         int read = (int)ReadImageAt(image, sizeof(auHeader), data,
+                                     (size_t)mSummaryInfo.totalSummaryBytes);
+         ReleaseImage(image);
+         mSilentLog = FALSE;
+
+         FixSummary(data);
+
+         return (read == mSummaryInfo.totalSummaryBytes);
+      }
+
+      if (mStore) {
+         // The image is missing, as the file may be
+         memset(data,0,(size_t)mSummaryInfo.totalSummaryBytes);
+         mSilentLog=TRUE;
+         return true;
+      }
+
       wxFFile file(mFileName.GetFullPath(), wxT("rb"));
 
       wxLogNull *silence=0;
@@ -369,7 +515,72 @@ bool SimpleBlockFile::ReadSummary(void *data)
    }
 }
 
-/// Read the data portion of the block file using libsndfile.  Convert it
+/// Read part of the 256-sample summary, straight from the pooled (and
+/// usually memory-mapped) file when possible.
+bool SimpleBlockFile::Read256(float *buffer,
+                              sampleCount start, sampleCount len)
+{
+   if (ReadSummaryFrames(buffer, mSummaryInfo.offset256,
+                         mSummaryInfo.frames256, start, len))
+      return true;
+   return BlockFile::Read256(buffer, start, len);
+}
+
+/// Read part of the 64K-sample summary, straight from the pooled (and
+/// usually memory-mapped) file when possible.
+bool SimpleBlockFile::Read64K(float *buffer,
+                              sampleCount start, sampleCount len)
+{
+   if (ReadSummaryFrames(buffer, mSummaryInfo.offset64K,
+                         mSummaryInfo.frames64K, start, len))
+      return true;
+   return BlockFile::Read64K(buffer, start, len);
+}
+
+/// Copy only the requested summary frames, rather than reading the whole
+/// summary as BlockFile::Read256() and Read64K() do.  Returns false if
+/// the caller should fall back to the generic path.
+bool SimpleBlockFile::ReadSummaryFrames(float *buffer, int offset,
+                                        sampleCount frames,
+                                        sampleCount start, sampleCount len)
+{
+   wxASSERT(start >= 0);
+
+   if (mCache.active ||
+       mSummaryInfo.format != floatSample || mSummaryInfo.fields != 3)
+      return false;
+
+   SimpleBlockFileImage image;
+   if (!AcquireImage(image))
+      return false;
+
+   if (start + len > frames)
+      len = frames - start;
+
+   size_t bytes = (size_t)len * mSummaryInfo.bytesPerFrame;
+   wxFileOffset pos = sizeof(auHeader) + offset +
+      (wxFileOffset)start * mSummaryInfo.bytesPerFrame;
+   size_t read = (len > 0) ? ReadImageAt(image, pos, buffer, bytes) : 0;
+
+   bool swapped = image.swapped;
+   ReleaseImage(image);
+
+   if (read != bytes)
+      return false;
+
+   // The header tells us exactly whether the summary needs swapping,
+   // so there's no need for FixSummary()'s guesswork here
+   if (swapped) {
+      wxUint32 *p = (wxUint32 *)buffer;
+      for (int i = 0; i < len * mSummaryInfo.fields; i++)
+         p[i] = wxUINT32_SWAP_ALWAYS(p[i]);
+   }
+
+   return true;
+}
+
+/// Read the data portion of the block file, through the DirManager's
+/// handle pool if possible, otherwise using libsndfile.  Convert it
 /// to the given format if it is not already.
 ///
 /// @param data   The buffer where the data will be stored
@@ -394,6 +605,23 @@ int SimpleBlockFile::ReadData(samplePtr data, sampleFormat format,
    {
       //wxLogDebug("SimpleBlockFile::ReadData(): Reading data from disk.");
 
+      SimpleBlockFileImage image;
+      if (AcquireImage(image)) {
+         int framesRead = ReadDataFromImage(image, data, format, start, len);
+         ReleaseImage(image);
+         mSilentLog = FALSE;
+         return framesRead;
+      }
+
+      if (mStore) {
+         // A packed block has no file of its own for libsndfile to try
+         memset(data,0,SAMPLE_SIZE(format)*len);
+         mSilentLog=TRUE;
+         return len;
+      }
+
+      // No usable pooled handle (missing or unusual file); let libsndfile
+      // deal with it.
       SF_INFO info;
       wxLogNull *silence=0;
       if(mSilentLog)silence= new wxLogNull();
@@ -464,8 +692,221 @@ int SimpleBlockFile::ReadData(samplePtr data, sampleFormat format,
    }
 }
 
+/// Find the .au image of the block: an open handle from the DirManager's
+/// pool, or the block's place in its segment store if it is packed.
+/// Every successful AcquireImage() must be paired with a ReleaseImage().
+bool SimpleBlockFile::AcquireImage(SimpleBlockFileImage &image)
+{
+   image.pool = NULL;
+   image.handle = NULL;
+
+   if (mStore) {
+      auHeader header;
+      wxUint32 dataOffset;
+      if (!mEntry ||
+          !mStore->ReadHeader(mEntry, &header, sizeof(header)) ||
+          !ParseHeader(header, &image.format, &dataOffset, &image.swapped))
+         return false;
+      image.dataOffset = dataOffset;
+      return true;
+   }
+
+   image.pool = DirManager::GetReadHandlePool();
+   image.handle =
+      image.pool ? image.pool->Acquire(mFileName.GetFullPath()) : NULL;
+   if (!image.handle)
+      return false;
+
+   image.format = image.handle->format;
+   image.dataOffset = image.handle->dataOffset;
+   image.swapped = image.handle->swapped;
+   return true;
+}
+
+void SimpleBlockFile::ReleaseImage(SimpleBlockFileImage &image)
+{
+   if (image.handle)
+      image.pool->Release(image.handle);
+}
+
+size_t SimpleBlockFile::ReadImageAt(SimpleBlockFileImage &image,
+                                    wxFileOffset pos,
+                                    void *buffer, size_t len)
+{
+   if (image.handle)
+      return image.pool->ReadAt(image.handle, pos, buffer, len);
+   return mStore->ReadAt(mEntry, pos, buffer, len);
+}
+
+/// Read samples from the image found by AcquireImage(), bypassing
+/// libsndfile.  The conversions match what libsndfile and
+/// CopySamples() gave us before, so the results are identical.
+int SimpleBlockFile::ReadDataFromImage(SimpleBlockFileImage &image,
+                                       samplePtr data, sampleFormat format,
+                                       sampleCount start, sampleCount len)
+{
+   if (start >= mLen || len <= 0)
+      return 0;
+   if (len > mLen - start)
+      len = mLen - start;
+
+   int diskSize = SAMPLE_SIZE_DISK(image.format);
+   wxFileOffset pos = image.dataOffset + (wxFileOffset)start * diskSize;
+   size_t bytes = (size_t)len * diskSize;
+
+   // Same-format reads go straight into the caller's buffer
+   bool direct = (format == image.format && image.format != int24Sample);
+   char *raw = direct ? (char *)data : new char[bytes];
+
+   int framesRead = (int)(ReadImageAt(image, pos, raw, bytes) / diskSize);
+
+   if (image.swapped) {
+      if (diskSize == 2) {
+         wxUint16 *p = (wxUint16 *)raw;
+         for (int i = 0; i < framesRead; i++)
+            p[i] = wxUINT16_SWAP_ALWAYS(p[i]);
+      }
+      else if (diskSize == 4) {
+         wxUint32 *p = (wxUint32 *)raw;
+         for (int i = 0; i < framesRead; i++)
+            p[i] = wxUINT32_SWAP_ALWAYS(p[i]);
+      }
+   }
+
+   if (direct)
+      return framesRead;
+
+   if (image.format == int24Sample) {
+      // Unpack 3-byte samples, sign-extending into the low 24 bits
+      int *intPtr = (int *)((format == int24Sample) ? data : NewSamples(framesRead, int24Sample));
+      #if wxBYTE_ORDER == wxBIG_ENDIAN
+         bool msbFirst = !image.swapped;
+      #else
+         bool msbFirst = image.swapped;
+      #endif
+      UnpackInt24((unsigned char *)raw, intPtr, framesRead, msbFirst);
+
+      if (format == int16Sample) {
+         // libsndfile truncated 24-bit samples to 16 bits without dither
+         short *shortPtr = (short *)data;
+         for (int i = 0; i < framesRead; i++)
+            shortPtr[i] = (short)(intPtr[i] >> 8);
+      }
+      if (format != int24Sample) {
+         if (format == floatSample)
+            CopySamples((samplePtr)intPtr, int24Sample, data, format, framesRead);
+         DeleteSamples((samplePtr)intPtr);
+      }
+   }
+   else
+      CopySamples((samplePtr)raw, image.format, data, format, framesRead);
+
+   delete[] raw;
+
+   return framesRead;
+}
+
+void SimpleBlockFile::InvalidateReadHandle()
+{
+   BlockFileHandlePool *pool = DirManager::GetReadHandlePool();
+   if (pool && !mStore && mFileName.HasName())
+      pool->Invalidate(mFileName.GetFullPath());
+}
+
+bool SimpleBlockFile::IsPackedImageOnDisk()
+{
+   return mEntry && mStore->IsOnDisk(mEntry);
+}
+
+/// Copy a packed block into another project's store, as the .au file of
+/// a block pasted from another project is copied into its directory.
+/// A block whose image is missing stays missing in the copy.
+///
+/// @param newFileName The name of the copy
+/// @param store       The store to append the image to
+BlockFile *SimpleBlockFile::CopyToSegmentStore(wxFileName newFileName,
+                                               BlockSegmentStore *store)
+{
+   BlockSegmentEntry *entry = NULL;
+
+   if (mEntry) {
+      int segment;
+      wxFileOffset offset;
+      wxUint32 bytes;
+      mStore->GetLocation(mEntry, &segment, &offset, &bytes);
+
+      char *image = new char[bytes];
+      if (mStore->ReadAt(mEntry, 0, image, bytes) == bytes)
+         entry = store->Append(image, bytes);
+      delete[] image;
+
+      if (!entry)
+         return NULL;
+   }
+
+   return new SimpleBlockFile(store, entry, newFileName, mLen,
+                              mMin, mMax, mRMS);
+}
+
+// static
+bool SimpleBlockFile::ParseHeader(const auHeader &header, sampleFormat *format,
+                                  wxUint32 *dataOffset, bool *swapped)
+{
+   // The magic is written in the byte order of the machine that
+   // wrote the block; see WriteSimpleBlockFile()
+   wxUint32 encoding = header.encoding;
+   *dataOffset = header.dataOffset;
+   if (header.magic == 0x2e736e64)
+      *swapped = false;
+   else if (header.magic == wxUINT32_SWAP_ALWAYS(0x2e736e64)) {
+      *swapped = true;
+      encoding = wxUINT32_SWAP_ALWAYS(encoding);
+      *dataOffset = wxUINT32_SWAP_ALWAYS(*dataOffset);
+   }
+   else
+      return false;
+
+   switch (encoding) {
+   case AU_SAMPLE_FORMAT_16:
+      *format = int16Sample;
+      return true;
+   case AU_SAMPLE_FORMAT_24:
+      *format = int24Sample;
+      return true;
+   case AU_SAMPLE_FORMAT_FLOAT:
+      *format = floatSample;
+      return true;
+   default:
+      // Leave anything unusual to libsndfile
+      return false;
+   }
+}
+
 void SimpleBlockFile::SaveXML(XMLWriter &xmlFile)
 {
+   if (mStore)
+   {
+      int segment = 0;
+      wxFileOffset offset = 0;
+      wxUint32 bytes = 0;
+      if (mEntry)
+         mStore->GetLocation(mEntry, &segment, &offset, &bytes);
+
+      xmlFile.StartTag(wxT("packedblockfile"));
+
+      xmlFile.WriteAttr(wxT("name"), mFileName.GetName());
+      xmlFile.WriteAttr(wxT("segment"), segment);
+      xmlFile.WriteAttr(wxT("offset"), (long long)offset);
+      xmlFile.WriteAttr(wxT("bytes"), (long long)bytes);
+      xmlFile.WriteAttr(wxT("len"), mLen);
+      xmlFile.WriteAttr(wxT("min"), mMin);
+      xmlFile.WriteAttr(wxT("max"), mMax);
+      xmlFile.WriteAttr(wxT("rms"), mRMS);
+
+      xmlFile.EndTag(wxT("packedblockfile"));
+      return;
+   }
+
    xmlFile.StartTag(wxT("simpleblockfile"));
 
    xmlFile.WriteAttr(wxT("filename"), mFileName.GetFullName());
@@ -524,11 +965,82 @@ BlockFile *SimpleBlockFile::BuildFromXML(DirManager &dm, const wxChar **attrs)
    return new SimpleBlockFile(fileName, len, min, max, rms);
 }
 
+// As BuildFromXML(), this always returns a packed block, with no image
+// if its location is flawed.
+/// static
+BlockFile *SimpleBlockFile::BuildPackedFromXML(DirManager &dm,
+                                               const wxChar **attrs)
+{
+   wxFileName fileName;
+   float min = 0.0f, max = 0.0f, rms = 0.0f;
+   sampleCount len = 0;
+   long segment = 0;
+   wxLongLong_t offset = -1;
+   wxLongLong_t bytes = 0;
+   double dblValue;
+   long nValue;
+   wxLongLong_t llValue;
+
+   while(*attrs)
+   {
+      const wxChar *attr =  *attrs++;
+      const wxChar *value = *attrs++;
+      if (!value)
+         break;
+
+      const wxString strValue = value;
+      if (!wxStricmp(attr, wxT("name")) &&
+            XMLValueChecker::IsGoodFileString(strValue))
+         fileName.Assign(wxEmptyString, strValue, wxT("au"));
+      else if (!wxStrcmp(attr, wxT("segment")) &&
+               XMLValueChecker::IsGoodInt(strValue) && strValue.ToLong(&nValue) &&
+               nValue > 0)
+         segment = nValue;
+      else if (!wxStrcmp(attr, wxT("offset")) &&
+               XMLValueChecker::IsGoodInt64(strValue) && strValue.ToLongLong(&llValue) &&
+               llValue >= 0)
+         offset = llValue;
+      else if (!wxStrcmp(attr, wxT("bytes")) &&
+               XMLValueChecker::IsGoodInt64(strValue) && strValue.ToLongLong(&llValue) &&
+               llValue > 0 && llValue <= 0xffffffff)
+         bytes = llValue;
+      else if (!wxStrcmp(attr, wxT("len")) &&
+               XMLValueChecker::IsGoodInt(strValue) && strValue.ToLong(&nValue) &&
+               nValue > 0)
+         len = nValue;
+      else if (XMLValueChecker::IsGoodString(strValue) && Internat::CompatibleToDouble(strValue, &dblValue))
+      {  // double parameters
+         if (!wxStricmp(attr, wxT("min")))
+            min = dblValue;
+         else if (!wxStricmp(attr, wxT("max")))
+            max = dblValue;
+         else if (!wxStricmp(attr, wxT("rms")) && (dblValue >= 0.0))
+            rms = dblValue;
+      }
+   }
+
+   BlockSegmentStore *store = dm.GetBlockSegmentStore();
+   BlockSegmentEntry *entry = NULL;
+   if (segment > 0 && offset >= 0 && bytes > 0)
+      entry = store->Load((int)segment, offset, (wxUint32)bytes);
+
+   return new SimpleBlockFile(store, entry, fileName, len, min, max, rms);
+}
+
 /// Create a copy of this BlockFile, but using a different disk file.
 ///
 /// @param newFileName The name of the new file to use.
 BlockFile *SimpleBlockFile::Copy(wxFileName newFileName)
 {
+   if (mStore)
+   {
+      // Images are never rewritten, so the copy can share this one
+      if (mEntry)
+         mStore->Share(mEntry);
+      return new SimpleBlockFile(mStore, mEntry, newFileName, mLen,
+                                 mMin, mMax, mRMS);
+   }
+
    BlockFile *newBlockFile = new SimpleBlockFile(newFileName, mLen,
                                                  mMin, mMax, mRMS);
 
@@ -543,12 +1055,35 @@ wxLongLong SimpleBlockFile::GetSpaceUsage()
       return 0;
    } else
    {
-      wxFFile dataFile(mFileName.GetFullPath());
-      return dataFile.Length();
+      // Files we didn't write ourselves are measured once
+      if (mSpaceUsage < 0 && mStore)
+         mSpaceUsage = mEntry ? mStore->GetSpaceUsage(mEntry) : 0;
+      else if (mSpaceUsage < 0) {
+         wxFFile dataFile(mFileName.GetFullPath());
+         mSpaceUsage = dataFile.Length();
+      }
+      return mSpaceUsage;
    }
 }
 
 void SimpleBlockFile::Recover(){
+   InvalidateReadHandle();
+   mSpaceUsage = -1;
+
+   if (mStore) {
+      // Append a silent image in place of the missing one
+      samplePtr silence = NewSamples(mLen, int16Sample);
+      ClearSamples(silence, int16Sample, 0, mLen);
+      char *summary = new char[mSummaryInfo.totalSummaryBytes];
+      memset(summary, 0, (size_t)mSummaryInfo.totalSummaryBytes);
+
+      WriteSimpleBlockFile(silence, mLen, int16Sample, summary);
+
+      delete[] summary;
+      DeleteSamples(silence);
+      return;
+   }
+
    wxFFile file(mFileName.GetFullPath(), wxT("wb"));
    int i;
 
@@ -18,6 +18,11 @@
 #include "../DirManager.h"
 #include "../xml/XMLWriter.h"
 
+class BlockFileHandle;
+class BlockFileHandlePool;
+class BlockSegmentEntry;
+class BlockSegmentStore;
+
 struct SimpleBlockFileCache {
    bool active;
    bool needWrite;
@@ -42,20 +47,37 @@ typedef struct {
    wxUint32 channels;   // number of interleaved channels
 } auHeader;
 
+/// Where a SimpleBlockFile reads its .au image from: a pooled handle on
+/// its own file, or its place in a BlockSegmentStore if it is packed
+struct SimpleBlockFileImage {
+   BlockFileHandlePool *pool;
+   BlockFileHandle *handle;   // NULL for a packed block
+   sampleFormat format;       // of the samples on disk
+   wxFileOffset dataOffset;
+   bool swapped;
+};
+
 class SimpleBlockFile : public BlockFile {
  public:
 
    // Constructor / Destructor
 
-   /// Create a disk file and write summary and sample data to it
+   /// Create a disk file and write summary and sample data to it, or,
+   /// given a store, append them to one of its segments
    SimpleBlockFile(wxFileName baseFileName,
                    samplePtr sampleData, sampleCount sampleLen,
                    sampleFormat format,
                    bool allowDeferredWrite = false,
-                   bool bypassCache = false );
+                   bool bypassCache = false,
+                   BlockSegmentStore *store = NULL);
    /// Create the memory structure to refer to the given block file
    SimpleBlockFile(wxFileName existingFile, sampleCount len,
                    float min, float max, float rms);
+   /// Create the memory structure to refer to a packed block whose image
+   /// is already in the store
+   SimpleBlockFile(BlockSegmentStore *store, BlockSegmentEntry *entry,
+                   wxFileName name, sampleCount len,
+                   float min, float max, float rms);
 
    virtual ~SimpleBlockFile();
 
@@ -66,6 +88,10 @@ class SimpleBlockFile : public BlockFile {
    /// Read the data section of the disk file
    virtual int ReadData(samplePtr data, sampleFormat format,
                         sampleCount start, sampleCount len);
+   /// Read part of the 256-sample summary
+   virtual bool Read256(float *buffer, sampleCount start, sampleCount len);
+   /// Read part of the 64K-sample summary
+   virtual bool Read64K(float *buffer, sampleCount start, sampleCount len);
 
    /// Create a new block file identical to this one
    virtual BlockFile *Copy(wxFileName newFileName);
@@ -76,6 +102,24 @@ class SimpleBlockFile : public BlockFile {
    virtual void Recover();
 
    static BlockFile *BuildFromXML(DirManager &dm, const wxChar **attrs);
+   static BlockFile *BuildPackedFromXML(DirManager &dm, const wxChar **attrs);
+
+   /// Whether the block is kept in a BlockSegmentStore rather than an .au
+   /// file of its own
+   virtual bool IsPacked() { return mStore != NULL; }
+   BlockSegmentStore *GetSegmentStore() { return mStore; }
+   BlockSegmentEntry *GetSegmentEntry() { return mEntry; }
+   /// Whether the whole image of a packed block is in its segment
+   bool IsPackedImageOnDisk();
+   /// Create a copy of a packed block in another store, appending its
+   /// image there.  Returns NULL if the image couldn't be copied.
+   BlockFile *CopyToSegmentStore(wxFileName newFileName,
+                                 BlockSegmentStore *store);
+
+   /// Reads the layout of the file from its .au header.  Returns false
+   /// if it isn't a block file we can read without libsndfile.
+   static bool ParseHeader(const auHeader &header, sampleFormat *format,
+                           wxUint32 *dataOffset, bool *swapped);
 
    virtual bool GetNeedWriteCacheToDisk();
    virtual void WriteCacheToDisk();
@@ -87,10 +131,36 @@ class SimpleBlockFile : public BlockFile {
 
    bool WriteSimpleBlockFile(samplePtr sampleData, sampleCount sampleLen,
                              sampleFormat format, void* summaryData);
+   bool WriteAuFile(const auHeader &header, void *summaryData,
+                    samplePtr sampleData, sampleCount sampleLen,
+                    sampleFormat format);
+   bool WritePackedImage(const auHeader &header, void *summaryData,
+                         samplePtr sampleData, sampleCount sampleLen,
+                         sampleFormat format);
    static bool GetCache();
    void ReadIntoCache();
 
+   bool AcquireImage(SimpleBlockFileImage &image);
+   void ReleaseImage(SimpleBlockFileImage &image);
+   size_t ReadImageAt(SimpleBlockFileImage &image, wxFileOffset pos,
+                      void *buffer, size_t len);
+   int ReadDataFromImage(SimpleBlockFileImage &image,
+                         samplePtr data, sampleFormat format,
+                         sampleCount start, sampleCount len);
+   bool ReadSummaryFrames(float *buffer, int offset, sampleCount frames,
+                          sampleCount start, sampleCount len);
+   void InvalidateReadHandle();
+
    SimpleBlockFileCache mCache;
+
+   // Size of the file as last written, or -1 if not known yet
+   wxLongLong mSpaceUsage;
+
+   // Where a packed block is kept; both NULL for a block with an .au file
+   // of its own.  mEntry is also NULL while a packed block is only in
+   // the cache, or if its image was missing from the project.
+   BlockSegmentStore *mStore;
+   BlockSegmentEntry *mEntry;
 };
 
 #endif
@@ -267,8 +267,56 @@ int ExportPlugin::DoExport(AudacityProject * WXUNUSED(project),
    return false;
 }
 
+bool ExportPlugin::CanCreateExportJob(int WXUNUSED(subformat))
+{
+   return false;
+}
+
+ExportJob *ExportPlugin::CreateExportJob(AudacityProject * WXUNUSED(project),
+                                         int WXUNUSED(channels),
+                                         wxString WXUNUSED(fName),
+                                         bool WXUNUSED(selectedOnly),
+                                         double WXUNUSED(t0),
+                                         double WXUNUSED(t1),
+                                         MixerSpec * WXUNUSED(mixerSpec),
+                                         Tags * WXUNUSED(metadata),
+                                         int WXUNUSED(subformat))
+{
+   return NULL;
+}
+
+/// Reports an ExportJob's progress in a ProgressDialog of its own
+class ExportProgressDialog : public ExportProgress
+{
+public:
+   ExportProgressDialog(const wxString &title, const wxString &message)
+      : mDialog(title, message) {}
+
+   virtual int Update(double current, double total)
+   {
+      return mDialog.Update(current, total);
+   }
+
+private:
+   ProgressDialog mDialog;
+};
+
+int ExportPlugin::RunExportJob(ExportJob *job)
+{
+   int result;
+   {
+      ExportProgressDialog progress(job->GetTitle(), job->GetMessage());
+      result = job->Run(&progress);
+   }
+
+   result = job->Finish(result);
+   delete job;
+
+   return result;
+}
+
 //Create a mixer by computing the time warp factor
-Mixer* ExportPlugin::CreateMixer(int numInputTracks, WaveTrack **inputTracks,
+MixerPipeline* ExportPlugin::CreateMixer(int numInputTracks, WaveTrack **inputTracks,
          TimeTrack *timeTrack,
          double startTime, double stopTime,
          int numOutChannels, int outBufferSize, bool outInterleaved,
@@ -276,13 +324,179 @@ Mixer* ExportPlugin::CreateMixer(int numInputTracks, WaveTrack **inputTracks,
          bool highQuality, MixerSpec *mixerSpec)
 {
    // MB: the stop time should not be warped, this was a bug.
-   return new Mixer(numInputTracks, inputTracks,
+   Mixer *mixer = new Mixer(numInputTracks, inputTracks,
                   timeTrack,
                   startTime, stopTime,
                   numOutChannels, outBufferSize, outInterleaved,
                   outRate, outFormat,
                   highQuality, mixerSpec);
+
+   return new MixerPipeline(mixer, numOutChannels, outBufferSize,
+                            outInterleaved, outFormat);
+}
+
+//----------------------------------------------------------------------------
+// MixerPipeline
+//----------------------------------------------------------------------------
+
+// How much the mixer may get ahead of the exporter
+#define MIXER_PIPELINE_SAMPLES 65536
+#define MIXER_PIPELINE_MIN_BLOCKS 3
+
+class MixerPipelineThread : public wxThread
+{
+public:
+   MixerPipelineThread(MixerPipeline *pipeline)
+      : wxThread(wxTHREAD_JOINABLE), mPipeline(pipeline) {}
+
+   virtual ExitCode Entry()
+   {
+      mPipeline->ThreadLoop();
+      return 0;
+   }
+
+private:
+   MixerPipeline *mPipeline;
+};
+
+MixerPipeline::MixerPipeline(Mixer *mixer, int numChannels,
+                             sampleCount blockLen, bool interleaved,
+                             sampleFormat format)
+   : mMixer(mixer),
+     mNumBuffers(interleaved ? 1 : numChannels),
+     mBlockLen(blockLen),
+     mFormat(format),
+     mThread(NULL),
+     mFilled(mMutex),
+     mEmptied(mMutex),
+     mNumFilled(0),
+     mHolding(false),
+     mFinished(false),
+     mExit(false),
+     mReadBlock(0),
+     mWriteBlock(0)
+{
+   int numBlocks = (MIXER_PIPELINE_SAMPLES + blockLen - 1) / blockLen;
+   if (numBlocks < MIXER_PIPELINE_MIN_BLOCKS)
+      numBlocks = MIXER_PIPELINE_MIN_BLOCKS;
+
+   sampleCount bufferLen = interleaved ? blockLen * numChannels : blockLen;
+
+   mBlocks.resize(numBlocks);
+   for (int i = 0; i < numBlocks; i++) {
+      mBlocks[i].buffers = new samplePtr[mNumBuffers];
+      for (int c = 0; c < mNumBuffers; c++)
+         mBlocks[i].buffers[c] = NewSamples(bufferLen, format);
+      mBlocks[i].len = 0;
+      mBlocks[i].time = 0.0;
+   }
+
+   mThread = new MixerPipelineThread(this);
+   if (mThread->Create() != wxTHREAD_NO_ERROR ||
+       mThread->Run() != wxTHREAD_NO_ERROR) {
+      delete mThread;
+      mThread = NULL;
+   }
 }
+
+MixerPipeline::~MixerPipeline()
+{
+   if (mThread) {
+      {
+         wxMutexLocker locker(mMutex);
+         mExit = true;
+         mEmptied.Signal();
+      }
+      mThread->Wait();
+      delete mThread;
+   }
+
+   delete mMixer;
+
+   for (unsigned int i = 0; i < mBlocks.size(); i++) {
+      for (int c = 0; c < mNumBuffers; c++)
+         DeleteSamples(mBlocks[i].buffers[c]);
+      delete[] mBlocks[i].buffers;
+   }
+}
+
+void MixerPipeline::ThreadLoop()
+{
+   int numBlocks = (int)mBlocks.size();
+
+   for (;;) {
+      {
+         wxMutexLocker locker(mMutex);
+         while (mNumFilled == numBlocks && !mExit)
+            mEmptied.Wait();
+         if (mExit)
+            return;
+      }
+
+      // The slot is ours until it is counted as filled
+      Block &block = mBlocks[mWriteBlock];
+      block.len = mMixer->Process(mBlockLen, block.buffers);
+      block.time = mMixer->MixGetCurrentTime();
+
+      wxMutexLocker locker(mMutex);
+      if (block.len == 0) {
+         mFinished = true;
+         mFilled.Signal();
+         return;
+      }
+      mNumFilled++;
+      mWriteBlock = (mWriteBlock + 1) % numBlocks;
+      mFilled.Signal();
+   }
+}
+
+sampleCount MixerPipeline::Process(sampleCount maxSamples)
+{
+   wxASSERT(maxSamples == mBlockLen);
+
+   if (!mThread) {
+      // No thread to be had; mix in step with the exporter instead
+      Block &block = mBlocks[0];
+      block.len = mMixer->Process(maxSamples, block.buffers);
+      block.time = mMixer->MixGetCurrentTime();
+      return block.len;
+   }
+
+   wxMutexLocker locker(mMutex);
+
+   // Hand back the block the exporter has finished with
+   if (mHolding) {
+      mHolding = false;
+      mNumFilled--;
+      mReadBlock = (mReadBlock + 1) % (int)mBlocks.size();
+      mEmptied.Signal();
+   }
+
+   while (mNumFilled == 0 && !mFinished)
+      mFilled.Wait();
+
+   if (mNumFilled == 0)
+      return 0;
+
+   mHolding = true;
+   return mBlocks[mReadBlock].len;
+}
+
+samplePtr MixerPipeline::GetBuffer()
+{
+   return mBlocks[mReadBlock].buffers[0];
+}
+
+samplePtr MixerPipeline::GetBuffer(int channel)
+{
+   return mBlocks[mReadBlock].buffers[channel];
+}
+
+double MixerPipeline::MixGetCurrentTime()
+{
+   return mBlocks[mReadBlock].time;
+}
+
 //----------------------------------------------------------------------------
 // Export
 //----------------------------------------------------------------------------
@@ -11,10 +11,13 @@
 #ifndef __AUDACITY_EXPORT__
 #define __AUDACITY_EXPORT__
 
+#include <vector>
+
 #include <wx/dialog.h>
 #include <wx/dynarray.h>
 #include <wx/filename.h>
 #include <wx/panel.h>
+#include <wx/thread.h>
 #include "../Tags.h"
 #include "../SampleFormat.h"
 
@@ -28,6 +31,7 @@ class MixerSpec;
 class FileDialog;
 class TimeTrack;
 class Mixer;
+class MixerPipelineThread;
 
 class AUDACITY_DLL_API FormatInfo
 {
@@ -45,6 +49,118 @@ class AUDACITY_DLL_API FormatInfo
 
 WX_DECLARE_USER_EXPORTED_OBJARRAY(FormatInfo, FormatInfoArray, AUDACITY_DLL_API);
 
+//----------------------------------------------------------------------------
+// ExportProgress
+//----------------------------------------------------------------------------
+/// Where an ExportJob reports how far it has got.
+class AUDACITY_DLL_API ExportProgress
+{
+public:
+   virtual ~ExportProgress() {}
+
+   /// Returns eProgressSuccess to carry on, or whatever the user asked for
+   /// instead, as ProgressDialog::Update() does.  Called on the thread
+   /// running the job.
+   virtual int Update(double current, double total) = 0;
+};
+
+//----------------------------------------------------------------------------
+// ExportJob
+//----------------------------------------------------------------------------
+/// \brief An export that has been set up by ExportPlugin::CreateExportJob()
+/// and is ready to mix and encode.
+///
+/// Run() does not touch the GUI, gPrefs or the project, so ExportMultiple
+/// can run several jobs at once on worker threads.  Everything else happens
+/// on the main thread.
+class AUDACITY_DLL_API ExportJob
+{
+public:
+   ExportJob(const wxString &title, const wxString &message)
+      : mTitle(title), mMessage(message) {}
+   virtual ~ExportJob() {}
+
+   /// Title and message for a progress dialog showing this job
+   const wxString &GetTitle() const { return mTitle; }
+   const wxString &GetMessage() const { return mMessage; }
+
+   /// Mixes and encodes the audio, until done or until progress says to
+   /// stop.  Returns the last result of progress->Update().
+   virtual int Run(ExportProgress *progress) = 0;
+
+   /// Completes the file and reports any errors to the user.  Gets the
+   /// result of Run() and returns the result of the whole export.
+   virtual int Finish(int result) = 0;
+
+private:
+   wxString mTitle;
+   wxString mMessage;
+};
+
+//----------------------------------------------------------------------------
+// MixerPipeline
+//----------------------------------------------------------------------------
+/// \brief Runs a Mixer on a thread of its own, a few blocks ahead of the
+/// exporter reading from it.
+///
+/// Offers the parts of the Mixer interface that exporters use.  While the
+/// exporter encodes one block the next ones are being mixed, so an export
+/// takes about as long as the slower of the two rather than their sum.
+/// The blocks are exactly those the Mixer would have returned itself.
+class AUDACITY_DLL_API MixerPipeline
+{
+public:
+   /// Takes ownership of mixer, whose output is described by the other
+   /// arguments, and starts mixing blocks of blockLen samples.
+   MixerPipeline(Mixer *mixer, int numChannels, sampleCount blockLen,
+                 bool interleaved, sampleFormat format);
+   ~MixerPipeline();
+
+   /// Moves on to the next mixed block, waiting for it if need be, and
+   /// returns its length, or 0 at the end.  maxSamples must be the block
+   /// length the pipeline was created with.
+   sampleCount Process(sampleCount maxSamples);
+
+   /// The interleaved buffer, or the first channel, of the current block
+   samplePtr GetBuffer();
+   /// One of the non-interleaved buffers of the current block
+   samplePtr GetBuffer(int channel);
+
+   /// Mixer::MixGetCurrentTime() as of the end of the current block
+   double MixGetCurrentTime();
+
+private:
+   friend class MixerPipelineThread;
+
+   void ThreadLoop();
+
+   struct Block {
+      samplePtr *buffers;
+      sampleCount len;
+      double time;
+   };
+
+   Mixer *mMixer;
+   int mNumBuffers;
+   sampleCount mBlockLen;
+   sampleFormat mFormat;
+   std::vector<Block> mBlocks;   // a ring, filled by the thread
+   MixerPipelineThread *mThread;
+
+   wxMutex mMutex;
+   wxCondition mFilled;    // a block was mixed, or the mixer ran out
+   wxCondition mEmptied;   // a block was handed back, or we are shutting down
+
+   // Guarded by mMutex
+   int mNumFilled;         // including the block the exporter is reading
+   bool mHolding;          // whether the exporter has a block
+   bool mFinished;
+   bool mExit;
+
+   int mReadBlock;         // only touched by the exporter
+   int mWriteBlock;        // only touched by the thread
+};
+
 //----------------------------------------------------------------------------
 // ExportPlugin
 //----------------------------------------------------------------------------
@@ -117,8 +233,34 @@ public:
                          MixerSpec *mixerSpec,
                          int subformat);
 
+   /** \brief Whether CreateExportJob() works for this sub-format. */
+   virtual bool CanCreateExportJob(int subformat = 0);
+
+   /** \brief Sets up an export as an ExportJob.
+    *
+    * Takes the same arguments as Export() and does the part of it that
+    * needs the main thread: reading options, opening the file and making
+    * the mixer.  Returns NULL, having told the user why, if that fails.
+    * Only called if CanCreateExportJob() says so.
+    */
+   virtual ExportJob *CreateExportJob(AudacityProject *project,
+                                      int channels,
+                                      wxString fName,
+                                      bool selectedOnly,
+                                      double t0,
+                                      double t1,
+                                      MixerSpec *mixerSpec = NULL,
+                                      Tags *metadata = NULL,
+                                      int subformat = 0);
+
 protected:
-   Mixer* CreateMixer(int numInputTracks, WaveTrack **inputTracks,
+   /// Runs a job on this thread with a ProgressDialog, finishes it and
+   /// deletes it; for plug-ins that implement Export() through a job.
+   int RunExportJob(ExportJob *job);
+
+   /// Creates a Mixer for the export, running on a thread of its own;
+   /// Process() must always ask for outBufferSize samples.
+   MixerPipeline* CreateMixer(int numInputTracks, WaveTrack **inputTracks,
          TimeTrack *timeTrack,
          double startTime, double stopTime,
          int numOutChannels, int outBufferSize, bool outInterleaved,
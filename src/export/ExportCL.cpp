@@ -415,7 +415,7 @@ int ExportCL::Export(AudacityProject *project,
    WaveTrack **waveTracks;
    TrackList *tracks = project->GetTracks();
    tracks->GetWaveTracks(selectionOnly, &numWaveTracks, &waveTracks);
-   Mixer *mixer = CreateMixer(numWaveTracks,
+   MixerPipeline *mixer = CreateMixer(numWaveTracks,
                             waveTracks,
                             tracks->GetTimeTrack(),
                             t0,
@@ -24,6 +24,7 @@ and libvorbis examples, Monty <monty@xiph.org>
 
 #include "Export.h"
 #include "ExportFLAC.h"
+#include "ParallelFLACEncoder.h"
 
 #include <wx/progdlg.h>
 #include <wx/ffile.h>
@@ -36,6 +37,7 @@ and libvorbis examples, Monty <monty@xiph.org>
 #include "../Project.h"
 #include "../Mix.h"
 #include "../Prefs.h"
+#include "../WorkerPool.h"
 
 #include "../Internat.h"
 #include "../Tags.h"
@@ -136,36 +138,6 @@ void ExportFLACOptions::OnOK(wxCommandEvent& WXUNUSED(event))
 
 #define SAMPLES_PER_RUN 8192
 
-/* FLACPP_API_VERSION_CURRENT is 6 for libFLAC++ from flac-1.1.3 (see <FLAC++/export.h>) */
-#if !defined FLACPP_API_VERSION_CURRENT || FLACPP_API_VERSION_CURRENT < 6
-#define LEGACY_FLAC
-#else
-#undef LEGACY_FLAC
-#endif
-
-static struct
-{
-   bool        do_exhaustive_model_search;
-   bool        do_escape_coding;
-   bool        do_mid_side_stereo;
-   bool        loose_mid_side_stereo;
-   unsigned    qlp_coeff_precision;
-   unsigned    min_residual_partition_order;
-   unsigned    max_residual_partition_order;
-   unsigned    rice_parameter_search_dist;
-   unsigned    max_lpc_order;
-} flacLevels[] = {
-   {  false,   false,   false,   false,   0, 2, 2, 0, 0  },
-   {  false,   false,   true,    true,    0, 2, 2, 0, 0  },
-   {  false,   false,   true,    false,   0, 0, 3, 0, 0  },
-   {  false,   false,   false,   false,   0, 3, 3, 0, 6  },
-   {  false,   false,   true,    true,    0, 3, 3, 0, 8  },
-   {  false,   false,   true,    false,   0, 3, 3, 0, 8  },
-   {  false,   false,   true,    false,   0, 0, 4, 0, 8  },
-   {  true,    false,   true,    false,   0, 0, 6, 0, 8  },
-   {  true,    false,   true,    false,   0, 0, 6, 0, 12 },
-};
-
 //----------------------------------------------------------------------------
 
 class ExportFLAC : public ExportPlugin
@@ -188,6 +160,17 @@ public:
                Tags *metadata = NULL,
                int subformat = 0);
 
+   bool CanCreateExportJob(int subformat = 0);
+   ExportJob *CreateExportJob(AudacityProject *project,
+                              int channels,
+                              wxString fName,
+                              bool selectedOnly,
+                              double t0,
+                              double t1,
+                              MixerSpec *mixerSpec = NULL,
+                              Tags *metadata = NULL,
+                              int subformat = 0);
+
 private:
 
    bool GetMetadata(AudacityProject *project, Tags *tags);
@@ -213,6 +196,155 @@ void ExportFLAC::Destroy()
    delete this;
 }
 
+//----------------------------------------------------------------------------
+// ExportFLACJob
+//----------------------------------------------------------------------------
+
+#ifndef LEGACY_FLAC
+// The threads that encode runs of frames are shared by all the jobs
+// exporting at once, as ExportMultiple's are, rather than each job
+// starting enough threads for every processor.  The pool is made for
+// the first such job and stopped once the last is deleted.
+static wxMutex sEncoderPoolMutex;
+static WorkerPool *sEncoderPool = NULL;
+static int sEncoderPoolUsers = 0;
+
+static WorkerPool *AcquireEncoderPool(int threads)
+{
+   wxMutexLocker locker(sEncoderPoolMutex);
+   if (!sEncoderPool)
+      sEncoderPool = new WorkerPool(threads);
+   sEncoderPoolUsers++;
+   return sEncoderPool;
+}
+
+static void ReleaseEncoderPool()
+{
+   wxMutexLocker locker(sEncoderPoolMutex);
+   if (--sEncoderPoolUsers == 0) {
+      delete sEncoderPool;
+      sEncoderPool = NULL;
+   }
+}
+#endif
+
+/// Mixes into an initialised libFLAC encoder
+class ExportFLACJob : public ExportJob
+{
+public:
+   ExportFLACJob(const wxString &title, const wxString &message)
+      : ExportJob(title, message)
+   {
+      mMixer = NULL;
+      mSampleBuffers = NULL;
+      mNumChannels = 0;
+#ifndef LEGACY_FLAC
+      mPool = NULL;
+      mParallel = NULL;
+#endif
+   }
+
+   virtual ~ExportFLACJob()
+   {
+      if (mSampleBuffers) {
+         for (int i = 0; i < mNumChannels; i++) {
+            free(mSampleBuffers[i]);
+         }
+         delete[] mSampleBuffers;
+      }
+      delete mMixer;
+#ifndef LEGACY_FLAC
+      delete mParallel;
+      if (mPool)
+         ReleaseEncoderPool();
+#endif
+   }
+
+   virtual int Run(ExportProgress *progress);
+   virtual int Finish(int result);
+
+   FLAC::Encoder::File mEncoder;
+#ifndef LEGACY_FLAC
+   wxFFile      mFile;
+   // When set, these encode in place of mEncoder
+   WorkerPool  *mPool;        // shared with other jobs
+   ParallelFLACEncoder *mParallel;
+#endif
+   MixerPipeline *mMixer;
+   FLAC__int32 **mSampleBuffers;
+   int          mNumChannels;
+   sampleFormat mFormat;
+   double       mT0;
+   double       mT1;
+};
+
+int ExportFLACJob::Run(ExportProgress *progress)
+{
+   int updateResult = eProgressSuccess;
+   int i, j;
+
+   while (updateResult == eProgressSuccess) {
+      sampleCount samplesThisRun = mMixer->Process(SAMPLES_PER_RUN);
+      if (samplesThisRun == 0) { //stop encoding
+         break;
+      }
+      else {
+         for (i = 0; i < mNumChannels; i++) {
+            samplePtr mixed = mMixer->GetBuffer(i);
+            if (mFormat == int24Sample) {
+               for (j = 0; j < samplesThisRun; j++) {
+                  mSampleBuffers[i][j] = ((int *) mixed)[j];
+               }
+            }
+            else {
+               for (j = 0; j < samplesThisRun; j++) {
+                  mSampleBuffers[i][j] = ((short *) mixed)[j];
+               }
+            }
+         }
+#ifndef LEGACY_FLAC
+         if (mParallel) {
+            if (!mParallel->Process(mSampleBuffers, samplesThisRun)) {
+               updateResult = eProgressFailed;
+               break;
+            }
+         }
+         else
+#endif
+         mEncoder.process(mSampleBuffers, samplesThisRun);
+      }
+      updateResult = progress->Update(mMixer->MixGetCurrentTime()-mT0, mT1-mT0);
+   }
+
+   return updateResult;
+}
+
+int ExportFLACJob::Finish(int updateResult)
+{
+   wxLogNull logNo;            // temporarily disable wxWidgets error messages
+
+#ifndef LEGACY_FLAC
+   if (mParallel) {
+      // A failed write, e.g. to a full disk, fails the export
+      bool ok = (updateResult != eProgressFailed);
+      if (!mParallel->Finish())
+         ok = false;
+      if (!mFile.Close())
+         ok = false;
+      if (!ok) {
+         wxMessageBox(_("Error while writing FLAC file (disk full?)."));
+         updateResult = eProgressFailed;
+      }
+      return updateResult;
+   }
+
+   mFile.Detach(); // libflac closes the file
+#endif
+   mEncoder.finish();
+
+   return updateResult;
+}
+
 int ExportFLAC::Export(AudacityProject *project,
                         int numChannels,
                         wxString fName,
@@ -221,13 +353,36 @@ int ExportFLAC::Export(AudacityProject *project,
                         double t1,
                         MixerSpec *mixerSpec,
                         Tags *metadata,
-                        int WXUNUSED(subformat))
+                        int subformat)
+{
+   ExportJob *job = CreateExportJob(project, numChannels, fName,
+                                    selectionOnly, t0, t1,
+                                    mixerSpec, metadata, subformat);
+   if (!job)
+      return false;
+
+   return RunExportJob(job);
+}
+
+bool ExportFLAC::CanCreateExportJob(int WXUNUSED(subformat))
+{
+   return true;
+}
+
+ExportJob *ExportFLAC::CreateExportJob(AudacityProject *project,
+                                       int numChannels,
+                                       wxString fName,
+                                       bool selectionOnly,
+                                       double t0,
+                                       double t1,
+                                       MixerSpec *mixerSpec,
+                                       Tags *metadata,
+                                       int WXUNUSED(subformat))
 {
    double    rate    = project->GetRate();
    TrackList *tracks = project->GetTracks();
 
    wxLogNull logNo;            // temporarily disable wxWidgets error messages
-   int updateResult = eProgressSuccess;
 
    int levelPref;
    gPrefs->Read(wxT("/FileFormats/FLACLevel"), &levelPref, 5);
@@ -235,17 +390,20 @@ int ExportFLAC::Export(AudacityProject *project,
    wxString bitDepthPref =
       gPrefs->Read(wxT("/FileFormats/FLACBitDepth"), wxT("16"));
 
-   FLAC::Encoder::File encoder;
+   ExportFLACJob *job = new ExportFLACJob(wxFileName(fName).GetName(),
+         selectionOnly ?
+         _("Exporting the selected audio as FLAC") :
+         _("Exporting the entire project as FLAC"));
+   FLAC::Encoder::File &encoder = job->mEncoder;
 
 #ifdef LEGACY_FLAC
    encoder.set_filename(OSOUTPUT(fName));
 #endif
-   encoder.set_channels(numChannels);
-   encoder.set_sample_rate(lrint(rate));
 
    // See note in GetMetadata() about a bug in libflac++ 1.1.2
    if (!GetMetadata(project, metadata)) {
-      return false;
+      delete job;
+      return NULL;
    }
 
    if (mMetadata) {
@@ -253,50 +411,57 @@ int ExportFLAC::Export(AudacityProject *project,
    }
 
    sampleFormat format;
+   unsigned bitsPerSample;
    if (bitDepthPref == wxT("24")) {
       format = int24Sample;
-      encoder.set_bits_per_sample(24);
+      bitsPerSample = 24;
    } else { //convert float to 16 bits
       format = int16Sample;
-      encoder.set_bits_per_sample(16);
+      bitsPerSample = 16;
    }
 
-   // Duplicate the flac command line compression levels
-   if (levelPref < 0 || levelPref > 8) {
-      levelPref = 5;
-   }
-   encoder.set_do_exhaustive_model_search(flacLevels[levelPref].do_exhaustive_model_search);
-   encoder.set_do_escape_coding(flacLevels[levelPref].do_escape_coding);
-   if (numChannels != 2) {
-      encoder.set_do_mid_side_stereo(false);
-      encoder.set_loose_mid_side_stereo(false);
-   }
-   else {
-      encoder.set_do_mid_side_stereo(flacLevels[levelPref].do_mid_side_stereo);
-      encoder.set_loose_mid_side_stereo(flacLevels[levelPref].loose_mid_side_stereo);
-   }
-   encoder.set_qlp_coeff_precision(flacLevels[levelPref].qlp_coeff_precision);
-   encoder.set_min_residual_partition_order(flacLevels[levelPref].min_residual_partition_order);
-   encoder.set_max_residual_partition_order(flacLevels[levelPref].max_residual_partition_order);
-   encoder.set_rice_parameter_search_dist(flacLevels[levelPref].rice_parameter_search_dist);
-   encoder.set_max_lpc_order(flacLevels[levelPref].max_lpc_order);
+   FLACEncoderSettings settings(numChannels, lrint(rate), bitsPerSample,
+                                levelPref);
+   settings.Apply(encoder);
 
 #ifdef LEGACY_FLAC
    encoder.init();
 #else
-   wxFFile f;     // will be closed when it goes out of scope
-   if (!f.Open(fName, wxT("w+b"))) {
+   // The job's wxFFile closes the file if the job is deleted before
+   // libflac has taken it over
+   if (!job->mFile.Open(fName, wxT("w+b"))) {
       wxMessageBox(wxString::Format(_("FLAC export couldn't open %s"), fName.c_str()));
-      return false;
+      if (mMetadata) {
+         ::FLAC__metadata_object_delete(mMetadata);
+      }
+      delete job;
+      return NULL;
    }
 
    // Even though there is an init() method that takes a filename, use the one that
    // takes a file handle because wxWidgets can open a file with a Unicode name and
-   // libflac can't (under Windows).
-   int status = encoder.init(f.fp());
+   // libflac can't (under Windows).  With threads to spare, runs of frames
+   // are encoded side by side, each by an encoder of its own.
+   int threads = gPrefs->Read(wxT("/FileFormats/FLACThreads"),
+                              (long)WorkerPool::GetDefaultNumThreads());
+   int status;
+   if (threads > 0 && ParallelFLACEncoder::CanEncode(settings)) {
+      job->mPool = AcquireEncoderPool(threads);
+      job->mParallel = new ParallelFLACEncoder(settings, job->mFile.fp(),
+                                               job->mPool);
+      status = job->mParallel->Init(mMetadata ? &mMetadata : NULL,
+                                    mMetadata ? 1 : 0);
+   }
+   else {
+      status = encoder.init(job->mFile.fp());
+   }
    if (status != FLAC__STREAM_ENCODER_INIT_STATUS_OK) {
       wxMessageBox(wxString::Format(_("FLAC encoder failed to initialize\nStatus: %d"), status));
-      return false;
+      if (mMetadata) {
+         ::FLAC__metadata_object_delete(mMetadata);
+      }
+      delete job;
+      return NULL;
    }
 #endif
 
@@ -307,60 +472,23 @@ int ExportFLAC::Export(AudacityProject *project,
    int numWaveTracks;
    WaveTrack **waveTracks;
    tracks->GetWaveTracks(selectionOnly, &numWaveTracks, &waveTracks);
-   Mixer *mixer = CreateMixer(numWaveTracks, waveTracks,
+   job->mMixer = CreateMixer(numWaveTracks, waveTracks,
                             tracks->GetTimeTrack(),
                             t0, t1,
                             numChannels, SAMPLES_PER_RUN, false,
                             rate, format, true, mixerSpec);
    delete [] waveTracks;
 
-   int i, j;
-   FLAC__int32 **tmpsmplbuf = new FLAC__int32*[numChannels];
-   for (i = 0; i < numChannels; i++) {
-      tmpsmplbuf[i] = (FLAC__int32 *) calloc(SAMPLES_PER_RUN, sizeof(FLAC__int32));
-   }
-
-   ProgressDialog *progress = new ProgressDialog(wxFileName(fName).GetName(),
-         selectionOnly ?
-         _("Exporting the selected audio as FLAC") :
-         _("Exporting the entire project as FLAC"));
-
-   while (updateResult == eProgressSuccess) {
-      sampleCount samplesThisRun = mixer->Process(SAMPLES_PER_RUN);
-      if (samplesThisRun == 0) { //stop encoding
-         break;
-      }
-      else {
-         for (i = 0; i < numChannels; i++) {
-            samplePtr mixed = mixer->GetBuffer(i);
-            if (format == int24Sample) {
-               for (j = 0; j < samplesThisRun; j++) {
-                  tmpsmplbuf[i][j] = ((int *) mixed)[j];
-               }
-            }
-            else {
-               for (j = 0; j < samplesThisRun; j++) {
-                  tmpsmplbuf[i][j] = ((short *) mixed)[j];
-               }
-            }
-         }
-         encoder.process(tmpsmplbuf, samplesThisRun);
-      }
-      updateResult = progress->Update(mixer->MixGetCurrentTime()-t0, t1-t0);
-   }
-   f.Detach(); // libflac closes the file
-   encoder.finish();
-
-   delete progress;
-
-   for (i = 0; i < numChannels; i++) {
-      free(tmpsmplbuf[i]);
+   job->mSampleBuffers = new FLAC__int32*[numChannels];
+   for (int i = 0; i < numChannels; i++) {
+      job->mSampleBuffers[i] = (FLAC__int32 *) calloc(SAMPLES_PER_RUN, sizeof(FLAC__int32));
    }
-   delete mixer;
-
-   delete[] tmpsmplbuf;
+   job->mNumChannels = numChannels;
+   job->mFormat = format;
+   job->mT0 = t0;
+   job->mT1 = t1;
 
-   return updateResult;
+   return job;
 }
 
 bool ExportFLAC::DisplayOptions(wxWindow *parent, int WXUNUSED(format))
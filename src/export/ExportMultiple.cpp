@@ -36,6 +36,9 @@
 #include <wx/stattext.h>
 #include <wx/textctrl.h>
 #include <wx/textdlg.h>
+#include <wx/thread.h>
+
+#include <vector>
 
 #include "Export.h"
 #include "ExportMultiple.h"
@@ -47,7 +50,9 @@
 #include "../Project.h"
 #include "../Prefs.h"
 #include "../Tags.h"
+#include "../WorkerPool.h"
 #include "../widgets/HelpSystem.h"
+#include "../widgets/ProgressDialog.h"
 
 
 /* define our dynamic array of export settings */
@@ -680,29 +685,15 @@ int ExportMultiple::ExportMultipleByLabel(bool byName,
       if (!setting.filetags.ShowEditDialog(mProject,_("Edit Metadata"), tagsPrompt))
          return false;
 
+      setting.channels = channels;
+
       /* add the settings to the array of settings to be used for export */
       exportSettings.Add(setting);
 
       l++;  // next label, count up one
    }
 
-   int ok = eProgressSuccess;   // did it work?
-   int count = 0; // count the number of sucessful runs
-   ExportKit activeSetting;  // pointer to the settings in use for this export
-   /* Go round again and do the exporting (so this run is slow but
-    * non-interactive) */
-   for (count = 0; count < numFiles; count++) {
-      /* get the settings to use for the export from the array */
-      activeSetting = exportSettings[count];
-
-      // Export it
-      ok = DoExport(channels, activeSetting.destfile, false, activeSetting.t0, activeSetting.t1, activeSetting.filetags);
-      if (ok != eProgressSuccess && ok != eProgressStopped) {
-         break;
-      }
-   }
-
-   return ok;
+   return DoExports(exportSettings, false);
 }
 
 int ExportMultiple::ExportMultipleByTrack(bool byName,
@@ -818,54 +809,17 @@ int ExportMultiple::ExportMultipleByTrack(bool byName,
       if (!setting.filetags.ShowEditDialog(mProject,_("Edit Metadata"), tagsPrompt))
          return false;
 
+      // remember the tracks to select when this file is exported
+      setting.track = tr;
+      setting.track2 = tr2;
+
       /* add the settings to the array of settings to be used for export */
       exportSettings.Add(setting);
 
       l++;  // next track, count up one
    }
    // end of user-interactive data gathering loop, start of export processing
-   // loop
-   int count = 0; // count the number of sucessful runs
-   ExportKit activeSetting;  // pointer to the settings in use for this export
-   for (tr = mIterator.First(mTracks); tr != NULL; tr = mIterator.Next()) {
-
-      // Want only non-muted wave tracks.
-      if ((tr->GetKind() != Track::Wave) || (tr->GetMute() == true)) {
-         continue;
-      }
-
-      /* Select the track */
-      tr->SetSelected(true);
-
-      // Check for a linked track
-      tr2 = NULL;
-      if (tr->GetLinked()) {
-         tr2 = mIterator.Next();
-         if (tr2) {
-            // Select it also
-            tr2->SetSelected(true);
-         }
-      }
-
-      /* get the settings to use for the export from the array */
-      activeSetting = exportSettings[count];
-      // Export the data. "channels" are per track.
-      ok = DoExport(activeSetting.channels, activeSetting.destfile, true, activeSetting.t0, activeSetting.t1, activeSetting.filetags);
-
-      // Reset selection state
-      tr->SetSelected(false);
-      if (tr2) {
-         tr2->SetSelected(false);
-      }
-
-      // Stop if an error occurred
-      if (ok != eProgressSuccess && ok != eProgressStopped) {
-         break;
-      }
-      // increment export counter
-      count++;
-
-   }
+   ok = DoExports(exportSettings, true);
 
    // Restore the selection states
    for (size_t i = 0; i < mSelected.GetCount(); i++) {
@@ -887,18 +841,8 @@ int ExportMultiple::DoExport(int channels,
    if (selectedOnly) wxLogDebug(wxT("Selected Region Only"));
    else wxLogDebug(wxT("Whole Project"));
 
-   if (mOverwrite->GetValue()) {
-      // Make sure we don't overwrite (corrupt) alias files
-      if (!mProject->GetDirManager()->EnsureSafeFilename(name)) {
-         return false;
-      }
-   }
-   else {
-      int i = 2;
-      wxString base(name.GetName());
-      while (name.FileExists()) {
-         name.SetName(wxString::Format(wxT("%s-%d"), base.c_str(), i++));
-      }
+   if (!PrepareFileName(name)) {
+      return false;
    }
 
    // Call the format export routine
@@ -919,6 +863,293 @@ int ExportMultiple::DoExport(int channels,
    return success;
 }
 
+bool ExportMultiple::PrepareFileName(wxFileName &name)
+{
+   if (mOverwrite->GetValue()) {
+      // Make sure we don't overwrite (corrupt) alias files
+      return mProject->GetDirManager()->EnsureSafeFilename(name);
+   }
+
+   int i = 2;
+   wxString base(name.GetName());
+   while (name.FileExists()) {
+      name.SetName(wxString::Format(wxT("%s-%d"), base.c_str(), i++));
+   }
+
+   return true;
+}
+
+void ExportMultiple::SelectKitTracks(ExportKit &setting, bool selected)
+{
+   if (setting.track) {
+      setting.track->SetSelected(selected);
+   }
+   if (setting.track2) {
+      setting.track2->SetSelected(selected);
+   }
+}
+
+/// State shared between the threads of a concurrent ExportMultiple and the
+/// dialog that is waiting for them.
+class ExportMultipleState
+{
+public:
+   ExportMultipleState(int numJobs)
+      : mJobReady(mMutex), mJobDone(mMutex),
+        mResult(eProgressSuccess),
+        mJobs(numJobs, (ExportJob *)NULL), mNumJobs(0), mStopping(false),
+        mFraction(numJobs, 0.0), mRunResult(numJobs, eProgressFailed),
+        mDone(numJobs, false), mNumDone(0)
+   {
+   }
+
+   wxMutex mMutex;
+   wxCondition mJobReady;        ///< mNumJobs went up, or mStopping was set
+   wxCondition mJobDone;         ///< A job returned from Run()
+   int mResult;                  ///< What the user has asked the jobs to do
+   std::vector<ExportJob *> mJobs;  ///< The jobs, NULL where setting one up failed
+   int mNumJobs;                 ///< How many of mJobs the dialog has set up
+   bool mStopping;               ///< No more jobs will be set up
+   std::vector<double> mFraction;   ///< How far through each job has got
+   std::vector<int> mRunResult;  ///< What each job's Run() returned
+   std::vector<bool> mDone;      ///< Which jobs have returned from Run()
+   int mNumDone;                 ///< How many have
+};
+
+/// Hands one job's progress to the shared state, and the user's cancel or
+/// stop request back to the job.
+class ExportMultipleProgress : public ExportProgress
+{
+public:
+   ExportMultipleProgress(ExportMultipleState *state, int index)
+      : mState(state), mIndex(index)
+   {
+   }
+
+   virtual int Update(double current, double total)
+   {
+      wxMutexLocker locker(mState->mMutex);
+      mState->mFraction[mIndex] = (total > 0.0) ? current / total : 1.0;
+      return mState->mResult;
+   }
+
+private:
+   ExportMultipleState *mState;
+   int mIndex;
+};
+
+/// Runs the ExportJobs of a concurrent ExportMultiple on a WorkerPool, each
+/// as soon as the dialog has set it up.
+class ExportMultipleWorker : public WorkerPoolJob
+{
+public:
+   ExportMultipleWorker(ExportMultipleState *state)
+      : mState(state)
+   {
+   }
+
+   virtual void RunItem(int item)
+   {
+      ExportJob *job = NULL;
+      {
+         wxMutexLocker locker(mState->mMutex);
+         while (item >= mState->mNumJobs && !mState->mStopping) {
+            mState->mJobReady.Wait();
+         }
+         if (item < mState->mNumJobs) {
+            job = mState->mJobs[item];
+         }
+      }
+
+      // Files that were never set up are skipped
+      if (!job) {
+         return;
+      }
+
+      ExportMultipleProgress progress(mState, item);
+      int result = job->Run(&progress);
+
+      wxMutexLocker locker(mState->mMutex);
+      mState->mRunResult[item] = result;
+      mState->mDone[item] = true;
+      mState->mNumDone++;
+      mState->mJobDone.Signal();
+   }
+
+private:
+   ExportMultipleState *mState;
+};
+
+int ExportMultiple::DoExports(ExportKitArray &settings, bool selectedOnly)
+{
+   int numFiles = settings.GetCount();
+   ExportPlugin *plugin = mPlugins[mPluginIndex];
+   int ok = eProgressSuccess;
+
+   // Each file is mixed and encoded on a thread of the pool, so this many
+   // files are written at once
+   long maxJobs = gPrefs->Read(wxT("/Export/MultipleThreads"),
+                               (long)(WorkerPool::GetDefaultNumThreads() + 1));
+   bool concurrent = (maxJobs > 1 && numFiles > 1 &&
+                      plugin->CanCreateExportJob(mSubFormatIndex));
+   WorkerPool pool(concurrent ? maxJobs : 0);
+
+   if (pool.GetNumThreads() == 0) {
+      for (int i = 0; i < numFiles; i++) {
+         ExportKit &setting = settings[i];
+
+         SelectKitTracks(setting, true);
+         ok = DoExport(setting.channels, setting.destfile, selectedOnly,
+                       setting.t0, setting.t1, setting.filetags);
+         SelectKitTracks(setting, false);
+
+         // Stop if an error occurred
+         if (ok != eProgressSuccess && ok != eProgressStopped) {
+            break;
+         }
+      }
+
+      return ok;
+   }
+   maxJobs = pool.GetNumThreads();
+
+   ExportMultipleState state(numFiles);
+   ExportMultipleWorker worker(&state);
+   std::vector<int> results(numFiles, eProgressSuccess);
+   std::vector<bool> finished(numFiles, false);
+   wxArrayString names;
+   names.Add(wxEmptyString, numFiles);
+
+   double total = 0.0;
+   for (int i = 0; i < numFiles; i++) {
+      total += wxMax(settings[i].t1 - settings[i].t0, 0.0);
+   }
+
+   ProgressDialog progress(_("Export Multiple"),
+                           wxString::Format(_("Exporting %d files"), numFiles));
+
+   // The pool's threads take the files in order, each waiting until the
+   // loop below has set its job up
+   pool.Post(&worker, numFiles);
+
+   int next = 0;
+   int running = 0;
+   int numFinished = 0;
+   bool starting = true;
+   while ((starting && next < numFiles) || running > 0) {
+      // Set up more jobs while there are threads to spare.  Files are named
+      // and created here, in order, so that a clashing name gets the same
+      // "-2" suffix whatever order the exports finish in.
+      while (starting && next < numFiles && running < maxJobs) {
+         ExportKit &setting = settings[next];
+         wxFileName name = setting.destfile;
+         ExportJob *job = NULL;
+
+         wxLogDebug(wxT("Doing multiple Export: File name \"%s\""), (name.GetFullName()).c_str());
+
+         if (PrepareFileName(name)) {
+            SelectKitTracks(setting, true);
+            job = plugin->CreateExportJob(mProject,
+                                          setting.channels,
+                                          name.GetFullPath(),
+                                          selectedOnly,
+                                          setting.t0,
+                                          setting.t1,
+                                          NULL,
+                                          &setting.filetags,
+                                          mSubFormatIndex);
+            SelectKitTracks(setting, false);
+         }
+
+         names[next] = name.GetFullPath();
+
+         if (job) {
+            running++;
+         }
+         else {
+            results[next] = eProgressFailed;
+            finished[next] = true;
+            starting = false;
+         }
+
+         wxMutexLocker locker(state.mMutex);
+         state.mJobs[next] = job;
+         state.mNumJobs = ++next;
+         state.mJobReady.Broadcast();
+      }
+
+      // Finish off any jobs that are done; this reports their errors, so
+      // it must happen here rather than on the worker thread
+      double done = 0.0;
+      for (int i = 0; i < next; i++) {
+         double length = wxMax(settings[i].t1 - settings[i].t0, 0.0);
+         bool jobDone;
+         int runResult;
+
+         if (finished[i]) {
+            done += length;
+            continue;
+         }
+
+         {
+            wxMutexLocker locker(state.mMutex);
+            jobDone = state.mDone[i];
+            runResult = state.mRunResult[i];
+            done += length * state.mFraction[i];
+         }
+
+         if (jobDone) {
+            results[i] = state.mJobs[i]->Finish(runResult);
+            delete state.mJobs[i];
+            finished[i] = true;
+            numFinished++;
+            running--;
+
+            if (results[i] != eProgressSuccess && results[i] != eProgressStopped) {
+               starting = false;
+            }
+         }
+      }
+
+      int update = progress.Update(done, total);
+
+      wxMutexLocker locker(state.mMutex);
+      if (update != eProgressSuccess) {
+         state.mResult = update;
+         starting = false;
+      }
+
+      // Let the threads waiting for files that won't be set up go
+      if (!starting && !state.mStopping) {
+         state.mStopping = true;
+         state.mJobReady.Broadcast();
+      }
+
+      // Sleep until a job finishes, waking now and then to move the
+      // progress dialog on
+      if (running > 0 && state.mNumDone == numFinished) {
+         state.mJobDone.WaitTimeout(100);
+      }
+   }
+
+   pool.Wait();
+
+   // Report in the order the files were asked for, not the order they
+   // finished in
+   for (int i = 0; i < next; i++) {
+      if (results[i] == eProgressSuccess || results[i] == eProgressStopped) {
+         mExported.Add(names[i]);
+      }
+
+      // The first failure is the one reported
+      if (ok == eProgressSuccess || ok == eProgressStopped) {
+         ok = results[i];
+      }
+   }
+
+   return ok;
+}
+
 wxString ExportMultiple::MakeFileName(wxString input)
 {
    wxString newname; // name we are generating
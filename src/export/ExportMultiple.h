@@ -28,6 +28,8 @@ class wxTextCtrl;
 
 class AudacityProject;
 class ShuttleGui;
+class ExportKit;
+class ExportKitArray;
 
 class ExportMultiple : public wxDialog
 {
@@ -78,6 +80,25 @@ private:
                  double t0,
                  double t1,
                  Tags tags);
+
+   /** Export every file of an export multiple set
+    *
+    * Plug-ins that can hand out an ExportJob have several files written at
+    * once on a WorkerPool, behind a single progress dialog; the rest go
+    * through DoExport() one file at a time.
+    * @param settings The files to export
+    * @param selectedOnly Should we export the selected tracks only?
+    */
+   int DoExports(ExportKitArray &settings, bool selectedOnly);
+
+   /** Applies the overwrite setting to the name of a file about to be
+    * exported.  Returns false if the export should not go ahead. */
+   bool PrepareFileName(wxFileName &name);
+
+   /** Selects (or deselects) the tracks an ExportMultipleByTrack kit is
+    * exported from */
+   void SelectKitTracks(ExportKit &setting, bool selected);
+
    /** \brief Takes an arbitrary text string and converts it to a form that can
     * be used as a file name, if necessary prompting the user to edit the file
     * name produced */
@@ -194,11 +215,15 @@ private:
    class ExportKit
    {
    public:
+      ExportKit() : t0(0.0), t1(0.0), channels(0), track(NULL), track2(NULL) {}
+
       Tags filetags; /**< The set of metadata to use for the export */
       wxFileName destfile; /**< The file to export to */
       double t0;           /**< Start time for the export */
       double t1;           /**< End time for the export */
       int channels;        /**< Number of channels for ExportMultipleByTrack */
+      Track *track;        /**< Track to select for ExportMultipleByTrack */
+      Track *track2;       /**< Its linked track, if any */
    };  // end of ExportKit declaration
    /* we are going to want an set of these kits, and don't know how many until
     * runtime. I would dearly like to use a std::vector, but it seems that
@@ -12,6 +12,7 @@
 
 #include <wx/choice.h>
 #include <wx/dynlib.h>
+#include <wx/file.h>
 #include <wx/filename.h>
 #include <wx/intl.h>
 #include <wx/timer.h>
@@ -33,7 +34,7 @@
 #include "../Tags.h"
 #include "../Track.h"
 #include "../WaveTrack.h"
-#include "../ondemand/ODManager.h"
+#include "../ondemand/ODSndFileLock.h"
 
 #include "Export.h"
 #include "ExportPCM.h"
@@ -316,10 +317,21 @@ public:
                MixerSpec *mixerSpec = NULL,
                Tags *metadata = NULL,
                int subformat = 0);
+   bool CanCreateExportJob(int subformat = 0);
+   ExportJob *CreateExportJob(AudacityProject *project,
+                              int channels,
+                              wxString fName,
+                              bool selectedOnly,
+                              double t0,
+                              double t1,
+                              MixerSpec *mixerSpec = NULL,
+                              Tags *metadata = NULL,
+                              int subformat = 0);
    // optional
    wxString GetExtension(int index = 0);
 
 private:
+   friend class ExportPCMJob;
 
    char *AdjustString(wxString wxStr, int sf_format);
    bool AddStrings(AudacityProject *project, SNDFILE *sf, Tags *tags, int sf_format);
@@ -393,6 +405,135 @@ void ExportPCM::Destroy()
    delete this;
 }
 
+//----------------------------------------------------------------------------
+// ExportPCMJob
+//----------------------------------------------------------------------------
+
+/// Mixes into an open libsndfile file
+class ExportPCMJob : public ExportJob
+{
+public:
+   ExportPCMJob(ExportPCM *plugin, const wxString &title, const wxString &message)
+      : ExportJob(title, message)
+   {
+      mPlugin = plugin;
+      mSf = NULL;
+      mMixer = NULL;
+   }
+
+   virtual ~ExportPCMJob()
+   {
+      delete mMixer;
+   }
+
+   virtual int Run(ExportProgress *progress);
+   virtual int Finish(int result);
+
+   ExportPCM   *mPlugin;
+   wxFile       mFile;
+   SNDFILE     *mSf;
+   int          mStripe;
+   int          mSfFormat;
+   wxString     mFormatStr;
+   wxString     mFileName;
+   sampleFormat mFormat;
+   int          mMaxBlockLen;
+   MixerPipeline *mMixer;
+   double       mT0;
+   double       mT1;
+   Tags         mMetadata;
+
+   // libsndfile's complaint if a write failed, for Finish() to show
+   wxString     mWriteError;
+};
+
+int ExportPCMJob::Run(ExportProgress *progress)
+{
+   int updateResult = eProgressSuccess;
+
+   while(updateResult == eProgressSuccess) {
+      sampleCount samplesWritten;
+      sampleCount numSamples = mMixer->Process(mMaxBlockLen);
+
+      if (numSamples == 0)
+         break;
+
+      samplePtr mixed = mMixer->GetBuffer();
+
+      ODSndFileLock::LockStripe(mStripe);
+      if (mFormat == int16Sample)
+         samplesWritten = sf_writef_short(mSf, (short *)mixed, numSamples);
+      else
+         samplesWritten = sf_writef_float(mSf, (float *)mixed, numSamples);
+      ODSndFileLock::UnlockStripe(mStripe);
+
+      if (samplesWritten != numSamples) {
+        char buffer2[1000];
+        sf_error_str(mSf, buffer2, 1000);
+        mWriteError = wxString::FromAscii(buffer2);
+        break;
+      }
+
+      updateResult = progress->Update(mMixer->MixGetCurrentTime()-mT0, mT1-mT0);
+   }
+
+   return updateResult;
+}
+
+int ExportPCMJob::Finish(int updateResult)
+{
+   int err;
+
+   delete mMixer;
+   mMixer = NULL;
+
+   if (!mWriteError.IsEmpty()) {
+      wxMessageBox(wxString::Format(
+         /* i18n-hint: %s will be the error message from libsndfile, which
+          * is usually something unhelpful (and untranslated) like "system
+          * error" */
+         _("Error while writing %s file (disk full?).\nLibsndfile says \"%s\""),
+         mFormatStr.c_str(),
+         mWriteError.c_str()));
+   }
+
+   // Install the WAV metata in a "LIST" chunk at the end of the file
+   if ((mSfFormat & SF_FORMAT_TYPEMASK) == SF_FORMAT_WAV ||
+       (mSfFormat & SF_FORMAT_TYPEMASK) == SF_FORMAT_WAVEX) {
+      if (!mPlugin->AddStrings(NULL, mSf, &mMetadata, mSfFormat)) {
+         sf_close(mSf);
+         return false;
+      }
+   }
+
+   ODSndFileLock::LockStripe(mStripe);
+   err = sf_close(mSf);
+   ODSndFileLock::UnlockStripe(mStripe);
+
+   if (err) {
+      char buffer[1000];
+      sf_error_str(mSf, buffer, 1000);
+      wxMessageBox(wxString::Format
+            /* i18n-hint: %s will be the error message from libsndfile */
+                   (_("Error (file may not have been written): %s"),
+                    buffer));
+   }
+
+   if (((mSfFormat & SF_FORMAT_TYPEMASK) == SF_FORMAT_AIFF) ||
+       ((mSfFormat & SF_FORMAT_TYPEMASK) == SF_FORMAT_WAV))
+      mPlugin->AddID3Chunk(mFileName, &mMetadata, mSfFormat);
+
+#ifdef __WXMAC__
+#if !wxCHECK_VERSION(3, 0, 0)
+   wxFileName fn(mFileName);
+   fn.MacSetTypeAndCreator(sf_header_mactype(mSfFormat & SF_FORMAT_TYPEMASK),
+                           AUDACITY_CREATOR);
+#endif
+#endif
+
+   return updateResult;
+}
+
 /**
  *
  * @param subformat Control whether we are doing a "preset" export to a popular
@@ -408,6 +549,30 @@ int ExportPCM::Export(AudacityProject *project,
                        MixerSpec *mixerSpec,
                        Tags *metadata,
                        int subformat)
+{
+   ExportJob *job = CreateExportJob(project, numChannels, fName,
+                                    selectionOnly, t0, t1,
+                                    mixerSpec, metadata, subformat);
+   if (!job)
+      return false;
+
+   return RunExportJob(job);
+}
+
+bool ExportPCM::CanCreateExportJob(int WXUNUSED(subformat))
+{
+   return true;
+}
+
+ExportJob *ExportPCM::CreateExportJob(AudacityProject *project,
+                                      int numChannels,
+                                      wxString fName,
+                                      bool selectionOnly,
+                                      double t0,
+                                      double t1,
+                                      MixerSpec *mixerSpec,
+                                      Tags *metadata,
+                                      int subformat)
 {
    double       rate = project->GetRate();
    TrackList   *tracks = project->GetTracks();
@@ -436,15 +601,22 @@ int ExportPCM::Export(AudacityProject *project,
    wxString     formatStr;
    SF_INFO      info;
    SNDFILE     *sf = NULL;
-   int          err;
 
-   //This whole operation should not occur while a file is being loaded on OD,
-   //(we are worried about reading from a file being written to,) so we block.
-   //Furthermore, we need to do this because libsndfile is not threadsafe.
-   ODManager::LockLibSndFileMutex();
    formatStr = sf_header_name(sf_format & SF_FORMAT_TYPEMASK);
 
-   ODManager::UnlockLibSndFileMutex();
+   ExportPCMJob *job = new ExportPCMJob(this,
+      wxFileName(fName).GetName(),
+      selectionOnly ?
+      wxString::Format(_("Exporting the selected audio as %s"),
+                       formatStr.c_str()) :
+      wxString::Format(_("Exporting the entire project as %s"),
+                       formatStr.c_str()));
+
+   //Writes take the stripe lock of the file so that nobody reads it
+   //on OD while a block is half written.  It is taken per block rather
+   //than for the whole export because the progress dialog yields, and
+   //drawing may read aliased files.
+   job->mStripe = ODSndFileLock::GetStripe(wxFileName(fName).GetFullPath());
 
    // Use libsndfile to export file
 
@@ -461,26 +633,28 @@ int ExportPCM::Export(AudacityProject *project,
       info.format = (info.format & SF_FORMAT_TYPEMASK);
    if (!sf_format_check(&info)) {
       wxMessageBox(_("Cannot export audio in this format."));
-      return false;
+      delete job;
+      return NULL;
    }
 
-   wxFile f;   // will be closed when it goes out of scope
-
-   if (f.Open(fName, wxFile::write)) {
+   // The job's wxFile closes the file when the job is deleted
+   if (job->mFile.Open(fName, wxFile::write)) {
       // Even though there is an sf_open() that takes a filename, use the one that
       // takes a file descriptor since wxWidgets can open a file with a Unicode name and
       // libsndfile can't (under Windows).
-      ODManager::LockLibSndFileMutex();
-      sf = sf_open_fd(f.fd(), SFM_WRITE, &info, FALSE);
+      ODSndFileLock::LockShared();
+      sf = sf_open_fd(job->mFile.fd(), SFM_WRITE, &info, FALSE);
+      ODSndFileLock::UnlockShared();
       //add clipping for integer formats.  We allow floats to clip.
-      sf_command(sf, SFC_SET_CLIPPING, NULL,sf_subtype_is_integer(sf_format)?SF_TRUE:SF_FALSE) ;
-      ODManager::UnlockLibSndFileMutex();
+      if (sf)
+         sf_command(sf, SFC_SET_CLIPPING, NULL,sf_subtype_is_integer(sf_format)?SF_TRUE:SF_FALSE) ;
    }
 
    if (!sf) {
       wxMessageBox(wxString::Format(_("Cannot export audio to %s"),
                                     fName.c_str()));
-      return false;
+      delete job;
+      return NULL;
    }
    // Retrieve tags if not given a set
    if (metadata == NULL)
@@ -492,7 +666,8 @@ int ExportPCM::Export(AudacityProject *project,
         (sf_format & SF_FORMAT_TYPEMASK) != SF_FORMAT_WAVEX) {
        if (!AddStrings(project, sf, metadata, sf_format)) {
           sf_close(sf);
-          return false;
+          delete job;
+          return NULL;
        }
    }
 
@@ -504,97 +679,27 @@ int ExportPCM::Export(AudacityProject *project,
 
    int maxBlockLen = 44100 * 5;
 
-   int updateResult = eProgressSuccess;
-
    int numWaveTracks;
    WaveTrack **waveTracks;
    tracks->GetWaveTracks(selectionOnly, &numWaveTracks, &waveTracks);
-   Mixer *mixer = CreateMixer(numWaveTracks, waveTracks,
+   job->mMixer = CreateMixer(numWaveTracks, waveTracks,
                             tracks->GetTimeTrack(),
                             t0, t1,
                             info.channels, maxBlockLen, true,
                             rate, format, true, mixerSpec);
-
-   ProgressDialog *progress = new ProgressDialog(wxFileName(fName).GetName(),
-      selectionOnly ?
-      wxString::Format(_("Exporting the selected audio as %s"),
-                       formatStr.c_str()) :
-      wxString::Format(_("Exporting the entire project as %s"),
-                       formatStr.c_str()));
-
-   while(updateResult == eProgressSuccess) {
-      sampleCount samplesWritten;
-      sampleCount numSamples = mixer->Process(maxBlockLen);
-
-      if (numSamples == 0)
-         break;
-
-      samplePtr mixed = mixer->GetBuffer();
-
-      ODManager::LockLibSndFileMutex();
-      if (format == int16Sample)
-         samplesWritten = sf_writef_short(sf, (short *)mixed, numSamples);
-      else
-         samplesWritten = sf_writef_float(sf, (float *)mixed, numSamples);
-      ODManager::UnlockLibSndFileMutex();
-
-      if (samplesWritten != numSamples) {
-        char buffer2[1000];
-        sf_error_str(sf, buffer2, 1000);
-        wxMessageBox(wxString::Format(
-           /* i18n-hint: %s will be the error message from libsndfile, which
-            * is usually something unhelpful (and untranslated) like "system
-            * error" */
-           _("Error while writing %s file (disk full?).\nLibsndfile says \"%s\""),
-           formatStr.c_str(),
-           wxString::FromAscii(buffer2).c_str()));
-        break;
-      }
-
-      updateResult = progress->Update(mixer->MixGetCurrentTime()-t0, t1-t0);
-   }
-
-   delete progress;
-
-   delete mixer;
-
    delete[] waveTracks;
 
-   // Install the WAV metata in a "LIST" chunk at the end of the file
-   if ((sf_format & SF_FORMAT_TYPEMASK) == SF_FORMAT_WAV ||
-       (sf_format & SF_FORMAT_TYPEMASK) == SF_FORMAT_WAVEX) {
-      if (!AddStrings(project, sf, metadata, sf_format)) {
-         sf_close(sf);
-         return false;
-      }
-   }
-
-   ODManager::LockLibSndFileMutex();
-   err = sf_close(sf);
-   ODManager::UnlockLibSndFileMutex();
-
-   if (err) {
-      char buffer[1000];
-      sf_error_str(sf, buffer, 1000);
-      wxMessageBox(wxString::Format
-            /* i18n-hint: %s will be the error message from libsndfile */
-                   (_("Error (file may not have been written): %s"),
-                    buffer));
-   }
-
-   if (((sf_format & SF_FORMAT_TYPEMASK) == SF_FORMAT_AIFF) ||
-       ((sf_format & SF_FORMAT_TYPEMASK) == SF_FORMAT_WAV))
-      AddID3Chunk(fName, metadata, sf_format);
-
-#ifdef __WXMAC__
-#if !wxCHECK_VERSION(3, 0, 0)
-   wxFileName fn(fName);
-   fn.MacSetTypeAndCreator(sf_header_mactype(sf_format & SF_FORMAT_TYPEMASK),
-                           AUDACITY_CREATOR);
-#endif
-#endif
-
-   return updateResult;
+   job->mSf = sf;
+   job->mSfFormat = sf_format;
+   job->mFormatStr = formatStr;
+   job->mFileName = fName;
+   job->mFormat = format;
+   job->mMaxBlockLen = maxBlockLen;
+   job->mT0 = t0;
+   job->mT1 = t1;
+   job->mMetadata = *metadata;
+
+   return job;
 }
 
 char *ExportPCM::AdjustString(const wxString wxStr, int sf_format)
@@ -0,0 +1,678 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  ParallelFLACEncoder.cpp
+
+*******************************************************************//**
+
+\class ParallelFLACEncoder
+\brief Writes a FLAC file using several libFLAC encoders at once.
+
+Each run of frames is encoded by a libFLAC encoder that thinks it is
+writing a stream of its own, starting at frame 0.  Nothing else in a
+frame depends on the frames before it (except with loose mid/side
+stereo), so the only changes needed to stitch the runs together are the
+frame number in each frame header and the two CRCs that cover it.
+
+STREAMINFO holds the MD5 of all the samples, the total length and the
+smallest and largest frame, which no single encoder knows.  The MD5 is
+taken by one of the pool's items while the others encode, and the rest
+is gathered as the runs are written.  They are patched into the header
+at the end, just as libFLAC does when it has a seekable file.
+
+*//*******************************************************************/
+
+#include "../Audacity.h"
+
+#ifdef USE_LIBFLAC
+
+#include "ParallelFLACEncoder.h"
+
+#include <string.h>
+
+#include <wx/defs.h>
+#include <wx/debug.h>
+
+static const struct
+{
+   bool        do_exhaustive_model_search;
+   bool        do_escape_coding;
+   bool        do_mid_side_stereo;
+   bool        loose_mid_side_stereo;
+   unsigned    qlp_coeff_precision;
+   unsigned    min_residual_partition_order;
+   unsigned    max_residual_partition_order;
+   unsigned    rice_parameter_search_dist;
+   unsigned    max_lpc_order;
+} flacLevels[] = {
+   {  false,   false,   false,   false,   0, 2, 2, 0, 0  },
+   {  false,   false,   true,    true,    0, 2, 2, 0, 0  },
+   {  false,   false,   true,    false,   0, 0, 3, 0, 0  },
+   {  false,   false,   false,   false,   0, 3, 3, 0, 6  },
+   {  false,   false,   true,    true,    0, 3, 3, 0, 8  },
+   {  false,   false,   true,    false,   0, 3, 3, 0, 8  },
+   {  false,   false,   true,    false,   0, 0, 4, 0, 8  },
+   {  true,    false,   true,    false,   0, 0, 6, 0, 8  },
+   {  true,    false,   true,    false,   0, 0, 6, 0, 12 },
+};
+
+FLACEncoderSettings::FLACEncoderSettings(unsigned channels,
+                                         unsigned sampleRate,
+                                         unsigned bitsPerSample,
+                                         int level)
+{
+   // Duplicate the flac command line compression levels
+   if (level < 0 || level > 8) {
+      level = 5;
+   }
+
+   mChannels = channels;
+   mSampleRate = sampleRate;
+   mBitsPerSample = bitsPerSample;
+   mDoExhaustiveModelSearch = flacLevels[level].do_exhaustive_model_search;
+   mDoEscapeCoding = flacLevels[level].do_escape_coding;
+   if (channels != 2) {
+      mDoMidSideStereo = false;
+      mLooseMidSideStereo = false;
+   }
+   else {
+      mDoMidSideStereo = flacLevels[level].do_mid_side_stereo;
+      mLooseMidSideStereo = flacLevels[level].loose_mid_side_stereo;
+   }
+   mQlpCoeffPrecision = flacLevels[level].qlp_coeff_precision;
+   mMinResidualPartitionOrder = flacLevels[level].min_residual_partition_order;
+   mMaxResidualPartitionOrder = flacLevels[level].max_residual_partition_order;
+   mRiceParameterSearchDist = flacLevels[level].rice_parameter_search_dist;
+   mMaxLpcOrder = flacLevels[level].max_lpc_order;
+}
+
+#ifndef LEGACY_FLAC
+
+// Frames in each run.  A run sets up an encoder of its own, so runs
+// shouldn't be too short, but a batch (one run per thread) is held in
+// memory and encoded before the next is started.
+#define FRAMES_PER_RUN 16
+
+// STREAMINFO is the first metadata block, after "fLaC" and its own
+// 4-byte block header
+#define STREAMINFO_OFFSET 8
+#define STREAMINFO_LENGTH 34
+
+// Exported by libFLAC, for the flac command line's --no-md5-sum, but only
+// declared in a header it doesn't install
+extern "C" FLAC_API FLAC__bool
+FLAC__stream_encoder_set_do_md5(FLAC__StreamEncoder *encoder, FLAC__bool value);
+
+//----------------------------------------------------------------------------
+// CRCs and MD5, as FLAC uses them; libFLAC's own are not exported
+//----------------------------------------------------------------------------
+
+/// CRC-8 (x^8 + x^2 + x + 1) of a frame header and CRC-16
+/// (x^16 + x^15 + x^2 + 1) of a whole frame, most significant bit first,
+/// starting from 0.
+class ParallelFLACCRC
+{
+public:
+   ParallelFLACCRC()
+   {
+      for (unsigned i = 0; i < 256; i++) {
+         unsigned crc8 = i;
+         unsigned crc16 = i << 8;
+         for (int bit = 0; bit < 8; bit++) {
+            crc8 = (crc8 & 0x80) ? (crc8 << 1) ^ 0x07 : crc8 << 1;
+            crc16 = (crc16 & 0x8000) ? (crc16 << 1) ^ 0x8005 : crc16 << 1;
+         }
+         mTable8[i] = (FLAC__byte)crc8;
+         mTable16[i] = (FLAC__uint16)crc16;
+      }
+   }
+
+   FLAC__byte CRC8(const FLAC__byte *data, size_t len) const
+   {
+      unsigned crc = 0;
+      while (len--)
+         crc = mTable8[crc ^ *data++];
+      return (FLAC__byte)crc;
+   }
+
+   FLAC__uint16 CRC16(const FLAC__byte *data, size_t len) const
+   {
+      unsigned crc = 0;
+      while (len--)
+         crc = ((crc << 8) ^ mTable16[(crc >> 8) ^ *data++]) & 0xFFFF;
+      return (FLAC__uint16)crc;
+   }
+
+private:
+   FLAC__byte mTable8[256];
+   FLAC__uint16 mTable16[256];
+};
+
+// Built before main(), so the threads only ever read it
+static const ParallelFLACCRC sCRC;
+
+/// MD5 (RFC 1321), for the STREAMINFO signature of the samples
+class ParallelFLACMD5
+{
+public:
+   ParallelFLACMD5()
+   {
+      mState[0] = 0x67452301;
+      mState[1] = 0xefcdab89;
+      mState[2] = 0x98badcfe;
+      mState[3] = 0x10325476;
+      mLength = 0;
+      mBufferLen = 0;
+   }
+
+   void Update(const FLAC__byte *data, size_t len)
+   {
+      mLength += len;
+
+      if (mBufferLen > 0) {
+         size_t n = 64 - mBufferLen;
+         if (n > len)
+            n = len;
+         memcpy(mBuffer + mBufferLen, data, n);
+         mBufferLen += n;
+         data += n;
+         len -= n;
+         if (mBufferLen < 64)
+            return;
+         Transform(mBuffer);
+         mBufferLen = 0;
+      }
+
+      for (; len >= 64; data += 64, len -= 64)
+         Transform(data);
+
+      memcpy(mBuffer, data, len);
+      mBufferLen = len;
+   }
+
+   void Final(FLAC__byte digest[16])
+   {
+      FLAC__uint64 bits = mLength * 8;
+      FLAC__byte pad[72];
+      size_t padLen = (mBufferLen < 56) ? 56 - mBufferLen : 120 - mBufferLen;
+
+      memset(pad, 0, sizeof(pad));
+      pad[0] = 0x80;
+      for (int i = 0; i < 8; i++)
+         pad[padLen + i] = (FLAC__byte)(bits >> (8 * i));
+      Update(pad, padLen + 8);
+
+      for (int i = 0; i < 4; i++)
+         for (int j = 0; j < 4; j++)
+            digest[4 * i + j] = (FLAC__byte)(mState[i] >> (8 * j));
+   }
+
+private:
+   void Transform(const FLAC__byte block[64])
+   {
+      static const FLAC__uint32 k[64] = {
+         0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+         0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+         0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+         0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+         0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+         0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+         0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+         0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+         0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+         0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+         0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+         0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+         0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+         0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+         0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+         0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+      };
+      static const int r[16] = {
+         7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21,
+      };
+
+      FLAC__uint32 m[16];
+      for (int i = 0; i < 16; i++)
+         m[i] = (FLAC__uint32)block[4 * i] |
+                ((FLAC__uint32)block[4 * i + 1] << 8) |
+                ((FLAC__uint32)block[4 * i + 2] << 16) |
+                ((FLAC__uint32)block[4 * i + 3] << 24);
+
+      FLAC__uint32 a = mState[0], b = mState[1], c = mState[2], d = mState[3];
+      for (int i = 0; i < 64; i++) {
+         FLAC__uint32 f;
+         int g;
+         switch (i / 16) {
+         case 0:  f = (b & c) | (~b & d);  g = i;                break;
+         case 1:  f = (d & b) | (~d & c);  g = (5 * i + 1) % 16; break;
+         case 2:  f = b ^ c ^ d;           g = (3 * i + 5) % 16; break;
+         default: f = c ^ (b | ~d);        g = (7 * i) % 16;     break;
+         }
+
+         FLAC__uint32 sum = a + f + k[i] + m[g];
+         int s = r[(i / 16) * 4 + i % 4];
+         a = d;
+         d = c;
+         c = b;
+         b += (sum << s) | (sum >> (32 - s));
+      }
+
+      mState[0] += a;
+      mState[1] += b;
+      mState[2] += c;
+      mState[3] += d;
+   }
+
+   FLAC__uint32 mState[4];
+   FLAC__uint64 mLength;
+   FLAC__byte mBuffer[64];
+   size_t mBufferLen;
+};
+
+//----------------------------------------------------------------------------
+// ParallelFLACRun
+//----------------------------------------------------------------------------
+
+// Bytes in a frame or sample number coded as in UTF-8, from the first
+static unsigned UTF8Length(FLAC__byte first)
+{
+   unsigned len = 1;
+   if (first & 0x80)
+      while (len < 7 && (first & (0x80 >> len)))
+         len++;
+   return len;
+}
+
+static void AppendUTF8(std::vector<FLAC__byte> &out, FLAC__uint32 value)
+{
+   if (value < 0x80) {
+      out.push_back((FLAC__byte)value);
+      return;
+   }
+
+   int extra = (value < 0x800) ? 1 :
+               (value < 0x10000) ? 2 :
+               (value < 0x200000) ? 3 :
+               (value < 0x4000000) ? 4 : 5;
+
+   out.push_back((FLAC__byte)((0xFF00 >> (extra + 1)) |
+                              (value >> (6 * extra))));
+   for (int i = extra - 1; i >= 0; i--)
+      out.push_back((FLAC__byte)(0x80 | ((value >> (6 * i)) & 0x3F)));
+}
+
+/// A run of whole frames, and the encoder that turns it into a stream of
+/// its own
+class ParallelFLACRun : public FLAC::Encoder::Stream
+{
+public:
+   ParallelFLACRun(unsigned channels, unsigned maxLen)
+   {
+      mChannels = channels;
+      mSamples = new FLAC__int32*[channels];
+      for (unsigned c = 0; c < channels; c++)
+         mSamples[c] = new FLAC__int32[maxLen];
+      mLen = 0;
+      mFirstFrame = 0;
+      mKeepHeader = false;
+      mMinFrameSize = 0;
+      mMaxFrameSize = 0;
+      mOK = true;
+   }
+
+   virtual ~ParallelFLACRun()
+   {
+      for (unsigned c = 0; c < mChannels; c++)
+         delete[] mSamples[c];
+      delete[] mSamples;
+   }
+
+   /// Encodes mSamples into mOutput, numbering the frames from mFirstFrame
+   void Encode(const FLACEncoderSettings &settings)
+   {
+      mOutput.clear();
+      mFrames.clear();
+
+      settings.Apply(*this);
+      // The MD5 is taken once, of the whole stream, by the
+      // ParallelFLACEncoder
+      FLAC__stream_encoder_set_do_md5(encoder_, false);
+
+      mOK = (init() == FLAC__STREAM_ENCODER_INIT_STATUS_OK);
+      if (mOK && mLen > 0)
+         mOK = process(mSamples, mLen);
+      if (!finish())
+         mOK = false;
+
+      if (mOK)
+         Renumber();
+   }
+
+   FLAC__int32 **mSamples;
+   unsigned mLen;
+   unsigned mFirstFrame;
+
+   bool mKeepHeader;                   // keep the metadata blocks
+   std::vector<FLAC__byte> mHeader;    // the metadata blocks, if kept
+   std::vector<FLAC__byte> mOutput;    // the frames
+   std::vector<size_t> mFrames;        // where each frame starts in mOutput
+   unsigned mMinFrameSize;
+   unsigned mMaxFrameSize;
+   bool mOK;
+
+protected:
+   virtual ::FLAC__StreamEncoderWriteStatus write_callback(
+      const FLAC__byte buffer[], size_t bytes,
+      unsigned samples, unsigned WXUNUSED(current_frame))
+   {
+      // libFLAC writes each metadata block, and each frame, in one go
+      if (samples == 0) {
+         if (mKeepHeader)
+            mHeader.insert(mHeader.end(), buffer, buffer + bytes);
+      }
+      else {
+         mFrames.push_back(mOutput.size());
+         mOutput.insert(mOutput.end(), buffer, buffer + bytes);
+      }
+      return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+   }
+
+private:
+   /// Gives the frames their numbers in the whole stream, and notes the
+   /// smallest and largest of them
+   void Renumber()
+   {
+      bool same = (mFirstFrame == 0);
+      if (!same)
+         mRenumbered.clear();
+
+      mMinFrameSize = (1u << FLAC__STREAM_METADATA_STREAMINFO_MIN_FRAME_SIZE_LEN) - 1;
+      mMaxFrameSize = 0;
+
+      for (unsigned i = 0; i < mFrames.size(); i++) {
+         size_t start = mFrames[i];
+         size_t end = (i + 1 < mFrames.size()) ? mFrames[i + 1] : mOutput.size();
+         const FLAC__byte *frame = &mOutput[start];
+         size_t len = end - start;
+
+         if (!same) {
+            // The header is 4 bytes, then the frame number, then a block
+            // size and sample rate if they have no code of their own, then
+            // the CRC-8.  A CRC-16 of everything before it ends the frame.
+            unsigned numberLen = UTF8Length(frame[4]);
+            unsigned blockSizeCode = frame[2] >> 4;
+            unsigned rateCode = frame[2] & 0x0F;
+            unsigned extra = (blockSizeCode == 6) ? 1 : (blockSizeCode == 7) ? 2 : 0;
+            extra += (rateCode == 12) ? 1 : (rateCode == 13 || rateCode == 14) ? 2 : 0;
+            size_t body = 4 + numberLen + extra + 1;
+
+            size_t newStart = mRenumbered.size();
+            mRenumbered.insert(mRenumbered.end(), frame, frame + 4);
+            AppendUTF8(mRenumbered, mFirstFrame + i);
+            mRenumbered.insert(mRenumbered.end(),
+                               frame + 4 + numberLen, frame + body - 1);
+            mRenumbered.push_back(sCRC.CRC8(&mRenumbered[newStart],
+                                            mRenumbered.size() - newStart));
+            mRenumbered.insert(mRenumbered.end(), frame + body, frame + len - 2);
+
+            FLAC__uint16 crc = sCRC.CRC16(&mRenumbered[newStart],
+                                          mRenumbered.size() - newStart);
+            mRenumbered.push_back((FLAC__byte)(crc >> 8));
+            mRenumbered.push_back((FLAC__byte)crc);
+
+            mFrames[i] = newStart;
+            len = mRenumbered.size() - newStart;
+         }
+
+         if (len < mMinFrameSize)
+            mMinFrameSize = len;
+         if (len > mMaxFrameSize)
+            mMaxFrameSize = len;
+      }
+
+      if (!same)
+         mOutput.swap(mRenumbered);
+   }
+
+   unsigned mChannels;
+   std::vector<FLAC__byte> mRenumbered;
+};
+
+//----------------------------------------------------------------------------
+// ParallelFLACEncoder
+//----------------------------------------------------------------------------
+
+ParallelFLACEncoder::ParallelFLACEncoder(const FLACEncoderSettings &settings,
+                                         FILE *fp, WorkerPool *pool)
+   : mSettings(settings),
+     mFile(fp),
+     mPool(pool),
+     mRunLen(0),
+     mFilling(0),
+     mBatchLen(0),
+     mMD5(new ParallelFLACMD5),
+     mTotalSamples(0),
+     mNextFrame(0),
+     mMinFrameSize((1u << FLAC__STREAM_METADATA_STREAMINFO_MIN_FRAME_SIZE_LEN) - 1),
+     mMaxFrameSize(0),
+     mOK(true)
+{
+}
+
+ParallelFLACEncoder::~ParallelFLACEncoder()
+{
+   for (unsigned i = 0; i < mRuns.size(); i++)
+      delete mRuns[i];
+   delete mMD5;
+}
+
+bool ParallelFLACEncoder::CanEncode(const FLACEncoderSettings &settings)
+{
+   return !settings.mLooseMidSideStereo;
+}
+
+::FLAC__StreamEncoderInitStatus
+ParallelFLACEncoder::Init(::FLAC__StreamMetadata **metadata,
+                          unsigned numBlocks)
+{
+   // An encoder with no samples writes just the header, which is what the
+   // file starts with.  The runs' own copies of it are thrown away.
+   ParallelFLACRun header(mSettings.mChannels, 1);
+   mSettings.Apply(header);
+   if (metadata)
+      header.set_metadata(metadata, numBlocks);
+   header.mKeepHeader = true;
+
+   ::FLAC__StreamEncoderInitStatus status = header.init();
+   if (status != FLAC__STREAM_ENCODER_INIT_STATUS_OK)
+      return status;
+
+   mRunLen = header.get_blocksize() * FRAMES_PER_RUN;
+   header.finish();
+
+   mHeader = header.mHeader;
+   wxASSERT(mHeader.size() >= STREAMINFO_OFFSET + STREAMINFO_LENGTH);
+   WriteBytes(&mHeader[0], mHeader.size());
+
+   int numRuns = mPool->GetNumThreads() + 1;
+   for (int i = 0; i < numRuns; i++)
+      mRuns.push_back(new ParallelFLACRun(mSettings.mChannels, mRunLen));
+
+   return status;
+}
+
+bool ParallelFLACEncoder::Process(const FLAC__int32 * const buffer[],
+                                  unsigned samples)
+{
+   unsigned channels = mSettings.mChannels;
+
+   mTotalSamples += samples;
+
+   unsigned done = 0;
+   while (done < samples) {
+      ParallelFLACRun *run = mRuns[mFilling];
+      unsigned len = mRunLen - run->mLen;
+      if (len > samples - done)
+         len = samples - done;
+
+      for (unsigned c = 0; c < channels; c++)
+         memcpy(run->mSamples[c] + run->mLen, buffer[c] + done,
+                len * sizeof(FLAC__int32));
+      run->mLen += len;
+      done += len;
+
+      if (run->mLen == mRunLen && ++mFilling == mRuns.size()) {
+         if (!EncodeBatch())
+            return false;
+      }
+   }
+
+   return mOK;
+}
+
+bool ParallelFLACEncoder::Finish()
+{
+   if (!EncodeBatch())
+      return false;
+
+   // Fill in what libFLAC leaves to the end
+   FLAC__byte *info = &mHeader[STREAMINFO_OFFSET];
+
+   info[4] = (FLAC__byte)(mMinFrameSize >> 16);
+   info[5] = (FLAC__byte)(mMinFrameSize >> 8);
+   info[6] = (FLAC__byte)mMinFrameSize;
+   info[7] = (FLAC__byte)(mMaxFrameSize >> 16);
+   info[8] = (FLAC__byte)(mMaxFrameSize >> 8);
+   info[9] = (FLAC__byte)mMaxFrameSize;
+
+   // 36 bits of total samples, after the sample rate, channels and bps
+   info[13] = (FLAC__byte)((info[13] & 0xF0) | ((mTotalSamples >> 32) & 0x0F));
+   info[14] = (FLAC__byte)(mTotalSamples >> 24);
+   info[15] = (FLAC__byte)(mTotalSamples >> 16);
+   info[16] = (FLAC__byte)(mTotalSamples >> 8);
+   info[17] = (FLAC__byte)mTotalSamples;
+
+   mMD5->Final(info + 18);
+
+   if (fseek(mFile, 0, SEEK_SET) != 0)
+      mOK = false;
+   WriteBytes(&mHeader[0], mHeader.size());
+   if (fflush(mFile) != 0)
+      mOK = false;
+
+   return mOK;
+}
+
+void ParallelFLACEncoder::RunItem(int item)
+{
+   // Item 0 takes the MD5 of the whole batch while the others encode it
+   if (item == 0) {
+      for (unsigned i = 0; i < mBatchLen; i++)
+         HashRun(mRuns[i]);
+   }
+   else
+      mRuns[item - 1]->Encode(mSettings);
+}
+
+bool ParallelFLACEncoder::EncodeBatch()
+{
+   mBatchLen = mFilling;
+   if (mBatchLen < mRuns.size() && mRuns[mBatchLen]->mLen > 0)
+      mBatchLen++;
+
+   // Only the last run of a batch can be short, so where each starts in
+   // the stream is known before any is encoded
+   for (unsigned i = 0; i < mBatchLen; i++)
+      mRuns[i]->mFirstFrame = mNextFrame + i * FRAMES_PER_RUN;
+
+   if (mBatchLen > 0)
+      mPool->Run(this, mBatchLen + 1);
+
+   for (unsigned i = 0; i < mBatchLen; i++) {
+      WriteRun(mRuns[i]);
+      mRuns[i]->mLen = 0;
+   }
+   mFilling = 0;
+   mBatchLen = 0;
+
+   return mOK;
+}
+
+void ParallelFLACEncoder::HashRun(ParallelFLACRun *run)
+{
+   unsigned channels = mSettings.mChannels;
+   unsigned bytesPerSample = (mSettings.mBitsPerSample + 7) / 8;
+   unsigned len = run->mLen;
+
+   // The MD5 is of the samples interleaved, in little-endian order
+   mInterleaved.resize((size_t)len * channels * bytesPerSample);
+   if (mInterleaved.empty())
+      return;
+
+   FLAC__byte *out = &mInterleaved[0];
+   for (unsigned c = 0; c < channels; c++) {
+      const FLAC__int32 *in = run->mSamples[c];
+      FLAC__byte *o = out + c * bytesPerSample;
+      size_t stride = channels * bytesPerSample;
+
+      switch (bytesPerSample) {
+      case 2:
+         for (unsigned s = 0; s < len; s++, o += stride) {
+            o[0] = (FLAC__byte)in[s];
+            o[1] = (FLAC__byte)(in[s] >> 8);
+         }
+         break;
+      case 3:
+         for (unsigned s = 0; s < len; s++, o += stride) {
+            o[0] = (FLAC__byte)in[s];
+            o[1] = (FLAC__byte)(in[s] >> 8);
+            o[2] = (FLAC__byte)(in[s] >> 16);
+         }
+         break;
+      default:
+         for (unsigned s = 0; s < len; s++, o += stride) {
+            FLAC__uint32 value = (FLAC__uint32)in[s];
+            for (unsigned b = 0; b < bytesPerSample; b++) {
+               o[b] = (FLAC__byte)value;
+               value >>= 8;
+            }
+         }
+         break;
+      }
+   }
+
+   mMD5->Update(out, mInterleaved.size());
+}
+
+void ParallelFLACEncoder::WriteRun(ParallelFLACRun *run)
+{
+   if (!mOK)
+      return;
+   if (!run->mOK) {
+      mOK = false;
+      return;
+   }
+
+   mNextFrame += run->mFrames.size();
+   if (run->mFrames.empty())
+      return;
+
+   if (run->mMinFrameSize < mMinFrameSize)
+      mMinFrameSize = run->mMinFrameSize;
+   if (run->mMaxFrameSize > mMaxFrameSize)
+      mMaxFrameSize = run->mMaxFrameSize;
+
+   WriteBytes(&run->mOutput[0], run->mOutput.size());
+}
+
+void ParallelFLACEncoder::WriteBytes(const FLAC__byte *data, size_t len)
+{
+   if (mOK && fwrite(data, 1, len, mFile) != len)
+      mOK = false;
+}
+
+#endif // LEGACY_FLAC
+
+#endif // USE_LIBFLAC
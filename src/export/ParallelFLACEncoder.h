@@ -0,0 +1,139 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  ParallelFLACEncoder.h
+
+**********************************************************************/
+
+#ifndef __AUDACITY_PARALLEL_FLAC_ENCODER__
+#define __AUDACITY_PARALLEL_FLAC_ENCODER__
+
+#include <stdio.h>
+#include <vector>
+
+#include "FLAC++/encoder.h"
+
+#include "../WorkerPool.h"
+
+/* FLACPP_API_VERSION_CURRENT is 6 for libFLAC++ from flac-1.1.3 (see <FLAC++/export.h>) */
+#if !defined FLACPP_API_VERSION_CURRENT || FLACPP_API_VERSION_CURRENT < 6
+#define LEGACY_FLAC
+#else
+#undef LEGACY_FLAC
+#endif
+
+/// The encoder settings of a FLAC export, so that every encoder writing
+/// to the same file can be set up alike.
+class FLACEncoderSettings
+{
+public:
+   /// level is the flac command line compression level, 0 to 8
+   FLACEncoderSettings(unsigned channels, unsigned sampleRate,
+                       unsigned bitsPerSample, int level);
+
+   /// Applies the settings to an encoder that is not yet initialised.
+   /// A template, since the File encoder of libFLAC++ before 1.1.3 is
+   /// not a Stream.
+   template <class Encoder> void Apply(Encoder &encoder) const
+   {
+      encoder.set_channels(mChannels);
+      encoder.set_sample_rate(mSampleRate);
+      encoder.set_bits_per_sample(mBitsPerSample);
+      encoder.set_do_exhaustive_model_search(mDoExhaustiveModelSearch);
+      encoder.set_do_escape_coding(mDoEscapeCoding);
+      encoder.set_do_mid_side_stereo(mDoMidSideStereo);
+      encoder.set_loose_mid_side_stereo(mLooseMidSideStereo);
+      encoder.set_qlp_coeff_precision(mQlpCoeffPrecision);
+      encoder.set_min_residual_partition_order(mMinResidualPartitionOrder);
+      encoder.set_max_residual_partition_order(mMaxResidualPartitionOrder);
+      encoder.set_rice_parameter_search_dist(mRiceParameterSearchDist);
+      encoder.set_max_lpc_order(mMaxLpcOrder);
+   }
+
+   unsigned mChannels;
+   unsigned mSampleRate;
+   unsigned mBitsPerSample;
+   bool     mDoExhaustiveModelSearch;
+   bool     mDoEscapeCoding;
+   bool     mDoMidSideStereo;
+   bool     mLooseMidSideStereo;
+   unsigned mQlpCoeffPrecision;
+   unsigned mMinResidualPartitionOrder;
+   unsigned mMaxResidualPartitionOrder;
+   unsigned mRiceParameterSearchDist;
+   unsigned mMaxLpcOrder;
+};
+
+#ifndef LEGACY_FLAC
+
+class ParallelFLACRun;
+class ParallelFLACMD5;
+
+/// \brief Writes a FLAC file using several libFLAC encoders at once.
+///
+/// The audio is cut into runs of whole frames, which are encoded by
+/// encoders of their own on the threads of a WorkerPool.  Their frames
+/// are written out in order with the frame numbers (and so the CRCs) put
+/// right, and STREAMINFO is completed by Finish().  The file is byte for
+/// byte the one a FLAC::Encoder::File with the same settings would write.
+///
+/// Loose mid/side stereo picks the channel coding of each frame from the
+/// frames before it, so it can't be encoded this way; see CanEncode().
+class ParallelFLACEncoder : public WorkerPoolJob
+{
+public:
+   /// Writes to fp, which must be seekable and is not closed.  pool may
+   /// be shared with other encoders, whose runs take turns on it.
+   ParallelFLACEncoder(const FLACEncoderSettings &settings, FILE *fp,
+                       WorkerPool *pool);
+   virtual ~ParallelFLACEncoder();
+
+   /// Whether the settings can be encoded frame by frame in parallel
+   static bool CanEncode(const FLACEncoderSettings &settings);
+
+   /// Writes the stream header.  The metadata is only needed during the
+   /// call.  Returns what FLAC::Encoder::Stream::init() would.
+   ::FLAC__StreamEncoderInitStatus Init(::FLAC__StreamMetadata **metadata,
+                                        unsigned numBlocks);
+
+   /// Takes 'samples' samples of every channel, as
+   /// FLAC::Encoder::Stream::process() does
+   bool Process(const FLAC__int32 * const buffer[], unsigned samples);
+
+   /// Encodes and writes what is left and completes STREAMINFO
+   bool Finish();
+
+   /// Item 0 takes the MD5 of the current batch, and item n encodes its
+   /// run n - 1
+   virtual void RunItem(int item);
+
+private:
+   bool EncodeBatch();
+   void HashRun(ParallelFLACRun *run);
+   void WriteRun(ParallelFLACRun *run);
+   void WriteBytes(const FLAC__byte *data, size_t len);
+
+   FLACEncoderSettings mSettings;
+   FILE *mFile;
+   WorkerPool *mPool;
+
+   std::vector<ParallelFLACRun *> mRuns;   // one batch, encoded together
+   unsigned mRunLen;          // samples in a run of whole frames
+   unsigned mFilling;         // the run Process() is adding to
+   unsigned mBatchLen;        // runs being encoded by the pool
+
+   std::vector<FLAC__byte> mHeader;    // as written, for Finish() to fix up
+   std::vector<FLAC__byte> mInterleaved;
+   ParallelFLACMD5 *mMD5;
+
+   FLAC__uint64 mTotalSamples;
+   unsigned mNextFrame;
+   unsigned mMinFrameSize;
+   unsigned mMaxFrameSize;
+   bool mOK;
+};
+
+#endif // LEGACY_FLAC
+
+#endif
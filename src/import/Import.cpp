@@ -41,6 +41,8 @@ and ImportLOF.cpp.
 #include <wx/intl.h>
 #include <wx/log.h>
 #include <wx/sizer.h>         //for wxBoxSizer
+#include <wx/thread.h>
+#include <wx/utils.h>
 #include <wx/arrimpl.cpp>
 #include <wx/listimpl.cpp>
 #include "../ShuttleGui.h"
@@ -60,6 +62,10 @@ and ImportLOF.cpp.
 #include "ImportGStreamer.h"
 #include "../Track.h"
 #include "../Prefs.h"
+#include "../Tags.h"
+#include "../WaveTrack.h"
+#include "../WorkerPool.h"
+#include "../widgets/ProgressDialog.h"
 
 WX_DEFINE_LIST(ImportPluginList);
 WX_DEFINE_LIST(UnusableImportPluginList);
@@ -349,28 +355,13 @@ ExtImportItem *Importer::CreateDefaultImportItem()
    return new_item;
 }
 
-// returns number of tracks imported
-int Importer::Import(wxString fName,
-                     TrackFactory *trackFactory,
-                     Track *** tracks,
-                     Tags *tags,
-                     wxString &errorMessage)
+// Fills importPlugins with the plugins to try fName with, in order
+void Importer::GetImportPlugins(const wxString &fName,
+                                ImportPluginList &importPlugins)
 {
-   AudacityProject *pProj = GetActiveProject();
-   pProj->mbBusyImporting = true;
-
-   ImportFileHandle *inFile = NULL;
-   int numTracks = 0;
-
    wxString extension = fName.AfterLast(wxT('.'));
-
-   // This list is used to call plugins in correct order
-   ImportPluginList importPlugins;
    ImportPluginList::compatibility_iterator importPluginNode;
 
-   // This list is used to remember plugins that should have been compatible with the file.
-   ImportPluginList compatiblePlugins;
-
    // If user explicitly selected a filter,
    // then we should try importing via corresponding plugin first
    wxString type = gPrefs->Read(wxT("/LastOpenType"),wxT(""));
@@ -523,6 +514,31 @@ int Importer::Import(wxString fName,
 
       importPluginNode = importPluginNode->GetNext();
    }
+}
+
+// returns number of tracks imported
+int Importer::Import(wxString fName,
+                     TrackFactory *trackFactory,
+                     Track *** tracks,
+                     Tags *tags,
+                     wxString &errorMessage)
+{
+   AudacityProject *pProj = GetActiveProject();
+   pProj->mbBusyImporting = true;
+
+   ImportFileHandle *inFile = NULL;
+   int numTracks = 0;
+
+   wxString extension = fName.AfterLast(wxT('.'));
+
+   // This list is used to call plugins in correct order
+   ImportPluginList importPlugins;
+   ImportPluginList::compatibility_iterator importPluginNode;
+
+   // This list is used to remember plugins that should have been compatible with the file.
+   ImportPluginList compatiblePlugins;
+
+   GetImportPlugins(fName, importPlugins);
 
    importPluginNode = importPlugins.GetFirst();
    while(importPluginNode)
@@ -727,6 +743,299 @@ int Importer::Import(wxString fName,
    return 0;
 }
 
+//-------------------------------------------------------------------------
+// ImportBatch
+//-------------------------------------------------------------------------
+
+/// State shared between the threads of an Importer::ImportBatch() and the
+/// dialog that is waiting for them.
+class ImportBatchState
+{
+public:
+   ImportBatchState(int numFiles)
+      : mResult(eProgressSuccess), mFraction(numFiles, 0.0), mDone(numFiles, false)
+   {
+   }
+
+   wxMutex mMutex;
+   int mResult;                  ///< What the user has asked the imports to do
+   std::vector<double> mFraction;   ///< How far through each import has got
+   std::vector<bool> mDone;      ///< Which imports have returned from Import()
+};
+
+/// Hands one import's progress to the shared state, and the user's cancel
+/// or stop request back to the import.
+class ImportBatchProgress : public ImportProgress
+{
+public:
+   ImportBatchProgress(ImportBatchState *state, int index)
+      : mState(state), mIndex(index)
+   {
+   }
+
+protected:
+   virtual int UpdateProgress(double current, double total)
+   {
+      wxMutexLocker locker(mState->mMutex);
+      mState->mFraction[mIndex] = (total > 0.0) ? wxMin(current / total, 1.0) : 1.0;
+      return mState->mResult;
+   }
+
+private:
+   ImportBatchState *mState;
+   int mIndex;
+};
+
+/// Runs the Import() of one file of an Importer::ImportBatch(), into tags
+/// of its own.  Deletes the handle when done, which closes the file.
+class ImportBatchThread : public wxThread
+{
+public:
+   ImportBatchThread(ImportFileHandle *inFile, TrackFactory *trackFactory,
+                     ImportBatchState *state, int index)
+      : wxThread(wxTHREAD_JOINABLE),
+        mFile(inFile), mTrackFactory(trackFactory), mState(state),
+        mIndex(index), mProgress(state, index),
+        mResult(eProgressFailed), mTracks(NULL), mNumTracks(0)
+   {
+      mTags.Clear();
+      mFile->SetProgress(&mProgress);
+   }
+
+   virtual ~ImportBatchThread()
+   {
+      delete mFile;
+   }
+
+   virtual ExitCode Entry()
+   {
+      mResult = mFile->Import(mTrackFactory, &mTracks, &mNumTracks, &mTags);
+
+      delete mFile;
+      mFile = NULL;
+
+      wxMutexLocker locker(mState->mMutex);
+      mState->mDone[mIndex] = true;
+
+      return 0;
+   }
+
+   int GetResult() const { return mResult; }
+   Track **GetTracks() { return mTracks; }
+   int GetNumTracks() const { return mNumTracks; }
+   Tags *GetTags() { return &mTags; }
+
+private:
+   ImportFileHandle *mFile;
+   TrackFactory *mTrackFactory;
+   ImportBatchState *mState;
+   int mIndex;
+   ImportBatchProgress mProgress;
+
+   int mResult;
+   Track **mTracks;
+   int mNumTracks;
+   Tags mTags;
+};
+
+ImportFileHandle *Importer::OpenConcurrently(const wxString &fName)
+{
+   // LOF ("list-of-files") files import other files into the project
+   if (fName.AfterLast(wxT('.')).IsSameAs(wxT("lof"), false))
+      return NULL;
+
+   ImportPluginList importPlugins;
+   GetImportPlugins(fName, importPlugins);
+
+   ImportPluginList::compatibility_iterator importPluginNode = importPlugins.GetFirst();
+   while(importPluginNode)
+   {
+      ImportPlugin *plugin = importPluginNode->GetData();
+      ImportFileHandle *inFile = plugin->Open(fName);
+      if ( (inFile != NULL) && (inFile->GetStreamCount() > 0) )
+      {
+         // Choosing streams needs a dialog
+         if (inFile->GetStreamCount() == 1 && inFile->CanImportConcurrently())
+         {
+            inFile->SetStreamUsage(0,TRUE);
+            return inFile;
+         }
+
+         delete inFile;
+         return NULL;
+      }
+
+      delete inFile;
+      importPluginNode = importPluginNode->GetNext();
+   }
+
+   return NULL;
+}
+
+int Importer::ImportBatch(const wxArrayString &fileNames,
+                          TrackFactory *trackFactory,
+                          Tags *tags,
+                          std::vector<Track **> &tracks,
+                          std::vector<int> &numTracks,
+                          wxArrayString &errorMessages)
+{
+   int numFiles = fileNames.GetCount();
+   int result = eProgressSuccess;
+
+   tracks.assign(numFiles, (Track **)NULL);
+   numTracks.assign(numFiles, 0);
+   errorMessages.Empty();
+   errorMessages.Add(wxEmptyString, numFiles);
+
+   // Each file is decoded on its own thread, so this many files are
+   // imported at once
+   long maxImports = gPrefs->Read(wxT("/FileFormats/ImportBatchThreads"),
+                                  (long)(WorkerPool::GetDefaultNumThreads() + 1));
+
+   if (maxImports <= 1 || numFiles <= 1) {
+      for (int i = 0; i < numFiles; i++) {
+         numTracks[i] = Import(fileNames[i], trackFactory, &tracks[i],
+                               tags, errorMessages[i]);
+      }
+
+      return result;
+   }
+
+   AudacityProject *pProj = GetActiveProject();
+   pProj->mbBusyImporting = true;
+
+   ImportBatchState state(numFiles);
+   std::vector<ImportBatchThread *> threads(numFiles, (ImportBatchThread *)NULL);
+   std::vector<bool> finished(numFiles, false);
+
+   ProgressDialog progress(_("Import"),
+                           wxString::Format(_("Importing %d files"), numFiles));
+
+   int next = 0;
+   int running = 0;
+   bool serialNext = false;   // file next is to be imported by Import()
+   while ((result == eProgressSuccess && next < numFiles) || running > 0) {
+      // Start more imports while there are threads to spare.  Files are
+      // opened and prepared here, in order, since that may ask the user
+      // something.
+      while (result == eProgressSuccess && next < numFiles && running < maxImports) {
+         if (!serialNext) {
+            ImportFileHandle *inFile = OpenConcurrently(fileNames[next]);
+
+            if (inFile && !inFile->PrepareImport()) {
+               // The user cancelled this file
+               delete inFile;
+               finished[next] = true;
+               next++;
+               continue;
+            }
+
+            if (inFile) {
+               // The batch already keeps the processors busy
+               inFile->SetMaxThreads(0);
+
+               ImportBatchThread *thread =
+                  new ImportBatchThread(inFile, trackFactory, &state, next);
+               if (thread->Create() == wxTHREAD_NO_ERROR &&
+                   thread->Run() == wxTHREAD_NO_ERROR) {
+                  threads[next] = thread;
+                  running++;
+                  next++;
+                  continue;
+               }
+               delete thread;
+            }
+
+            serialNext = true;
+         }
+
+         // Any other file is imported the usual way, once the running
+         // imports are done, as it may show dialogs or read gPrefs
+         if (running > 0)
+            break;
+
+         numTracks[next] = Import(fileNames[next], trackFactory, &tracks[next],
+                                  tags, errorMessages[next]);
+         pProj->mbBusyImporting = true;
+         finished[next] = true;
+         serialNext = false;
+         next++;
+      }
+
+      double done = 0.0;
+      for (int i = 0; i < next; i++) {
+         ImportBatchThread *thread = threads[i];
+
+         if (finished[i]) {
+            done += 1.0;
+            continue;
+         }
+
+         {
+            wxMutexLocker locker(state.mMutex);
+            finished[i] = state.mDone[i];
+            done += state.mFraction[i];
+         }
+
+         if (finished[i]) {
+            thread->Wait();
+            running--;
+         }
+      }
+
+      int update = progress.Update(done, (double)numFiles);
+      if (update != eProgressSuccess) {
+         wxMutexLocker locker(state.mMutex);
+         state.mResult = update;
+         result = update;
+      }
+
+      if (running > 0) {
+         wxMilliSleep(20);
+      }
+   }
+
+   // Hand the results over in the order of fileNames, not the order the
+   // imports finished in.  Tracks made on the threads get the default view
+   // now, as they couldn't read it then.
+   long display = gPrefs->Read(wxT("/GUI/DefaultViewMode"), 0L);
+   for (int i = 0; i < numFiles; i++) {
+      ImportBatchThread *thread = threads[i];
+      if (!thread)
+         continue;
+
+      int res = thread->GetResult();
+      if ((res == eProgressSuccess || res == eProgressStopped) &&
+          thread->GetNumTracks() > 0) {
+         tracks[i] = thread->GetTracks();
+         numTracks[i] = thread->GetNumTracks();
+
+         for (int j = 0; j < numTracks[i]; j++) {
+            if (tracks[i][j]->GetKind() == Track::Wave)
+               ((WaveTrack *)tracks[i][j])->SetDisplay(display);
+         }
+
+         wxString name, value;
+         bool more = thread->GetTags()->GetFirst(name, value);
+         while (more) {
+            tags->SetTag(name, value);
+            more = thread->GetTags()->GetNext(name, value);
+         }
+      }
+      else if (res == eProgressSuccess && result == eProgressSuccess) {
+         // The plugin found nothing to import, and another may yet
+         numTracks[i] = Import(fileNames[i], trackFactory, &tracks[i],
+                               tags, errorMessages[i]);
+      }
+
+      delete thread;
+   }
+
+   pProj->mbBusyImporting = false;
+
+   return result;
+}
+
 //-------------------------------------------------------------------------
 // ImportStreamDialog
 //-------------------------------------------------------------------------
@@ -19,6 +19,8 @@
 #include <wx/listbox.h>
 #include <wx/tokenzr.h>
 
+#include <vector>
+
 class Tags;
 class TrackFactory;
 class Track;
@@ -146,7 +148,33 @@ public:
               Tags *tags,
               wxString &errorMessage);
 
+   /**
+    * Imports several files behind a single progress dialog, decoding up
+    * to /FileFormats/ImportBatchThreads of them at once on threads of
+    * their own.  Files whose importer can't run on a worker thread are
+    * imported one at a time by Import().
+    * @tracks, @numTracks and @errorMessages get the results of each file
+    * as Import() gives them, in the order of @fileNames.  The tags read
+    * from the files are added to @tags in that order too.
+    * Returns eProgressSuccess, or what the user asked for instead.
+    * Cancel and Stop apply to all the running imports, and no more are
+    * started; a file cancelled or failing on its own stops no others.
+    */
+   int ImportBatch(const wxArrayString &fileNames,
+                   TrackFactory *trackFactory,
+                   Tags *tags,
+                   std::vector<Track **> &tracks,
+                   std::vector<int> &numTracks,
+                   wxArrayString &errorMessages);
+
 private:
+   void GetImportPlugins(const wxString &fName,
+                         ImportPluginList &importPlugins);
+
+   // Opens fName as Import() would, returning the handle if it can be
+   // imported on a worker thread, else NULL
+   ImportFileHandle *OpenConcurrently(const wxString &fName);
+
    static Importer mInstance;
 
    ExtImportItems *mExtImportItems;
@@ -162,6 +162,8 @@ public:
 
    void SetStreamUsage(wxInt32 WXUNUSED(StreamID), bool WXUNUSED(Use)){}
 
+   bool CanImportConcurrently(){ return true; }
+
 private:
    sampleFormat          mFormat;
    MyFLACFile           *mFile;
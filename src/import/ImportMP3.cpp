@@ -96,7 +96,8 @@ struct private_data {
    unsigned char *inputBuffer;
    TrackFactory *trackFactory;
    WaveTrack **channels;
-   ProgressDialog *progress;
+   sampleFormat format;
+   ImportProgress *progress;
    int numChannels;
    int updateResult;
    bool id3checked;
@@ -124,6 +125,9 @@ public:
       ImportFileHandle(filename),
       mFile(file)
    {
+      // Read here, since Import() may run on a worker thread
+      mFormat = (sampleFormat)
+         gPrefs->Read(wxT("/SamplingRate/DefaultProjectSampleFormat"), floatSample);
    }
 
    ~MP3ImportFileHandle();
@@ -139,10 +143,13 @@ public:
 
    void SetStreamUsage(wxInt32 WXUNUSED(StreamID), bool WXUNUSED(Use)){}
 
+   bool CanImportConcurrently() { return true; }
+
 private:
    void ImportID3(Tags *tags);
 
    wxFile *mFile;
+   sampleFormat mFormat;
    void *mUserData;
    struct private_data mPrivateData;
    mad_decoder mDecoder;
@@ -215,6 +222,7 @@ int MP3ImportFileHandle::Import(TrackFactory *trackFactory, Track ***outTracks,
    mPrivateData.inputBuffer = new unsigned char [INPUT_BUFFER_SIZE];
    mPrivateData.progress    = mProgress;
    mPrivateData.channels    = NULL;
+   mPrivateData.format      = mFormat;
    mPrivateData.updateResult= eProgressSuccess;
    mPrivateData.id3checked  = false;
    mPrivateData.numChannels = 0;
@@ -485,11 +493,8 @@ enum mad_flow output_cb(void *_data,
    if(!data->channels) {
       data->channels = new WaveTrack* [channels];
 
-      sampleFormat format = (sampleFormat) gPrefs->
-         Read(wxT("/SamplingRate/DefaultProjectSampleFormat"), floatSample);
-
       for(chn = 0; chn < channels; chn++) {
-         data->channels[chn] = data->trackFactory->NewWaveTrack(format, samplerate);
+         data->channels[chn] = data->trackFactory->NewWaveTrack(data->format, samplerate);
          data->channels[chn]->SetChannel(Track::MonoChannel);
       }
 
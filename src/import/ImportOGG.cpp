@@ -144,6 +144,11 @@ public:
       }
    }
 
+   bool CanImportConcurrently()
+   {
+      return true;
+   }
+
 private:
    wxFFile        *mFile;
    OggVorbis_File *mVorbisFile;
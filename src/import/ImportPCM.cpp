@@ -51,6 +51,7 @@
 #include "../FileFormats.h"
 #include "../Prefs.h"
 #include "../WaveTrack.h"
+#include "../WorkerPool.h"
 #include "ImportPlugin.h"
 
 #ifdef USE_LIBID3TAG
@@ -101,10 +102,16 @@ public:
 
    void SetStreamUsage(wxInt32 WXUNUSED(StreamID), bool WXUNUSED(Use)){}
 
+   bool CanImportConcurrently(){ return true; }
+   bool PrepareImport();
+   void SetMaxThreads(int threads){ mThreads = wxMin(mThreads, threads); }
+
 private:
    SNDFILE              *mFile;
    SF_INFO               mInfo;
    sampleFormat          mFormat;
+   wxString              mCopyEdit;     // as asked by PrepareImport()
+   int                   mThreads;      // channel writers of a copy
 };
 
 void GetPCMImportPlugin(ImportPluginList * importPluginList,
@@ -201,6 +208,9 @@ PCMImportFileHandle::PCMImportFileHandle(wxString name,
    if (mFormat != floatSample &&
        sf_subtype_more_than_16_bits(mInfo.format))
       mFormat = floatSample;
+
+   mThreads = gPrefs->Read(wxT("/FileFormats/ImportThreads"),
+                           (long)WorkerPool::GetDefaultNumThreads());
 }
 
 wxString PCMImportFileHandle::GetFileDescription()
@@ -306,6 +316,106 @@ How do you want to import the current file(s)?"), oldCopyPref == wxT("copy") ? _
    return oldCopyPref;
 }
 
+bool PCMImportFileHandle::PrepareImport()
+{
+   mCopyEdit = AskCopyOrEdit();
+
+   return mCopyEdit != wxT("cancel");
+}
+
+/// \brief The copy mode of PCMImportFileHandle::Import, as a pipeline.
+///
+/// Each step appends the chunk read last to the tracks, every channel on a
+/// thread of its own, while the next chunk is read from the file.  The
+/// channels are taken straight out of the interleaved chunk by
+/// WaveTrack::Append, and the block files are written and summarized by
+/// the threads appending them.  Only two chunks are ever held.
+class PCMImportPipeline : public WorkerPoolJob
+{
+public:
+   /// format must be int16Sample or floatSample, as sf_readf_* gives
+   PCMImportPipeline(SNDFILE *file, sampleFormat format, int numChannels,
+                     sampleCount chunkLen, WaveTrack **channels,
+                     WorkerPool *pool)
+      : mFile(file),
+        mFormat(format),
+        mNumChannels(numChannels),
+        mChunkLen(chunkLen),
+        mChannels(channels),
+        mPool(pool),
+        mCurrent(0)
+   {
+      mBuffers[0] = NewSamples(chunkLen * numChannels, format);
+      mBuffers[1] = NewSamples(chunkLen * numChannels, format);
+      mLens[0] = mLens[1] = 0;
+
+      // Appending to an empty track makes a clip, which refers to the
+      // DirManager, and that mustn't happen on several threads at once
+      for (int c = 0; c < numChannels; c++)
+         channels[c]->RightmostOrNewClip();
+   }
+
+   virtual ~PCMImportPipeline()
+   {
+      DeleteSamples(mBuffers[0]);
+      DeleteSamples(mBuffers[1]);
+   }
+
+   /// Reads the first chunk
+   void Start()
+   {
+      mLens[mCurrent] = Read(mBuffers[mCurrent]);
+   }
+
+   /// Appends the chunk read last and reads the next.  Returns the frames
+   /// appended, which are 0 at the end of the file.
+   sampleCount Step()
+   {
+      sampleCount len = mLens[mCurrent];
+      if (len == 0)
+         return 0;
+
+      mPool->Run(this, mNumChannels + 1);
+
+      mCurrent = 1 - mCurrent;
+      return len;
+   }
+
+   /// Item 0 reads the next chunk, and item c + 1 appends channel c of
+   /// the current one
+   virtual void RunItem(int item)
+   {
+      if (item == 0) {
+         mLens[1 - mCurrent] = Read(mBuffers[1 - mCurrent]);
+         return;
+      }
+
+      int c = item - 1;
+      mChannels[c]->Append(mBuffers[mCurrent] + c * SAMPLE_SIZE(mFormat),
+                           mFormat, mLens[mCurrent], mNumChannels);
+   }
+
+private:
+   sampleCount Read(samplePtr buffer)
+   {
+      if (mFormat == int16Sample)
+         return sf_readf_short(mFile, (short *)buffer, mChunkLen);
+      else
+         return sf_readf_float(mFile, (float *)buffer, mChunkLen);
+   }
+
+   SNDFILE *mFile;
+   sampleFormat mFormat;
+   int mNumChannels;
+   sampleCount mChunkLen;
+   WaveTrack **mChannels;
+   WorkerPool *mPool;
+
+   samplePtr mBuffers[2];
+   sampleCount mLens[2];
+   int mCurrent;           // the buffer holding the chunk to append
+};
+
 int PCMImportFileHandle::Import(TrackFactory *trackFactory,
                                 Track ***outTracks,
                                 int *outNumTracks,
@@ -313,8 +423,11 @@ int PCMImportFileHandle::Import(TrackFactory *trackFactory,
 {
    wxASSERT(mFile);
 
-   // Get the preference / warn the user about aliased files.
-   wxString copyEdit = AskCopyOrEdit();
+   // Get the preference / warn the user about aliased files, unless
+   // PrepareImport() already has.
+   wxString copyEdit = mCopyEdit;
+   if (copyEdit.IsEmpty())
+      copyEdit = AskCopyOrEdit();
 
    if (copyEdit == wxT("cancel"))
       return eProgressCancelled;
@@ -412,39 +525,27 @@ int PCMImportFileHandle::Import(TrackFactory *trackFactory,
       // samples from the file and store our own local copy of the
       // samples in the tracks.
 
-      samplePtr srcbuffer = NewSamples(maxBlockSize * mInfo.channels,
-                                       mFormat);
-      samplePtr buffer = NewSamples(maxBlockSize, mFormat);
+      // Writers for as many channels as there are threads to spare.
+      // Each track dithers with its own state when converting to its
+      // format, so the channels may be appended at once.
+      int threads = mThreads;
+      if (threads > mInfo.channels)
+         threads = mInfo.channels;
+      WorkerPool pool(threads);
+
+      //import 24 bit int as float and have the append function convert it.  This is how PCMAliasBlockFile works too.
+      PCMImportPipeline pipeline(mFile,
+                                 (mFormat == int16Sample) ? int16Sample : floatSample,
+                                 mInfo.channels, maxBlockSize, channels,
+                                 &pool);
 
       unsigned long framescompleted = 0;
 
-      long block;
+      sampleCount block;
+      pipeline.Start();
       do {
-         block = maxBlockSize;
-
-         if (mFormat == int16Sample)
-            block = sf_readf_short(mFile, (short *)srcbuffer, block);
-         //import 24 bit int as float and have the append function convert it.  This is how PCMAliasBlockFile works too.
-         else
-            block = sf_readf_float(mFile, (float *)srcbuffer, block);
-
-         if (block) {
-            for(c=0; c<mInfo.channels; c++) {
-               if (mFormat==int16Sample) {
-                  for(int j=0; j<block; j++)
-                     ((short *)buffer)[j] =
-                        ((short *)srcbuffer)[mInfo.channels*j+c];
-               }
-               else {
-                  for(int j=0; j<block; j++)
-                     ((float *)buffer)[j] =
-                        ((float *)srcbuffer)[mInfo.channels*j+c];
-               }
-
-               channels[c]->Append(buffer, (mFormat == int16Sample)?int16Sample:floatSample, block);
-            }
-            framescompleted += block;
-         }
+         block = pipeline.Step();
+         framescompleted += block;
 
          updateResult = mProgress->Update((long long unsigned)framescompleted,
                                         (long long unsigned)fileTotalFrames);
@@ -452,9 +553,6 @@ int PCMImportFileHandle::Import(TrackFactory *trackFactory,
             break;
 
       } while (block > 0);
-
-      DeleteSamples(buffer);
-      DeleteSamples(srcbuffer);
    }
 
    if (updateResult == eProgressFailed || updateResult == eProgressCancelled) {
@@ -12,7 +12,8 @@
 \file ImportPlugin.h
 \brief
   The interface that all file import "plugins" (if you want to call
-  them that) must implement.  Defines ImportFileHandle, ImportPlugin,
+  them that) must implement.  Defines ImportProgress,
+  ImportDialogProgress, ImportFileHandle, ImportPlugin,
   UnusableImportPlugin, ImportPluginList and UnusableImportPluginList.
 
   Since this is part of libaudacity, it must not use any GUI parts
@@ -114,34 +115,121 @@ protected:
 };
 
 
+/// Where an ImportFileHandle reports how far it has got.  Update() takes
+/// the same arguments as ProgressDialog::Update() and likewise returns
+/// eProgressSuccess to carry on, or whatever the user asked for instead.
+class ImportProgress
+{
+public:
+   virtual ~ImportProgress() {}
+
+   int Update(int current, int total)
+   {
+      return UpdateProgress(current, total);
+   }
+   int Update(double current, double total)
+   {
+      return UpdateProgress(current, total);
+   }
+   int Update(wxULongLong_t current, wxULongLong_t total)
+   {
+      return UpdateProgress((double)current, (double)total);
+   }
+   int Update(wxLongLong current, wxLongLong total)
+   {
+      return UpdateProgress(current.ToDouble(), total.ToDouble());
+   }
+   int Update(wxLongLong_t current, wxLongLong_t total)
+   {
+      return UpdateProgress((double)current, (double)total);
+   }
+
+protected:
+   /// Called on the thread doing the import
+   virtual int UpdateProgress(double current, double total) = 0;
+};
+
+/// The ImportProgress of an import on its own, in a dialog of its own
+class ImportDialogProgress : public ImportProgress
+{
+public:
+   ImportDialogProgress(const wxString & title, const wxString & message)
+   :  mDialog(title, message)
+   {
+   }
+
+protected:
+   virtual int UpdateProgress(double current, double total)
+   {
+      return mDialog.Update(current, total);
+   }
+
+private:
+   ProgressDialog mDialog;
+};
+
 class ImportFileHandle
 {
 public:
    ImportFileHandle(const wxString & filename)
    :  mFilename(filename),
-   mProgress(NULL)
+   mProgress(NULL),
+   mOwnsProgress(false)
    {
    }
 
    virtual ~ImportFileHandle()
    {
-      if (mProgress != NULL)
+      if (mOwnsProgress)
       {
          delete mProgress;
-         mProgress = NULL;
       }
+      mProgress = NULL;
    }
 
    // The importer should call this to create the progress dialog and
-   // identify the filename being imported.
+   // identify the filename being imported.  Does nothing if the caller
+   // has already given a progress with SetProgress().
    void CreateProgress()
    {
+      if (mProgress != NULL)
+         return;
+
       wxFileName f(mFilename);
       wxString title;
 
       title.Printf(_("Importing %s"), GetFileDescription().c_str());
-      mProgress = new ProgressDialog(title,
-                                     f.GetFullName());
+      mProgress = new ImportDialogProgress(title,
+                                           f.GetFullName());
+      mOwnsProgress = true;
+   }
+
+   // Has Import() report to progress, which the caller keeps, instead of
+   // to a dialog of its own.  Used by Importer::ImportBatch().
+   void SetProgress(ImportProgress *progress)
+   {
+      mProgress = progress;
+   }
+
+   // Whether Import() may run on a worker thread alongside other imports.
+   // It must then show no dialogs and read no gPrefs, which leaves
+   // PrepareImport() to ask the user anything it needs to.
+   virtual bool CanImportConcurrently()
+   {
+      return false;
+   }
+
+   // Limits the worker threads Import() may start besides its own.  Used
+   // by Importer::ImportBatch(), whose imports already run side by side.
+   virtual void SetMaxThreads(int WXUNUSED(threads))
+   {
+   }
+
+   // Called on the main thread before Import() is run on a worker thread.
+   // Returns false if the user cancels the import.
+   virtual bool PrepareImport()
+   {
+      return true;
    }
 
    // This is similar to GetImporterDescription, but if possible the
@@ -170,7 +258,10 @@ public:
 
 protected:
    wxString mFilename;
-   ProgressDialog *mProgress;
+   ImportProgress *mProgress;
+
+private:
+   bool mOwnsProgress;
 };
 
 
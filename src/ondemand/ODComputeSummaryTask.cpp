@@ -27,9 +27,11 @@ updating the ODPCMAliasBlockFile and the GUI of the newly available data.
 
 ///Creates a new task that computes summaries for a wavetrack that needs to be specified through SetWaveTrack()
 ODComputeSummaryTask::ODComputeSummaryTask()
+:  mBlockFilesWrittenCond(&mBlockFilesMutex)
 {
    mMaxBlockFiles = 0;
    mComputedBlockFiles = 0;
+   mBlockFilesInFlight = 0;
    mHasUpdateRan=false;
 }
 
@@ -56,8 +58,16 @@ void ODComputeSummaryTask::Terminate()
 ///Computes and writes the data for one BlockFile if it still has a refcount.
 void ODComputeSummaryTask::DoSomeInternal()
 {
+   mBlockFilesMutex.Lock();
+   //The task is only done once the threads that claimed the last blocks
+   //have written their summaries, so wait for the last of them to finish.
+   while(mBlockFiles.size()<=0 && mBlockFilesInFlight > 0)
+      mBlockFilesWrittenCond.Wait();
+
    if(mBlockFiles.size()<=0)
    {
+      mBlockFilesMutex.Unlock();
+
       mPercentCompleteMutex.Lock();
       mPercentComplete = 1.0;
       mPercentCompleteMutex.Unlock();
@@ -69,39 +79,44 @@ void ODComputeSummaryTask::DoSomeInternal()
    sampleCount blockEndSample = 0;
    bool success =false;
 
-   mBlockFilesMutex.Lock();
    for(size_t i=0; i < mWaveTracks.size() && mBlockFiles.size();i++)
    {
+      //take it out of the array - other threads may be working on this task too, so
+      //this claims it.  The summary is computed without the lock, so they can go
+      //on claiming blocks meanwhile.
       bf = mBlockFiles[0];
+      mBlockFiles.erase(mBlockFiles.begin());
+      mBlockFilesInFlight++;
+      mBlockFilesMutex.Unlock();
 
       //first check to see if the ref count is at least 2.  It should have one
       //from when we added it to this instance's mBlockFiles array, and one from
       //the Wavetrack/sequence.  If it doesn't it has been deleted and we should forget it.
-      if(bf->RefCount()>=2)
+      success = bf->RefCount()>=2;
+      if(success)
       {
          bf->DoWriteSummary();
-         success = true;
          blockStartSample = bf->GetStart();
          blockEndSample = blockStartSample + bf->GetLength();
-         mComputedBlockFiles++;
-      }
-      else
-      {
-         //the waveform in the wavetrack now is shorter, so we need to update mMaxBlockFiles
-         //because now there is less work to do.
-         mMaxBlockFiles--;
       }
 
       //Release the refcount we placed on it.
       bf->Deref();
-      //take it out of the array - we are done with it.
-      mBlockFiles.erase(mBlockFiles.begin());
 
-      //This is a bit of a convenience in case someone tries to terminate the task by closing the trackpanel or window.
-      //ODComputeSummaryTask::Terminate() uses this lock to remove everything, and we don't want it to wait since the UI is being blocked.
-      mBlockFilesMutex.Unlock();
       wxThread::This()->Yield();
       mBlockFilesMutex.Lock();
+      mBlockFilesInFlight--;
+      if(mBlockFilesInFlight == 0)
+         mBlockFilesWrittenCond.Broadcast();
+
+      if(success)
+         mComputedBlockFiles++;
+      else
+      {
+         //the waveform in the wavetrack now is shorter, so we need to update mMaxBlockFiles
+         //because now there is less work to do.
+         mMaxBlockFiles--;
+      }
 
       //upddate the gui for all associated blocks.  It doesn't matter that we're hitting more wavetracks then we should
       //because this loop runs a number of times equal to the number of tracks, they probably are getting processed in
@@ -156,9 +171,15 @@ void ODComputeSummaryTask::CalculatePercentComplete()
 {
    bool hasUpdateRan;
    hasUpdateRan = HasUpdateRan();
+
+   //blocks still being summarized on other threads aren't done yet
+   mBlockFilesMutex.Lock();
+   int remaining = (int)mBlockFiles.size() + mBlockFilesInFlight;
+   mBlockFilesMutex.Unlock();
+
    mPercentCompleteMutex.Lock();
    if(hasUpdateRan)
-      mPercentComplete = (float) 1.0 - ((float)mBlockFiles.size() / (mMaxBlockFiles+1));
+      mPercentComplete = (float) 1.0 - ((float)remaining / (mMaxBlockFiles+1));
    else
       mPercentComplete =0.0;
    mPercentCompleteMutex.Unlock();
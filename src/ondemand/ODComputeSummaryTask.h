@@ -46,6 +46,9 @@ class ODComputeSummaryTask:public ODTask
 
    virtual const wxChar* GetTip(){return _("Import complete. Calculating waveform");}
 
+   ///Each block's summary is independent, so any number of threads can work on the track.
+   virtual bool CanRunConcurrently(){return true;}
+
    virtual bool UsesCustomWorkUntilPercentage(){return true;}
    virtual float ComputeNextWorkUntilPercentageComplete();
 
@@ -75,6 +78,10 @@ protected:
    std::vector<ODPCMAliasBlockFile*> mBlockFiles;
    int mMaxBlockFiles;
    int mComputedBlockFiles;
+   //blocks taken out of mBlockFiles whose summaries are still being written; guarded by mBlockFilesMutex.
+   int mBlockFilesInFlight;
+   //signalled on mBlockFilesMutex when mBlockFilesInFlight drops to zero.
+   ODCondition mBlockFilesWrittenCond;
    ODLock  mHasUpdateRanMutex;
    bool mHasUpdateRan;
 };
@@ -15,9 +15,11 @@ ODTask requests and internals.
 *//*******************************************************************/
 
 #include "ODManager.h"
+#include "ODSndFileLock.h"
 #include "ODTask.h"
 #include "ODTaskThread.h"
 #include "ODWaveTrackTaskQueue.h"
+#include "../Prefs.h"
 #include "../Project.h"
 #include <NonGuiThread.h>
 #include <wx/utils.h>
@@ -37,9 +39,6 @@ ODManager* ODManager::pMan=NULL;
 typedef  ODManager* (*pfodman)();
 pfodman ODManager::Instance = &(ODManager::InstanceFirstTime);
 
-//libsndfile is not threadsafe - this deals with it
-static ODLock sLibSndFileMutex;
-
 DEFINE_EVENT_TYPE(EVT_ODTASK_UPDATE)
 
 //using this with wxStringArray::Sort will give you a list that
@@ -50,26 +49,21 @@ int CompareNoCaseFileName(const wxString& first, const wxString& second)
    return first.CmpNoCase(second);
 }
 
-void ODManager::LockLibSndFileMutex()
-{
-   sLibSndFileMutex.Lock();
-}
-
-void ODManager::UnlockLibSndFileMutex()
-{
-   sLibSndFileMutex.Unlock();
-}
-
-
 //private constructor - Singleton.
 ODManager::ODManager()
 {
    mTerminate = false;
    mTerminated = false;
    mPause= gPause;
+   mDemandedTask = NULL;
+   mNextWorkerQueue = 0;
+   mStopWorkers = false;
 
    //must set up the queue condition
    mQueueNotEmptyCond = new ODCondition(&mQueueNotEmptyCondLock);
+   mQueueUpdateNeeded = false;
+   mTasksAvailableCond = new ODCondition(&mTasksMutex);
+   mTaskIdleCond = new ODCondition(&mTasksMutex);
 }
 
 //private destructor - delete with static method Quit()
@@ -81,26 +75,40 @@ ODManager::~ODManager()
       delete mQueues[i];
 
    delete mQueueNotEmptyCond;
+   delete mTasksAvailableCond;
+   delete mTaskIdleCond;
 }
 
 ///Adds a task to running queue.  Thread-safe.
 void ODManager::AddTask(ODTask* task)
 {
    mTasksMutex.Lock();
-   mTasks.push_back(task);
+   ScheduleTaskLocked(task, -1);
    mTasksMutex.Unlock();
-   //signal the queue not empty condition.
-   bool paused;
 
-   mPauseLock.Lock();
-   paused=mPause;
-   mPauseLock.Unlock();
+   SignalTaskQueueLoop();
+}
 
-   mQueueNotEmptyCondLock.Lock();
-   //don't signal if we are paused since if we wake up the loop it will start processing other tasks while paused
-   if(!paused)
-      mQueueNotEmptyCond->Signal();
-   mQueueNotEmptyCondLock.Unlock();
+void ODManager::ScheduleTaskLocked(ODTask* task, int worker)
+{
+   //a task that can't be split only ever needs one entry.
+   int maxEntries = task->CanRunConcurrently() ? (int)mWorkerQueues.size() : 1;
+   if(task->mUnscheduled || task->mScheduledCount >= maxEntries || mWorkerQueues.empty())
+      return;
+
+   task->mScheduledCount++;
+   if(task == mDemandedTask)
+      mDemandQueue.push_back(task);
+   else
+   {
+      if(worker < 0)
+      {
+         worker = mNextWorkerQueue;
+         mNextWorkerQueue = (mNextWorkerQueue + 1) % mWorkerQueues.size();
+      }
+      mWorkerQueues[worker].push_back(task);
+   }
+   mTasksAvailableCond->Signal();
 }
 
 void ODManager::SignalTaskQueueLoop()
@@ -113,7 +121,10 @@ void ODManager::SignalTaskQueueLoop()
    mQueueNotEmptyCondLock.Lock();
    //don't signal if we are paused
    if(!paused)
+   {
+      mQueueUpdateNeeded = true;
       mQueueNotEmptyCond->Signal();
+   }
    mQueueNotEmptyCondLock.Unlock();
 }
 
@@ -121,17 +132,29 @@ void ODManager::SignalTaskQueueLoop()
 void ODManager::RemoveTaskIfInQueue(ODTask* task)
 {
    mTasksMutex.Lock();
-   //linear search okay for now, (probably only 1-5 tasks exist at a time.)
-   for(unsigned int i=0;i<mTasks.size();i++)
+   //no more entries for this task, even from the workers running it now.
+   task->mUnscheduled = true;
+   if(mDemandedTask == task)
+      mDemandedTask = NULL;
+
+   //linear search okay for now, (the deques are short.)
+   for(unsigned int i=0;i<=mWorkerQueues.size();i++)
    {
-      if(mTasks[i]==task)
+      std::deque<ODTask*> &queue = i<mWorkerQueues.size() ? mWorkerQueues[i] : mDemandQueue;
+      for(unsigned int j=0;j<queue.size();j++)
       {
-         mTasks.erase(mTasks.begin()+i);
-         break;
+         if(queue[j]==task)
+         {
+            queue.erase(queue.begin()+j--);
+            task->mScheduledCount--;
+         }
       }
    }
-   mTasksMutex.Unlock();
 
+   //what is left is running; wait for the workers to finish their turn.
+   while(task->mScheduledCount > 0)
+      mTaskIdleCond->Wait();
+   mTasksMutex.Unlock();
 }
 
 ///Adds a new task to the queue.  Creates a queue if the tracks associated with the task is not in the list
@@ -209,8 +232,7 @@ bool ODManager::IsInstanceCreated()
 ///Launches a thread for the manager and starts accepting Tasks.
 void ODManager::Init()
 {
-   mCurrentThreads = 0;
-   mMaxThreads = 5;
+   StartWorkers();
 
    //   wxLogDebug(wxT("Initializing ODManager...Creating manager thread"));
    ODManagerHelperThread* startThread = new ODManagerHelperThread;
@@ -224,19 +246,124 @@ void ODManager::Init()
    //destruction of thread is taken care of by thread library
 }
 
-void ODManager::DecrementCurrentThreads()
+void ODManager::StartWorkers()
+{
+   int numThreads = wxThread::GetCPUCount();
+   numThreads = gPrefs->Read(wxT("/OnDemand/Threads"), (long)(numThreads > 0 ? numThreads : 1));
+   if(numThreads < 1)
+      numThreads = 1;
+
+   mTasksMutex.Lock();
+   mWorkerQueues.resize(numThreads);
+   mTasksMutex.Unlock();
+
+   for(int i=0;i<numThreads;i++)
+   {
+      ODTaskThread* thread = new ODTaskThread(this, i);
+      thread->Create();
+      thread->Run();
+      mWorkers.push_back(thread);
+   }
+}
+
+void ODManager::StopWorkers()
 {
-   mCurrentThreadsMutex.Lock();
-   mCurrentThreads--;
-   mCurrentThreadsMutex.Unlock();
+   mTasksMutex.Lock();
+   mStopWorkers = true;
+   mTasksAvailableCond->Broadcast();
+   mTasksMutex.Unlock();
+
+   for(unsigned int i=0;i<mWorkers.size();i++)
+   {
+#ifdef __WXMAC__
+      mWorkers[i]->Delete();
+#else
+      mWorkers[i]->Wait();
+#endif
+      delete mWorkers[i];
+   }
+   mWorkers.clear();
+}
+
+void ODManager::RunWorker(int index)
+{
+   ODTask* task;
+   while((task = TakeTask(index)) != NULL)
+   {
+      //Do at least 5 percent of the task
+      bool moreToDo = task->DoSome(0.05f);
+
+      mTasksMutex.Lock();
+      task->mScheduledCount--;
+      if(moreToDo)
+         ScheduleTaskLocked(task, index);
+      if(task->mScheduledCount == 0)
+         mTaskIdleCond->Broadcast();
+      mTasksMutex.Unlock();
+
+      //let the manager loop check for finished tasks and redraw.
+      SignalTaskQueueLoop();
+   }
+}
+
+ODTask* ODManager::TakeTask(int index)
+{
+   ODTask* task = NULL;
+
+   mTasksMutex.Lock();
+   while(!mStopWorkers)
+   {
+      bool paused;
+      mPauseLock.Lock();
+      paused=mPause;
+      mPauseLock.Unlock();
+
+      if(!paused)
+      {
+         std::deque<ODTask*> &own = mWorkerQueues[index];
+         if(mDemandQueue.size())
+         {
+            task = mDemandQueue.front();
+            mDemandQueue.pop_front();
+         }
+         else if(own.size())
+         {
+            task = own.front();
+            own.pop_front();
+         }
+         else
+         {
+            //steal, starting with the next worker along so the thieves spread out.
+            for(unsigned int i=1;i<mWorkerQueues.size() && !task;i++)
+            {
+               std::deque<ODTask*> &other = mWorkerQueues[(index+i)%mWorkerQueues.size()];
+               if(other.size())
+               {
+                  task = other.back();
+                  other.pop_back();
+               }
+            }
+         }
+
+         if(task)
+         {
+            //the entry we took now stands for this worker running the task.  If the task can use
+            //more threads, offer it to the idle ones.
+            ScheduleTaskLocked(task, index);
+            break;
+         }
+      }
+
+      mTasksAvailableCond->Wait();
+   }
+   mTasksMutex.Unlock();
+
+   return task;
 }
 
 ///Main loop for managing threads and tasks.
 void ODManager::Start()
 {
-   ODTaskThread* thread;
-   bool tasksInArray;
-   bool paused;
    int  numQueues=0;
 
    mNeedsDraw=0;
@@ -252,47 +379,16 @@ void ODManager::Start()
 //    printf("ODManager thread running \n");
 
       //we should look at our WaveTrack queues to see if we can process a new task to the running queue.
+      //The worker threads take the tasks from there.
       UpdateQueues();
 
-      //start some threads if necessary
-
-      mTasksMutex.Lock();
-      tasksInArray = mTasks.size()>0;
-      mTasksMutex.Unlock();
-
-      mPauseLock.Lock();
-      paused=mPause;
-      mPauseLock.Unlock();
-
-      mCurrentThreadsMutex.Lock();
-      // keep adding tasks if there is work to do, up to the limit.
-      while(!paused && tasksInArray && (mCurrentThreads < mMaxThreads))
-      {
-         mCurrentThreads++;
-         mCurrentThreadsMutex.Unlock();
-
-         mTasksMutex.Lock();
-         //detach a new thread.
-         thread = new ODTaskThread(mTasks[0]);//task);
-         //thread->SetPriority(10);//default is 50.
-         thread->Create();
-         thread->Run();
-
-         mTasks.erase(mTasks.begin());
-         tasksInArray = mTasks.size()>0;
-         mTasksMutex.Unlock();
-
-         mCurrentThreadsMutex.Lock();
-      }
-
-      mCurrentThreadsMutex.Unlock();
       //use a conditon variable to block here instead of a sleep.
 
-      // JKC: If there are no tasks ready to run, or we're paused then
-      // we wait for there to be tasks in the queue.
+      // JKC: Wait until a task is added or a worker has done some of one.
       mQueueNotEmptyCondLock.Lock();
-      if( (!tasksInArray) || paused)
+      if(!mQueueUpdateNeeded)
          mQueueNotEmptyCond->Wait();
+      mQueueUpdateNeeded = false;
       mQueueNotEmptyCondLock.Unlock();
 
       //if there is some ODTask running, then there will be something in the queue.  If so then redraw to show progress
@@ -318,6 +414,8 @@ void ODManager::Start()
    }
    mTerminateMutex.Unlock();
 
+   StopWorkers();
+
    mTerminatedMutex.Lock();
    mTerminated=true;
    mTerminatedMutex.Unlock();
@@ -337,6 +435,11 @@ void ODManager::Pause(bool pause)
       pMan->mPause = pause;
       pMan->mPauseLock.Unlock();
 
+      //wake the workers so they pick up tasks again.
+      pMan->mTasksMutex.Lock();
+      pMan->mTasksAvailableCond->Broadcast();
+      pMan->mTasksMutex.Unlock();
+
       //we should check the queue again.
       pMan->mQueueNotEmptyCondLock.Lock();
       pMan->mQueueNotEmptyCond->Signal();
@@ -355,6 +458,13 @@ void ODManager::Resume()
 
 void ODManager::Quit()
 {
+   ODSndFileLockStats stripes, shared;
+   ODSndFileLock::GetStats(&stripes, &shared);
+   wxLogDebug(wxT("libsndfile file locks: %lu taken, %lu contended, %lu ms waiting"),
+              stripes.acquisitions, stripes.contended, stripes.waitMillis);
+   wxLogDebug(wxT("libsndfile shared lock: %lu taken, %lu contended, %lu ms waiting"),
+              shared.acquisitions, shared.contended, shared.waitMillis);
+
    if(IsInstanceCreated())
    {
       pMan->mTerminateMutex.Lock();
@@ -477,11 +587,36 @@ bool ODManager::MakeWaveTrackDependent(WaveTrack* dependentTrack,WaveTrack* mast
 ///@param seconds the point in the track from which the tasks associated with track should begin processing from.
 void ODManager::DemandTrackUpdate(WaveTrack* track, double seconds)
 {
+   ODTask* demanded = NULL;
+
    mQueuesMutex.Lock();
    for(unsigned int i=0;i<mQueues.size();i++)
    {
       mQueues[i]->DemandTrackUpdate(track,seconds);
+      if(!demanded && mQueues[i]->ContainsWaveTrack(track))
+         demanded = mQueues[i]->GetFrontTask();
    }
+
+   //the user is waiting on this track, so its running task goes ahead of the others.
+   //The task can't be deleted while we hold mQueuesMutex.
+   mTasksMutex.Lock();
+   mDemandedTask = demanded;
+   if(demanded)
+   {
+      for(unsigned int i=0;i<mWorkerQueues.size();i++)
+      {
+         std::deque<ODTask*> &queue = mWorkerQueues[i];
+         for(unsigned int j=0;j<queue.size();j++)
+         {
+            if(queue[j]==demanded)
+            {
+               queue.erase(queue.begin()+j--);
+               mDemandQueue.push_front(demanded);
+            }
+         }
+      }
+   }
+   mTasksMutex.Unlock();
    mQueuesMutex.Unlock();
 }
 
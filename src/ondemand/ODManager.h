@@ -19,6 +19,7 @@ number of threads.
 #ifndef __AUDACITY_ODMANAGER__
 #define __AUDACITY_ODMANAGER__
 
+#include <deque>
 #include <vector>
 #include "ODTask.h"
 #include "ODTaskThread.h"
@@ -58,9 +59,6 @@ class ODManager
    ///changes the tasks associated with this Waveform to process the task from a different point in the track
    void DemandTrackUpdate(WaveTrack* track, double seconds);
 
-   ///Reduces the count of current threads running.  Meant to be called when ODTaskThreads end in their own threads.  Thread-safe.
-   void DecrementCurrentThreads();
-
    ///Adds a wavetrack, creates a queue member.
    void AddNewTask(ODTask* task, bool lockMutex=true);
 
@@ -83,6 +81,8 @@ class ODManager
    ///Adds a task to the running queue.  Threas-safe.
    void AddTask(ODTask* task);
 
+   ///Takes a task out of the scheduler for good, waiting for any worker running it.
+   ///Call before deleting the task.
    void RemoveTaskIfInQueue(ODTask* task);
 
    ///sets a flag that is set if we have loaded some OD blockfiles from PCM.
@@ -110,9 +110,6 @@ class ODManager
    static void Pause(bool pause = true);
    static void Resume();
 
-   static void LockLibSndFileMutex();
-   static void UnlockLibSndFileMutex();
-
 
 
   protected:
@@ -126,6 +123,20 @@ class ODManager
    ///Start the main loop for the manager.
    void Start();
 
+   ///Starts the worker threads, one per processor unless the /OnDemand/Threads preference says otherwise.
+   void StartWorkers();
+   ///Tells the worker threads to finish their current task and waits for them.
+   void StopWorkers();
+
+   friend class ODTaskThread;
+   ///Runs tasks on worker thread number index until StopWorkers() is called.
+   void RunWorker(int index);
+   ///Waits for a task for worker number index to run.  Returns NULL when the worker should exit.
+   ODTask* TakeTask(int index);
+   ///Queues an entry for task, on the given worker's deque or (for -1) the next one in turn,
+   ///unless it has as many as it can use already.  mTasksMutex must be held.
+   void ScheduleTaskLocked(ODTask* task, int worker);
+
    ///Remove references in our array to Tasks that have been completed/Schedule new ones
    void UpdateQueues();
 
@@ -136,10 +147,23 @@ class ODManager
    std::vector<ODWaveTrackTaskQueue*> mQueues;
    ODLock mQueuesMutex;
 
-   //List of current Task to do.
-   std::vector<ODTask*> mTasks;
-   //mutex for above variable
+   //The work-stealing scheduler.  Each worker thread has a deque of entries for tasks ready to run.
+   //It takes from the front of its own deque, and when that is empty it steals from the back of
+   //another's.  A task that can run concurrently gets one entry per worker, so idle workers pick
+   //up its blocks; others get one.  Entries for the task the user last demanded go on mDemandQueue,
+   //which every worker serves first.
+   std::vector< std::deque<ODTask*> > mWorkerQueues;
+   std::deque<ODTask*> mDemandQueue;
+   ODTask* mDemandedTask;
+   int mNextWorkerQueue;
+   bool mStopWorkers;
+   std::vector<ODTaskThread*> mWorkers;
+   //mutex for the above variables and the tasks' scheduling counts
    ODLock mTasksMutex;
+   //signalled when an entry is queued, on resume, and when the workers should stop
+   ODCondition* mTasksAvailableCond;
+   //signalled when a task has no entries queued or running
+   ODCondition* mTaskIdleCond;
 
    //global pause switch for OD
    volatile bool mPause;
@@ -147,14 +171,6 @@ class ODManager
 
    volatile int mNeedsDraw;
 
-   ///Number of threads currently running.   Accessed thru multiple threads
-   volatile int mCurrentThreads;
-   //mutex for above variable
-   ODLock mCurrentThreadsMutex;
-
-   ///Maximum number of threads allowed out.
-   int mMaxThreads;
-
    volatile bool mTerminate;
    ODLock mTerminateMutex;
 
@@ -164,6 +180,8 @@ class ODManager
    //for the queue not empty comdition
    ODLock         mQueueNotEmptyCondLock;
    ODCondition*   mQueueNotEmptyCond;
+   //set when the queues need looking at; guarded by mQueueNotEmptyCondLock
+   bool           mQueueUpdateNeeded;
 
 #ifdef __WXMAC__
 
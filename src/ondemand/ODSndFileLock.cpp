@@ -0,0 +1,115 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  ODSndFileLock.cpp
+
+******************************************************************//**
+
+\class ODSndFileLock
+\brief The locks that keep threads from using libsndfile unsafely,
+one per group of files plus one for libsndfile's global state.
+
+*//*******************************************************************/
+
+#include "ODSndFileLock.h"
+
+#include <wx/timer.h>
+
+namespace {
+
+// A mutex that counts how often it was taken and waited for.  The
+// counts are only changed while holding the mutex itself.
+class CountingLock
+{
+ public:
+   void Lock()
+   {
+      if (mMutex.TryLock() == wxMUTEX_NO_ERROR) {
+         mStats.acquisitions++;
+         return;
+      }
+
+      wxStopWatch waited;
+      mMutex.Lock();
+      mStats.acquisitions++;
+      mStats.contended++;
+      mStats.waitMillis += waited.Time();
+   }
+
+   void Unlock()
+   {
+      mMutex.Unlock();
+   }
+
+   void AddStats(ODSndFileLockStats *total)
+   {
+      wxMutexLocker locker(mMutex);
+      total->acquisitions += mStats.acquisitions;
+      total->contended += mStats.contended;
+      total->waitMillis += mStats.waitMillis;
+   }
+
+   void ResetStats()
+   {
+      wxMutexLocker locker(mMutex);
+      mStats = ODSndFileLockStats();
+   }
+
+ private:
+   wxMutex mMutex;
+   ODSndFileLockStats mStats;
+};
+
+CountingLock sStripes[ODSndFileLock::NumStripes];
+CountingLock sShared;
+
+}
+
+int ODSndFileLock::GetStripe(const wxString &fullPath)
+{
+   // FNV-1a over the characters of the path
+   unsigned int hash = 2166136261u;
+   for (size_t i = 0; i < fullPath.Length(); i++) {
+      hash ^= (unsigned int)fullPath[i];
+      hash *= 16777619u;
+   }
+   return (int)(hash % NumStripes);
+}
+
+void ODSndFileLock::LockStripe(int stripe)
+{
+   sStripes[stripe].Lock();
+}
+
+void ODSndFileLock::UnlockStripe(int stripe)
+{
+   sStripes[stripe].Unlock();
+}
+
+void ODSndFileLock::LockShared()
+{
+   sShared.Lock();
+}
+
+void ODSndFileLock::UnlockShared()
+{
+   sShared.Unlock();
+}
+
+void ODSndFileLock::GetStats(ODSndFileLockStats *stripes, ODSndFileLockStats *shared)
+{
+   *stripes = ODSndFileLockStats();
+   for (int i = 0; i < NumStripes; i++)
+      sStripes[i].AddStats(stripes);
+
+   *shared = ODSndFileLockStats();
+   sShared.AddStats(shared);
+}
+
+void ODSndFileLock::ResetStats()
+{
+   for (int i = 0; i < NumStripes; i++)
+      sStripes[i].ResetStats();
+   sShared.ResetStats();
+}
@@ -0,0 +1,77 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  ODSndFileLock.h
+
+**********************************************************************/
+
+#ifndef __AUDACITY_ODSNDFILELOCK__
+#define __AUDACITY_ODSNDFILELOCK__
+
+#include <wx/string.h>
+#include <wx/thread.h>
+
+/// How often a group of libsndfile locks was taken, and how often a
+/// thread had to wait for one because another thread held it.
+struct ODSndFileLockStats
+{
+   ODSndFileLockStats() : acquisitions(0), contended(0), waitMillis(0) {}
+
+   unsigned long acquisitions;
+   unsigned long contended;
+   unsigned long waitMillis;   // total time spent waiting when contended
+};
+
+/// \brief The locks that keep threads from using libsndfile unsafely.
+///
+/// libsndfile keeps almost all of its state in the SNDFILE handle, so
+/// handles on different files can be used from different threads at
+/// once.  Calls on a handle take the stripe lock of the file it was
+/// opened on; files are hashed onto a fixed set of stripes, so two
+/// threads only wait for each other when their files share a stripe.
+/// Holding the stripe of a file also keeps anyone else from reading it
+/// while it is being written.
+///
+/// The few calls that touch libsndfile's process-wide state (opening a
+/// file, which records the error of a failed open globally) take the
+/// shared lock instead, for as short a time as possible.
+class ODSndFileLock
+{
+ public:
+   /// The stripe that serializes access to the file at fullPath
+   static int GetStripe(const wxString &fullPath);
+
+   static void LockStripe(int stripe);
+   static void UnlockStripe(int stripe);
+
+   static void LockShared();
+   static void UnlockShared();
+
+   /// Totals over all stripes, and for the shared lock, since the
+   /// program started or since the last ResetStats()
+   static void GetStats(ODSndFileLockStats *stripes, ODSndFileLockStats *shared);
+   static void ResetStats();
+
+   enum { NumStripes = 16 };
+};
+
+/// Holds the stripe lock of one file for the life of the object
+class ODSndFileStripeLocker
+{
+ public:
+   ODSndFileStripeLocker(const wxString &fullPath)
+      : mStripe(ODSndFileLock::GetStripe(fullPath))
+   {
+      ODSndFileLock::LockStripe(mStripe);
+   }
+   ~ODSndFileStripeLocker()
+   {
+      ODSndFileLock::UnlockStripe(mStripe);
+   }
+
+ private:
+   int mStripe;
+};
+
+#endif //__AUDACITY_ODSNDFILELOCK__
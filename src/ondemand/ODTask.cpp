@@ -30,6 +30,7 @@ DEFINE_EVENT_TYPE(EVT_ODTASK_COMPLETE)
 
 /// Constructs an ODTask
 ODTask::ODTask()
+:  mNotRunningCond(&mIsRunningMutex)
 {
 
    static int sTaskNumber=0;
@@ -37,7 +38,9 @@ ODTask::ODTask()
    mDoingTask=false;
    mTerminate = false;
    mNeedsODUpdate=false;
-   mIsRunning = false;
+   mNumRunning = 0;
+   mScheduledCount = 0;
+   mUnscheduled = false;
 
    mTaskNumber=sTaskNumber++;
 
@@ -53,12 +56,12 @@ void ODTask::TerminateAndBlock()
    //release all data the derived class may have allocated
    mTerminateMutex.Unlock();
 
-   //and one mutex pair for the exit of the function
-   mBlockUntilTerminateMutex.Lock();
-//TODO lock mTerminate?
-   mBlockUntilTerminateMutex.Unlock();
+   //wait till every thread is out of DoSome() to terminate.
+   mIsRunningMutex.Lock();
+   while(mNumRunning > 0)
+      mNotRunningCond.Wait();
+   mIsRunningMutex.Unlock();
 
-   //wait till we are out of doSome() to terminate.
    Terminate();
 }
 
@@ -66,10 +69,12 @@ void ODTask::TerminateAndBlock()
 ///Relies on DoSomeInternal(), which is the subclasses must implement.
 ///@param amountWork the percent amount of the total job to do.  1.0 represents the entire job.  the default of 0.0
 /// will do the smallest unit of work possible
-void ODTask::DoSome(float amountWork)
+///@return true if there is more to do and the task should be scheduled again.
+bool ODTask::DoSome(float amountWork)
 {
+   bool moreToDo;
+
    SetIsRunning(true);
-   mBlockUntilTerminateMutex.Lock();
 
 //   printf("%s %i subtask starting on new thread with priority\n", GetTaskName(),GetTaskNumber());
 
@@ -85,8 +90,7 @@ void ODTask::DoSome(float amountWork)
    {
       mTerminateMutex.Unlock();
       SetIsRunning(false);
-      mBlockUntilTerminateMutex.Unlock();
-      return;
+      return false;
    }
    mTerminateMutex.Unlock();
 
@@ -104,11 +108,14 @@ void ODTask::DoSome(float amountWork)
    mTerminateMutex.Lock();
    while(PercentComplete() < workUntil && PercentComplete() < 1.0 && !mTerminate)
    {
+      //release within the loop so we can cut the number of iterations short.
+      //TerminateAndBlock() waits for us to leave DoSome(), so the task's data
+      //can't go away under DoSomeInternal(), and other threads running this
+      //task aren't held up.
+      mTerminateMutex.Unlock();
       wxThread::This()->Yield();
-      //release within the loop so we can cut the number of iterations short
 
-      DoSomeInternal(); //keep the terminate mutex on so we don't remo
-      mTerminateMutex.Unlock();
+      DoSomeInternal();
       //check to see if ondemand has been called
       if(GetNeedsODUpdate() && PercentComplete() < 1.0)
          ODUpdate();
@@ -121,11 +128,10 @@ void ODTask::DoSome(float amountWork)
    mDoingTask=false;
 
    mTerminateMutex.Lock();
-   //if it is not done, put it back onto the ODManager queue.
-   if(PercentComplete() < 1.0&& !mTerminate)
+   //if it is not done, the caller puts it back onto the ODManager queue.
+   moreToDo = PercentComplete() < 1.0 && !mTerminate;
+   if(moreToDo)
    {
-      ODManager::Instance()->AddTask(this);
-
       //we did a bit of progress - we should allow a resave.
       AudacityProject::AllProjectsDeleteLock();
       for(unsigned i=0; i<gAudacityProjects.GetCount(); i++)
@@ -170,7 +176,7 @@ void ODTask::DoSome(float amountWork)
    }
    mTerminateMutex.Unlock();
    SetIsRunning(false);
-   mBlockUntilTerminateMutex.Unlock();
+   return moreToDo;
 }
 
 bool ODTask::IsTaskAssociatedWithProject(AudacityProject* proj)
@@ -210,10 +216,13 @@ void ODTask::ODUpdate()
    ResetNeedsODUpdate();
 }
 
+///counts a thread in or out of DoSome()
 void ODTask::SetIsRunning(bool value)
 {
    mIsRunningMutex.Lock();
-   mIsRunning=value;
+   mNumRunning += value ? 1 : -1;
+   if(mNumRunning == 0)
+      mNotRunningCond.Broadcast();
    mIsRunningMutex.Unlock();
 }
 
@@ -221,7 +230,7 @@ bool ODTask::IsRunning()
 {
    bool ret;
    mIsRunningMutex.Lock();
-   ret= mIsRunning;
+   ret= mNumRunning > 0;
    mIsRunningMutex.Unlock();
    return ret;
 }
@@ -64,13 +64,18 @@ class ODTask
 ///Relies on DoSomeInternal(), which is the subclasses must implement.
 ///@param amountWork the percent amount of the total job to do.  1.0 represents the entire job.  the default of 0.0
 /// will do the smallest unit of work possible
-   void DoSome(float amountWork=0.0);
+///@return true if there is more to do and the task should be scheduled again.
+   bool DoSome(float amountWork=0.0);
 
    ///Call DoSome until PercentComplete >= 1.0
    void DoAll();
 
    virtual float PercentComplete();
 
+   ///Whether several threads may run DoSome() on this task at once.  Subclasses that
+   ///return true must claim each unit of work in DoSomeInternal() under their own lock.
+   virtual bool CanRunConcurrently(){return false;}
+
    virtual bool UsesCustomWorkUntilPercentage(){return false;}
    virtual float ComputeNextWorkUntilPercentageComplete(){return 1.0;}
 
@@ -152,8 +157,6 @@ class ODTask
    volatile bool  mTaskStarted;
    volatile bool mTerminate;
    ODLock mTerminateMutex;
-   //for a function not a member var.
-   ODLock mBlockUntilTerminateMutex;
 
    std::vector<WaveTrack*> mWaveTracks;
    ODLock     mWaveTrackMutex;
@@ -161,11 +164,20 @@ class ODTask
    volatile sampleCount mDemandSample;
    ODLock      mDemandSampleMutex;
 
-   volatile bool mIsRunning;
+   ///the number of threads in DoSome()
+   int mNumRunning;
    ODLock mIsRunningMutex;
+   ///signalled when mNumRunning drops to zero
+   ODCondition mNotRunningCond;
 
 
    private:
+   friend class ODManager;
+
+   //The ODManager's bookkeeping, guarded by its task mutex: the number of entries
+   //for this task waiting in its scheduler or running, and whether it may be scheduled at all.
+   int mScheduledCount;
+   bool mUnscheduled;
 
    volatile bool mNeedsODUpdate;
    ODLock mNeedsODUpdateMutex;
@@ -11,7 +11,8 @@
 ******************************************************************//**
 
 \class ODTaskThread
-\brief A thread that executes a part of the task specfied by an ODTask.
+\brief One of the ODManager's worker threads, which run ODTasks a part at
+a time until the manager quits.
 
 *//*******************************************************************/
 
@@ -21,12 +22,13 @@
 #include "ODManager.h"
 
 
-ODTaskThread::ODTaskThread(ODTask* task)
+ODTaskThread::ODTaskThread(ODManager* manager, int index)
 #ifndef __WXMAC__
-: wxThread()
+: wxThread(wxTHREAD_JOINABLE)
 #endif
 {
-   mTask=task;
+   mManager=manager;
+   mIndex=index;
 #ifdef __WXMAC__
    mDestroy = false;
    mThread = NULL;
@@ -44,12 +46,7 @@ void *ODTaskThread::Entry()
 {
    //TODO: Figure out why this has no effect at all.
    //wxThread::This()->SetPriority( 40);
-   //Do at least 5 percent of the task
-   mTask->DoSome(0.05f);
-
-   //release the thread count so that the ODManager knows how many active threads are alive.
-   ODManager::Instance()->DecrementCurrentThreads();
-
+   mManager->RunWorker(mIndex);
 
 #ifndef __WXMAC__
    return NULL;
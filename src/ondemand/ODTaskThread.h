@@ -11,7 +11,8 @@
 ******************************************************************//**
 
 \class ODTaskThread
-\brief A thread that executes a part of the task specfied by an ODTask.
+\brief One of the ODManager's worker threads, which run ODTasks a part at
+a time until the manager quits.
 
 *//*******************************************************************/
 
@@ -26,6 +27,7 @@
 #include "../Audacity.h"	// contains the set-up of AUDACITY_DLL_API
 
 class ODTask;
+class ODManager;
 
 #ifdef __WXMAC__
 
@@ -38,7 +40,7 @@ class ODTask;
 class ODTaskThread {
  public:
    typedef int ExitCode;
-   ODTaskThread(ODTask* task);
+   ODTaskThread(ODManager* manager, int index);
    /*ExitCode*/ void Entry();
    void Create() {}
    void Delete() {
@@ -77,7 +79,8 @@ class ODTaskThread {
    bool mDestroy;
    pthread_t mThread;
 
-   ODTask* mTask;
+   ODManager* mManager;
+   int mIndex;
 };
 
 class ODLock {
@@ -128,15 +131,17 @@ protected:
 class ODTaskThread : public wxThread
 {
 public:
-   ///Constructs a ODTaskThread
-   ///@param task the task to be launched as an
-   ODTaskThread(ODTask* task);
+   ///Constructs a joinable ODTaskThread
+   ///@param manager the manager whose tasks the thread runs
+   ///@param index the number of the thread's queue in the manager's scheduler
+   ODTaskThread(ODManager* manager, int index);
 
 
 protected:
-   ///Executes a part of the task
+   ///Runs tasks until the manager stops its workers
    virtual void* Entry();
-   ODTask* mTask;
+   ODManager* mManager;
+   int mIndex;
 
 };
 
@@ -305,6 +305,7 @@ void ODWaveTrackTaskQueue::RemoveFrontTask()
    if(mTasks.size())
    {
       //wait for the task to stop running.
+      ODManager::Instance()->RemoveTaskIfInQueue(mTasks[0]);
       delete mTasks[0];
       mTasks.erase(mTasks.begin());
    }
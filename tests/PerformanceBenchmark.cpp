@@ -0,0 +1,670 @@
+/**********************************************************************
+
+  Audacity: A Digital Audio Editor
+
+  PerformanceBenchmark.cpp
+
+  A headless benchmark of the code under the editing, display, playback
+  and export paths: Sequence editing and summaries, block file reads and
+  writes, packing 24-bit samples, the FFT used by the spectrogram,
+  resampling, mixing playback tracks and FLAC encoding, serial and
+  parallel.  It needs no project window, so it can be run unattended and
+  its output compared from one build to the next.
+
+  Every case is repeated and the distribution of the times is reported,
+  in milliseconds per repetition, as JSON (the default) or CSV:
+
+     PerformanceBenchmark [--format=json|csv] [--repeat=N]
+                          [--length=SAMPLES] [--block=SAMPLES]
+                          [--fft=SIZE] [--tracks=N] [--dir=PATH]
+
+**********************************************************************/
+
+#include "Sequence.h"
+#include "DirManager.h"
+#include "BlockFile.h"
+#include "FFT.h"
+#include "Mix.h"
+#include "MixKernels.h"
+#include "Prefs.h"
+#include "Resample.h"
+#include "WaveTrack.h"
+#include "WorkerPool.h"
+
+#ifdef USE_LIBFLAC
+#include "export/ParallelFLACEncoder.h"
+#endif
+
+#include <wx/sstream.h>
+
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static double NowMillis()
+{
+   struct timeval tv;
+   gettimeofday(&tv, NULL);
+   return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+// Times of the repetitions of one case
+struct BenchmarkResult
+{
+   std::string name;
+   long work;                 // samples processed per repetition
+   std::vector<double> times;
+
+   // Nearest-rank percentile of the sorted times
+   double Percentile(double p) const
+   {
+      int n = (int)times.size();
+      int rank = (int)ceil(p / 100.0 * n);
+      if (rank < 1)
+         rank = 1;
+      return times[(rank > n ? n : rank) - 1];
+   }
+
+   double Mean() const
+   {
+      double sum = 0;
+      for (size_t i = 0; i < times.size(); i++)
+         sum += times[i];
+      return sum / times.size();
+   }
+};
+
+// Mixes one fill cycle of each of a set of playback mixers, as
+// AudioIO::FillBuffers() does
+class BenchmarkMixJob : public WorkerPoolJob
+{
+public:
+   BenchmarkMixJob(Mixer **mixers, int len)
+      : mMixers(mixers), mLen(len), mProcessed(0) {}
+
+   virtual void RunItem(int item)
+   {
+      sampleCount processed = mMixers[item]->Process(mLen);
+      // The tracks are all the same length
+      if (item == 0)
+         mProcessed = processed;
+   }
+
+   sampleCount GetProcessed() const { return mProcessed; }
+
+private:
+   Mixer **mMixers;
+   int mLen;
+   sampleCount mProcessed;
+};
+
+class PerformanceBenchmark
+{
+private:
+   std::string mFormat;
+   int mRepeat;
+   int mLength;
+   int mBlockLen;
+   int mFFTSize;
+   int mTracks;
+   std::string mDir;
+
+   DirManager *mDirManager;
+   std::vector<float> mSignal;
+   std::vector<BenchmarkResult> mResults;
+
+public:
+   PerformanceBenchmark()
+      : mFormat("json"),
+        mRepeat(20),
+        mLength(1 << 20),
+        mBlockLen(1 << 18),
+        mFFTSize(2048),
+        mTracks(16),
+        mDir("/tmp/audacity-benchmark-dir"),
+        mDirManager(NULL)
+   {
+   }
+
+   bool ParseArgs(int argc, char **argv)
+   {
+      for (int i = 1; i < argc; i++) {
+         std::string arg = argv[i];
+         size_t eq = arg.find('=');
+         std::string key = arg.substr(0, eq);
+         std::string value = (eq == std::string::npos) ? "" : arg.substr(eq + 1);
+
+         if (key == "--format" && (value == "json" || value == "csv"))
+            mFormat = value;
+         else if (key == "--repeat")
+            mRepeat = atoi(value.c_str());
+         else if (key == "--length")
+            mLength = atoi(value.c_str());
+         else if (key == "--block")
+            mBlockLen = atoi(value.c_str());
+         else if (key == "--fft")
+            mFFTSize = atoi(value.c_str());
+         else if (key == "--tracks")
+            mTracks = atoi(value.c_str());
+         else if (key == "--dir" && !value.empty())
+            mDir = value;
+         else {
+            std::cerr << "unknown or bad option: " << arg << "\n";
+            return false;
+         }
+      }
+
+      // PowerSpectrum wants a power of two
+      if (mRepeat < 1 || mLength < 1024 || mBlockLen < 1 || mTracks < 1 ||
+          mFFTSize < 16 || (mFFTSize & (mFFTSize - 1)) != 0) {
+         std::cerr << "sizes out of range\n";
+         return false;
+      }
+
+      return true;
+   }
+
+   void SetUp()
+   {
+      // In-memory preferences, so the resampler finds its defaults and
+      // nothing is written to the user's configuration
+      wxStringInputStream noPrefs(wxEmptyString);
+      gPrefs = new wxFileConfig(noPrefs);
+
+      DirManager::SetTempDir(wxString::FromAscii(mDir.c_str()));
+      mDirManager = new DirManager;
+
+      // A repeatable signal that isn't trivially compressible
+      srand(1);
+      mSignal.resize(mLength);
+      for (int i = 0; i < mLength; i++)
+         mSignal[i] = 0.5f * sinf(i * 0.01f) +
+                      0.1f * (rand() / (float)RAND_MAX - 0.5f);
+   }
+
+   void TearDown()
+   {
+      delete mDirManager;
+      mDirManager = NULL;
+
+      delete gPrefs;
+      gPrefs = NULL;
+   }
+
+   BenchmarkResult &NewResult(const std::string &name, long work)
+   {
+      mResults.push_back(BenchmarkResult());
+      mResults.back().name = name;
+      mResults.back().work = work;
+      return mResults.back();
+   }
+
+   Sequence *NewFilledSequence()
+   {
+      Sequence *seq = new Sequence(mDirManager, floatSample);
+      int chunk = seq->GetIdealAppendLen();
+      for (int pos = 0; pos < mLength; pos += chunk) {
+         int len = std::min(chunk, mLength - pos);
+         seq->Append((samplePtr)&mSignal[pos], floatSample, len);
+      }
+      return seq;
+   }
+
+   void RunSequenceCases()
+   {
+      BenchmarkResult &append = NewResult("sequence_append", mLength);
+      for (int r = 0; r < mRepeat; r++) {
+         double t0 = NowMillis();
+         Sequence *seq = NewFilledSequence();
+         append.times.push_back(NowMillis() - t0);
+         delete seq;
+      }
+
+      Sequence *seq = NewFilledSequence();
+
+      const int getLen = 65536;
+      std::vector<float> buffer(getLen);
+      BenchmarkResult &get = NewResult("sequence_get", mLength);
+      for (int r = 0; r < mRepeat; r++) {
+         double t0 = NowMillis();
+         for (int pos = 0; pos < mLength; pos += getLen)
+            seq->Get((samplePtr)&buffer[0], floatSample,
+                     pos, std::min(getLen, mLength - pos));
+         get.times.push_back(NowMillis() - t0);
+      }
+
+      // One screen's worth of columns over the whole sequence
+      const int columns = 1024;
+      std::vector<float> min(columns), max(columns), rms(columns);
+      std::vector<int> bl(columns);
+      std::vector<sampleCount> where(columns + 1);
+      for (int i = 0; i <= columns; i++)
+         where[i] = (sampleCount)((double)mLength * i / columns);
+      BenchmarkResult &display = NewResult("sequence_wave_display", mLength);
+      for (int r = 0; r < mRepeat; r++) {
+         double t0 = NowMillis();
+         seq->GetWaveDisplay(&min[0], &max[0], &rms[0], &bl[0], columns,
+                             &where[0], (double)mLength / columns);
+         display.times.push_back(NowMillis() - t0);
+      }
+
+      // Paste a tenth of the sequence at a random place and delete it
+      // again, so every repetition starts from the same length
+      int editLen = mLength / 10;
+      BenchmarkResult &paste = NewResult("sequence_paste", editLen);
+      BenchmarkResult &del = NewResult("sequence_delete", editLen);
+      for (int r = 0; r < mRepeat; r++) {
+         Sequence *clip;
+         int s0 = rand() % (mLength - editLen);
+         seq->Copy(s0, s0 + editLen, &clip);
+
+         int dest = rand() % mLength;
+         double t0 = NowMillis();
+         seq->Paste(dest, clip);
+         double t1 = NowMillis();
+         seq->Delete(dest, editLen);
+         double t2 = NowMillis();
+
+         paste.times.push_back(t1 - t0);
+         del.times.push_back(t2 - t1);
+         delete clip;
+      }
+
+      delete seq;
+   }
+
+   void RunBlockFileCases()
+   {
+      static const sampleFormat formats[] =
+         { int16Sample, int24Sample, floatSample };
+      static const char *names[] = { "int16", "int24", "float" };
+
+      for (int f = 0; f < 3; f++) {
+         samplePtr data = NewSamples(mBlockLen, formats[f]);
+         CopySamples((samplePtr)&mSignal[0], floatSample, data, formats[f],
+                     std::min(mBlockLen, mLength));
+
+         BenchmarkResult &write =
+            NewResult(std::string("blockfile_write_") + names[f], mBlockLen);
+         for (int r = 0; r < mRepeat; r++) {
+            double t0 = NowMillis();
+            BlockFile *b = mDirManager->NewSimpleBlockFile(data, mBlockLen,
+                                                           formats[f]);
+            write.times.push_back(NowMillis() - t0);
+            mDirManager->Deref(b);
+         }
+
+         // Reads come from the operating system's cache after the first
+         BlockFile *b = mDirManager->NewSimpleBlockFile(data, mBlockLen,
+                                                        formats[f]);
+         BenchmarkResult &read =
+            NewResult(std::string("blockfile_read_") + names[f], mBlockLen);
+         for (int r = 0; r < mRepeat; r++) {
+            double t0 = NowMillis();
+            b->ReadData(data, formats[f], 0, mBlockLen);
+            read.times.push_back(NowMillis() - t0);
+         }
+         mDirManager->Deref(b);
+
+         DeleteSamples(data);
+      }
+   }
+
+   void RunFFTCases()
+   {
+      // The windows of a spectrogram of the whole signal, without overlap
+      int frames = mLength / mFFTSize;
+      std::vector<float> in(mFFTSize), out(mFFTSize);
+
+      BenchmarkResult &fft = NewResult("fft_power_spectrum",
+                                       (long)frames * mFFTSize);
+      for (int r = 0; r < mRepeat; r++) {
+         double t0 = NowMillis();
+         for (int i = 0; i < frames; i++) {
+            memcpy(&in[0], &mSignal[i * mFFTSize], mFFTSize * sizeof(float));
+            WindowFunc(3, mFFTSize, &in[0]);
+            PowerSpectrum(mFFTSize, &in[0], &out[0]);
+         }
+         fft.times.push_back(NowMillis() - t0);
+      }
+   }
+
+   void RunResampleCases()
+   {
+      const double factor = 48000.0 / 44100.0;
+      const int inLen = 65536;
+      int outLen = (int)(inLen * factor) + 1024;
+      std::vector<float> out(outLen);
+
+      static const bool best[] = { false, true };
+      static const char *names[] = { "resample_fast", "resample_best" };
+
+      for (int m = 0; m < 2; m++) {
+         BenchmarkResult &result = NewResult(names[m], mLength);
+         for (int r = 0; r < mRepeat; r++) {
+            Resample resample(best[m], factor, factor);
+
+            double t0 = NowMillis();
+            int pos = 0;
+            for (;;) {
+               int len = std::min(inLen, mLength - pos);
+               bool last = (pos + len == mLength);
+               int used = 0;
+               resample.Process(factor, &mSignal[pos], len, last,
+                                &used, &out[0], outLen);
+               pos += used;
+               if (last && used == len)
+                  break;
+            }
+            result.times.push_back(NowMillis() - t0);
+         }
+      }
+   }
+
+   // Writes and reads back the signal as 24-bit samples, one sample per
+   // call as SimpleBlockFile used to, and packed with PackInt24() into
+   // a single write
+   void RunInt24Cases()
+   {
+      const bool msbFirst = (wxBYTE_ORDER == wxBIG_ENDIAN);
+      std::string path = mDir + "/benchmark-int24.raw";
+
+      std::vector<int> samples(mLength), unpacked(mLength);
+      std::vector<unsigned char> packed(mLength * 3);
+      for (int i = 0; i < mLength; i++)
+         samples[i] = (int)lrintf(8388607 * mSignal[i]);
+
+      BenchmarkResult &writeOld = NewResult("int24_write_per_sample", mLength);
+      BenchmarkResult &writeNew = NewResult("int24_write_packed", mLength);
+      BenchmarkResult &unpackOld = NewResult("int24_unpack_per_sample", mLength);
+      BenchmarkResult &unpackNew = NewResult("int24_unpack", mLength);
+      bool ok = true;
+      for (int r = 0; r < mRepeat; r++) {
+         double t0 = NowMillis();
+         FILE *fp = fopen(path.c_str(), "wb");
+         if (fp) {
+            for (int i = 0; i < mLength && ok; i++)
+               ok = (fwrite((char *)&samples[i] + (msbFirst ? 1 : 0),
+                            1, 3, fp) == 3);
+            fclose(fp);
+         }
+         else
+            ok = false;
+         writeOld.times.push_back(NowMillis() - t0);
+
+         t0 = NowMillis();
+         fp = fopen(path.c_str(), "wb");
+         if (fp) {
+            PackInt24(&samples[0], &packed[0], mLength, msbFirst);
+            ok = ok && (fwrite(&packed[0], 1, packed.size(), fp) ==
+                        packed.size());
+            fclose(fp);
+         }
+         else
+            ok = false;
+         writeNew.times.push_back(NowMillis() - t0);
+
+         t0 = NowMillis();
+         const unsigned char *p = &packed[0];
+         for (int i = 0; i < mLength; i++, p += 3) {
+            unsigned int v = msbFirst ?
+               ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) |
+                  ((unsigned int)p[2] << 8) :
+               ((unsigned int)p[2] << 24) | ((unsigned int)p[1] << 16) |
+                  ((unsigned int)p[0] << 8);
+            unpacked[i] = ((int)v) >> 8;
+         }
+         unpackOld.times.push_back(NowMillis() - t0);
+
+         t0 = NowMillis();
+         UnpackInt24(&packed[0], &unpacked[0], mLength, msbFirst);
+         unpackNew.times.push_back(NowMillis() - t0);
+
+         ok = ok && (unpacked == samples);
+      }
+
+      if (!ok)
+         std::cerr << "int24: writing or unpacking failed\n";
+
+      remove(path.c_str());
+   }
+
+   // A playback fill cycle the way AudioIO::FillBuffers() does it: one
+   // Mixer per track, resampling the tracks from 48 kHz to 44.1 kHz,
+   // run one after another and shared out over a WorkerPool
+   void RunMixCases()
+   {
+      const double rate = 44100.0;
+      const double trackRate = 48000.0;
+      const int fillLen = 65536;
+
+      TrackFactory factory(mDirManager);
+      WaveTrack *source = factory.NewWaveTrack(floatSample, trackRate);
+      const int chunk = 65536;
+      for (int pos = 0; pos < mLength; pos += chunk)
+         source->Append((samplePtr)&mSignal[pos], floatSample,
+                        std::min(chunk, mLength - pos));
+      source->Flush();
+
+      // The copies share the source's block files
+      std::vector<WaveTrack *> tracks(mTracks);
+      for (int t = 0; t < mTracks; t++)
+         tracks[t] = factory.DuplicateWaveTrack(*source);
+
+      WorkerPool serial(0);
+      WorkerPool parallel(WorkerPool::GetDefaultNumThreads());
+      WorkerPool *pools[] = { &serial, &parallel };
+      static const char *names[] = { "mix_tracks_serial", "mix_tracks_parallel" };
+
+      std::vector<Mixer *> mixers(mTracks);
+      for (int p = 0; p < 2; p++) {
+         BenchmarkResult &mix = NewResult(names[p], (long)mLength * mTracks);
+         for (int r = 0; r < mRepeat; r++) {
+            for (int t = 0; t < mTracks; t++) {
+               mixers[t] = new Mixer(1, &tracks[t], NULL,
+                                     0.0, source->GetEndTime(),
+                                     1, fillLen, false,
+                                     rate, floatSample, false);
+               mixers[t]->ApplyTrackGains(false);
+            }
+
+            BenchmarkMixJob job(&mixers[0], fillLen);
+            double t0 = NowMillis();
+            do
+               pools[p]->Run(&job, mTracks);
+            while (job.GetProcessed() > 0);
+            mix.times.push_back(NowMillis() - t0);
+
+            for (int t = 0; t < mTracks; t++)
+               delete mixers[t];
+         }
+      }
+
+      for (int t = 0; t < mTracks; t++)
+         delete tracks[t];
+      delete source;
+   }
+
+#if defined(USE_LIBFLAC) && !defined(LEGACY_FLAC)
+   // Encodes the signal as a stereo 16-bit export at the default level
+   // would, with the threads of pool if there is one
+   bool EncodeFLAC(const std::string &path, WorkerPool *pool)
+   {
+      const unsigned chunk = 8192;
+      FLACEncoderSettings settings(2, 44100, 16, 5);
+
+      FILE *fp = fopen(path.c_str(), "w+b");
+      if (!fp)
+         return false;
+
+      std::vector<FLAC__int32> data(2 * chunk);
+      FLAC__int32 *buffers[2] = { &data[0], &data[chunk] };
+
+      FLAC::Encoder::File serial;
+      ParallelFLACEncoder *parallel = NULL;
+      bool ok;
+      if (pool) {
+         parallel = new ParallelFLACEncoder(settings, fp, pool);
+         ok = (parallel->Init(NULL, 0) == FLAC__STREAM_ENCODER_INIT_STATUS_OK);
+      }
+      else {
+         settings.Apply(serial);
+         ok = (serial.init(fp) == FLAC__STREAM_ENCODER_INIT_STATUS_OK);
+         if (!ok) {
+            fclose(fp);
+            return false;
+         }
+      }
+
+      for (int pos = 0; ok && pos < mLength; pos += chunk) {
+         int len = std::min((int)chunk, mLength - pos);
+         // The right channel is the left, a little later
+         for (int c = 0; c < 2; c++)
+            for (int i = 0; i < len; i++)
+               buffers[c][i] = (FLAC__int32)lrintf(
+                  32767 * mSignal[(pos + i + c * 997) % mLength]);
+         ok = pool ? parallel->Process(buffers, len) :
+                     serial.process(buffers, len);
+      }
+
+      if (pool) {
+         ok = parallel->Finish() && ok;
+         delete parallel;
+         fclose(fp);
+      }
+      else
+         ok = serial.finish() && ok;    // closes fp
+
+      return ok;
+   }
+
+   static std::vector<char> ReadFile(const std::string &path)
+   {
+      std::vector<char> data;
+      FILE *fp = fopen(path.c_str(), "rb");
+      if (fp) {
+         char buf[65536];
+         size_t len;
+         while ((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+            data.insert(data.end(), buf, buf + len);
+         fclose(fp);
+      }
+      return data;
+   }
+
+   void RunFLACCases()
+   {
+      std::string serialPath = mDir + "/benchmark-serial.flac";
+      std::string parallelPath = mDir + "/benchmark-parallel.flac";
+      WorkerPool pool(WorkerPool::GetDefaultNumThreads());
+
+      BenchmarkResult &serial = NewResult("flac_encode_serial",
+                                          (long)mLength * 2);
+      BenchmarkResult &parallel = NewResult("flac_encode_parallel",
+                                            (long)mLength * 2);
+      for (int r = 0; r < mRepeat; r++) {
+         double t0 = NowMillis();
+         if (!EncodeFLAC(serialPath, NULL))
+            std::cerr << "flac_encode_serial: encoding failed\n";
+         serial.times.push_back(NowMillis() - t0);
+
+         t0 = NowMillis();
+         if (!EncodeFLAC(parallelPath, &pool))
+            std::cerr << "flac_encode_parallel: encoding failed\n";
+         parallel.times.push_back(NowMillis() - t0);
+      }
+
+      // The files should be byte for byte the same
+      if (ReadFile(serialPath) != ReadFile(parallelPath))
+         std::cerr << "flac_encode_parallel: output differs from libFLAC's\n";
+
+      remove(serialPath.c_str());
+      remove(parallelPath.c_str());
+   }
+#endif
+
+   void Report()
+   {
+      for (size_t i = 0; i < mResults.size(); i++)
+         std::sort(mResults[i].times.begin(), mResults[i].times.end());
+
+      if (mFormat == "csv") {
+         std::cout << "name,work,repeat,min_ms,median_ms,p90_ms,p99_ms,max_ms,mean_ms\n";
+         for (size_t i = 0; i < mResults.size(); i++) {
+            const BenchmarkResult &r = mResults[i];
+            std::cout << r.name << "," << r.work << "," << r.times.size()
+                      << "," << r.times.front()
+                      << "," << r.Percentile(50)
+                      << "," << r.Percentile(90)
+                      << "," << r.Percentile(99)
+                      << "," << r.times.back()
+                      << "," << r.Mean() << "\n";
+         }
+         return;
+      }
+
+      std::cout << "{\n"
+                << "  \"config\": {\"repeat\": " << mRepeat
+                << ", \"length\": " << mLength
+                << ", \"block\": " << mBlockLen
+                << ", \"fft\": " << mFFTSize
+                << ", \"tracks\": " << mTracks
+                << ", \"mix_kernel_path\": " << (int)GetMixKernelPath()
+                << "},\n"
+                << "  \"results\": [\n";
+      for (size_t i = 0; i < mResults.size(); i++) {
+         const BenchmarkResult &r = mResults[i];
+         std::cout << "    {\"name\": \"" << r.name << "\""
+                   << ", \"work\": " << r.work
+                   << ", \"repeat\": " << r.times.size()
+                   << ", \"min_ms\": " << r.times.front()
+                   << ", \"median_ms\": " << r.Percentile(50)
+                   << ", \"p90_ms\": " << r.Percentile(90)
+                   << ", \"p99_ms\": " << r.Percentile(99)
+                   << ", \"max_ms\": " << r.times.back()
+                   << ", \"mean_ms\": " << r.Mean()
+                   << "}" << (i + 1 < mResults.size() ? "," : "") << "\n";
+      }
+      std::cout << "  ]\n}\n";
+   }
+};
+
+int main(int argc, char **argv)
+{
+   PerformanceBenchmark benchmark;
+
+   if (!benchmark.ParseArgs(argc, argv))
+      return 1;
+
+   benchmark.SetUp();
+   benchmark.RunSequenceCases();
+   benchmark.RunBlockFileCases();
+   benchmark.RunInt24Cases();
+   benchmark.RunFFTCases();
+   benchmark.RunResampleCases();
+   benchmark.RunMixCases();
+#if defined(USE_LIBFLAC) && !defined(LEGACY_FLAC)
+   benchmark.RunFLACCases();
+#endif
+   benchmark.TearDown();
+
+   benchmark.Report();
+
+   return 0;
+}
+
+class wxWindow;
+
+void ShowWarningDialog(wxWindow *parent,
+                      wxString internalDialogName,
+                      wxString message)
+{
+   std::cerr << "warning: " << message << std::endl;
+}
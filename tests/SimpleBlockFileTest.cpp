@@ -2,9 +2,88 @@
 #include <iostream>
 #include <ostream>
 #include <cassert>
+#include <cstring>
+
+#include <wx/fileconf.h>
+#include <wx/sstream.h>
 
 #include "sndfile.h"
 #include "blockfile/SimpleBlockFile.h"
+#include "BlockSegmentStore.h"
+#include "DirManager.h"
+#include "Prefs.h"
+#include "WorkerPool.h"
+#include "xml/XMLFileReader.h"
+#include "xml/XMLWriter.h"
+
+// Writes blocks on a pool's threads, each item with its own values, and
+// checks that every block got the summary of its own samples
+class SummaryWriterJob : public WorkerPoolJob {
+public:
+   enum { kBlocks = 50, kLen = 100000 };
+
+   SummaryWriterJob() { mOK[0] = mOK[1] = true; }
+
+   virtual void RunItem(int item)
+   {
+      float *data = new float[kLen];
+      float *summary = new float[((kLen + 255) / 256) * 3];
+      wxString name = wxString::Format(wxT("/tmp/summary%d"), item);
+
+      for (int k = 0; k < kBlocks && mOK[item]; k++)
+      {
+         float lo = -0.1f * (item + 1) - 0.001f * k;
+         float hi = 0.1f * (item + 1) + 0.001f * k;
+         for (int i = 0; i < kLen; i++)
+            data[i] = (i & 1) ? hi : lo;
+
+         SimpleBlockFile *bf =
+            new SimpleBlockFile(wxFileName(name), (samplePtr)data, kLen,
+                                floatSample);
+
+         float min, max, rms;
+         bf->GetMinMax(&min, &max, &rms);
+         if (min != lo || max != hi)
+            mOK[item] = false;
+
+         int frames = (kLen + 255) / 256;
+         bf->Read256(summary, 0, frames);
+         for (int i = 0; i < frames; i++)
+            if (summary[i * 3] != lo || summary[i * 3 + 1] != hi)
+               mOK[item] = false;
+
+         delete bf;
+      }
+
+      delete [] summary;
+      delete [] data;
+   }
+
+   bool mOK[2];
+};
+
+// Loads the packed block saved in a project file fragment, as DirManager
+// does when it opens a project
+class PackedBlockLoader : public XMLTagHandler {
+public:
+   PackedBlockLoader(DirManager *dm) : mDirManager(dm), mBlock(NULL) {}
+
+   virtual bool HandleXMLTag(const wxChar *tag, const wxChar **attrs)
+   {
+      if (wxStrcmp(tag, wxT("packedblockfile")))
+         return false;
+      mBlock = SimpleBlockFile::BuildPackedFromXML(*mDirManager, attrs);
+      return true;
+   }
+
+   virtual XMLTagHandler *HandleXMLChild(const wxChar *WXUNUSED(tag))
+   {
+      return NULL;
+   }
+
+   DirManager *mDirManager;
+   BlockFile *mBlock;
+};
 
 
 class SimpleBlockFileTest {
@@ -186,6 +265,158 @@ public:
 
        std::cout << "OK\n";
    }
+
+   void testInt24Packing() {
+      // Packing must give exactly the bytes of the old one-sample-at-a-time
+      // writes, for every length (the packer works in groups of 4) and for
+      // the extremes of the range
+      std::cout << "\tVerifying 24-bit packing and unpacking..." << std::flush;
+
+      const int maxLen = 37;
+      int src[maxLen];
+      int unpacked[maxLen];
+      unsigned char packed[maxLen * 3];
+      unsigned char expected[maxLen * 3];
+
+      for (int i = 0; i < maxLen; i++)
+         src[i] = (i % 3 == 0) ? -0x800000 : (i % 3 == 1) ? 0x7FFFFF : int24Data[i];
+
+      for (int msbFirst = 0; msbFirst < 2; msbFirst++)
+         for (int len = 0; len <= maxLen; len++)
+         {
+            for (int i = 0; i < len; i++)
+            {
+               unsigned int s = (unsigned int)src[i];
+               unsigned char *e = &expected[i * 3];
+               e[msbFirst ? 2 : 0] = (unsigned char)s;
+               e[1] = (unsigned char)(s >> 8);
+               e[msbFirst ? 0 : 2] = (unsigned char)(s >> 16);
+            }
+
+            PackInt24(src, packed, len, msbFirst != 0);
+            assert(memcmp(packed, expected, len * 3) == 0);
+
+            UnpackInt24(packed, unpacked, len, msbFirst != 0);
+            AssertBuffersEqual(src, unpacked, len);
+         }
+
+      std::cout << "OK\n";
+   }
+
+   // The packed block must read back as the .au file of the same data does
+   void AssertSameBlock(BlockFile *packed, BlockFile *au, int len)
+   {
+      samplePtr buf1 = NewSamples(len, floatSample);
+      samplePtr buf2 = NewSamples(len, floatSample);
+      packed->ReadData(buf1, floatSample, 0, len);
+      au->ReadData(buf2, floatSample, 0, len);
+      AssertBuffersEqual((float *)buf2, (float *)buf1, len);
+      DeleteSamples(buf1);
+      DeleteSamples(buf2);
+
+      int frames = (len + 255) / 256;
+      float *summary1 = new float[frames * 3];
+      float *summary2 = new float[frames * 3];
+      assert(packed->Read256(summary1, 0, frames));
+      assert(au->Read256(summary2, 0, frames));
+      AssertBuffersEqual(summary2, summary1, frames * 3);
+      delete [] summary1;
+      delete [] summary2;
+   }
+
+   void testPackedBlocks() {
+      // Packed blocks are written into segments, saved to and loaded from
+      // the project file, and moved between segments by compaction
+      std::cout << "\tVerifying packed blocks through save, load and compaction..." << std::flush;
+
+      wxStringInputStream noPrefs(wxEmptyString);
+      gPrefs = new wxFileConfig(noPrefs);
+      gPrefs->Write(wxT("/Directories/PackBlockFiles"), 1L);
+      gPrefs->Write(wxT("/Directories/BlockSegmentSize"), 1L);   // MB
+
+      DirManager::SetTempDir(wxT("/tmp/packed-block-test-dir"));
+      DirManager *dm = new DirManager;
+      BlockSegmentStore *store = dm->GetBlockSegmentStore();
+
+      // The first segment gets a short block and a long one; a third
+      // block doesn't fit, and starts the segment appended to
+      int shortLen = dataLen / 4;
+      BlockFile *kept = dm->NewSimpleBlockFile((samplePtr)int16Data,
+                                               shortLen, int16Sample);
+      BlockFile *freed = dm->NewSimpleBlockFile((samplePtr)floatData,
+                                                dataLen / 2, floatSample);
+      BlockFile *last = dm->NewSimpleBlockFile((samplePtr)floatData,
+                                               dataLen, floatSample);
+      assert(kept->IsPacked() && freed->IsPacked() && last->IsPacked());
+
+      BlockFile *au = new SimpleBlockFile(wxFileName(wxT("/tmp/int16short")),
+                                          (samplePtr)int16Data, shortLen,
+                                          int16Sample);
+      AssertSameBlock(kept, au, shortLen);
+      AssertSameBlock(last, floatBlockFile, dataLen);
+
+      // Save and load
+      wxString xmlPath = wxT("/tmp/packed-block-test.xml");
+      XMLFileWriter xmlFile;
+      xmlFile.Open(xmlPath, wxT("wb"));
+      kept->SaveXML(xmlFile);
+      xmlFile.Close();
+
+      PackedBlockLoader loader(dm);
+      XMLFileReader reader;
+      assert(reader.Parse(&loader, xmlPath));
+      assert(loader.mBlock && loader.mBlock->IsPacked());
+      assert(((SimpleBlockFile *)loader.mBlock)->IsPackedImageOnDisk());
+      AssertSameBlock(loader.mBlock, au, shortLen);
+
+      // Freeing the long block leaves the first segment mostly dead, so
+      // compaction moves the short one, which both blocks share
+      int segment, newSegment;
+      wxFileOffset offset;
+      wxUint32 bytes;
+      store->GetLocation(((SimpleBlockFile *)kept)->GetSegmentEntry(),
+                         &segment, &offset, &bytes);
+
+      dm->Deref(freed);
+      dm->CompactBlockSegments();
+      dm->RemoveCompactedBlockSegments();
+
+      store->GetLocation(((SimpleBlockFile *)kept)->GetSegmentEntry(),
+                         &newSegment, &offset, &bytes);
+      assert(newSegment != segment);
+      assert(!wxFileExists(store->GetDirectory() + wxFILE_SEP_PATH +
+                           BlockSegmentStore::GetSegmentFileName(segment)));
+
+      AssertSameBlock(kept, au, shortLen);
+      AssertSameBlock(loader.mBlock, au, shortLen);
+      AssertSameBlock(last, floatBlockFile, dataLen);
+
+      delete loader.mBlock;
+      delete au;
+      dm->Deref(kept);
+      dm->Deref(last);
+      delete dm;
+
+      delete gPrefs;
+      gPrefs = NULL;
+
+      std::cout << "OK\n";
+   }
+
+   void testConcurrentSummaries() {
+      // Blocks are written on several threads at once by imports, so
+      // the summary of one must never end up in another
+      std::cout << "\tVerifying summaries of blocks written on two threads..." << std::flush;
+
+      WorkerPool pool(1);
+      SummaryWriterJob job;
+      pool.Run(&job, 2);
+
+      assert(job.mOK[0]);
+      assert(job.mOK[1]);
+
+      std::cout << "OK\n";
+   }
 };
 
 int main()
@@ -204,6 +435,16 @@ int main()
     tester.testReads();
     tester.tearDown();
 
+    tester.setUp();
+    tester.testInt24Packing();
+    tester.tearDown();
+
+    tester.setUp();
+    tester.testPackedBlocks();
+    tester.tearDown();
+
+    tester.testConcurrentSummaries();
+
     return 0;
 }
 